@@ -0,0 +1,14 @@
+# Benchmarks of the image viewer. Build them alone with
+#   qmake benchmarks/benchmarks.pro && make
+# or together with the application through the top-level imageviewer-all.pro,
+# and run headless, e.g.
+#   QT_QPA_PLATFORM=offscreen ./gridbench/gridbench --output gridbench.json
+#   QT_QPA_PLATFORM=offscreen ./scalebench/scalebench --output scalebench.json
+#   QT_QPA_PLATFORM=offscreen ./selectionbench/selectionbench --output selectionbench.json
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    gridbench \
+    scalebench \
+    selectionbench
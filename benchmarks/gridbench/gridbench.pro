@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Thumbnail grid benchmark: directory loading, first tile, viewport fill,
+# scroll-through throughput, peak RSS and cache hit rate on synthetic
+# directories, reported as JSON
+#
+#-------------------------------------------------
+
+include(../../imageviewer.pri)
+
+TARGET = gridbench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+win32: LIBS += -lpsapi
+
+SOURCES += \
+    main.cpp \
+    gridbenchmark.cpp \
+    syntheticdataset.cpp
+
+HEADERS += \
+    gridbenchmark.h \
+    syntheticdataset.h \
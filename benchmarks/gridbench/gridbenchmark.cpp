@@ -0,0 +1,223 @@
+#include "gridbenchmark.h"
+#include "imagelistmodel.h"
+#include "imagelistview.h"
+#include "syntheticdataset.h"
+#include "thumbnailstore.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QScrollBar>
+#include <QTimer>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+#include <memory>
+
+namespace {
+// период пробуждения цикла ожидания, если событий нет
+const int wakeUpInterval = 50;
+
+QJsonObject stageToJson(const ImageLoaderStageStatistics& statistics)
+{
+    QJsonObject object;
+    object["jobs"] = qint64(statistics.jobs);
+    object["bytes"] = statistics.bytes;
+    object["busyMs"] = statistics.nanoseconds / 1000000;
+    // задач в секунду на один поток этапа
+    object["jobsPerThreadSecond"] = statistics.nanoseconds ? statistics.jobs * 1e9 / statistics.nanoseconds : 0.0;
+    return object;
+}
+
+int lastVisibleRow(const ImageListView& view, int rowCount)
+{
+    QModelIndex index = view.indexAt(view.viewport()->rect().bottomRight());
+    return index.isValid() ? index.row() : rowCount - 1;
+}
+}
+
+QJsonObject GridBenchmarkOptions::toJson() const
+{
+    QJsonObject object;
+    object["viewWidth"] = viewSize.width();
+    object["viewHeight"] = viewSize.height();
+    object["columnCount"] = columnCount;
+    object["cacheMemoryBudgetMb"] = cacheMemoryBudget;
+    object["readThreadCount"] = readThreadCount;
+    object["decodeThreadCount"] = decodeThreadCount;
+    object["maxScrollPages"] = maxScrollPages;
+    object["timeoutMs"] = timeout;
+    return object;
+}
+
+QJsonObject GridBenchmarkResult::toJson() const
+{
+    QJsonObject object;
+    object["directoryLoadMs"] = directoryLoadMs;
+    object["firstTileMs"] = firstTileMs;
+    object["viewportFillMs"] = viewportFillMs;
+    object["scrolledPages"] = scrolledPages;
+    object["scrolledTiles"] = scrolledTiles;
+    object["scrollMs"] = scrollMs;
+    object["scrollTilesPerSecond"] = scrollTilesPerSecond;
+    object["cacheHits"] = qint64(cacheHits);
+    object["cacheMisses"] = qint64(cacheMisses);
+    object["cacheHitRate"] = cacheHitRate;
+    object["peakRssBytes"] = peakRssBytes;
+    object["firstPassMs"] = firstPassMs;
+    object["finalPassMs"] = finalPassMs;
+    object["read"] = stageToJson(readStatistics);
+    object["decode"] = stageToJson(decodeStatistics);
+    object["timedOut"] = timedOut;
+    return object;
+}
+
+GridBenchmark::GridBenchmark(const GridBenchmarkOptions& options)
+    : m_options{ options }
+{
+}
+
+GridBenchmarkResult GridBenchmark::run(const SyntheticDataset& dataset, const QString& thumbnailStorePath)
+{
+    GridBenchmarkResult result;
+    resetPeakResidentSetSize();
+
+    ImageListModel model;
+    ImageListView view;
+    view.setThumbnailStore(std::make_shared<ThumbnailStore>(thumbnailStorePath));
+    view.setCacheMemoryBudget(m_options.cacheMemoryBudget);
+    if (m_options.readThreadCount > 0) {
+        view.setLoaderStage(ImageLoader::ReadStage, m_options.readThreadCount, view.loaderQueueDepth(ImageLoader::ReadStage));
+    }
+    if (m_options.decodeThreadCount > 0) {
+        view.setLoaderStage(ImageLoader::DecodeStage, m_options.decodeThreadCount, m_options.decodeThreadCount * 2);
+    }
+    view.setColumnCount(m_options.columnCount);
+    view.setModel(&model);
+    view.resize(m_options.viewSize);
+    view.show();
+    QCoreApplication::processEvents();
+
+    QElapsedTimer timer;
+    bool loaded = false;
+    QObject::connect(&model, &ImageListModel::loadingFinished, [&] {
+        result.directoryLoadMs = timer.elapsed();
+        loaded = true;
+    });
+    auto rowCount = [&] { return model.rowCount(QModelIndex()); };
+
+    // загрузка каталога, первая плитка и заполнение видового окна
+    timer.start();
+    model.loadDirectoryImageList(dataset.path());
+    if (waitUntil([&] { return view.paintStatistics().tileCount > 0; })) {
+        result.firstTileMs = timer.elapsed();
+    }
+    if (waitUntil([&] { return rowCount() > 0 && view.isViewportFilled(); })) {
+        result.viewportFillMs = timer.elapsed();
+    }
+    result.timedOut = !waitUntil([&] { return loaded; }) || result.viewportFillMs < 0;
+
+    // постраничная прокрутка до конца: каждая страница ждет заполнения видового окна
+    ImageCacheStatistics statistics = view.cacheStatistics();
+    QScrollBar* scrollBar = view.verticalScrollBar();
+    int lastRow = lastVisibleRow(view, rowCount());
+    QElapsedTimer scrollTimer;
+    scrollTimer.start();
+    while (!result.timedOut && scrollBar->value() < scrollBar->maximum() && result.scrolledPages < m_options.maxScrollPages) {
+        scrollBar->setValue(scrollBar->value() + scrollBar->pageStep());
+        ++result.scrolledPages;
+        if (!waitUntil([&] { return view.isViewportFilled(); })) {
+            result.timedOut = true;
+            break;
+        }
+        int row = lastVisibleRow(view, rowCount());
+        result.scrolledTiles += row - lastRow;
+        lastRow = row;
+    }
+    result.scrollMs = scrollTimer.elapsed();
+    if (result.scrollMs > 0) {
+        result.scrollTilesPerSecond = result.scrolledTiles * 1000.0 / result.scrollMs;
+    }
+    ImageCacheStatistics scrollStatistics = view.cacheStatistics();
+    result.cacheHits = scrollStatistics.hits - statistics.hits;
+    result.cacheMisses = scrollStatistics.misses - statistics.misses;
+    quint64 lookups = result.cacheHits + result.cacheMisses;
+    result.cacheHitRate = lookups ? qreal(result.cacheHits) / lookups : 0;
+    result.peakRssBytes = peakResidentSetSize();
+    PassStatistics passStatistics = view.passStatistics();
+    if (passStatistics.firstPassCount) {
+        result.firstPassMs = passStatistics.firstPassNanoseconds / 1e6 / passStatistics.firstPassCount;
+    }
+    if (passStatistics.finalPassCount) {
+        result.finalPassMs = passStatistics.finalPassNanoseconds / 1e6 / passStatistics.finalPassCount;
+    }
+    ImageLoaderStatistics loaderStatistics = view.loaderStatistics();
+    result.readStatistics = loaderStatistics.read;
+    result.decodeStatistics = loaderStatistics.decode;
+    return result;
+}
+
+void GridBenchmark::resetPeakResidentSetSize()
+{
+#if defined(Q_OS_LINUX)
+    // запись "5" сбрасывает VmHWM процесса (Linux 4.0+)
+    QFile clearRefs{ QStringLiteral("/proc/self/clear_refs") };
+    if (clearRefs.open(QIODevice::WriteOnly)) {
+        clearRefs.write("5");
+    }
+#endif
+}
+
+qint64 GridBenchmark::peakResidentSetSize()
+{
+#if defined(Q_OS_LINUX)
+    QFile status{ QStringLiteral("/proc/self/status") };
+    if (status.open(QIODevice::ReadOnly)) {
+        for (QByteArray line = status.readLine(); !line.isEmpty(); line = status.readLine()) {
+            if (line.startsWith("VmHWM:")) {
+                return line.mid(6).trimmed().split(' ').value(0).toLongLong() * 1024;
+            }
+        }
+    }
+#endif
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return qint64(counters.PeakWorkingSetSize);
+    }
+    return -1;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#if defined(Q_OS_DARWIN)
+    return qint64(usage.ru_maxrss);
+#else
+    return qint64(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return -1;
+#endif
+}
+
+bool GridBenchmark::waitUntil(const std::function<bool()>& condition) const
+{
+    // ожидание без активного опроса: загрузчик и таймеры вида будят цикл событиями
+    QTimer wakeUpTimer;
+    wakeUpTimer.start(wakeUpInterval);
+    QElapsedTimer timer;
+    timer.start();
+    while (!condition()) {
+        if (timer.hasExpired(m_options.timeout)) {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    return true;
+}
@@ -0,0 +1,122 @@
+#ifndef GRIDBENCHMARK_H
+#define GRIDBENCHMARK_H
+
+#include "imageloader.h"
+
+#include <QJsonObject>
+#include <QSize>
+#include <QString>
+
+#include <functional>
+
+class SyntheticDataset;
+
+/**
+ * @brief The GridBenchmarkOptions struct
+ * Параметры замера сетки эскизов
+ */
+struct GridBenchmarkOptions {
+    QSize viewSize{ 1280, 800 };
+    int columnCount = 5;
+    int cacheMemoryBudget = 256;
+    /**
+     * @brief readThreadCount число потоков этапа чтения, 0 - по умолчанию
+     */
+    int readThreadCount = 0;
+    /**
+     * @brief decodeThreadCount число потоков этапа декодирования, 0 - по умолчанию
+     */
+    int decodeThreadCount = 0;
+    /**
+     * @brief maxScrollPages наибольшее число страниц, прокручиваемых при замере
+     * пропускной способности
+     */
+    int maxScrollPages = 100;
+    /**
+     * @brief timeout наибольшее время ожидания каждого этапа в миллисекундах
+     */
+    int timeout = 120000;
+
+    QJsonObject toJson() const;
+};
+
+/**
+ * @brief The GridBenchmarkResult struct
+ * Результаты замера одного набора; время в миллисекундах от начала загрузки каталога
+ */
+struct GridBenchmarkResult {
+    qint64 directoryLoadMs = -1;
+    qint64 firstTileMs = -1;
+    qint64 viewportFillMs = -1;
+    int scrolledPages = 0;
+    qint64 scrolledTiles = 0;
+    qint64 scrollMs = 0;
+    qreal scrollTilesPerSecond = 0;
+    quint64 cacheHits = 0;
+    quint64 cacheMisses = 0;
+    qreal cacheHitRate = 0;
+    qint64 peakRssBytes = -1;
+    /**
+     * @brief firstPassMs, finalPassMs среднее время от запроса видимой плитки
+     * до наброска и до окончательного эскиза
+     */
+    qreal firstPassMs = 0;
+    qreal finalPassMs = 0;
+    /**
+     * @brief readStatistics счетчики этапа чтения за весь замер
+     */
+    ImageLoaderStageStatistics readStatistics;
+    /**
+     * @brief decodeStatistics счетчики этапа декодирования за весь замер
+     */
+    ImageLoaderStageStatistics decodeStatistics;
+    bool timedOut = false;
+
+    QJsonObject toJson() const;
+};
+
+/**
+ * @brief The GridBenchmark class
+ * GridBenchmark - замер ImageListView и ImageListModel на синтетическом каталоге:
+ * время загрузки каталога, первой нарисованной плитки и полного заполнения
+ * видового окна, пропускная способность при постраничной прокрутке до конца,
+ * пиковый объем резидентной памяти и доля попаданий в кеш при прокрутке.
+ * Каждый замер выполняется с новыми моделью, видом и пустым хранилищем эскизов.
+ */
+class GridBenchmark {
+public:
+    explicit GridBenchmark(const GridBenchmarkOptions& options);
+
+    // GridBenchmark interface
+public:
+    /**
+     * @brief run выполняет замер набора dataset
+     * @param dataset созданный набор изображений
+     * @param thumbnailStorePath пустой каталог хранилища эскизов
+     * @return результаты замера
+     */
+    GridBenchmarkResult run(const SyntheticDataset& dataset, const QString& thumbnailStorePath);
+    /**
+     * @brief resetPeakResidentSetSize сбрасывает пиковый объем резидентной памяти
+     * процесса, если система это позволяет (Linux)
+     */
+    static void resetPeakResidentSetSize();
+    /**
+     * @brief peakResidentSetSize возвращает пиковый объем резидентной памяти процесса
+     * @return объем в байтах или -1, если он неизвестен
+     */
+    static qint64 peakResidentSetSize();
+
+private:
+    /**
+     * @brief waitUntil обрабатывает события, пока не выполнится condition
+     * @param condition
+     * @return false, если истекло время ожидания
+     */
+    bool waitUntil(const std::function<bool()>& condition) const;
+
+private:
+    GridBenchmarkOptions m_options;
+};
+
+#endif // GRIDBENCHMARK_H
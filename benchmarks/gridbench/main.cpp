@@ -0,0 +1,133 @@
+#include "gridbenchmark.h"
+#include "syntheticdataset.h"
+#include "trace.h"
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QtDebug>
+
+#include <cstdio>
+
+namespace {
+QList<QSize> parseSizes(const QString& text)
+{
+    QList<QSize> sizes;
+    for (const QString& size : text.split(',', Qt::SkipEmptyParts)) {
+        QStringList parts = size.split('x');
+        if (parts.size() == 2 && parts.at(0).toInt() > 0 && parts.at(1).toInt() > 0) {
+            sizes.append(QSize(parts.at(0).toInt(), parts.at(1).toInt()));
+        }
+    }
+    return sizes;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    // замер выполняется без дисплея и не должен трогать кеш эскизов пользователя
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QString defaultWorkDir = QDir::tempPath() + QStringLiteral("/imageviewer-gridbench");
+    QTemporaryDir cacheDir{ QDir::tempPath() + QStringLiteral("/imageviewer-gridbench-cache-XXXXXX") };
+    qputenv("XDG_CACHE_HOME", QFile::encodeName(cacheDir.path()));
+
+    QApplication application(argc, argv);
+    QApplication::setApplicationName(QStringLiteral("gridbench"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Thumbnail grid benchmark"));
+    parser.addHelpOption();
+    QCommandLineOption workDirOption{ "work-dir", "Directory for the generated image sets.", "dir", defaultWorkDir };
+    QCommandLineOption countsOption{ "counts", "Comma-separated image counts.", "list", "1000,10000,100000" };
+    QCommandLineOption formatsOption{ "formats", "Comma-separated image formats (png, jpeg).", "list", "png,jpeg" };
+    QCommandLineOption imageSizesOption{ "image-sizes", "Comma-separated image sizes.", "list", "320x240,1024x768,2048x1536" };
+    QCommandLineOption viewSizeOption{ "view-size", "View size.", "WxH", "1280x800" };
+    QCommandLineOption columnsOption{ "columns", "Column count.", "n", "5" };
+    QCommandLineOption cacheOption{ "cache", "Image cache budget in megabytes.", "mb", "256" };
+    QCommandLineOption readThreadsOption{ "read-threads", "Read stage thread count.", "n", "0" };
+    QCommandLineOption decodeThreadsOption{ "decode-threads", "Decode stage thread count.", "n", "0" };
+    QCommandLineOption scrollPagesOption{ "scroll-pages", "Maximum pages scrolled.", "n", "100" };
+    QCommandLineOption timeoutOption{ "timeout", "Timeout of each stage in milliseconds.", "ms", "120000" };
+    QCommandLineOption outputOption{ "output", "JSON output file, standard output by default.", "file" };
+    QCommandLineOption traceOption{ "trace", "Chrome trace output file (builds with CONFIG+=tracing only).", "file" };
+    parser.addOptions({ workDirOption, countsOption, formatsOption, imageSizesOption, viewSizeOption,
+        columnsOption, cacheOption, readThreadsOption, decodeThreadsOption, scrollPagesOption, timeoutOption, outputOption, traceOption });
+    parser.process(application);
+
+    GridBenchmarkOptions options;
+    QList<QSize> viewSizes = parseSizes(parser.value(viewSizeOption));
+    if (!viewSizes.isEmpty()) {
+        options.viewSize = viewSizes.first();
+    }
+    options.columnCount = qMax(1, parser.value(columnsOption).toInt());
+    options.cacheMemoryBudget = qMax(1, parser.value(cacheOption).toInt());
+    options.readThreadCount = qMax(0, parser.value(readThreadsOption).toInt());
+    options.decodeThreadCount = qMax(0, parser.value(decodeThreadsOption).toInt());
+    options.maxScrollPages = qMax(0, parser.value(scrollPagesOption).toInt());
+    options.timeout = qMax(1, parser.value(timeoutOption).toInt());
+    QList<QSize> imageSizes = parseSizes(parser.value(imageSizesOption));
+    if (imageSizes.isEmpty()) {
+        qCritical() << "No valid image sizes given";
+        return 1;
+    }
+
+    GridBenchmark benchmark{ options };
+    QJsonArray runs;
+    bool timedOut = false;
+    for (const QString& format : parser.value(formatsOption).split(',', Qt::SkipEmptyParts)) {
+        for (const QString& count : parser.value(countsOption).split(',', Qt::SkipEmptyParts)) {
+            QString path = QString("%1/%2-%3").arg(parser.value(workDirOption), format, count);
+            SyntheticDataset dataset{ path, count.toInt(), format.toLatin1(), imageSizes };
+            qInfo() << "Generating" << path << "...";
+            if (!dataset.generate()) {
+                qCritical() << "Generating" << path << "failed";
+                return 1;
+            }
+            QTemporaryDir storeDir{ QDir::tempPath() + QStringLiteral("/imageviewer-gridbench-store-XXXXXX") };
+            qInfo() << "Running" << path << "...";
+            GridBenchmarkResult result = benchmark.run(dataset, storeDir.path());
+            timedOut = timedOut || result.timedOut;
+
+            QJsonObject run = result.toJson();
+            run["format"] = format;
+            run["imageCount"] = dataset.imageCount();
+            run["totalBytes"] = dataset.totalBytes();
+            runs.append(run);
+        }
+    }
+
+    QJsonObject report;
+    report["benchmark"] = QStringLiteral("gridbench");
+    report["qtVersion"] = QString::fromLatin1(qVersion());
+    report["platform"] = QApplication::platformName();
+    report["idealThreadCount"] = QThread::idealThreadCount();
+    QJsonArray sizes;
+    for (const QSize& size : imageSizes) {
+        sizes.append(QString("%1x%2").arg(size.width()).arg(size.height()));
+    }
+    QJsonObject optionsObject = options.toJson();
+    optionsObject["imageSizes"] = sizes;
+    report["options"] = optionsObject;
+    report["runs"] = runs;
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(outputOption)) {
+        QFile output{ parser.value(outputOption) };
+        if (!output.open(QIODevice::WriteOnly) || output.write(json) != json.size()) {
+            qCritical() << "Writing" << output.fileName() << "failed:" << output.errorString();
+            return 1;
+        }
+    } else {
+        std::fwrite(json.constData(), 1, size_t(json.size()), stdout);
+    }
+    TRACE_WRITE(parser.value(traceOption));
+    return timedOut ? 2 : 0;
+}
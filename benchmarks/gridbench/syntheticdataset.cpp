@@ -0,0 +1,131 @@
+#include "syntheticdataset.h"
+
+#include <QBuffer>
+#include <QColor>
+#include <QDir>
+#include <QFile>
+#include <QImageWriter>
+#include <QLinearGradient>
+#include <QPainter>
+#include <QtDebug>
+
+namespace {
+// число различающихся образцов каждого размера
+const int samplesPerSize = 4;
+const int jpegQuality = 90;
+}
+
+SyntheticDataset::SyntheticDataset(const QString& path, int imageCount, const QByteArray& format, const QList<QSize>& imageSizes)
+    : m_path{ path }
+    , m_imageCount{ imageCount }
+    , m_format{ format }
+    , m_imageSizes{ imageSizes }
+{
+}
+
+QString SyntheticDataset::path() const
+{
+    return m_path;
+}
+
+int SyntheticDataset::imageCount() const
+{
+    return m_imageCount;
+}
+
+QByteArray SyntheticDataset::format() const
+{
+    return m_format;
+}
+
+QList<QSize> SyntheticDataset::imageSizes() const
+{
+    return m_imageSizes;
+}
+
+qint64 SyntheticDataset::totalBytes() const
+{
+    return m_totalBytes;
+}
+
+bool SyntheticDataset::generate()
+{
+    QList<QByteArray> samples;
+    for (const QSize& size : m_imageSizes) {
+        for (int seed = 0; seed < samplesPerSize; ++seed) {
+            QByteArray bytes;
+            QBuffer buffer{ &bytes };
+            buffer.open(QIODevice::WriteOnly);
+            QImageWriter writer{ &buffer, m_format };
+            writer.setQuality(jpegQuality);
+            if (!writer.write(renderSample(size, samples.size()))) {
+                qWarning() << "Encoding sample failed:" << writer.errorString();
+                return false;
+            }
+            samples.append(bytes);
+        }
+    }
+    if (samples.isEmpty()) {
+        return false;
+    }
+
+    m_totalBytes = 0;
+    for (int index = 0; index < m_imageCount; ++index) {
+        m_totalBytes += samples.at(index % samples.size()).size();
+    }
+    QFile marker{ completeMarkerFileName() };
+    if (marker.open(QIODevice::ReadOnly) && marker.readAll().trimmed().toInt() == m_imageCount) {
+        return true;
+    }
+    marker.close();
+
+    if (!QDir().mkpath(m_path)) {
+        qWarning() << "Creating" << m_path << "failed";
+        return false;
+    }
+    for (int index = 0; index < m_imageCount; ++index) {
+        QFile file{ fileName(index) };
+        const QByteArray& bytes = samples.at(index % samples.size());
+        if (!file.open(QIODevice::WriteOnly) || file.write(bytes) != bytes.size()) {
+            qWarning() << "Writing" << file.fileName() << "failed:" << file.errorString();
+            return false;
+        }
+    }
+    if (!marker.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    marker.write(QByteArray::number(m_imageCount));
+    return true;
+}
+
+QImage SyntheticDataset::renderSample(const QSize& size, int seed)
+{
+    QImage image{ size, QImage::Format_RGB32 };
+    QPainter painter{ &image };
+    painter.setRenderHint(QPainter::Antialiasing);
+    QLinearGradient gradient{ QPointF(0, 0), QPointF(size.width(), size.height()) };
+    gradient.setColorAt(0, QColor::fromHsv((seed * 67) % 360, 160, 230));
+    gradient.setColorAt(1, QColor::fromHsv((seed * 67 + 180) % 360, 200, 90));
+    painter.fillRect(image.rect(), gradient);
+    for (int i = 0; i < 12; ++i) {
+        int hue = (seed * 31 + i * 47) % 360;
+        painter.setBrush(QColor::fromHsv(hue, 200, 200, 160));
+        painter.setPen(Qt::NoPen);
+        int x = (seed * 97 + i * 193) % qMax(size.width(), 1);
+        int y = (seed * 53 + i * 151) % qMax(size.height(), 1);
+        int radius = qMax(1, qMin(size.width(), size.height()) / (4 + i % 5));
+        painter.drawEllipse(QPoint(x, y), radius, radius);
+    }
+    return image;
+}
+
+QString SyntheticDataset::fileName(int index) const
+{
+    QString suffix = m_format == "jpeg" ? QStringLiteral("jpg") : QString::fromLatin1(m_format);
+    return QString("%1/image_%2.%3").arg(m_path).arg(index, 6, 10, QLatin1Char('0')).arg(suffix);
+}
+
+QString SyntheticDataset::completeMarkerFileName() const
+{
+    return m_path + QStringLiteral("/.complete");
+}
@@ -0,0 +1,66 @@
+#ifndef SYNTHETICDATASET_H
+#define SYNTHETICDATASET_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QList>
+#include <QSize>
+#include <QString>
+
+/**
+ * @brief The SyntheticDataset class
+ * SyntheticDataset - каталог синтетических изображений для замеров.
+ * Для каждого размера кодируется несколько различающихся образцов, которые
+ * затем циклически записываются в файлы image_NNNNNN.<ext>, поэтому даже
+ * каталог из 100 тысяч файлов создается за время записи на диск.
+ * Созданный каталог помечается файлом .complete и повторно не создается.
+ */
+class SyntheticDataset {
+public:
+    /**
+     * @brief SyntheticDataset
+     * @param path каталог набора
+     * @param imageCount число файлов
+     * @param format формат файлов ("png" или "jpeg")
+     * @param imageSizes размеры изображений, чередующиеся по файлам
+     */
+    SyntheticDataset(const QString& path, int imageCount, const QByteArray& format, const QList<QSize>& imageSizes);
+
+    // SyntheticDataset interface
+public:
+    QString path() const;
+    int imageCount() const;
+    QByteArray format() const;
+    QList<QSize> imageSizes() const;
+    /**
+     * @brief totalBytes возвращает суммарный размер файлов набора
+     * @return размер в байтах, известный после generate()
+     */
+    qint64 totalBytes() const;
+    /**
+     * @brief generate создает файлы набора, если каталог еще не создан полностью
+     * @return true в случае успеха
+     */
+    bool generate();
+
+private:
+    /**
+     * @brief renderSample рисует образец изображения: градиент и фигуры,
+     * зависящие от seed, чтобы образцы различались и не сжимались до нуля
+     * @param size
+     * @param seed
+     * @return изображение образца
+     */
+    static QImage renderSample(const QSize& size, int seed);
+    QString fileName(int index) const;
+    QString completeMarkerFileName() const;
+
+private:
+    QString m_path;
+    int m_imageCount;
+    QByteArray m_format;
+    QList<QSize> m_imageSizes;
+    qint64 m_totalBytes = 0;
+};
+
+#endif // SYNTHETICDATASET_H
@@ -0,0 +1,238 @@
+#include "imagescaler.h"
+
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLinearGradient>
+#include <QPainter>
+#include <QVector>
+#include <QtDebug>
+
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <limits>
+
+namespace {
+QList<QSize> parseSizes(const QString& text)
+{
+    QList<QSize> sizes;
+    for (const QString& size : text.split(',', Qt::SkipEmptyParts)) {
+        QStringList parts = size.split('x');
+        if (parts.size() == 2 && parts.at(0).toInt() > 0 && parts.at(1).toInt() > 0) {
+            sizes.append(QSize(parts.at(0).toInt(), parts.at(1).toInt()));
+        }
+    }
+    return sizes;
+}
+
+/**
+ * @brief sampleImage рисует изображение с градиентом, мелкой сеткой и
+ * полупрозрачными фигурами: мелкие детали делают ошибки фильтра заметными
+ */
+QImage sampleImage(const QSize& size, QImage::Format format)
+{
+    QImage image{ size, format };
+    image.fill(Qt::transparent);
+    QPainter painter{ &image };
+    QLinearGradient gradient{ 0, 0, qreal(size.width()), qreal(size.height()) };
+    gradient.setColorAt(0, QColor(32, 96, 200, 255));
+    gradient.setColorAt(1, QColor(240, 180, 40, 160));
+    painter.fillRect(image.rect(), gradient);
+    painter.setPen(QColor(0, 0, 0, 200));
+    for (int x = 0; x < size.width(); x += 7) {
+        painter.drawLine(x, 0, x, size.height());
+    }
+    for (int y = 0; y < size.height(); y += 11) {
+        painter.drawLine(0, y, size.width(), y);
+    }
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(QColor(220, 40, 60, 128));
+    painter.drawEllipse(QRect(QPoint(0, 0), size / 2).translated(size.width() / 4, size.height() / 4));
+    return image;
+}
+
+/**
+ * @brief areaAverage уменьшает source точным усреднением по площади в double:
+ * эталон, с которым сравниваются и ImageScaler, и Qt::SmoothTransformation
+ * @return изображение размера size в формате ARGB32_Premultiplied
+ */
+QImage areaAverage(const QImage& source, const QSize& size)
+{
+    QImage image = source.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage result{ size, QImage::Format_ARGB32_Premultiplied };
+    double scaleX = double(image.width()) / size.width();
+    double scaleY = double(image.height()) / size.height();
+    QVector<double> row(size.width() * 4);
+    for (int y = 0; y < size.height(); ++y) {
+        double top = y * scaleY;
+        double bottom = qMin((y + 1) * scaleY, double(image.height()));
+        row.fill(0);
+        for (int j = int(top); j < image.height() && j < bottom; ++j) {
+            double weightY = qMin(bottom, j + 1.0) - qMax(top, double(j));
+            const uchar* line = image.constScanLine(j);
+            for (int x = 0; x < size.width(); ++x) {
+                double left = x * scaleX;
+                double right = qMin((x + 1) * scaleX, double(image.width()));
+                for (int i = int(left); i < image.width() && i < right; ++i) {
+                    double weight = weightY * (qMin(right, i + 1.0) - qMax(left, double(i)));
+                    for (int c = 0; c < 4; ++c) {
+                        row[x * 4 + c] += line[i * 4 + c] * weight;
+                    }
+                }
+            }
+        }
+        uchar* target = result.scanLine(y);
+        for (int i = 0; i < size.width() * 4; ++i) {
+            target[i] = uchar(qBound(0, qRound(row.at(i) / (scaleX * scaleY)), 255));
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief psnr сравнивает два изображения одинакового размера по всем каналам
+ * @return отношение сигнал/шум в дБ, бесконечность для одинаковых изображений
+ */
+double psnr(const QImage& a, const QImage& b)
+{
+    QImage first = a.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage second = b.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    double sum = 0;
+    for (int y = 0; y < first.height(); ++y) {
+        const uchar* p = first.constScanLine(y);
+        const uchar* q = second.constScanLine(y);
+        for (int i = 0; i < first.width() * 4; ++i) {
+            double difference = double(p[i]) - double(q[i]);
+            sum += difference * difference;
+        }
+    }
+    double mse = sum / (double(first.width()) * first.height() * 4);
+    if (mse == 0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+/**
+ * @brief measure выполняет scale повторно в течение не менее minimumMs
+ * @return среднее время одного вызова в миллисекундах
+ */
+double measure(const std::function<QImage()>& scale, int minimumMs, QImage& result)
+{
+    result = scale();
+    QElapsedTimer timer;
+    timer.start();
+    int iterations = 0;
+    do {
+        result = scale();
+        ++iterations;
+    } while (timer.elapsed() < minimumMs);
+    return timer.nsecsElapsed() / 1e6 / iterations;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    QGuiApplication application(argc, argv);
+    QGuiApplication::setApplicationName(QStringLiteral("scalebench"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Thumbnail downscaling benchmark"));
+    parser.addHelpOption();
+    QCommandLineOption sourceSizesOption{ "source-sizes", "Comma-separated source image sizes.", "list", "4000x3000,1920x1080,1024x768" };
+    QCommandLineOption targetsOption{ "targets", "Comma-separated longest sides of the thumbnails.", "list", "256,128" };
+    QCommandLineOption durationOption{ "duration", "Minimum measuring time of each case in milliseconds.", "ms", "500" };
+    QCommandLineOption outputOption{ "output", "JSON output file, standard output by default.", "file" };
+    parser.addOptions({ sourceSizesOption, targetsOption, durationOption, outputOption });
+    parser.process(application);
+
+    QList<QSize> sourceSizes = parseSizes(parser.value(sourceSizesOption));
+    QList<int> targets;
+    for (const QString& target : parser.value(targetsOption).split(',', Qt::SkipEmptyParts)) {
+        if (target.toInt() > 0) {
+            targets.append(target.toInt());
+        }
+    }
+    if (sourceSizes.isEmpty() || targets.isEmpty()) {
+        qCritical() << "No valid sizes given";
+        return 1;
+    }
+    int duration = qMax(1, parser.value(durationOption).toInt());
+
+    QJsonArray results;
+    for (QImage::Format format : { QImage::Format_RGB32, QImage::Format_ARGB32_Premultiplied }) {
+        for (const QSize& sourceSize : sourceSizes) {
+            QImage source = sampleImage(sourceSize, format);
+            double megapixels = double(sourceSize.width()) * sourceSize.height() / 1e6;
+            for (int target : targets) {
+                QSize size = sourceSize.scaled(target, target, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+                // качество ImageScaler и Qt оценивается по одному эталону: ImageScaler
+                // не хуже Qt, если его PSNR не ниже
+                QImage exact = areaAverage(source, size);
+                QImage reference;
+                double referenceMs = measure([&] {
+                    return source.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+                }, duration, reference);
+                double referenceQuality = psnr(reference, exact);
+
+                QJsonObject kernels;
+                for (ImageScaler::Kernel kernel : { ImageScaler::ScalarKernel, ImageScaler::Sse2Kernel, ImageScaler::Avx2Kernel, ImageScaler::NeonKernel }) {
+                    if (!ImageScaler::isKernelSupported(kernel)) {
+                        continue;
+                    }
+                    QImage scaled;
+                    double ms = measure([&] {
+                        return ImageScaler::scaled(source, size, kernel);
+                    }, duration, scaled);
+                    double quality = psnr(scaled, exact);
+                    kernels.insert(QLatin1String(ImageScaler::kernelName(kernel)), QJsonObject{
+                        { "ms", ms },
+                        { "megapixelsPerSecond", megapixels / ms * 1000 },
+                        { "speedup", referenceMs / ms },
+                        // JSON не допускает бесконечность: совпадение с эталоном отмечается отдельно
+                        { "psnrDb", std::isinf(quality) ? QJsonValue() : QJsonValue(quality) },
+                        { "exact", std::isinf(quality) },
+                        { "atLeastQtQuality", quality >= referenceQuality },
+                    });
+                }
+                results.append(QJsonObject{
+                    { "format", format == QImage::Format_RGB32 ? "rgb32" : "argb32pm" },
+                    { "sourceSize", QStringLiteral("%1x%2").arg(sourceSize.width()).arg(sourceSize.height()) },
+                    { "targetSize", QStringLiteral("%1x%2").arg(size.width()).arg(size.height()) },
+                    { "qt", QJsonObject{
+                        { "ms", referenceMs },
+                        { "megapixelsPerSecond", megapixels / referenceMs * 1000 },
+                        { "psnrDb", std::isinf(referenceQuality) ? QJsonValue() : QJsonValue(referenceQuality) },
+                    } },
+                    { "kernels", kernels },
+                });
+                fprintf(stderr, "%s %dx%d -> %dx%d: qt %.2f ms, %s %.2f ms\n",
+                    format == QImage::Format_RGB32 ? "rgb32" : "argb32pm",
+                    sourceSize.width(), sourceSize.height(), size.width(), size.height(), referenceMs,
+                    ImageScaler::kernelName(ImageScaler::defaultKernel()),
+                    kernels.value(QLatin1String(ImageScaler::kernelName(ImageScaler::defaultKernel()))).toObject().value("ms").toDouble());
+            }
+        }
+    }
+
+    QJsonObject report{
+        { "defaultKernel", QLatin1String(ImageScaler::kernelName(ImageScaler::defaultKernel())) },
+        { "results", results },
+    };
+    QByteArray json = QJsonDocument(report).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile file{ parser.value(outputOption) };
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+            qCritical() << "Writing" << file.fileName() << "failed:" << file.errorString();
+            return 1;
+        }
+    } else {
+        fwrite(json.constData(), 1, size_t(json.size()), stdout);
+    }
+    return 0;
+}
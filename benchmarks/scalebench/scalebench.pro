@@ -0,0 +1,25 @@
+#-------------------------------------------------
+#
+# Downscaling benchmark: ImageScaler kernels against
+# QImage::scaled(Qt::SmoothTransformation), reported as JSON
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = scalebench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += \
+    main.cpp \
+    ../../imagescaler.cpp
+
+HEADERS += \
+    ../../imagescaler.h \
@@ -0,0 +1,210 @@
+#include "imagelistmodel.h"
+#include "imagelistview.h"
+
+#include <QAbstractListModel>
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMouseEvent>
+#include <QTemporaryDir>
+#include <QtDebug>
+
+#include <cstdio>
+#include <functional>
+
+namespace {
+/**
+ * @brief The SyntheticListModel class
+ * Модель из rowCount строк без файлов: выделение и его геометрия от содержимого
+ * строк не зависят, а загрузка несуществующих файлов сразу завершается ошибкой
+ */
+class SyntheticListModel : public QAbstractListModel {
+public:
+    explicit SyntheticListModel(int rowCount)
+        : m_rowCount{ rowCount }
+    {
+    }
+
+    int rowCount(const QModelIndex& parent) const override
+    {
+        return parent.isValid() ? 0 : m_rowCount;
+    }
+
+    QVariant data(const QModelIndex& index, int role) const override
+    {
+        if (!index.isValid()) {
+            return QVariant();
+        }
+        switch (role) {
+        case Qt::DisplayRole:
+            return QStringLiteral("/nonexistent/%1.png").arg(index.row());
+        case ImageListModel::ImageIdRole:
+            return quint32(index.row());
+        }
+        return QVariant();
+    }
+
+private:
+    int m_rowCount;
+};
+
+/**
+ * @brief The BenchmarkView class
+ * Открывает замеру защищенные методы выделения ImageListView
+ */
+class BenchmarkView : public ImageListView {
+public:
+    using ImageListView::setSelection;
+    using ImageListView::visualRegionForSelection;
+};
+
+/**
+ * @brief click посылает виду щелчок левой кнопкой в точке position видового окна
+ */
+void click(QAbstractItemView& view, const QPoint& position, Qt::KeyboardModifiers modifiers)
+{
+    QMouseEvent press{ QEvent::MouseButtonPress, position, Qt::LeftButton, Qt::LeftButton, modifiers };
+    QApplication::sendEvent(view.viewport(), &press);
+    QMouseEvent release{ QEvent::MouseButtonRelease, position, Qt::LeftButton, Qt::NoButton, modifiers };
+    QApplication::sendEvent(view.viewport(), &release);
+}
+
+/**
+ * @brief measure выполняет run повторно в течение не менее minimumMs
+ * @return среднее время одного вызова в миллисекундах и число вызовов
+ */
+QJsonObject measure(const std::function<void()>& run, int minimumMs)
+{
+    run();
+    QElapsedTimer timer;
+    timer.start();
+    int iterations = 0;
+    do {
+        run();
+        ++iterations;
+    } while (timer.elapsed() < minimumMs);
+    return QJsonObject{ { "ms", timer.nsecsElapsed() / 1e6 / iterations }, { "iterations", iterations } };
+}
+}
+
+int main(int argc, char* argv[])
+{
+    // замер выполняется без дисплея и не должен трогать кеш эскизов пользователя
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QTemporaryDir cacheDir{ QDir::tempPath() + QStringLiteral("/imageviewer-selectionbench-cache-XXXXXX") };
+    qputenv("XDG_CACHE_HOME", QFile::encodeName(cacheDir.path()));
+
+    QApplication application(argc, argv);
+    QApplication::setApplicationName(QStringLiteral("selectionbench"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Image list selection benchmark"));
+    parser.addHelpOption();
+    QCommandLineOption rowsOption{ "rows", "Model row count.", "n", "1000000" };
+    QCommandLineOption viewSizeOption{ "view-size", "View size.", "WxH", "1280x800" };
+    QCommandLineOption columnsOption{ "columns", "Column count.", "n", "5" };
+    QCommandLineOption bandOption{ "band-lines", "Grid lines covered by the rubber band selection.", "n", "1000" };
+    QCommandLineOption durationOption{ "duration", "Minimum measuring time of each case in milliseconds.", "ms", "500" };
+    QCommandLineOption outputOption{ "output", "JSON output file, standard output by default.", "file" };
+    parser.addOptions({ rowsOption, viewSizeOption, columnsOption, bandOption, durationOption, outputOption });
+    parser.process(application);
+
+    int rowCount = qMax(1, parser.value(rowsOption).toInt());
+    QStringList viewSize = parser.value(viewSizeOption).split('x');
+    int columnCount = qMax(1, parser.value(columnsOption).toInt());
+    int bandLines = qMax(1, parser.value(bandOption).toInt());
+    int duration = qMax(1, parser.value(durationOption).toInt());
+    if (viewSize.size() != 2 || viewSize.at(0).toInt() <= 0 || viewSize.at(1).toInt() <= 0) {
+        qCritical() << "Invalid view size" << parser.value(viewSizeOption);
+        return 1;
+    }
+
+    SyntheticListModel model{ rowCount };
+    BenchmarkView view;
+    view.setColumnCount(columnCount);
+    view.setModel(&model);
+    view.resize(viewSize.at(0).toInt(), viewSize.at(1).toInt());
+    view.show();
+    QCoreApplication::processEvents();
+
+    QItemSelectionModel* selectionModel = view.selectionModel();
+    QRect itemRect = view.visualRect(model.index(0, 0));
+    int lineCount = (rowCount + columnCount - 1) / columnCount;
+    // прямоугольник рамки в координатах видового окна при прокрутке в начало
+    QRect bandRect{ QPoint(itemRect.width() + 1, 0), QPoint(columnCount / 2 * itemRect.width() + itemRect.width() / 2, qMin(bandLines, lineCount) * itemRect.height() - 1) };
+
+    QJsonObject results;
+    results.insert("selectAll", measure([&] {
+        selectionModel->clear();
+        view.selectAll();
+        QCoreApplication::processEvents();
+    }, duration));
+    // настоящий щелчок по первой плитке задает якорь выделения, а shift-щелчок по
+    // последней проходит через обработку мыши QAbstractItemView и QItemSelectionModel
+    selectionModel->clear();
+    view.scrollToTop();
+    QCoreApplication::processEvents();
+    click(view, view.visualRect(model.index(0, 0)).center(), Qt::NoModifier);
+    QModelIndex lastIndex = model.index(rowCount - 1, 0);
+    view.scrollTo(lastIndex);
+    QCoreApplication::processEvents();
+    results.insert("shiftClickAll", measure([&] {
+        click(view, view.visualRect(lastIndex).center(), Qt::ShiftModifier);
+        QCoreApplication::processEvents();
+    }, duration));
+    if (!selectionModel->isSelected(model.index(0, 0)) || !selectionModel->isSelected(lastIndex)) {
+        qWarning() << "Shift-click did not select the whole range";
+    }
+    view.scrollToTop();
+    QCoreApplication::processEvents();
+    // рамка по части колонок выделяет по диапазону на строку сетки
+    results.insert("rubberBand", measure([&] {
+        view.setSelection(bandRect, QItemSelectionModel::ClearAndSelect);
+        QCoreApplication::processEvents();
+    }, duration));
+    // выделение рамкой сверяется построчным перебором, независимым от арифметики сетки
+    int bandLineCount = qMin(bandLines, lineCount);
+    for (int row = 0; row < rowCount && row / columnCount <= bandLineCount; ++row) {
+        int column = row % columnCount;
+        bool expected = row / columnCount < bandLineCount && column >= 1 && column <= columnCount / 2;
+        if (selectionModel->isSelected(model.index(row, 0)) != expected) {
+            qWarning() << "Rubber band selection differs from the grid at row" << row;
+            break;
+        }
+    }
+    view.selectAll();
+    QCoreApplication::processEvents();
+    results.insert("visualRegionAll", measure([&] {
+        view.visualRegionForSelection(selectionModel->selection());
+    }, duration));
+    results.insert("paintAllSelected", measure([&] {
+        view.viewport()->repaint();
+    }, duration));
+
+    QJsonObject report{
+        { "rowCount", rowCount },
+        { "columnCount", columnCount },
+        { "bandLines", bandLines },
+        { "results", results },
+    };
+    for (auto it = results.constBegin(); it != results.constEnd(); ++it) {
+        fprintf(stderr, "%s: %.3f ms\n", qPrintable(it.key()), it.value().toObject().value("ms").toDouble());
+    }
+    QByteArray json = QJsonDocument(report).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile file{ parser.value(outputOption) };
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+            qCritical() << "Writing" << file.fileName() << "failed:" << file.errorString();
+            return 1;
+        }
+    } else {
+        fwrite(json.constData(), 1, size_t(json.size()), stdout);
+    }
+    return 0;
+}
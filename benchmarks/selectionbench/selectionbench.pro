@@ -0,0 +1,19 @@
+#-------------------------------------------------
+#
+# Selection benchmark: select-all, shift-click and rubber band selection,
+# selection region and painting of ImageListView on a model with a million
+# rows, reported as JSON
+#
+#-------------------------------------------------
+
+include(../../imageviewer.pri)
+
+TARGET = selectionbench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,21 @@
+#include "cancellablebuffer.h"
+
+CancellableBuffer::CancellableBuffer(QByteArray* data, const std::atomic_bool* cancelled)
+    : QBuffer(data)
+    , m_cancelled{ cancelled }
+{
+}
+
+bool CancellableBuffer::isCancelled() const
+{
+    return m_cancelled && *m_cancelled;
+}
+
+qint64 CancellableBuffer::readData(char* data, qint64 maxSize)
+{
+    if (isCancelled()) {
+        setErrorString("Operation canceled");
+        return -1;
+    }
+    return QBuffer::readData(data, maxSize);
+}
@@ -0,0 +1,42 @@
+#ifndef CANCELLABLEBUFFER_H
+#define CANCELLABLEBUFFER_H
+
+#include <QBuffer>
+
+#include <atomic>
+
+/**
+ * @brief The CancellableBuffer class
+ * CancellableBuffer - то же, что CancellableFile, для данных, уже прочитанных
+ * в память: чтение прерывается ошибкой, как только взведен признак отмены,
+ * поэтому QImageReader прекращает декодирование из памяти так же, как из файла.
+ */
+class CancellableBuffer : public QBuffer {
+public:
+    /**
+     * @brief CancellableBuffer
+     * @param data данные; буфер на них ссылается и не копирует их
+     * @param cancelled признак отмены или nullptr
+     */
+    CancellableBuffer(QByteArray* data, const std::atomic_bool* cancelled);
+
+    // CancellableBuffer interface
+public:
+    /**
+     * @brief isCancelled проверяет, взведен ли признак отмены
+     * @return true, если чтение отменено
+     */
+    bool isCancelled() const;
+
+    // QIODevice interface
+protected:
+    virtual qint64 readData(char* data, qint64 maxSize) override;
+
+private:
+    /**
+     * @brief m_cancelled признак отмены
+     */
+    const std::atomic_bool* m_cancelled;
+};
+
+#endif // CANCELLABLEBUFFER_H
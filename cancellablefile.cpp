@@ -0,0 +1,21 @@
+#include "cancellablefile.h"
+
+CancellableFile::CancellableFile(const QString& fileName, const std::atomic_bool* cancelled)
+    : QFile(fileName)
+    , m_cancelled{ cancelled }
+{
+}
+
+bool CancellableFile::isCancelled() const
+{
+    return m_cancelled && *m_cancelled;
+}
+
+qint64 CancellableFile::readData(char* data, qint64 maxSize)
+{
+    if (isCancelled()) {
+        setErrorString("Operation canceled");
+        return -1;
+    }
+    return QFile::readData(data, maxSize);
+}
@@ -0,0 +1,43 @@
+#ifndef CANCELLABLEFILE_H
+#define CANCELLABLEFILE_H
+
+#include <QFile>
+
+#include <atomic>
+
+/**
+ * @brief The CancellableFile class
+ * CancellableFile - файл, чтение которого прерывается ошибкой, как только
+ * взведен признак отмены. QImageReader, читающий из такого файла, завершает
+ * декодирование при следующем обращении к устройству, поэтому долгое
+ * декодирование отменяется кооперативно, не дожидаясь конца файла.
+ */
+class CancellableFile : public QFile {
+public:
+    /**
+     * @brief CancellableFile
+     * @param fileName
+     * @param cancelled признак отмены или nullptr
+     */
+    CancellableFile(const QString& fileName, const std::atomic_bool* cancelled);
+
+    // CancellableFile interface
+public:
+    /**
+     * @brief isCancelled проверяет, взведен ли признак отмены
+     * @return true, если чтение отменено
+     */
+    bool isCancelled() const;
+
+    // QIODevice interface
+protected:
+    virtual qint64 readData(char* data, qint64 maxSize) override;
+
+private:
+    /**
+     * @brief m_cancelled признак отмены
+     */
+    const std::atomic_bool* m_cancelled;
+};
+
+#endif // CANCELLABLEFILE_H
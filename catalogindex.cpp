@@ -0,0 +1,246 @@
+#include "catalogindex.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtDebug>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+const char magic[8] = { 'I', 'V', 'C', 'A', 'T', 'L', 'G', '\0' };
+const quint32 formatVersion = 1;
+// записывается в порядке байтов машины; индекс с другим порядком не читается
+const quint32 byteOrderMark = 0x01020304;
+
+const quint32 fileHasMetadataFlag = 0x01;
+
+QStringRef directoryPart(const QStringRef& path)
+{
+    int slash = path.lastIndexOf(QLatin1Char('/'));
+    return slash < 0 ? QStringRef() : path.left(slash);
+}
+}
+
+struct CatalogIndex::Header {
+    char magic[8];
+    quint32 version;
+    quint32 byteOrderMark;
+    quint32 directoryCount;
+    quint32 fileCount;
+    // длина строк в символах QChar
+    quint64 stringLength;
+};
+
+struct CatalogIndex::DirectoryRecord {
+    quint32 pathOffset;
+    quint32 pathLength;
+    qint64 modificationTime;
+};
+
+struct CatalogIndex::FileRecord {
+    quint32 pathOffset;
+    quint32 pathLength;
+    quint32 directory;
+    quint32 flags;
+    qint64 fileSize;
+    qint64 modificationTime;
+    qint64 captureTime;
+    qint32 width;
+    qint32 height;
+};
+
+CatalogIndex::CatalogIndex(const QString& indexPath)
+    : m_file{ indexPath }
+{
+    if (!m_file.exists() || !m_file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    qint64 size = m_file.size();
+    if (size < qint64(sizeof(Header))) {
+        return;
+    }
+    const uchar* data = m_file.map(0, size);
+    if (!data) {
+        return;
+    }
+    const Header* header = reinterpret_cast<const Header*>(data);
+    if (memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != formatVersion || header->byteOrderMark != byteOrderMark) {
+        qWarning() << "Catalog index" << indexPath << "has unsupported format";
+        return;
+    }
+    quint64 directoriesSize = quint64(header->directoryCount) * sizeof(DirectoryRecord);
+    quint64 filesSize = quint64(header->fileCount) * sizeof(FileRecord);
+    if (sizeof(Header) + directoriesSize + filesSize + header->stringLength * sizeof(QChar) != quint64(size)) {
+        qWarning() << "Catalog index" << indexPath << "is truncated";
+        return;
+    }
+    m_data = data;
+    m_header = header;
+    m_directories = reinterpret_cast<const DirectoryRecord*>(data + sizeof(Header));
+    m_files = reinterpret_cast<const FileRecord*>(data + sizeof(Header) + directoriesSize);
+    m_strings = reinterpret_cast<const QChar*>(data + sizeof(Header) + directoriesSize + filesSize);
+    m_stringLength = header->stringLength;
+    // ссылки в строки и подкаталоги проверяются один раз, а не при каждом обращении
+    for (int directory = 0; directory < directoryCount() && m_data; ++directory) {
+        const DirectoryRecord& record = directoryRecord(directory);
+        if (quint64(record.pathOffset) + record.pathLength > m_stringLength) {
+            m_data = nullptr;
+        }
+    }
+    for (int file = 0; file < fileCount() && m_data; ++file) {
+        const FileRecord& record = fileRecord(file);
+        if (quint64(record.pathOffset) + record.pathLength > m_stringLength || record.directory >= header->directoryCount) {
+            m_data = nullptr;
+        }
+    }
+    if (!m_data) {
+        qWarning() << "Catalog index" << indexPath << "is corrupted";
+        m_header = nullptr;
+    }
+}
+
+QString CatalogIndex::defaultIndexPath(const QString& rootPath)
+{
+    QByteArray hash = QCryptographicHash::hash(QDir::cleanPath(rootPath).toUtf8(), QCryptographicHash::Md5).toHex();
+    QDir directory{ QDir{ QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) }.filePath("imageviewer/catalogs") };
+    return directory.filePath(QLatin1String(hash) + QLatin1String(".index"));
+}
+
+bool CatalogIndex::write(const QString& indexPath, const QHash<QString, qint64>& directories, QVector<CatalogIndexFile> files)
+{
+    std::sort(files.begin(), files.end(), [](const CatalogIndexFile& a, const CatalogIndexFile& b) {
+        return QStringRef::compare(a.path, b.path) < 0;
+    });
+    QStringList directoryPaths = directories.keys();
+    std::sort(directoryPaths.begin(), directoryPaths.end());
+
+    QString strings;
+    QVector<DirectoryRecord> directoryRecords;
+    directoryRecords.reserve(directoryPaths.size());
+    QHash<QString, quint32> directoryNumbers;
+    directoryNumbers.reserve(directoryPaths.size());
+    for (const QString& path : directoryPaths) {
+        directoryNumbers.insert(path, quint32(directoryRecords.size()));
+        directoryRecords.append(DirectoryRecord{ quint32(strings.size()), quint32(path.size()), directories.value(path) });
+        strings.append(path);
+    }
+    QVector<FileRecord> fileRecords;
+    fileRecords.reserve(files.size());
+    for (const CatalogIndexFile& file : files) {
+        auto directory = directoryNumbers.constFind(directoryPart(file.path).toString());
+        if (directory == directoryNumbers.constEnd()) {
+            // файл из подкаталога, который не был обойден, в индекс не попадает
+            continue;
+        }
+        fileRecords.append(FileRecord{ quint32(strings.size()), quint32(file.path.size()), directory.value(),
+            file.hasMetadata ? fileHasMetadataFlag : 0, file.fileSize, file.modificationTime, file.captureTime,
+            file.imageSize.width(), file.imageSize.height() });
+        strings.append(file.path);
+    }
+
+    Header header;
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = formatVersion;
+    header.byteOrderMark = byteOrderMark;
+    header.directoryCount = quint32(directoryRecords.size());
+    header.fileCount = quint32(fileRecords.size());
+    header.stringLength = quint64(strings.size());
+
+    QDir{}.mkpath(QFileInfo{ indexPath }.absolutePath());
+    QSaveFile file{ indexPath };
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Writing catalog index" << indexPath << "failed:" << file.errorString();
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(directoryRecords.constData()), directoryRecords.size() * qint64(sizeof(DirectoryRecord)));
+    file.write(reinterpret_cast<const char*>(fileRecords.constData()), fileRecords.size() * qint64(sizeof(FileRecord)));
+    file.write(reinterpret_cast<const char*>(strings.constData()), strings.size() * qint64(sizeof(QChar)));
+    if (!file.commit()) {
+        qWarning() << "Writing catalog index" << indexPath << "failed:" << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool CatalogIndex::isValid() const
+{
+    return m_header != nullptr;
+}
+
+int CatalogIndex::directoryCount() const
+{
+    return m_header ? int(m_header->directoryCount) : 0;
+}
+
+QStringView CatalogIndex::directoryPath(int directory) const
+{
+    const DirectoryRecord& record = directoryRecord(directory);
+    return string(record.pathOffset, record.pathLength);
+}
+
+qint64 CatalogIndex::directoryModificationTime(int directory) const
+{
+    return directoryRecord(directory).modificationTime;
+}
+
+int CatalogIndex::fileCount() const
+{
+    return m_header ? int(m_header->fileCount) : 0;
+}
+
+QStringView CatalogIndex::filePath(int file) const
+{
+    const FileRecord& record = fileRecord(file);
+    return string(record.pathOffset, record.pathLength);
+}
+
+int CatalogIndex::fileDirectory(int file) const
+{
+    return int(fileRecord(file).directory);
+}
+
+qint64 CatalogIndex::fileSize(int file) const
+{
+    return fileRecord(file).fileSize;
+}
+
+qint64 CatalogIndex::fileModificationTime(int file) const
+{
+    return fileRecord(file).modificationTime;
+}
+
+qint64 CatalogIndex::fileCaptureTime(int file) const
+{
+    return fileRecord(file).captureTime;
+}
+
+QSize CatalogIndex::fileImageSize(int file) const
+{
+    const FileRecord& record = fileRecord(file);
+    return QSize(record.width, record.height);
+}
+
+bool CatalogIndex::fileHasMetadata(int file) const
+{
+    return fileRecord(file).flags & fileHasMetadataFlag;
+}
+
+const CatalogIndex::DirectoryRecord& CatalogIndex::directoryRecord(int directory) const
+{
+    return m_directories[directory];
+}
+
+const CatalogIndex::FileRecord& CatalogIndex::fileRecord(int file) const
+{
+    return m_files[file];
+}
+
+QStringView CatalogIndex::string(quint32 offset, quint32 length) const
+{
+    return QStringView(m_strings + offset, qsizetype(length));
+}
@@ -0,0 +1,122 @@
+#ifndef CATALOGINDEX_H
+#define CATALOGINDEX_H
+
+#include <QFile>
+#include <QHash>
+#include <QSize>
+#include <QString>
+#include <QStringRef>
+#include <QStringView>
+#include <QVector>
+
+/**
+ * @brief The CatalogIndexFile struct
+ * Сведения о файле каталога, сохраняемые в индекс
+ */
+struct CatalogIndexFile {
+    /**
+     * @brief path путь файла относительно корня каталога, через '/'
+     */
+    QStringRef path;
+    qint64 fileSize;
+    qint64 modificationTime;
+    qint64 captureTime;
+    QSize imageSize;
+    /**
+     * @brief hasMetadata сведения из заголовков (imageSize, captureTime) прочитаны
+     */
+    bool hasMetadata;
+};
+
+/**
+ * @brief The CatalogIndex class
+ * CatalogIndex - постоянный индекс каталога изображений (дерева подкаталогов).
+ * Индекс - один файл собственного формата: заголовок, таблица подкаталогов
+ * с временами изменения, таблица файлов фиксированного размера и строки путей
+ * в UTF-16. Файл отображается в память, поэтому открытие индекса не зависит
+ * от числа файлов, а модель копирует пути прямо из отображения.
+ * Файлы индекса упорядочены по пути (сравнение QString::compare).
+ * Индекс с другой версией формата, порядком байтов или поврежденный
+ * считается отсутствующим.
+ */
+class CatalogIndex {
+public:
+    /**
+     * @brief CatalogIndex открывает индекс indexPath
+     * @param indexPath
+     */
+    explicit CatalogIndex(const QString& indexPath);
+
+    // CatalogIndex interface
+public:
+    /**
+     * @brief defaultIndexPath возвращает путь индекса каталога rootPath
+     * в кеше приложения ($XDG_CACHE_HOME/imageviewer/catalogs)
+     * @param rootPath
+     * @return путь файла индекса
+     */
+    static QString defaultIndexPath(const QString& rootPath);
+    /**
+     * @brief write сохраняет индекс в файл indexPath, заменяя его атомарно
+     * @param indexPath
+     * @param directories времена изменения всех подкаталогов по их путям
+     * относительно корня ("" - сам корень)
+     * @param files файлы каталога в любом порядке
+     * @return true в случае успеха
+     */
+    static bool write(const QString& indexPath, const QHash<QString, qint64>& directories, QVector<CatalogIndexFile> files);
+    /**
+     * @brief isValid проверяет, открыт ли индекс
+     * @return true, если индекс прочитан и его формат поддерживается
+     */
+    bool isValid() const;
+    int directoryCount() const;
+    /**
+     * @brief directoryPath возвращает путь подкаталога directory относительно корня
+     * @param directory
+     * @return путь подкаталога, "" для корня
+     */
+    QStringView directoryPath(int directory) const;
+    qint64 directoryModificationTime(int directory) const;
+    int fileCount() const;
+    /**
+     * @brief filePath возвращает путь файла file относительно корня
+     * @param file
+     * @return строка в отображении индекса, действительная, пока открыт индекс
+     */
+    QStringView filePath(int file) const;
+    /**
+     * @brief fileDirectory возвращает номер подкаталога файла file
+     * @param file
+     * @return номер подкаталога
+     */
+    int fileDirectory(int file) const;
+    qint64 fileSize(int file) const;
+    qint64 fileModificationTime(int file) const;
+    qint64 fileCaptureTime(int file) const;
+    QSize fileImageSize(int file) const;
+    bool fileHasMetadata(int file) const;
+
+private:
+    struct Header;
+    struct DirectoryRecord;
+    struct FileRecord;
+
+    const DirectoryRecord& directoryRecord(int directory) const;
+    const FileRecord& fileRecord(int file) const;
+    QStringView string(quint32 offset, quint32 length) const;
+
+private:
+    /**
+     * @brief m_file отображаемый файл индекса
+     */
+    QFile m_file;
+    const uchar* m_data = nullptr;
+    const Header* m_header = nullptr;
+    const DirectoryRecord* m_directories = nullptr;
+    const FileRecord* m_files = nullptr;
+    const QChar* m_strings = nullptr;
+    quint64 m_stringLength = 0;
+};
+
+#endif // CATALOGINDEX_H
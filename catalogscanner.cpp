@@ -0,0 +1,271 @@
+#include "catalogscanner.h"
+#include "catalogindex.h"
+#include "trace.h"
+
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <functional>
+
+namespace {
+// как и при обходе одного каталога, пачка публикуется по заполнении или по интервалу
+const int maxBatchSize = 4096;
+const qint64 batchInterval = 100;
+
+// состояния подкаталогов индекса при сопоставлении файлов
+const quint8 unchangedDirectory = 0;
+const quint8 scannedDirectory = 1;
+const quint8 removedDirectory = 2;
+
+/**
+ * @brief The DirectoryScan struct
+ * Результат обхода одного подкаталога
+ */
+struct DirectoryScan {
+    QString path;
+    qint64 modificationTime = 0;
+    bool exists = false;
+    /**
+     * @brief scanned содержимое подкаталога прочитано, а не взято из индекса
+     */
+    bool scanned = false;
+    QStringList subdirectories;
+    QFileInfoList entries;
+};
+
+/**
+ * @brief The PreviousScan struct
+ * Подкаталоги прошлого обхода, прочитанные из индекса
+ */
+struct PreviousScan {
+    QHash<QString, qint64> modificationTimes;
+    QHash<QString, QStringList> subdirectories;
+};
+
+PreviousScan readPreviousScan(const CatalogIndex* index)
+{
+    PreviousScan previous;
+    if (!index || !index->isValid()) {
+        return previous;
+    }
+    previous.modificationTimes.reserve(index->directoryCount());
+    for (int directory = 0; directory < index->directoryCount(); ++directory) {
+        QString path = index->directoryPath(directory).toString();
+        previous.modificationTimes.insert(path, index->directoryModificationTime(directory));
+        if (!path.isEmpty()) {
+            int slash = path.lastIndexOf(QLatin1Char('/'));
+            previous.subdirectories[slash < 0 ? QString() : path.left(slash)].append(path);
+        }
+    }
+    return previous;
+}
+
+/**
+ * @brief diffIndex находит отличия файлов entries прочитанных подкаталогов от индекса
+ * и дополняет ими result; файлы индекса сопоставляются только в прочитанных
+ * заново и удаленных подкаталогах
+ */
+void diffIndex(const CatalogIndex& index, const QString& rootPath, const QFileInfoList& entries, CatalogScanResult& result)
+{
+    QVector<quint8> directoryStates(index.directoryCount(), unchangedDirectory);
+    for (int directory = 0; directory < index.directoryCount(); ++directory) {
+        QString path = index.directoryPath(directory).toString();
+        if (result.scannedDirectories.contains(path)) {
+            directoryStates[directory] = scannedDirectory;
+        } else if (result.removedDirectories.contains(path)) {
+            directoryStates[directory] = removedDirectory;
+        }
+    }
+    QHash<QStringView, int> filesByPath;
+    for (int file = 0; file < index.fileCount(); ++file) {
+        switch (directoryStates.at(index.fileDirectory(file))) {
+        case scannedDirectory:
+            filesByPath.insert(index.filePath(file), file);
+            break;
+        case removedDirectory:
+            result.removedFiles.append(file);
+            break;
+        }
+    }
+    QVector<bool> found(index.fileCount(), false);
+    for (const QFileInfo& entry : entries) {
+        QString path = entry.filePath().mid(rootPath.size());
+        auto it = filesByPath.constFind(QStringView(path));
+        if (it == filesByPath.constEnd()) {
+            result.addedEntries.append(entry);
+            continue;
+        }
+        int file = it.value();
+        found[file] = true;
+        qint64 size = entry.size();
+        qint64 modificationTime = entry.lastModified().toMSecsSinceEpoch();
+        if (size != index.fileSize(file) || modificationTime != index.fileModificationTime(file)) {
+            result.changedFiles.append(file);
+            result.changedFileSizes.append(size);
+            result.changedModificationTimes.append(modificationTime);
+        }
+    }
+    for (auto it = filesByPath.constBegin(); it != filesByPath.constEnd(); ++it) {
+        if (!found.at(it.value())) {
+            result.removedFiles.append(it.value());
+        }
+    }
+    std::sort(result.removedFiles.begin(), result.removedFiles.end());
+}
+
+DirectoryScan scanDirectory(const QString& rootPath, const QStringList& nameFilters, const PreviousScan& previous,
+    const std::atomic_bool& cancelled, const QString& path)
+{
+    DirectoryScan scan;
+    scan.path = path;
+    if (cancelled) {
+        return scan;
+    }
+    QString directoryPath = path.isEmpty() ? rootPath : rootPath + path + QLatin1Char('/');
+    QFileInfo directoryInfo{ directoryPath };
+    scan.exists = directoryInfo.isDir();
+    if (!scan.exists) {
+        return scan;
+    }
+    scan.modificationTime = directoryInfo.lastModified().toMSecsSinceEpoch();
+    // добавление, удаление и переименование файла или подкаталога меняют время
+    // изменения каталога: если оно совпадает с индексом, каталог не читается
+    auto previousTime = previous.modificationTimes.constFind(path);
+    if (previousTime != previous.modificationTimes.constEnd() && previousTime.value() == scan.modificationTime) {
+        scan.subdirectories = previous.subdirectories.value(path);
+        return scan;
+    }
+    scan.scanned = true;
+    // маски имен к подкаталогам не применяются (QDir::AllDirs)
+    QDirIterator iterator{ directoryPath, nameFilters, QDir::AllDirs | QDir::Files | QDir::NoDotAndDotDot };
+    while (!cancelled && iterator.hasNext()) {
+        iterator.next();
+        QFileInfo fileInfo = iterator.fileInfo();
+        if (fileInfo.isDir()) {
+            // символические ссылки на каталоги не обходятся, чтобы не зациклиться
+            if (!fileInfo.isSymLink()) {
+                scan.subdirectories.append(path.isEmpty() ? fileInfo.fileName() : path + QLatin1Char('/') + fileInfo.fileName());
+            }
+            continue;
+        }
+        fileInfo.stat();
+        scan.entries.append(fileInfo);
+    }
+    return scan;
+}
+}
+
+CatalogScanner::CatalogScanner(QObject* parent)
+    : QObject(parent)
+{
+}
+
+CatalogScanner::~CatalogScanner()
+{
+    cancel();
+    m_future.waitForFinished();
+    for (QFuture<void>& future : m_supersededFutures) {
+        future.waitForFinished();
+    }
+}
+
+void CatalogScanner::start(const QString& rootPath, const QStringList& nameFilters, std::shared_ptr<const CatalogIndex> index)
+{
+    cancel();
+    // отмененная задача завершится на ближайшей проверке признака отмены:
+    // UI-поток ее не ждет, но объект не удаляется, пока она выполняется
+    m_supersededFutures.erase(std::remove_if(m_supersededFutures.begin(), m_supersededFutures.end(), [](const QFuture<void>& future) {
+        return future.isFinished();
+    }), m_supersededFutures.end());
+    if (!m_future.isFinished()) {
+        m_supersededFutures.append(m_future);
+    }
+    auto cancelled = std::make_shared<std::atomic_bool>(false);
+    m_cancelled = cancelled;
+    if (index && !index->isValid()) {
+        index.reset();
+    }
+    m_future = QtConcurrent::run([this, cancelled, rootPath, nameFilters, index] {
+        auto publish = [this, cancelled](const QFileInfoList& entries) {
+            QMetaObject::invokeMethod(this, [this, cancelled, entries] {
+                if (!*cancelled) {
+                    emit entriesFound(entries);
+                }
+            }, Qt::QueuedConnection);
+        };
+        TRACE_SCOPE("catalog.scan");
+        const PreviousScan previous = readPreviousScan(index.get());
+        std::function<DirectoryScan(const QString&)> scan = [&rootPath, &nameFilters, &previous, &cancelled](const QString& path) {
+            return scanDirectory(rootPath, nameFilters, previous, *cancelled, path);
+        };
+        CatalogScanResult result;
+        // с индексом файлы не публикуются, а сопоставляются с ним после обхода
+        QFileInfoList scannedEntries;
+        QFileInfoList batch;
+        QElapsedTimer batchTimer;
+        batchTimer.start();
+        // обход по уровням вложенности: подкаталоги уровня читаются параллельно
+        QStringList level{ QString() };
+        while (!level.isEmpty() && !*cancelled) {
+            TRACE_SCOPE("catalog.scan.level");
+            QVector<DirectoryScan> scans = QtConcurrent::blockingMapped<QVector<DirectoryScan>>(level, scan);
+            level.clear();
+            for (const DirectoryScan& directory : scans) {
+                if (!directory.exists) {
+                    continue;
+                }
+                result.directories.insert(directory.path, directory.modificationTime);
+                level += directory.subdirectories;
+                if (!directory.scanned) {
+                    continue;
+                }
+                result.scannedDirectories.insert(directory.path);
+                if (index) {
+                    scannedEntries += directory.entries;
+                    continue;
+                }
+                batch += directory.entries;
+                if (batch.size() >= maxBatchSize || batchTimer.hasExpired(batchInterval)) {
+                    TRACE_COUNTER("catalog.scan.batch", batch.size());
+                    publish(batch);
+                    batch = QFileInfoList();
+                    batchTimer.restart();
+                }
+            }
+        }
+        if (*cancelled) {
+            return;
+        }
+        if (!batch.isEmpty()) {
+            publish(batch);
+        }
+        for (auto it = previous.modificationTimes.constBegin(); it != previous.modificationTimes.constEnd(); ++it) {
+            if (!result.directories.contains(it.key())) {
+                result.removedDirectories.insert(it.key());
+            }
+        }
+        if (index) {
+            TRACE_SCOPE("catalog.scan.diff");
+            diffIndex(*index, rootPath, scannedEntries, result);
+        }
+        QMetaObject::invokeMethod(this, [this, cancelled, result] {
+            if (!*cancelled) {
+                emit finished(result);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void CatalogScanner::cancel()
+{
+    if (m_cancelled) {
+        *m_cancelled = true;
+    }
+}
+
+bool CatalogScanner::isRunning() const
+{
+    return m_future.isRunning();
+}
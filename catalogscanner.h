@@ -0,0 +1,126 @@
+#ifndef CATALOGSCANNER_H
+#define CATALOGSCANNER_H
+
+#include <QFileInfoList>
+#include <QFuture>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+
+class CatalogIndex;
+
+/**
+ * @brief The CatalogScanResult struct
+ * Итог обхода дерева каталога
+ */
+struct CatalogScanResult {
+    /**
+     * @brief directories времена изменения всех найденных подкаталогов
+     * по их путям относительно корня ("" - сам корень)
+     */
+    QHash<QString, qint64> directories;
+    /**
+     * @brief scannedDirectories подкаталоги, содержимое которых прочитано заново:
+     * новые и изменившиеся с прошлого обхода
+     */
+    QSet<QString> scannedDirectories;
+    /**
+     * @brief removedDirectories подкаталоги из индекса, которых больше нет
+     */
+    QSet<QString> removedDirectories;
+    /**
+     * @brief addedEntries файлы прочитанных подкаталогов, которых нет в индексе
+     * (только при обходе с индексом)
+     */
+    QFileInfoList addedEntries;
+    /**
+     * @brief changedFiles номера файлов индекса, размер или время изменения
+     * которых отличаются от сохраненных; changedFileSizes и changedModificationTimes -
+     * их новые значения
+     */
+    QVector<int> changedFiles;
+    QVector<qint64> changedFileSizes;
+    QVector<qint64> changedModificationTimes;
+    /**
+     * @brief removedFiles номера файлов индекса, которых больше нет, по возрастанию
+     */
+    QVector<int> removedFiles;
+};
+
+/**
+ * @brief The CatalogScanner class
+ * CatalogScanner - фоновый параллельный обход дерева каталогов.
+ * Подкаталоги одного уровня вложенности обходятся одновременно на всех ядрах.
+ * Если задан индекс прошлого обхода, заново читаются только подкаталоги,
+ * время изменения которых не совпадает с сохраненным; у остальных только
+ * проверяется время изменения, а их подкаталоги берутся из индекса.
+ * Изменение содержимого файла время изменения каталога не меняет, поэтому
+ * такие файлы находятся только при обходе их подкаталога по другой причине.
+ * Без индекса файлы прочитанных подкаталогов публикуются пачками в потоке
+ * объекта, пути файлов начинаются с пути корня, переданного в start().
+ * С индексом пачки не публикуются: отличия от индекса (добавленные, измененные
+ * и удаленные файлы) вычисляются в потоке обхода и передаются в итоге обхода,
+ * поэтому потоку объекта не нужно сопоставлять файлы всего дерева.
+ */
+class CatalogScanner : public QObject {
+    Q_OBJECT
+public:
+    explicit CatalogScanner(QObject* parent = Q_NULLPTR);
+    ~CatalogScanner();
+
+    // CatalogScanner interface
+public:
+    /**
+     * @brief start запускает обход дерева rootPath, отменяя текущий обход
+     * @param rootPath путь корня с завершающим разделителем
+     * @param nameFilters маски имен файлов
+     * @param index открытый индекс прошлого обхода или nullptr; номера файлов
+     * в итоге обхода - номера файлов этого индекса
+     */
+    void start(const QString& rootPath, const QStringList& nameFilters, std::shared_ptr<const CatalogIndex> index);
+    /**
+     * @brief cancel отменяет текущий обход
+     */
+    void cancel();
+    /**
+     * @brief isRunning проверяет, выполняется ли обход
+     * @return true, если обход выполняется
+     */
+    bool isRunning() const;
+
+signals:
+    /**
+     * @brief entriesFound сообщает об очередной пачке файлов прочитанных подкаталогов
+     * при обходе без индекса
+     * @param entries
+     */
+    void entriesFound(const QFileInfoList& entries);
+    /**
+     * @brief finished сообщает о завершении обхода (кроме отмененного)
+     * @param result
+     */
+    void finished(const CatalogScanResult& result);
+
+private:
+    /**
+     * @brief m_cancelled признак отмены текущего обхода
+     */
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+    /**
+     * @brief m_future текущий обход
+     */
+    QFuture<void> m_future;
+    /**
+     * @brief m_supersededFutures отмененные обходы, которые еще выполняются и могут
+     * обратиться к объекту; деструктор дожидается и их
+     */
+    QList<QFuture<void>> m_supersededFutures;
+};
+
+#endif // CATALOGSCANNER_H
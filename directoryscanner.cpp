@@ -0,0 +1,106 @@
+#include "directoryscanner.h"
+#include "trace.h"
+
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+
+#include <algorithm>
+
+namespace {
+// пачка публикуется не реже, чем раз в этот интервал, даже если не заполнена,
+// поэтому быстрый локальный каталог приходит одной уже отсортированной пачкой,
+// а из медленного первый экран эскизов появляется через batchInterval
+const int maxBatchSize = 4096;
+const qint64 batchInterval = 100;
+
+void sortByName(QFileInfoList& entries)
+{
+    std::sort(entries.begin(), entries.end(), [](const QFileInfo& a, const QFileInfo& b) {
+        return a.fileName() < b.fileName();
+    });
+}
+}
+
+DirectoryScanner::DirectoryScanner(QObject* parent)
+    : QObject(parent)
+{
+}
+
+DirectoryScanner::~DirectoryScanner()
+{
+    cancel();
+    m_future.waitForFinished();
+    for (QFuture<void>& future : m_supersededFutures) {
+        future.waitForFinished();
+    }
+}
+
+void DirectoryScanner::start(const QString& path, const QStringList& nameFilters)
+{
+    cancel();
+    // отмененная задача завершится на ближайшей проверке признака отмены:
+    // UI-поток ее не ждет, но объект не удаляется, пока она выполняется
+    m_supersededFutures.erase(std::remove_if(m_supersededFutures.begin(), m_supersededFutures.end(), [](const QFuture<void>& future) {
+        return future.isFinished();
+    }), m_supersededFutures.end());
+    if (!m_future.isFinished()) {
+        m_supersededFutures.append(m_future);
+    }
+    auto cancelled = std::make_shared<std::atomic_bool>(false);
+    m_cancelled = cancelled;
+    m_future = QtConcurrent::run([this, cancelled, path, nameFilters] {
+        auto publish = [this, cancelled](QFileInfoList entries) {
+            sortByName(entries);
+            // пачка доставляется в поток объекта; если обход к этому времени
+            // отменен, она отбрасывается
+            QMetaObject::invokeMethod(this, [this, cancelled, entries] {
+                if (!*cancelled) {
+                    emit entriesFound(entries);
+                }
+            }, Qt::QueuedConnection);
+        };
+        TRACE_SCOPE("enumerate");
+        QDirIterator iterator{ path, nameFilters, QDir::Files };
+        QFileInfoList batch;
+        QElapsedTimer batchTimer;
+        batchTimer.start();
+        while (!*cancelled && iterator.hasNext()) {
+            iterator.next();
+            // размер и время изменения запрашиваются здесь, в потоке обхода,
+            // и кешируются в QFileInfo, чтобы модель не обращалась к диску
+            QFileInfo fileInfo = iterator.fileInfo();
+            fileInfo.stat();
+            batch.append(fileInfo);
+            if (batch.size() >= maxBatchSize || batchTimer.hasExpired(batchInterval)) {
+                TRACE_COUNTER("enumerate.batch", batch.size());
+                publish(std::move(batch));
+                batch = QFileInfoList();
+                batchTimer.restart();
+            }
+        }
+        if (*cancelled) {
+            return;
+        }
+        if (!batch.isEmpty()) {
+            publish(std::move(batch));
+        }
+        QMetaObject::invokeMethod(this, [this, cancelled] {
+            if (!*cancelled) {
+                emit finished();
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void DirectoryScanner::cancel()
+{
+    if (m_cancelled) {
+        *m_cancelled = true;
+    }
+}
+
+bool DirectoryScanner::isRunning() const
+{
+    return m_future.isRunning();
+}
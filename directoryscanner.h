@@ -0,0 +1,73 @@
+#ifndef DIRECTORYSCANNER_H
+#define DIRECTORYSCANNER_H
+
+#include <QFileInfoList>
+#include <QFuture>
+#include <QList>
+#include <QObject>
+#include <QStringList>
+
+#include <atomic>
+#include <memory>
+
+/**
+ * @brief The DirectoryScanner class
+ * DirectoryScanner - фоновый обход каталога через QDirIterator.
+ * Найденные файлы публикуются пачками в потоке объекта, поэтому первые
+ * файлы становятся доступны, пока обход медленного каталога (например, NFS)
+ * еще продолжается. Новый запуск или cancel() отменяет текущий обход,
+ * и его необработанные пачки отбрасываются.
+ */
+class DirectoryScanner : public QObject {
+    Q_OBJECT
+public:
+    explicit DirectoryScanner(QObject* parent = Q_NULLPTR);
+    ~DirectoryScanner();
+
+    // DirectoryScanner interface
+public:
+    /**
+     * @brief start запускает обход каталога path, отменяя текущий обход
+     * @param path
+     * @param nameFilters маски имен файлов
+     */
+    void start(const QString& path, const QStringList& nameFilters);
+    /**
+     * @brief cancel отменяет текущий обход
+     */
+    void cancel();
+    /**
+     * @brief isRunning проверяет, выполняется ли обход
+     * @return true, если обход выполняется
+     */
+    bool isRunning() const;
+
+signals:
+    /**
+     * @brief entriesFound сообщает об очередной пачке найденных файлов,
+     * отсортированной по имени
+     * @param entries
+     */
+    void entriesFound(const QFileInfoList& entries);
+    /**
+     * @brief finished сообщает о завершении обхода (кроме отмененного)
+     */
+    void finished();
+
+private:
+    /**
+     * @brief m_cancelled признак отмены текущего обхода
+     */
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+    /**
+     * @brief m_future текущий обход
+     */
+    QFuture<void> m_future;
+    /**
+     * @brief m_supersededFutures отмененные обходы, которые еще выполняются и могут
+     * обратиться к объекту; деструктор дожидается и их
+     */
+    QList<QFuture<void>> m_supersededFutures;
+};
+
+#endif // DIRECTORYSCANNER_H
@@ -0,0 +1,107 @@
+#include "directorywatcher.h"
+
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QtDebug>
+
+#if defined(Q_OS_LINUX)
+#include <sys/inotify.h>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#endif
+
+DirectoryWatcher::DirectoryWatcher(QObject* parent)
+    : QObject(parent)
+{
+#if defined(Q_OS_LINUX)
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify >= 0) {
+        m_notifier = new QSocketNotifier{ m_inotify, QSocketNotifier::Read, this };
+        // QSocketNotifier::activated перегружен начиная с Qt 5.15, а обе перегрузки
+        // закрыты QPrivateSignal, поэтому сигнал подключается по сигнатуре
+        connect(m_notifier, SIGNAL(activated(int)), this, SLOT(readEvents()));
+        return;
+    }
+    qWarning() << "inotify is not available:" << strerror(errno);
+#endif
+    m_fileSystemWatcher = new QFileSystemWatcher{ this };
+    connect(m_fileSystemWatcher, &QFileSystemWatcher::directoryChanged, this, &DirectoryWatcher::directoryChanged);
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+#if defined(Q_OS_LINUX)
+    if (m_inotify >= 0) {
+        delete m_notifier;
+        close(m_inotify);
+    }
+#endif
+}
+
+bool DirectoryWatcher::addPath(const QString& path)
+{
+    if (m_fileSystemWatcher) {
+        return m_fileSystemWatcher->addPath(path);
+    }
+#if defined(Q_OS_LINUX)
+    const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB | IN_ONLYDIR;
+    int watch = inotify_add_watch(m_inotify, QFile::encodeName(path).constData(), mask);
+    if (watch < 0) {
+        qWarning() << "Watching" << path << "failed:" << strerror(errno);
+        return false;
+    }
+    m_watches.insert(watch, path);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void DirectoryWatcher::removeAllPaths()
+{
+    if (m_fileSystemWatcher) {
+        QStringList paths = m_fileSystemWatcher->directories();
+        if (!paths.isEmpty()) {
+            m_fileSystemWatcher->removePaths(paths);
+        }
+        return;
+    }
+#if defined(Q_OS_LINUX)
+    for (auto it = m_watches.constBegin(); it != m_watches.constEnd(); ++it) {
+        inotify_rm_watch(m_inotify, it.key());
+    }
+    m_watches.clear();
+#endif
+}
+
+void DirectoryWatcher::readEvents()
+{
+#if defined(Q_OS_LINUX)
+    // события одного каталога, прочитанные за раз, дают одно уведомление
+    QSet<int> changed;
+    alignas(struct inotify_event) char buffer[4096];
+    for (;;) {
+        ssize_t length = read(m_inotify, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+        for (ssize_t offset = 0; offset < length;) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+            offset += ssize_t(sizeof(struct inotify_event) + event->len);
+            if (event->mask & IN_IGNORED) {
+                // каталог удален или наблюдение снято
+                m_watches.remove(event->wd);
+                changed.remove(event->wd);
+            } else if (m_watches.contains(event->wd)) {
+                changed.insert(event->wd);
+            }
+        }
+    }
+    for (int watch : changed) {
+        emit directoryChanged(m_watches.value(watch));
+    }
+#endif
+}
@@ -0,0 +1,71 @@
+#ifndef DIRECTORYWATCHER_H
+#define DIRECTORYWATCHER_H
+
+#include <QHash>
+#include <QObject>
+#include <QString>
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+
+/**
+ * @brief The DirectoryWatcher class
+ * DirectoryWatcher - уведомления об изменениях файлов каталога.
+ * QFileSystemWatcher сообщает об изменении каталога, только когда файлы
+ * создаются, удаляются или переименовываются, но не когда файл дописывается
+ * или перезаписывается на месте. Поэтому в Linux каталог отслеживается через
+ * inotify напрямую, и изменением каталога считается также закрытие файла
+ * после записи (IN_CLOSE_WRITE) и смена его атрибутов, включая время изменения.
+ * Файл, который создается и затем пишется несколько секунд, вызывает второе
+ * уведомление, когда запись закончена. В остальных системах и при недоступном
+ * inotify используется QFileSystemWatcher.
+ */
+class DirectoryWatcher : public QObject {
+    Q_OBJECT
+public:
+    explicit DirectoryWatcher(QObject* parent = Q_NULLPTR);
+    ~DirectoryWatcher();
+
+    // DirectoryWatcher interface
+public:
+    /**
+     * @brief addPath начинает отслеживать каталог path
+     * @param path
+     * @return true, если каталог отслеживается
+     */
+    bool addPath(const QString& path);
+    /**
+     * @brief removeAllPaths прекращает отслеживать все каталоги
+     */
+    void removeAllPaths();
+
+signals:
+    /**
+     * @brief directoryChanged сообщает об изменении файлов каталога path
+     * @param path
+     */
+    void directoryChanged(const QString& path);
+
+private slots:
+    /**
+     * @brief readEvents читает накопившиеся события inotify
+     */
+    void readEvents();
+
+private:
+    /**
+     * @brief m_inotify дескриптор inotify или -1
+     */
+    int m_inotify = -1;
+    QSocketNotifier* m_notifier = nullptr;
+    /**
+     * @brief m_watches отслеживаемые каталоги по дескрипторам наблюдения inotify
+     */
+    QHash<int, QString> m_watches;
+    /**
+     * @brief m_fileSystemWatcher замена inotify, где его нет
+     */
+    QFileSystemWatcher* m_fileSystemWatcher = nullptr;
+};
+
+#endif // DIRECTORYWATCHER_H
@@ -0,0 +1,410 @@
+#include "embeddedpreviewreader.h"
+
+#include <QBuffer>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QImageReader>
+#include <QSet>
+#include <QTransform>
+#include <QtEndian>
+
+#include <algorithm>
+
+namespace {
+// защита от испорченных файлов
+const qint64 maxPreviewLength = 64 * 1024 * 1024;
+const int maxIfdCount = 32;
+const int maxIfdEntryCount = 1024;
+const int maxSubIfdCount = 16;
+const int maxJpegMarkerCount = 64;
+
+// теги TIFF/EXIF, нужные для поиска эскизов
+const quint16 tagCompression = 0x0103;
+const quint16 tagStripOffsets = 0x0111;
+const quint16 tagOrientation = 0x0112;
+const quint16 tagStripByteCounts = 0x0117;
+const quint16 tagSubIfds = 0x014A;
+const quint16 tagJpegInterchangeFormat = 0x0201;
+const quint16 tagJpegInterchangeFormatLength = 0x0202;
+// теги даты съемки: DateTime в IFD0 и DateTimeOriginal в IFD EXIF
+const quint16 tagDateTime = 0x0132;
+const quint16 tagExifIfd = 0x8769;
+const quint16 tagDateTimeOriginal = 0x9003;
+
+// типы значений TIFF
+const quint16 typeShort = 3;
+
+// дата EXIF: "YYYY:MM:DD HH:MM:SS" с завершающим нулем
+const int dateTimeLength = 19;
+
+// сжатие JPEG в TIFF: 6 - старый JPEG, 7 - JPEG (в DNG также lossless JPEG,
+// который отсеивается по маркеру SOF)
+const quint32 compressionOldJpeg = 6;
+const quint32 compressionJpeg = 7;
+
+const char rawSuffixes[][4] = { "cr2", "nef", "arw", "dng" };
+
+QImage oriented(const QImage& image, int orientation)
+{
+    switch (orientation) {
+    case 2:
+        return image.mirrored(true, false);
+    case 3:
+        return image.transformed(QTransform().rotate(180));
+    case 4:
+        return image.mirrored(false, true);
+    case 5:
+        return image.mirrored(true, false).transformed(QTransform().rotate(270));
+    case 6:
+        return image.transformed(QTransform().rotate(90));
+    case 7:
+        return image.mirrored(true, false).transformed(QTransform().rotate(90));
+    case 8:
+        return image.transformed(QTransform().rotate(270));
+    default:
+        return image;
+    }
+}
+
+/**
+ * @brief The TiffByteOrder class
+ * Чтение чисел TIFF в порядке байтов файла
+ */
+class TiffByteOrder {
+public:
+    explicit TiffByteOrder(bool littleEndian)
+        : m_littleEndian{ littleEndian }
+    {
+    }
+
+    quint16 u16(const char* data) const
+    {
+        const uchar* p = reinterpret_cast<const uchar*>(data);
+        return m_littleEndian ? qFromLittleEndian<quint16>(p) : qFromBigEndian<quint16>(p);
+    }
+
+    quint32 u32(const char* data) const
+    {
+        const uchar* p = reinterpret_cast<const uchar*>(data);
+        return m_littleEndian ? qFromLittleEndian<quint32>(p) : qFromBigEndian<quint32>(p);
+    }
+
+    quint32 value(quint16 type, const char* data) const
+    {
+        return type == typeShort ? u16(data) : u32(data);
+    }
+
+private:
+    bool m_littleEndian;
+};
+
+quint16 bigEndian16(const char* data)
+{
+    return qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(data));
+}
+}
+
+EmbeddedPreviewReader::EmbeddedPreviewReader(QIODevice* device)
+    : m_device{ device }
+{
+    char magic[4];
+    if (!readBytes(0, magic, sizeof(magic))) {
+        return;
+    }
+    if (uchar(magic[0]) == 0xFF && uchar(magic[1]) == 0xD8) {
+        parseJpeg();
+    } else if ((magic[0] == 'I' && magic[1] == 'I' && magic[2] == 42 && magic[3] == 0)
+        || (magic[0] == 'M' && magic[1] == 'M' && magic[2] == 0 && magic[3] == 42)) {
+        parseTiff(0, m_device->size());
+    }
+    std::sort(m_previews.begin(), m_previews.end(), [](const EmbeddedPreview& a, const EmbeddedPreview& b) {
+        return qint64(a.size.width()) * a.size.height() < qint64(b.size.width()) * b.size.height();
+    });
+}
+
+bool EmbeddedPreviewReader::isRawFileName(const QString& fileName)
+{
+    QString suffix = QFileInfo{ fileName }.suffix();
+    for (const char* rawSuffix : rawSuffixes) {
+        if (suffix.compare(QLatin1String(rawSuffix), Qt::CaseInsensitive) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EmbeddedPreviewReader::mayContainPreviews(const QString& fileName)
+{
+    QString suffix = QFileInfo{ fileName }.suffix();
+    return suffix.compare(QLatin1String("jpg"), Qt::CaseInsensitive) == 0
+        || suffix.compare(QLatin1String("jpeg"), Qt::CaseInsensitive) == 0
+        || isRawFileName(fileName);
+}
+
+QDateTime EmbeddedPreviewReader::captureTime() const
+{
+    return m_captureTime;
+}
+
+QList<EmbeddedPreview> EmbeddedPreviewReader::previews() const
+{
+    return m_previews;
+}
+
+int EmbeddedPreviewReader::orientation() const
+{
+    return m_orientation;
+}
+
+int EmbeddedPreviewReader::suitablePreview(const QSize& boundingSize) const
+{
+    QSize size = orientedSize(boundingSize);
+    for (int i = 0; i < m_previews.size(); ++i) {
+        // эскиз подходит, если при вписывании в плитку его не придется увеличивать
+        const QSize& previewSize = m_previews.at(i).size;
+        QSize fitted = previewSize.scaled(size, Qt::KeepAspectRatio);
+        if (fitted.width() <= previewSize.width() && fitted.height() <= previewSize.height()) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+QImage EmbeddedPreviewReader::read(const QSize& boundingSize)
+{
+    int preview = suitablePreview(boundingSize);
+    return preview < 0 ? QImage() : decode(m_previews.at(preview), boundingSize);
+}
+
+QImage EmbeddedPreviewReader::readLargest(const QSize& boundingSize)
+{
+    return m_previews.isEmpty() ? QImage() : decode(m_previews.last(), boundingSize);
+}
+
+void EmbeddedPreviewReader::parseJpeg()
+{
+    // ищем сегмент APP1 с EXIF среди маркеров до начала данных изображения
+    qint64 pos = 2;
+    for (int i = 0; i < maxJpegMarkerCount; ++i) {
+        char header[4];
+        if (!readBytes(pos, header, sizeof(header)) || uchar(header[0]) != 0xFF) {
+            return;
+        }
+        uchar marker = uchar(header[1]);
+        if (marker == 0xFF) {
+            ++pos;
+            continue;
+        }
+        if (marker == 0xDA || (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)) {
+            return;
+        }
+        qint64 segmentLength = bigEndian16(header + 2);
+        if (marker == 0xE1) {
+            char signature[6];
+            if (readBytes(pos + 4, signature, sizeof(signature)) && qstrncmp(signature, "Exif", 5) == 0 && signature[5] == 0) {
+                parseTiff(pos + 4 + sizeof(signature), pos + 2 + segmentLength);
+                return;
+            }
+        }
+        pos += 2 + segmentLength;
+    }
+}
+
+void EmbeddedPreviewReader::parseTiff(qint64 base, qint64 limit)
+{
+    char header[8];
+    if (!readBytes(base, header, sizeof(header))) {
+        return;
+    }
+    TiffByteOrder byteOrder{ header[0] == 'I' };
+    QList<quint32> ifdOffsets{ byteOrder.u32(header + 4) };
+    QSet<quint32> visited;
+    for (int ifdIndex = 0; !ifdOffsets.isEmpty() && ifdIndex < maxIfdCount; ++ifdIndex) {
+        quint32 ifdOffset = ifdOffsets.takeFirst();
+        if (!ifdOffset || visited.contains(ifdOffset) || base + ifdOffset + 2 > limit) {
+            continue;
+        }
+        visited.insert(ifdOffset);
+        char countBytes[2];
+        if (!readBytes(base + ifdOffset, countBytes, sizeof(countBytes))) {
+            continue;
+        }
+        int entryCount = qMin<int>(byteOrder.u16(countBytes), maxIfdEntryCount);
+        QByteArray entries(entryCount * 12 + 4, Qt::Uninitialized);
+        if (!readBytes(base + ifdOffset + 2, entries.data(), entries.size())) {
+            continue;
+        }
+        quint32 jpegOffset = 0;
+        quint32 jpegLength = 0;
+        quint32 compression = 0;
+        quint32 stripOffset = 0;
+        quint32 stripByteCount = 0;
+        QDateTime dateTime;
+        for (int i = 0; i < entryCount; ++i) {
+            const char* entry = entries.constData() + i * 12;
+            quint16 tag = byteOrder.u16(entry);
+            quint16 type = byteOrder.u16(entry + 2);
+            quint32 count = byteOrder.u32(entry + 4);
+            const char* value = entry + 8;
+            switch (tag) {
+            case tagOrientation:
+                // ориентация основного изображения задается в IFD0
+                if (ifdIndex == 0) {
+                    m_orientation = qBound(1, int(byteOrder.value(type, value)), 8);
+                }
+                break;
+            case tagCompression:
+                compression = byteOrder.value(type, value);
+                break;
+            case tagStripOffsets:
+                stripOffset = count == 1 ? byteOrder.value(type, value) : 0;
+                break;
+            case tagStripByteCounts:
+                stripByteCount = count == 1 ? byteOrder.value(type, value) : 0;
+                break;
+            case tagJpegInterchangeFormat:
+                jpegOffset = byteOrder.value(type, value);
+                break;
+            case tagJpegInterchangeFormatLength:
+                jpegLength = byteOrder.value(type, value);
+                break;
+            case tagExifIfd:
+                if (ifdIndex == 0) {
+                    ifdOffsets.append(byteOrder.u32(value));
+                }
+                break;
+            case tagDateTimeOriginal:
+                // дата съемки точнее даты изменения, записанной редактором
+                m_captureTime = readDateTime(base + byteOrder.u32(value), count);
+                break;
+            case tagDateTime:
+                if (ifdIndex == 0) {
+                    dateTime = readDateTime(base + byteOrder.u32(value), count);
+                }
+                break;
+            case tagSubIfds:
+                if (count == 1) {
+                    ifdOffsets.append(byteOrder.u32(value));
+                } else if (count > 1) {
+                    int subIfdCount = qMin<int>(count, maxSubIfdCount);
+                    QByteArray offsets(subIfdCount * 4, Qt::Uninitialized);
+                    if (readBytes(base + byteOrder.u32(value), offsets.data(), offsets.size())) {
+                        for (int j = 0; j < subIfdCount; ++j) {
+                            ifdOffsets.append(byteOrder.u32(offsets.constData() + j * 4));
+                        }
+                    }
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        if (!m_captureTime.isValid()) {
+            m_captureTime = dateTime;
+        }
+        if (jpegOffset && jpegLength && base + jpegOffset + jpegLength <= limit) {
+            appendJpegPreview(base + jpegOffset, jpegLength);
+        }
+        if ((compression == compressionOldJpeg || compression == compressionJpeg)
+            && stripOffset && stripByteCount && base + stripOffset + stripByteCount <= limit) {
+            appendJpegPreview(base + stripOffset, stripByteCount);
+        }
+        ifdOffsets.append(byteOrder.u32(entries.constData() + entryCount * 12));
+    }
+}
+
+void EmbeddedPreviewReader::appendJpegPreview(qint64 offset, qint64 length)
+{
+    if (length <= 0 || length > maxPreviewLength) {
+        return;
+    }
+    for (const EmbeddedPreview& preview : m_previews) {
+        if (preview.offset == offset) {
+            return;
+        }
+    }
+    char soi[2];
+    if (!readBytes(offset, soi, sizeof(soi)) || uchar(soi[0]) != 0xFF || uchar(soi[1]) != 0xD8) {
+        return;
+    }
+    // размер эскиза берем из маркера SOF, не читая данные изображения
+    qint64 pos = offset + 2;
+    for (int i = 0; i < maxJpegMarkerCount && pos + 4 <= offset + length; ++i) {
+        char header[9];
+        if (!readBytes(pos, header, 4) || uchar(header[0]) != 0xFF) {
+            return;
+        }
+        uchar marker = uchar(header[1]);
+        if (marker == 0xFF) {
+            ++pos;
+            continue;
+        }
+        if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2) {
+            // baseline, extended и progressive JPEG декодируются плагином Qt
+            if (!readBytes(pos + 4, header + 4, 5)) {
+                return;
+            }
+            QSize size{ bigEndian16(header + 7), bigEndian16(header + 5) };
+            if (!size.isEmpty()) {
+                m_previews.append(EmbeddedPreview{ offset, length, size });
+            }
+            return;
+        }
+        if (marker == 0xDA || marker == 0xD9 || (marker >= 0xC3 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)) {
+            // lossless и арифметический JPEG (например, данные сенсора DNG) не подходят
+            return;
+        }
+        pos += 2 + bigEndian16(header + 2);
+    }
+}
+
+QDateTime EmbeddedPreviewReader::readDateTime(qint64 offset, quint32 count)
+{
+    // строка длиннее 4 байтов хранится по смещению, указанному в записи IFD
+    char text[dateTimeLength];
+    if (count < quint32(dateTimeLength) || !readBytes(offset, text, sizeof(text))) {
+        return QDateTime();
+    }
+    return QDateTime::fromString(QString::fromLatin1(text, sizeof(text)), QStringLiteral("yyyy:MM:dd HH:mm:ss"));
+}
+
+bool EmbeddedPreviewReader::readBytes(qint64 offset, char* data, qint64 size)
+{
+    return m_device->seek(offset) && m_device->read(data, size) == size;
+}
+
+QByteArray EmbeddedPreviewReader::readData(const EmbeddedPreview& preview)
+{
+    QByteArray data(preview.length, Qt::Uninitialized);
+    if (!readBytes(preview.offset, data.data(), data.size())) {
+        return QByteArray();
+    }
+    return data;
+}
+
+QImage EmbeddedPreviewReader::decodeData(const QByteArray& data, const QSize& previewSize, int orientation, const QSize& boundingSize)
+{
+    QByteArray bytes = data;
+    QBuffer buffer{ &bytes };
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader{ &buffer, "jpeg" };
+    // ориентации 5-8 поворачивают изображение на 90 градусов
+    QSize size = orientation >= 5 ? boundingSize.transposed() : boundingSize;
+    if (!size.isEmpty() && (previewSize.width() > size.width() || previewSize.height() > size.height())) {
+        // крупное превью RAW тоже уменьшается в DCT-области
+        reader.setScaledSize(previewSize.scaled(size, Qt::KeepAspectRatio).expandedTo(QSize(1, 1)));
+    }
+    return oriented(reader.read(), orientation);
+}
+
+QImage EmbeddedPreviewReader::decode(const EmbeddedPreview& preview, const QSize& boundingSize)
+{
+    QByteArray data = readData(preview);
+    return data.isEmpty() ? QImage() : decodeData(data, preview.size, m_orientation, boundingSize);
+}
+
+QSize EmbeddedPreviewReader::orientedSize(const QSize& size) const
+{
+    // ориентации 5-8 поворачивают изображение на 90 градусов
+    return m_orientation >= 5 ? size.transposed() : size;
+}
@@ -0,0 +1,133 @@
+#ifndef EMBEDDEDPREVIEWREADER_H
+#define EMBEDDEDPREVIEWREADER_H
+
+#include <QDateTime>
+#include <QImage>
+#include <QList>
+#include <QSize>
+#include <QString>
+
+class QIODevice;
+
+/**
+ * @brief The EmbeddedPreview struct
+ * Описание встроенного JPEG-эскиза: положение в файле и размер изображения
+ */
+struct EmbeddedPreview {
+    qint64 offset;
+    qint64 length;
+    QSize size;
+};
+
+/**
+ * @brief The EmbeddedPreviewReader class
+ * EmbeddedPreviewReader - чтение встроенных эскизов без декодирования основного
+ * изображения: эскиза EXIF (IFD1) в JPEG и JPEG-превью в RAW-файлах на основе
+ * TIFF (CR2, NEF, ARW, DNG). Читаются только заголовки IFD, маркеры JPEG и байты
+ * выбранного эскиза, то есть единицы килобайт вместо всего файла. Попутно из
+ * заголовков извлекаются ориентация и дата съемки.
+ */
+class EmbeddedPreviewReader {
+public:
+    /**
+     * @brief EmbeddedPreviewReader разбирает заголовки файла, открытого на device
+     * @param device открытое для чтения устройство с произвольным доступом
+     */
+    explicit EmbeddedPreviewReader(QIODevice* device);
+
+    // EmbeddedPreviewReader interface
+public:
+    /**
+     * @brief isRawFileName проверяет, является ли файл RAW-файлом, который Qt
+     * не умеет декодировать и который можно показать только по встроенному эскизу
+     * @param fileName
+     * @return true для CR2, NEF, ARW и DNG
+     */
+    static bool isRawFileName(const QString& fileName);
+    /**
+     * @brief mayContainPreviews проверяет по имени файла, могут ли в нем быть
+     * встроенные эскизы, не открывая его
+     * @param fileName
+     * @return true для JPEG и RAW-файлов
+     */
+    static bool mayContainPreviews(const QString& fileName);
+    /**
+     * @brief previews возвращает найденные эскизы в порядке возрастания площади
+     * @return список эскизов
+     */
+    QList<EmbeddedPreview> previews() const;
+    /**
+     * @brief orientation возвращает ориентацию EXIF (1-8) основного изображения
+     * @return ориентация EXIF, 1 если она не указана
+     */
+    int orientation() const;
+    /**
+     * @brief captureTime возвращает дату съемки EXIF (DateTimeOriginal или DateTime)
+     * @return дата съемки в местном времени или недействительная дата, если она не указана
+     */
+    QDateTime captureTime() const;
+    /**
+     * @brief suitablePreview ищет наименьший эскиз, которого хватает для boundingSize
+     * без увеличения, с учетом ориентации
+     * @param boundingSize
+     * @return номер эскиза в previews() или -1, если подходящего нет
+     */
+    int suitablePreview(const QSize& boundingSize) const;
+    /**
+     * @brief read декодирует наименьший эскиз, которого хватает для boundingSize
+     * без увеличения, с учетом ориентации
+     * @param boundingSize
+     * @return эскиз, вписанный в boundingSize, или пустое изображение, если подходящего нет
+     */
+    QImage read(const QSize& boundingSize);
+    /**
+     * @brief readLargest декодирует самый крупный эскиз, вписывая его в boundingSize
+     * @param boundingSize
+     * @return эскиз или пустое изображение, если эскизов нет
+     */
+    QImage readLargest(const QSize& boundingSize);
+    /**
+     * @brief readData читает сжатые данные эскиза preview, не декодируя их
+     * @param preview
+     * @return данные JPEG или пустой массив в случае ошибки
+     */
+    QByteArray readData(const EmbeddedPreview& preview);
+    /**
+     * @brief decodeData декодирует данные эскиза, прочитанные readData()
+     * @param data данные JPEG
+     * @param previewSize размер эскиза
+     * @param orientation ориентация EXIF, которую надо применить
+     * @param boundingSize размер, в который вписывается эскиз (с учетом ориентации)
+     * @return эскиз или пустое изображение в случае ошибки
+     */
+    static QImage decodeData(const QByteArray& data, const QSize& previewSize, int orientation, const QSize& boundingSize);
+
+private:
+    void parseJpeg();
+    void parseTiff(qint64 base, qint64 limit);
+    void appendJpegPreview(qint64 offset, qint64 length);
+    QDateTime readDateTime(qint64 offset, quint32 count);
+    bool readBytes(qint64 offset, char* data, qint64 size);
+    QImage decode(const EmbeddedPreview& preview, const QSize& boundingSize);
+    QSize orientedSize(const QSize& size) const;
+
+private:
+    /**
+     * @brief m_device устройство файла
+     */
+    QIODevice* m_device;
+    /**
+     * @brief m_previews найденные эскизы
+     */
+    QList<EmbeddedPreview> m_previews;
+    /**
+     * @brief m_orientation ориентация EXIF
+     */
+    int m_orientation = 1;
+    /**
+     * @brief m_captureTime дата съемки EXIF
+     */
+    QDateTime m_captureTime;
+};
+
+#endif // EMBEDDEDPREVIEWREADER_H
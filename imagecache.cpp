@@ -0,0 +1,215 @@
+#include "imagecache.h"
+
+#include <iterator>
+
+namespace {
+const qint64 megabyte = 1024 * 1024;
+// доля бюджета, отводимая под очередь новых изображений (Kin в терминах 2Q)
+const int probationShare = 4;
+// минимальная длина истории вытесненных ключей (Kout в терминах 2Q)
+const int minimumGhostCount = 64;
+}
+
+ImageCache::ImageCache(int memoryBudget)
+    : m_budget{ qMax(memoryBudget, 1) * megabyte }
+{
+}
+
+int ImageCache::memoryBudget() const
+{
+    return static_cast<int>(m_budget / megabyte);
+}
+
+void ImageCache::setMemoryBudget(int megabytes)
+{
+    m_budget = qMax(megabytes, 1) * megabyte;
+    trim();
+}
+
+qint64 ImageCache::probationCapacity() const
+{
+    return m_budget / probationShare;
+}
+
+qint64 ImageCache::totalCost() const
+{
+    return m_probationCost + m_protectedCost;
+}
+
+int ImageCache::count() const
+{
+    return m_entries.size();
+}
+
+bool ImageCache::contains(const Key& key) const
+{
+    return m_entries.contains(key);
+}
+
+QImage ImageCache::object(const Key& key)
+{
+    auto found = m_entries.constFind(key);
+    if (found == m_entries.constEnd()) {
+        ++m_statistics.misses;
+        return QImage();
+    }
+    ++m_statistics.hits;
+    EntryList::iterator it = found.value();
+    // попадания в очередь новых изображений порядок не меняют (2Q),
+    // иначе однократная прокрутка туда и обратно выглядела бы как рабочий набор
+    if (it->queue == Protected) {
+        m_protected.splice(m_protected.begin(), m_protected, it);
+    }
+    return it->image;
+}
+
+QImage ImageCache::peek(const Key& key) const
+{
+    auto found = m_entries.constFind(key);
+    return found == m_entries.constEnd() ? QImage() : found.value()->image;
+}
+
+QImage ImageCache::peekNearest(quint32 imageId, int level, int* foundLevel) const
+{
+    int nearest = 0;
+    bool found = false;
+    for (auto it = m_levels.constFind(imageId); it != m_levels.constEnd() && it.key() == imageId; ++it) {
+        int candidate = it.value();
+        // уменьшать изображение лучше, чем увеличивать, поэтому при равном
+        // удалении выбираем более высокий уровень
+        if (!found || qAbs(candidate - level) < qAbs(nearest - level)
+            || (qAbs(candidate - level) == qAbs(nearest - level) && candidate > nearest)) {
+            nearest = candidate;
+            found = true;
+        }
+    }
+    if (!found) {
+        return QImage();
+    }
+    if (foundLevel) {
+        *foundLevel = nearest;
+    }
+    return peek(Key{ imageId, nearest });
+}
+
+bool ImageCache::insert(const Key& key, const QImage& image)
+{
+    qint64 cost = image.sizeInBytes();
+    if (cost > m_budget) {
+        remove(key);
+        return false;
+    }
+    ++m_statistics.insertions;
+    auto found = m_entries.find(key);
+    if (found != m_entries.end()) {
+        // замена изображения сохраняет очередь, в которой оно находится
+        EntryList::iterator it = found.value();
+        EntryList& queue = it->queue == Probation ? m_probation : m_protected;
+        qint64& queueCost = it->queue == Probation ? m_probationCost : m_protectedCost;
+        queueCost += cost - it->cost;
+        it->image = image;
+        it->cost = cost;
+        queue.splice(queue.begin(), queue, it);
+        trim();
+        return true;
+    }
+    auto ghost = m_ghostIndex.find(key);
+    if (ghost != m_ghostIndex.end()) {
+        // изображение запрашивается повторно после вытеснения - это рабочий набор
+        m_ghosts.erase(ghost.value());
+        m_ghostIndex.erase(ghost);
+        m_protected.push_front(Entry{ key, image, cost, Protected });
+        m_protectedCost += cost;
+        link(m_protected.begin());
+    } else {
+        m_probation.push_front(Entry{ key, image, cost, Probation });
+        m_probationCost += cost;
+        link(m_probation.begin());
+    }
+    trim();
+    return true;
+}
+
+void ImageCache::remove(const Key& key)
+{
+    auto found = m_entries.find(key);
+    if (found == m_entries.end()) {
+        return;
+    }
+    unlink(found.value());
+}
+
+void ImageCache::removeImage(quint32 imageId)
+{
+    for (int level : m_levels.values(imageId)) {
+        remove(Key{ imageId, level });
+    }
+}
+
+void ImageCache::clear()
+{
+    m_entries.clear();
+    m_levels.clear();
+    m_probation.clear();
+    m_protected.clear();
+    m_probationCost = 0;
+    m_protectedCost = 0;
+    m_ghostIndex.clear();
+    m_ghosts.clear();
+}
+
+ImageCacheStatistics ImageCache::statistics() const
+{
+    return m_statistics;
+}
+
+void ImageCache::resetStatistics()
+{
+    m_statistics = ImageCacheStatistics{};
+}
+
+void ImageCache::link(EntryList::iterator it)
+{
+    m_entries.insert(it->key, it);
+    m_levels.insert(it->key.imageId, it->key.level);
+}
+
+void ImageCache::unlink(EntryList::iterator it)
+{
+    m_entries.remove(it->key);
+    m_levels.remove(it->key.imageId, it->key.level);
+    if (it->queue == Probation) {
+        m_probationCost -= it->cost;
+        m_probation.erase(it);
+    } else {
+        m_protectedCost -= it->cost;
+        m_protected.erase(it);
+    }
+}
+
+void ImageCache::rememberGhost(const Key& key)
+{
+    m_ghosts.push_front(key);
+    m_ghostIndex.insert(key, m_ghosts.begin());
+    int ghostCapacity = qMax(m_entries.size() / 2, minimumGhostCount);
+    while (m_ghosts.size() > static_cast<size_t>(ghostCapacity)) {
+        m_ghostIndex.remove(m_ghosts.back());
+        m_ghosts.pop_back();
+    }
+}
+
+void ImageCache::trim()
+{
+    while (totalCost() > m_budget) {
+        EntryList::iterator victim;
+        if (m_protected.empty() || (m_probationCost > probationCapacity() && !m_probation.empty())) {
+            // вытесняем самое старое из новых изображений, запоминая его ключ
+            victim = std::prev(m_probation.end());
+            rememberGhost(victim->key);
+        } else {
+            victim = std::prev(m_protected.end());
+        }
+        unlink(victim);
+        ++m_statistics.evictions;
+    }
+}
@@ -0,0 +1,213 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QHash>
+#include <QImage>
+
+#include <list>
+
+/**
+ * @brief The ImageCacheKey struct
+ * Ключ кеша изображений: идентификатор изображения (ImageListModel::ImageIdRole)
+ * и уровень разрешения, в котором оно декодировано. Одно изображение может
+ * храниться в нескольких разрешениях.
+ */
+struct ImageCacheKey {
+    quint32 imageId;
+    int level;
+};
+
+inline bool operator==(const ImageCacheKey& a, const ImageCacheKey& b)
+{
+    return a.imageId == b.imageId && a.level == b.level;
+}
+
+inline uint qHash(const ImageCacheKey& key, uint seed = 0)
+{
+    return qHash((quint64(key.imageId) << 32) | quint32(key.level), seed);
+}
+
+/**
+ * @brief The ImageCacheStatistics struct
+ * Счетчики работы кеша изображений
+ */
+struct ImageCacheStatistics {
+    quint64 hits = 0;
+    quint64 misses = 0;
+    quint64 insertions = 0;
+    quint64 evictions = 0;
+};
+
+/**
+ * @brief The ImageCache class
+ * ImageCache - кеш изображений, ограниченный объемом памяти в байтах.
+ * Стоимость элемента - реальный размер QImage::sizeInBytes().
+ * Вытеснение выполняется по алгоритму 2Q: новые изображения попадают в
+ * FIFO-очередь "испытательного срока", и только повторно запрошенные после
+ * вытеснения из нее переходят в основную LRU-очередь. Поэтому быстрая прокрутка,
+ * которая проходит по изображениям один раз, не вытесняет рабочий набор.
+ */
+class ImageCache {
+public:
+    using Key = ImageCacheKey;
+
+    /**
+     * @brief ImageCache
+     * @param memoryBudget бюджет памяти в мегабайтах
+     */
+    explicit ImageCache(int memoryBudget = 256);
+
+    // ImageCache interface
+public:
+    /**
+     * @brief memoryBudget возвращает бюджет памяти кеша в мегабайтах
+     * @return бюджет памяти в мегабайтах
+     */
+    int memoryBudget() const;
+    /**
+     * @brief setMemoryBudget устанавливает бюджет памяти кеша в мегабайтах,
+     * при необходимости вытесняя изображения
+     * @param megabytes
+     */
+    void setMemoryBudget(int megabytes);
+    /**
+     * @brief probationCapacity возвращает объем очереди новых изображений, при
+     * превышении которого вытесняются прежде всего они
+     * @return объем в байтах
+     */
+    qint64 probationCapacity() const;
+    /**
+     * @brief totalCost возвращает суммарный размер изображений кеша в байтах
+     * @return суммарный размер в байтах
+     */
+    qint64 totalCost() const;
+    /**
+     * @brief count возвращает число изображений в кеше
+     * @return число изображений
+     */
+    int count() const;
+    /**
+     * @brief contains проверяет наличие изображения по ключу key
+     * @param key
+     * @return true, если изображение есть в кеше
+     */
+    bool contains(const Key& key) const;
+    /**
+     * @brief object возвращает изображение по ключу key, учитывая попадание
+     * или промах в статистике и обновляя положение изображения в очереди
+     * @param key
+     * @return изображение или пустое изображение при промахе
+     */
+    QImage object(const Key& key);
+    /**
+     * @brief peek возвращает изображение по ключу key, не влияя ни на статистику,
+     * ни на порядок вытеснения (для отрисовки)
+     * @param key
+     * @return изображение или пустое изображение
+     */
+    QImage peek(const Key& key) const;
+    /**
+     * @brief peekNearest возвращает изображение imageId в ближайшем к level уровне
+     * разрешения, предпочитая более высокие уровни. Как и peek(), не влияет на
+     * статистику и порядок вытеснения.
+     * @param imageId
+     * @param level
+     * @param foundLevel уровень найденного изображения или nullptr
+     * @return изображение или пустое изображение, если его нет ни в одном разрешении
+     */
+    QImage peekNearest(quint32 imageId, int level, int* foundLevel = Q_NULLPTR) const;
+    /**
+     * @brief insert помещает изображение в кеш
+     * @param key
+     * @param image
+     * @return false, если изображение больше всего бюджета и не было помещено
+     */
+    bool insert(const Key& key, const QImage& image);
+    /**
+     * @brief remove удаляет изображение по ключу key
+     * @param key
+     */
+    void remove(const Key& key);
+    /**
+     * @brief removeImage удаляет изображение imageId во всех уровнях разрешения
+     * (например, после изменения файла)
+     * @param imageId
+     */
+    void removeImage(quint32 imageId);
+    /**
+     * @brief clear удаляет все изображения и историю вытеснений
+     */
+    void clear();
+    /**
+     * @brief statistics возвращает счетчики кеша
+     * @return счетчики кеша
+     */
+    ImageCacheStatistics statistics() const;
+    /**
+     * @brief resetStatistics обнуляет счетчики кеша
+     */
+    void resetStatistics();
+
+private:
+    enum Queue {
+        Probation,
+        Protected
+    };
+    struct Entry {
+        Key key;
+        QImage image;
+        qint64 cost;
+        Queue queue;
+    };
+    using EntryList = std::list<Entry>;
+    using GhostList = std::list<Key>;
+
+    void link(EntryList::iterator it);
+    void unlink(EntryList::iterator it);
+    void rememberGhost(const Key& key);
+    void trim();
+
+private:
+    /**
+     * @brief m_budget бюджет памяти в байтах
+     */
+    qint64 m_budget;
+    /**
+     * @brief m_probation FIFO-очередь новых изображений (A1in), в начале - самые новые
+     */
+    EntryList m_probation;
+    /**
+     * @brief m_protected LRU-очередь повторно используемых изображений (Am)
+     */
+    EntryList m_protected;
+    /**
+     * @brief m_probationCost суммарный размер изображений очереди m_probation
+     */
+    qint64 m_probationCost = 0;
+    /**
+     * @brief m_protectedCost суммарный размер изображений очереди m_protected
+     */
+    qint64 m_protectedCost = 0;
+    /**
+     * @brief m_entries индекс изображений обеих очередей
+     */
+    QHash<Key, EntryList::iterator> m_entries;
+    /**
+     * @brief m_levels уровни разрешения, в которых хранится каждое изображение
+     */
+    QMultiHash<quint32, int> m_levels;
+    /**
+     * @brief m_ghosts ключи, недавно вытесненные из m_probation (A1out), без изображений
+     */
+    GhostList m_ghosts;
+    /**
+     * @brief m_ghostIndex индекс ключей m_ghosts
+     */
+    QHash<Key, GhostList::iterator> m_ghostIndex;
+    /**
+     * @brief m_statistics счетчики кеша
+     */
+    ImageCacheStatistics m_statistics;
+};
+
+#endif // IMAGECACHE_H
@@ -1,30 +1,1008 @@
 #include "imagelistmodel.h"
+#include "catalogindex.h"
+#include "catalogscanner.h"
+#include "directoryscanner.h"
+#include "directorywatcher.h"
+#include "metadatascanner.h"
+#include "trace.h"
 
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
+#include <QTimer>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <numeric>
+
+namespace {
+// изменения каталога, пришедшие в пределах интервала (мс), применяются одним обходом
+const int rescanDelay = 500;
+// при большем числе разрозненных диапазонов строк модель сбрасывается, а не
+// сдвигает массив строк и не рассылает сигналы на каждый диапазон
+const int maxIncrementalRanges = 32;
+
+// признаки файла в Columns::flags
+const quint8 entryRemoved = 0x01;
+const quint8 entryMetadataLoaded = 0x02;
+
+const ImageListModel::SortKey sortKeys[] = {
+    ImageListModel::SortByName,
+    ImageListModel::SortByModificationTime,
+    ImageListModel::SortByFileSize,
+    ImageListModel::SortByCaptureTime,
+    ImageListModel::SortByImageSize
+};
+
+bool dependsOnMetadata(ImageListModel::SortKey key)
+{
+    return key == ImageListModel::SortByCaptureTime || key == ImageListModel::SortByImageSize;
+}
+
+/**
+ * @brief rangeCount возвращает число непрерывных диапазонов в упорядоченном списке строк
+ */
+int rangeCount(const QVector<int>& rows)
+{
+    int count = 0;
+    for (int i = 0; i < rows.size(); ++i) {
+        if (i == 0 || rows.at(i) != rows.at(i - 1) + 1) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+bool entryLessThan(const ImageListModel::Columns& columns, ImageListModel::SortKey key, int a, int b)
+{
+    switch (key) {
+    case ImageListModel::SortByModificationTime:
+        if (columns.modificationTimes.at(a) != columns.modificationTimes.at(b)) {
+            return columns.modificationTimes.at(a) < columns.modificationTimes.at(b);
+        }
+        break;
+    case ImageListModel::SortByFileSize:
+        if (columns.fileSizes.at(a) != columns.fileSizes.at(b)) {
+            return columns.fileSizes.at(a) < columns.fileSizes.at(b);
+        }
+        break;
+    case ImageListModel::SortByCaptureTime: {
+        auto captureTime = [&columns](int entry) {
+            qint64 time = columns.captureTimes.at(entry);
+            return time != ImageMetadata::noCaptureTime ? time : columns.modificationTimes.at(entry);
+        };
+        qint64 timeA = captureTime(a);
+        qint64 timeB = captureTime(b);
+        if (timeA != timeB) {
+            return timeA < timeB;
+        }
+        break;
+    }
+    case ImageListModel::SortByImageSize: {
+        const QSize& sizeA = columns.imageSizes.at(a);
+        const QSize& sizeB = columns.imageSizes.at(b);
+        qint64 areaA = sizeA.isValid() ? qint64(sizeA.width()) * sizeA.height() : 0;
+        qint64 areaB = sizeB.isValid() ? qint64(sizeB.width()) * sizeB.height() : 0;
+        if (areaA != areaB) {
+            return areaA < areaB;
+        }
+        break;
+    }
+    case ImageListModel::SortByName:
+        break;
+    }
+    // порядок полный, поэтому перестановка по ключу однозначна
+    int byName = QStringRef::compare(columns.name(a), columns.name(b));
+    return byName != 0 ? byName < 0 : a < b;
+}
+
+/**
+ * @brief sortedEntries упорядочивает все неудаленные файлы по возрастанию ключа key
+ */
+QVector<int> sortedEntries(const ImageListModel::Columns& columns, ImageListModel::SortKey key)
+{
+    QVector<int> order;
+    order.reserve(columns.count());
+    for (int entry = 0; entry < columns.count(); ++entry) {
+        if (!(columns.flags.at(entry) & entryRemoved)) {
+            order.append(entry);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&columns, key](int a, int b) {
+        return entryLessThan(columns, key, a, b);
+    });
+    return order;
+}
+
+/**
+ * @brief mergedEntries добавляет файлы entries в упорядоченную по ключу key перестановку order
+ */
+QVector<int> mergedEntries(const ImageListModel::Columns& columns, ImageListModel::SortKey key, const QVector<int>& order, QVector<int> entries)
+{
+    auto lessThan = [&columns, key](int a, int b) {
+        return entryLessThan(columns, key, a, b);
+    };
+    std::sort(entries.begin(), entries.end(), lessThan);
+    QVector<int> merged(order.size() + entries.size());
+    std::merge(order.begin(), order.end(), entries.begin(), entries.end(), merged.begin(), lessThan);
+    return merged;
+}
+}
+
+int ImageListModel::Columns::count() const
+{
+    return imageIds.size();
+}
+
+QStringRef ImageListModel::Columns::name(int entry) const
+{
+    return QStringRef(&nameArena, nameOffsets.at(entry), nameLengths.at(entry));
+}
 
 ImageListModel::ImageListModel(QObject* parent)
     : QAbstractTableModel(parent)
+    , directoryScanner{ new DirectoryScanner{ this } }
+    , directoryRescanner{ new DirectoryScanner{ this } }
+    , directoryWatcher{ new DirectoryWatcher{ this } }
+    , rescanDelayTimer{ new QTimer{ this } }
+    , metadataScanner{ new MetadataScanner{ this } }
+    , catalogScanner{ new CatalogScanner{ this } }
 {
-    imageNameFilter << "*.png"
-                    << "*.jpg"
-                    << "*.gif";
+    imageNameFilter = imageNameFilters();
+    connect(directoryScanner, &DirectoryScanner::entriesFound, this, &ImageListModel::appendImages);
+    connect(directoryScanner, &DirectoryScanner::finished, this, &ImageListModel::finishLoading);
+    connect(directoryRescanner, &DirectoryScanner::entriesFound, this, &ImageListModel::appendRescannedImages);
+    connect(directoryRescanner, &DirectoryScanner::finished, this, &ImageListModel::finishRescan);
+    connect(directoryWatcher, &DirectoryWatcher::directoryChanged, this, &ImageListModel::scheduleRescan);
+    connect(metadataScanner, &MetadataScanner::metadataFound, this, &ImageListModel::applyMetadata);
+    connect(metadataScanner, &MetadataScanner::finished, this, &ImageListModel::finishMetadataLoading);
+    // с индексом обход пачек не публикует, а передает отличия в итоге обхода
+    connect(catalogScanner, &CatalogScanner::entriesFound, this, &ImageListModel::appendImages);
+    connect(catalogScanner, &CatalogScanner::finished, this, &ImageListModel::finishCatalogScan);
+    rescanDelayTimer->setSingleShot(true);
+    rescanDelayTimer->setInterval(rescanDelay);
+    connect(rescanDelayTimer, &QTimer::timeout, this, &ImageListModel::startRescan);
+}
+
+QStringList ImageListModel::imageNameFilters()
+{
+    return QStringList() << "*.png"
+                         << "*.jpg"
+                         << "*.jpeg"
+                         << "*.gif"
+                         << "*.tif"
+                         << "*.tiff"
+                         << "*.cr2"
+                         << "*.nef"
+                         << "*.arw"
+                         << "*.dng";
+}
+
+ImageListModel::~ImageListModel()
+{
+    if (entryOrderCancelled) {
+        *entryOrderCancelled = true;
+    }
+    entryOrderFuture.waitForFinished();
+    for (QFuture<void>& future : supersededEntryOrderFutures) {
+        future.waitForFinished();
+    }
+    catalogIndexFuture.waitForFinished();
 }
 
 bool ImageListModel::loadDirectoryImageList(const QString& fullPath)
 {
     qInfo() << "Loading Image List From " << fullPath << "started";
-    QDir directory{ fullPath };
     beginResetModel();
-    imageFileInfoList = directory.entryInfoList(imageNameFilter, QDir::Files, QDir::Name);
-    qInfo() << "Loading Image List From " << fullPath << "finished: " << imageFileInfoList.size() << "images";
+    clear();
+    directoryPath = QDir::cleanPath(QDir{ fullPath }.absolutePath());
+    if (!directoryPath.endsWith(QLatin1Char('/'))) {
+        directoryPath += QLatin1Char('/');
+    }
+    directoryScanner->start(fullPath, imageNameFilter);
+    // изменения, сделанные во время первого обхода, тоже будут замечены:
+    // повторный обход начнется после его завершения
+    if (!directoryWatcher->addPath(fullPath)) {
+        qWarning() << "Watching" << fullPath << "failed";
+    }
+    emit imageListReplaced();
     endResetModel();
     return true;
 }
 
+bool ImageListModel::loadCatalog(const QString& rootPath)
+{
+    qInfo() << "Loading Catalog From " << rootPath << "started";
+    beginResetModel();
+    clear();
+    directoryPath = QDir::cleanPath(QDir{ rootPath }.absolutePath());
+    if (!directoryPath.endsWith(QLatin1Char('/'))) {
+        directoryPath += QLatin1Char('/');
+    }
+    catalog = true;
+    catalogIndexPath = CatalogIndex::defaultIndexPath(directoryPath);
+    // обход сопоставляет файлы с тем же открытым индексом, из которого загружена
+    // модель, поэтому номера файлов в его итоге совпадают с номерами файлов модели
+    std::shared_ptr<const CatalogIndex> index;
+    {
+        TRACE_SCOPE("catalog.load");
+        index = std::make_shared<const CatalogIndex>(catalogIndexPath);
+        if (index->isValid()) {
+            appendIndexEntries(*index);
+            catalogIndexLoaded = true;
+            // пока перестановка текущего ключа вычисляется в фоне, строки идут по имени
+            rows = filteredRows(entryOrders.contains(currentSortKey) ? entryOrder(currentSortKey) : entryOrder(SortByName));
+        } else {
+            index.reset();
+        }
+    }
+    catalogScanner->start(directoryPath, imageNameFilter, index);
+    emit imageListReplaced();
+    endResetModel();
+    if (catalogIndexLoaded) {
+        qInfo() << "Catalog index loaded: " << columns.count() << "images";
+        startEntryOrderBuilding();
+    }
+    return true;
+}
+
+bool ImageListModel::isCatalog() const
+{
+    return catalog;
+}
+
+bool ImageListModel::isLoading() const
+{
+    return directoryScanner->isRunning() || catalogScanner->isRunning();
+}
+
+bool ImageListModel::isMetadataLoading() const
+{
+    return metadataScanner->isRunning();
+}
+
+ImageListModel::SortKey ImageListModel::sortKey() const
+{
+    return currentSortKey;
+}
+
+Qt::SortOrder ImageListModel::sortOrder() const
+{
+    return currentSortOrder;
+}
+
+void ImageListModel::setSorting(SortKey key, Qt::SortOrder order)
+{
+    if (key == currentSortKey && order == currentSortOrder) {
+        return;
+    }
+    currentSortKey = key;
+    currentSortOrder = order;
+    updateRows();
+}
+
+ImageListFilter ImageListModel::filter() const
+{
+    return currentFilter;
+}
+
+void ImageListModel::setFilter(const ImageListFilter& filter)
+{
+    currentFilter = filter;
+    updateRows();
+}
+
+quint32 ImageListModel::imageId(int row) const
+{
+    return columns.imageIds.at(rows.at(row));
+}
+
+QStringRef ImageListModel::fileName(int row) const
+{
+    return columns.name(rows.at(row));
+}
+
+QString ImageListModel::filePath(int row) const
+{
+    QString path;
+    path.reserve(directoryPath.size() + columns.nameLengths.at(rows.at(row)));
+    path.append(directoryPath);
+    path.append(fileName(row));
+    return path;
+}
+
+void ImageListModel::clear()
+{
+    directoryScanner->cancel();
+    catalogScanner->cancel();
+    directoryRescanner->cancel();
+    metadataScanner->cancel();
+    rescannedImageList.clear();
+    rescanDelayTimer->stop();
+    directoryWatcher->removeAllPaths();
+    if (entryOrderCancelled) {
+        *entryOrderCancelled = true;
+    }
+    entryOrderBuilding = false;
+    entryOrderBuildingPending = false;
+    directoryPath.clear();
+    catalog = false;
+    catalogIndexLoaded = false;
+    catalogIndexPath.clear();
+    catalogDirectories.clear();
+    catalogIndexSavePending = false;
+    // память освобождается сразу, а не при следующем росте массивов
+    columns = Columns();
+    removedEntryCount = 0;
+    rows = QVector<int>();
+    entryOrders.clear();
+    staleEntryOrderKeys.clear();
+    ++columnsGeneration;
+    ++metadataGeneration;
+}
+
+int ImageListModel::appendEntries(const QFileInfoList& entries)
+{
+    int first = columns.count();
+    for (const QFileInfo& entry : entries) {
+        // сведения о файле уже получены в потоке обхода, здесь они только копируются
+        QString name = entryName(entry);
+        columns.nameOffsets.append(columns.nameArena.size());
+        columns.nameLengths.append(name.size());
+        columns.nameArena.append(name);
+        columns.imageIds.append(nextImageId++);
+        columns.fileSizes.append(entry.size());
+        columns.modificationTimes.append(entry.lastModified().toMSecsSinceEpoch());
+        columns.captureTimes.append(ImageMetadata::noCaptureTime);
+        columns.imageSizes.append(QSize());
+        columns.flags.append(0);
+    }
+    ++columnsGeneration;
+    QVector<int> added(columns.count() - first);
+    std::iota(added.begin(), added.end(), first);
+    mergeEntryOrders(added);
+    return first;
+}
+
+void ImageListModel::appendIndexEntries(const CatalogIndex& index)
+{
+    int count = index.fileCount();
+    columns.nameOffsets.reserve(count);
+    columns.nameLengths.reserve(count);
+    columns.imageIds.reserve(count);
+    columns.fileSizes.reserve(count);
+    columns.modificationTimes.reserve(count);
+    columns.captureTimes.reserve(count);
+    columns.imageSizes.reserve(count);
+    columns.flags.reserve(count);
+    for (int file = 0; file < count; ++file) {
+        // пути копируются из отображения индекса в хранилище имен без промежуточных строк
+        QStringView path = index.filePath(file);
+        columns.nameOffsets.append(columns.nameArena.size());
+        columns.nameLengths.append(int(path.size()));
+        columns.nameArena.append(path.data(), int(path.size()));
+        columns.imageIds.append(nextImageId++);
+        columns.fileSizes.append(index.fileSize(file));
+        columns.modificationTimes.append(index.fileModificationTime(file));
+        bool hasMetadata = index.fileHasMetadata(file);
+        columns.captureTimes.append(hasMetadata ? index.fileCaptureTime(file) : ImageMetadata::noCaptureTime);
+        columns.imageSizes.append(hasMetadata ? index.fileImageSize(file) : QSize());
+        columns.flags.append(hasMetadata ? entryMetadataLoaded : 0);
+    }
+    columns.nameArena.squeeze();
+    entryOrders.clear();
+    staleEntryOrderKeys.clear();
+    ++columnsGeneration;
+    // файлы индекса уже упорядочены по пути тем же сравнением, что и SortByName
+    QVector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    entryOrders.insert(SortByName, order);
+}
+
+void ImageListModel::compactEntries()
+{
+    Columns compacted;
+    int count = columns.count() - removedEntryCount;
+    compacted.nameOffsets.reserve(count);
+    compacted.nameLengths.reserve(count);
+    compacted.imageIds.reserve(count);
+    compacted.fileSizes.reserve(count);
+    compacted.modificationTimes.reserve(count);
+    compacted.captureTimes.reserve(count);
+    compacted.imageSizes.reserve(count);
+    compacted.flags.reserve(count);
+    QVector<int> newEntries(columns.count(), -1);
+    for (int entry = 0; entry < columns.count(); ++entry) {
+        if (columns.flags.at(entry) & entryRemoved) {
+            continue;
+        }
+        newEntries[entry] = compacted.count();
+        compacted.nameOffsets.append(compacted.nameArena.size());
+        compacted.nameLengths.append(columns.nameLengths.at(entry));
+        compacted.nameArena.append(columns.name(entry));
+        compacted.imageIds.append(columns.imageIds.at(entry));
+        compacted.fileSizes.append(columns.fileSizes.at(entry));
+        compacted.modificationTimes.append(columns.modificationTimes.at(entry));
+        compacted.captureTimes.append(columns.captureTimes.at(entry));
+        compacted.imageSizes.append(columns.imageSizes.at(entry));
+        compacted.flags.append(columns.flags.at(entry));
+    }
+    columns = compacted;
+    removedEntryCount = 0;
+    // строки и перестановки не содержат удаленных файлов, их достаточно перенумеровать
+    for (int& entry : rows) {
+        entry = newEntries.at(entry);
+    }
+    for (QVector<int>& order : entryOrders) {
+        for (int& entry : order) {
+            entry = newEntries.at(entry);
+        }
+    }
+    ++columnsGeneration;
+    ++metadataGeneration;
+}
+
+bool ImageListModel::acceptsEntry(int entry) const
+{
+    if (columns.flags.at(entry) & entryRemoved) {
+        return false;
+    }
+    qint64 fileSize = columns.fileSizes.at(entry);
+    if (fileSize < currentFilter.minimumFileSize || fileSize > currentFilter.maximumFileSize) {
+        return false;
+    }
+    QStringRef name = columns.name(entry);
+    if (!currentFilter.suffixes.isEmpty()) {
+        int dot = name.lastIndexOf(QLatin1Char('.'));
+        QStringRef suffix = dot < 0 ? QStringRef() : name.mid(dot + 1);
+        bool accepted = false;
+        for (const QString& allowed : currentFilter.suffixes) {
+            if (suffix.compare(allowed, Qt::CaseInsensitive) == 0) {
+                accepted = true;
+                break;
+            }
+        }
+        if (!accepted) {
+            return false;
+        }
+    }
+    return currentFilter.nameSubstring.isEmpty() || name.contains(currentFilter.nameSubstring, Qt::CaseInsensitive);
+}
+
+const QVector<int>& ImageListModel::entryOrder(SortKey key)
+{
+    auto it = entryOrders.find(key);
+    if (it == entryOrders.end()) {
+        // перестановка еще не вычислена в фоне - сортируем здесь
+        it = entryOrders.insert(key, sortedEntries(columns, key));
+    }
+    return it.value();
+}
+
+void ImageListModel::mergeEntryOrders(const QVector<int>& entries)
+{
+    if (entries.isEmpty()) {
+        return;
+    }
+    // файлы вставляются слиянием в уже вычисленные перестановки, чтобы смена
+    // сортировки после повторного обхода не сортировала файлы на потоке интерфейса
+    for (auto it = entryOrders.begin(); it != entryOrders.end(); ++it) {
+        it.value() = mergedEntries(columns, SortKey(it.key()), it.value(), entries);
+    }
+}
+
+QVector<int> ImageListModel::filteredRows(const QVector<int>& order) const
+{
+    QVector<int> result;
+    result.reserve(order.size());
+    if (currentSortOrder == Qt::AscendingOrder) {
+        for (int entry : order) {
+            if (acceptsEntry(entry)) {
+                result.append(entry);
+            }
+        }
+    } else {
+        for (auto it = order.crbegin(); it != order.crend(); ++it) {
+            if (acceptsEntry(*it)) {
+                result.append(*it);
+            }
+        }
+    }
+    return result;
+}
+
+void ImageListModel::updateRows()
+{
+    replaceRows(filteredRows(entryOrder(currentSortKey)));
+}
+
+void ImageListModel::reorderRows(const QVector<int>& newRows)
+{
+    // строки переставляются с сохранением постоянных индексов (текущий элемент, выделение)
+    emit layoutAboutToBeChanged();
+    QVector<int> newRowOfEntry(columns.count(), -1);
+    for (int row = 0; row < newRows.size(); ++row) {
+        newRowOfEntry[newRows.at(row)] = row;
+    }
+    QModelIndexList from = persistentIndexList();
+    QModelIndexList to;
+    to.reserve(from.size());
+    for (const QModelIndex& index : from) {
+        to.append(index.isValid() ? this->index(newRowOfEntry.at(rows.at(index.row())), index.column()) : index);
+    }
+    rows = newRows;
+    changePersistentIndexList(from, to);
+    emit layoutChanged();
+}
+
+void ImageListModel::replaceRows(const QVector<int>& newRows)
+{
+    if (newRows == rows) {
+        return;
+    }
+    QVector<bool> inNewRows(columns.count(), false);
+    for (int entry : newRows) {
+        inNewRows[entry] = true;
+    }
+    QVector<bool> inRows(columns.count(), false);
+    for (int entry : rows) {
+        inRows[entry] = true;
+    }
+    QVector<int> removedRows;
+    for (int row = 0; row < rows.size(); ++row) {
+        if (!inNewRows.at(rows.at(row))) {
+            removedRows.append(row);
+        }
+    }
+    QVector<int> insertedRows;
+    for (int row = 0; row < newRows.size(); ++row) {
+        if (!inRows.at(newRows.at(row))) {
+            insertedRows.append(row);
+        }
+    }
+    if (rangeCount(removedRows) + rangeCount(insertedRows) > maxIncrementalRanges) {
+        beginResetModel();
+        rows = newRows;
+        endResetModel();
+        return;
+    }
+
+    // удаленные строки - с конца, чтобы номера еще не удаленных не сдвигались
+    for (int last = removedRows.size() - 1; last >= 0;) {
+        int first = last;
+        while (first > 0 && removedRows.at(first - 1) == removedRows.at(first) - 1) {
+            --first;
+        }
+        beginRemoveRows(QModelIndex(), removedRows.at(first), removedRows.at(last));
+        rows.remove(removedRows.at(first), last - first + 1);
+        endRemoveRows();
+        last = first - 1;
+    }
+    // оставшиеся строки упорядочиваются так же, как в новом списке
+    QVector<int> keptRows;
+    keptRows.reserve(rows.size());
+    for (int entry : newRows) {
+        if (inRows.at(entry)) {
+            keptRows.append(entry);
+        }
+    }
+    if (keptRows != rows) {
+        reorderRows(keptRows);
+    }
+    // добавленные строки - по возрастанию, тогда каждая встает на свое итоговое место
+    for (int first = 0; first < insertedRows.size();) {
+        int last = first;
+        while (last + 1 < insertedRows.size() && insertedRows.at(last + 1) == insertedRows.at(last) + 1) {
+            ++last;
+        }
+        int row = insertedRows.at(first);
+        int count = last - first + 1;
+        beginInsertRows(QModelIndex(), row, row + count - 1);
+        rows.insert(row, count, 0);
+        std::copy(newRows.begin() + row, newRows.begin() + row + count, rows.begin() + row);
+        endInsertRows();
+        first = last + 1;
+    }
+}
+
+void ImageListModel::startEntryOrderBuilding()
+{
+    if (entryOrderBuilding) {
+        entryOrderBuildingPending = true;
+        return;
+    }
+    QVector<int> keys;
+    for (SortKey key : sortKeys) {
+        if (!entryOrders.contains(key) || staleEntryOrderKeys.contains(key)) {
+            keys.append(key);
+        }
+    }
+    if (keys.isEmpty()) {
+        return;
+    }
+    entryOrderBuilding = true;
+    // отмененное clear() вычисление завершится на ближайшей проверке признака отмены:
+    // UI-поток его не ждет, но модель не удаляется, пока оно выполняется
+    supersededEntryOrderFutures.erase(std::remove_if(supersededEntryOrderFutures.begin(), supersededEntryOrderFutures.end(), [](const QFuture<void>& future) {
+        return future.isFinished();
+    }), supersededEntryOrderFutures.end());
+    if (!entryOrderFuture.isFinished()) {
+        supersededEntryOrderFutures.append(entryOrderFuture);
+    }
+    auto cancelled = std::make_shared<std::atomic_bool>(false);
+    entryOrderCancelled = cancelled;
+    // снимок массивов разделяется с моделью неявно и копируется, только если
+    // модель изменится, пока перестановки вычисляются
+    Columns snapshot = columns;
+    quint64 snapshotColumnsGeneration = columnsGeneration;
+    quint64 snapshotMetadataGeneration = metadataGeneration;
+    entryOrderFuture = QtConcurrent::run([this, cancelled, snapshot, snapshotColumnsGeneration, snapshotMetadataGeneration, keys] {
+        for (int key : keys) {
+            if (*cancelled) {
+                return;
+            }
+            QVector<int> order = sortedEntries(snapshot, SortKey(key));
+            if (*cancelled) {
+                return;
+            }
+            QMetaObject::invokeMethod(this, [this, cancelled, snapshotColumnsGeneration, snapshotMetadataGeneration, key, order] {
+                bool current = snapshotColumnsGeneration == columnsGeneration
+                    && (!dependsOnMetadata(SortKey(key)) || snapshotMetadataGeneration == metadataGeneration);
+                if (*cancelled || !current || (entryOrders.contains(key) && !staleEntryOrderKeys.contains(key))) {
+                    return;
+                }
+                entryOrders.insert(key, order);
+                staleEntryOrderKeys.remove(key);
+                // строки, упорядоченные до прочтения сведений из заголовков, встают на места
+                if (key == currentSortKey) {
+                    updateRows();
+                }
+            }, Qt::QueuedConnection);
+        }
+        if (*cancelled) {
+            return;
+        }
+        QMetaObject::invokeMethod(this, [this, cancelled] {
+            if (*cancelled) {
+                return;
+            }
+            entryOrderBuilding = false;
+            if (entryOrderBuildingPending) {
+                entryOrderBuildingPending = false;
+                startEntryOrderBuilding();
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ImageListModel::startMetadataLoading()
+{
+    QVector<quint32> imageIds;
+    QStringList fileNames;
+    for (int entry = 0; entry < columns.count(); ++entry) {
+        if (!(columns.flags.at(entry) & (entryRemoved | entryMetadataLoaded))) {
+            imageIds.append(columns.imageIds.at(entry));
+            fileNames.append(columns.name(entry).toString());
+        }
+    }
+    if (!imageIds.isEmpty()) {
+        metadataScanner->start(directoryPath, imageIds, fileNames);
+    }
+}
+
+void ImageListModel::appendImages(const QFileInfoList& entries)
+{
+    if (entries.isEmpty()) {
+        return;
+    }
+    int first = appendEntries(entries);
+    QVector<int> accepted;
+    for (int entry = first; entry < columns.count(); ++entry) {
+        if (acceptsEntry(entry)) {
+            accepted.append(entry);
+        }
+    }
+    if (accepted.isEmpty()) {
+        return;
+    }
+    // до завершения обхода строки добавляются в конец, упорядочиваются после
+    beginInsertRows(QModelIndex(), rows.size(), rows.size() + accepted.size() - 1);
+    rows += accepted;
+    endInsertRows();
+}
+
+void ImageListModel::finishLoading()
+{
+    qInfo() << "Loading Image List finished: " << columns.count() << "images";
+    // хранилище имен больше не растет - отдаем запас, оставленный для роста
+    columns.nameArena.squeeze();
+    // пачки упорядочены по отдельности; упорядочиваем всю модель, сохраняя
+    // постоянные индексы (текущий элемент, выделение)
+    updateRows();
+    emit loadingFinished();
+    startMetadataLoading();
+    startEntryOrderBuilding();
+}
+
+void ImageListModel::scheduleRescan()
+{
+    // поток уведомлений не откладывает обход бесконечно: таймер не перезапускается
+    if (!rescanDelayTimer->isActive()) {
+        rescanDelayTimer->start();
+    }
+}
+
+void ImageListModel::startRescan()
+{
+    // отличия считаются от полного списка, поэтому обход ждет
+    // завершения первой загрузки и предыдущего повторного обхода
+    if (directoryScanner->isRunning() || directoryRescanner->isRunning() || directoryPath.isEmpty()) {
+        if (!directoryPath.isEmpty()) {
+            rescanDelayTimer->start();
+        }
+        return;
+    }
+    rescannedImageList.clear();
+    directoryRescanner->start(directoryPath, imageNameFilter);
+}
+
+void ImageListModel::finishCatalogScan(const CatalogScanResult& result)
+{
+    catalogDirectories = result.directories;
+    if (catalogIndexLoaded) {
+        qInfo() << "Catalog rescan finished: " << result.scannedDirectories.size() << "of"
+                << result.directories.size() << "directories changed," << result.removedDirectories.size() << "removed";
+        // файлы модели до этого момента не менялись: номера файлов индекса
+        // в итоге обхода - это номера файлов модели
+        applyEntryChanges(result.addedEntries, result.changedFiles, result.changedFileSizes,
+            result.changedModificationTimes, result.removedFiles);
+        emit loadingFinished();
+        startMetadataLoading();
+        startEntryOrderBuilding();
+    } else {
+        finishLoading();
+    }
+    // иначе индекс сохранится вместе с прочитанными сведениями из заголовков
+    if (!metadataScanner->isRunning()) {
+        saveCatalogIndex();
+    }
+}
+
+void ImageListModel::saveCatalogIndex()
+{
+    // поток интерфейса не ждет предыдущую запись: индекс сохранится заново
+    // по ее завершении, уже с текущим содержимым модели
+    if (catalogIndexSaving) {
+        catalogIndexSavePending = true;
+        return;
+    }
+    catalogIndexSaving = true;
+    catalogIndexSavePending = false;
+    // снимок массивов разделяется с моделью неявно, файл заменяется атомарно
+    Columns snapshot = columns;
+    QHash<QString, qint64> directories = catalogDirectories;
+    QString indexPath = catalogIndexPath;
+    catalogIndexFuture = QtConcurrent::run([this, snapshot, directories, indexPath] {
+        TRACE_SCOPE("catalog.save");
+        QVector<CatalogIndexFile> files;
+        files.reserve(snapshot.count());
+        for (int entry = 0; entry < snapshot.count(); ++entry) {
+            quint8 flags = snapshot.flags.at(entry);
+            if (flags & entryRemoved) {
+                continue;
+            }
+            files.append(CatalogIndexFile{ snapshot.name(entry), snapshot.fileSizes.at(entry), snapshot.modificationTimes.at(entry),
+                snapshot.captureTimes.at(entry), snapshot.imageSizes.at(entry), (flags & entryMetadataLoaded) != 0 });
+        }
+        CatalogIndex::write(indexPath, directories, files);
+        QMetaObject::invokeMethod(this, [this] {
+            catalogIndexSaving = false;
+            if (catalogIndexSavePending) {
+                saveCatalogIndex();
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ImageListModel::appendRescannedImages(const QFileInfoList& entries)
+{
+    rescannedImageList.append(entries);
+}
+
+void ImageListModel::finishRescan()
+{
+    QFileInfoList entries;
+    entries.swap(rescannedImageList);
+    if (applyScannedEntries(entries)) {
+        startMetadataLoading();
+        startEntryOrderBuilding();
+    }
+}
+
+bool ImageListModel::applyScannedEntries(const QFileInfoList& entries)
+{
+    QHash<QStringRef, int> entriesByName;
+    entriesByName.reserve(columns.count() - removedEntryCount);
+    for (int entry = 0; entry < columns.count(); ++entry) {
+        if (!(columns.flags.at(entry) & entryRemoved)) {
+            entriesByName.insert(columns.name(entry), entry);
+        }
+    }
+
+    QVector<bool> found(columns.count(), false);
+    QFileInfoList addedEntries;
+    QVector<int> changedEntries;
+    QVector<qint64> changedFileSizes;
+    QVector<qint64> changedModificationTimes;
+    for (const QFileInfo& info : entries) {
+        QString name = entryName(info);
+        auto it = entriesByName.constFind(QStringRef(&name));
+        if (it == entriesByName.constEnd()) {
+            addedEntries.append(info);
+            continue;
+        }
+        int entry = it.value();
+        found[entry] = true;
+        qint64 size = info.size();
+        qint64 modificationTime = info.lastModified().toMSecsSinceEpoch();
+        if (size != columns.fileSizes.at(entry) || modificationTime != columns.modificationTimes.at(entry)) {
+            changedEntries.append(entry);
+            changedFileSizes.append(size);
+            changedModificationTimes.append(modificationTime);
+        }
+    }
+    entriesByName.clear();
+    QVector<int> removedEntries;
+    for (int entry = 0; entry < found.size(); ++entry) {
+        if (!found.at(entry) && !(columns.flags.at(entry) & entryRemoved)) {
+            removedEntries.append(entry);
+        }
+    }
+    return applyEntryChanges(addedEntries, changedEntries, changedFileSizes, changedModificationTimes, removedEntries);
+}
+
+bool ImageListModel::applyEntryChanges(const QFileInfoList& addedEntries, const QVector<int>& changedEntries,
+    const QVector<qint64>& changedFileSizes, const QVector<qint64>& changedModificationTimes, const QVector<int>& removedEntries)
+{
+    if (addedEntries.isEmpty() && removedEntries.isEmpty() && changedEntries.isEmpty()) {
+        return false;
+    }
+    qInfo() << "Directory" << directoryPath << "changed:" << addedEntries.size() << "added,"
+            << removedEntries.size() << "removed," << changedEntries.size() << "changed";
+    // эскизы сбрасываются по идентификаторам до удаления строк: удаление строки
+    // само по себе означает и скрытие фильтром, после которого эскиз остается верным
+    QSet<quint32> invalidatedImageIds;
+    for (int entry : removedEntries) {
+        invalidatedImageIds.insert(columns.imageIds.at(entry));
+    }
+    for (int entry : changedEntries) {
+        invalidatedImageIds.insert(columns.imageIds.at(entry));
+    }
+    if (!invalidatedImageIds.isEmpty()) {
+        emit imagesInvalidated(invalidatedImageIds);
+    }
+
+    // перестановки обновляются слиянием: измененные и удаленные файлы
+    // убираются из них, измененные и добавленные - вставляются на свои места
+    entryOrder(currentSortKey);
+    QVector<bool> reordered(columns.count(), false);
+    for (int entry : removedEntries) {
+        columns.flags[entry] |= entryRemoved;
+        reordered[entry] = true;
+    }
+    removedEntryCount += removedEntries.size();
+    for (int entry : changedEntries) {
+        reordered[entry] = true;
+    }
+    for (QVector<int>& order : entryOrders) {
+        order.erase(std::remove_if(order.begin(), order.end(), [&reordered](int entry) {
+            return reordered.at(entry);
+        }), order.end());
+    }
+
+    // измененные файлы: строки остаются прежними, вид только перерисовывает их
+    QVector<int> rowOfEntry(columns.count(), -1);
+    for (int row = 0; row < rows.size(); ++row) {
+        rowOfEntry[rows.at(row)] = row;
+    }
+    QVector<int> changedRows;
+    for (int i = 0; i < changedEntries.size(); ++i) {
+        int entry = changedEntries.at(i);
+        columns.fileSizes[entry] = changedFileSizes.at(i);
+        columns.modificationTimes[entry] = changedModificationTimes.at(i);
+        columns.flags[entry] &= ~entryMetadataLoaded;
+        if (rowOfEntry.at(entry) >= 0) {
+            changedRows.append(rowOfEntry.at(entry));
+        }
+    }
+    std::sort(changedRows.begin(), changedRows.end());
+    for (int first = 0; first < changedRows.size();) {
+        int last = first;
+        while (last + 1 < changedRows.size() && changedRows.at(last + 1) == changedRows.at(last) + 1) {
+            ++last;
+        }
+        emit dataChanged(index(changedRows.at(first), 0), index(changedRows.at(last), 0), { FileSizeRole, LastModifiedRole });
+        first = last + 1;
+    }
+
+    mergeEntryOrders(changedEntries);
+    appendEntries(addedEntries);
+    // удаления, перемещения измененных и вставки - диапазонами строк
+    updateRows();
+    if (removedEntryCount > columns.count() / 2) {
+        compactEntries();
+    }
+    return true;
+}
+
+void ImageListModel::applyMetadata(const QVector<ImageMetadata>& metadata)
+{
+    QVector<int> changedEntries;
+    for (const ImageMetadata& item : metadata) {
+        // идентификаторы в columns возрастают: файлы только добавляются в конец
+        auto it = std::lower_bound(columns.imageIds.constBegin(), columns.imageIds.constEnd(), item.imageId);
+        if (it == columns.imageIds.constEnd() || *it != item.imageId) {
+            continue;
+        }
+        int entry = int(it - columns.imageIds.constBegin());
+        columns.flags[entry] |= entryMetadataLoaded;
+        if (columns.imageSizes.at(entry) == item.imageSize && columns.captureTimes.at(entry) == item.captureTime) {
+            continue;
+        }
+        columns.imageSizes[entry] = item.imageSize;
+        columns.captureTimes[entry] = item.captureTime;
+        changedEntries.append(entry);
+    }
+    if (changedEntries.isEmpty()) {
+        return;
+    }
+    // перестановки по сведениям из заголовков не удаляются: пока они вычисляются
+    // в фоне заново (после завершения чтения), смена сортировки использует прежние
+    for (SortKey key : sortKeys) {
+        if (dependsOnMetadata(key) && entryOrders.contains(key)) {
+            staleEntryOrderKeys.insert(key);
+        }
+    }
+    ++metadataGeneration;
+    // dataChanged - только диапазонами строк изменившихся файлов
+    QVector<bool> changed(columns.count(), false);
+    for (int entry : changedEntries) {
+        changed[entry] = true;
+    }
+    for (int first = 0; first < rows.size(); ++first) {
+        if (!changed.at(rows.at(first))) {
+            continue;
+        }
+        int last = first;
+        while (last + 1 < rows.size() && changed.at(rows.at(last + 1))) {
+            ++last;
+        }
+        emit dataChanged(index(first, 0), index(last, 0), { CaptureTimeRole, ImageSizeRole });
+        first = last;
+    }
+}
+
+void ImageListModel::finishMetadataLoading()
+{
+    qInfo() << "Loading Image Metadata finished";
+    // перестановки по сведениям из заголовков вычисляются в фоне; если по ним
+    // упорядочен список, строки переставятся, когда перестановка будет готова
+    startEntryOrderBuilding();
+    if (catalog) {
+        saveCatalogIndex();
+    }
+    emit metadataLoadingFinished();
+}
+
+QString ImageListModel::entryName(const QFileInfo& entry) const
+{
+    // в каталоге файлы хранятся с путем подкаталога относительно корня
+    return catalog ? entry.filePath().mid(directoryPath.size()) : entry.fileName();
+}
+
 int ImageListModel::rowCount(const QModelIndex& parent) const
 {
-    return parent.isValid() ? 0 : imageFileInfoList.size();
+    return parent.isValid() ? 0 : rows.size();
 }
 
 int ImageListModel::columnCount(const QModelIndex& parent) const
@@ -35,8 +1013,25 @@ int ImageListModel::columnCount(const QModelIndex& parent) const
 QVariant ImageListModel::data(const QModelIndex& index, int role) const
 {
     if (index.isValid()) {
-        if (role == Qt::DisplayRole) {
-            return imageFileInfoList[index.row()].absoluteFilePath();
+        int entry = rows[index.row()];
+        switch (role) {
+        case Qt::DisplayRole:
+            return filePath(index.row());
+        case ImageIdRole:
+            return columns.imageIds[entry];
+        case FileSizeRole:
+            return columns.fileSizes[entry];
+        case LastModifiedRole:
+            return QDateTime::fromMSecsSinceEpoch(columns.modificationTimes[entry]);
+        case CaptureTimeRole:
+            if (columns.captureTimes[entry] == ImageMetadata::noCaptureTime) {
+                return QDateTime();
+            }
+            return QDateTime::fromMSecsSinceEpoch(columns.captureTimes[entry]);
+        case ImageSizeRole:
+            return columns.imageSizes[entry];
+        case AnimatedRole:
+            return columns.name(entry).endsWith(QLatin1String(".gif"), Qt::CaseInsensitive);
         }
     }
     return QVariant();
@@ -3,24 +3,234 @@
 
 #include <QAbstractTableModel>
 #include <QFileInfoList>
+#include <QFuture>
+#include <QHash>
 #include <QList>
+#include <QSet>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QStringRef>
+#include <QVector>
+
+#include <atomic>
+#include <limits>
+#include <memory>
+
+class CatalogIndex;
+class CatalogScanner;
+class DirectoryScanner;
+class DirectoryWatcher;
+class MetadataScanner;
+class QTimer;
+struct CatalogScanResult;
+struct ImageMetadata;
+
+/**
+ * @brief The ImageListFilter struct
+ * Условия отбора строк модели; пустое условие пропускает все файлы
+ */
+struct ImageListFilter {
+    /**
+     * @brief suffixes допустимые расширения файлов без точки (без учета регистра)
+     * или пустой список, если отбор по расширению не нужен
+     */
+    QStringList suffixes;
+    qint64 minimumFileSize = 0;
+    qint64 maximumFileSize = std::numeric_limits<qint64>::max();
+    /**
+     * @brief nameSubstring подстрока имени файла (без учета регистра)
+     */
+    QString nameSubstring;
+};
 
 /**
  * @brief The ImageListModel class
- * ImageListModel - класс модели, содержащей список имен файлов изображений
+ * ImageListModel - класс модели, содержащей список имен файлов изображений.
+ * Файлы хранятся компактно: общий путь каталога, имена файлов подряд в одной
+ * строке-хранилище и отдельные массивы смещений, размеров, времен изменения и
+ * сведений из заголовков. Строки модели - это отобранные фильтром файлы в порядке
+ * сортировки; перестановки файлов по каждому ключу сортировки вычисляются в фоне
+ * и переиспользуются, поэтому смена сортировки не требует ни обхода каталога,
+ * ни сортировки на потоке интерфейса.
+ * Каждый файл получает постоянный идентификатор (ImageIdRole), по которому
+ * вид и кеши находят эскизы, не собирая строку пути.
+ * Загруженный каталог отслеживается DirectoryWatcher, включая запись в уже
+ * существующие файлы: изменения, накопившиеся за интервал
+ * объединения, находятся повторным обходом каталога и применяются к модели
+ * пачками rowsInserted/rowsRemoved/dataChanged без сброса модели.
+ * В режиме каталога модель содержит изображения всего дерева подкаталогов;
+ * имена файлов тогда хранятся с путем подкаталога относительно корня.
  */
 class ImageListModel : public QAbstractTableModel {
     Q_OBJECT
 public:
+    /**
+     * @brief The ItemDataRole enum
+     * Роли данных модели помимо Qt::DisplayRole (полный путь файла)
+     */
+    enum ItemDataRole {
+        /**
+         * @brief ImageIdRole постоянный идентификатор изображения (quint32): не меняется
+         * при переупорядочивании строк и не повторяется при загрузке другого каталога
+         */
+        ImageIdRole = Qt::UserRole,
+        /**
+         * @brief FileSizeRole размер файла в байтах (qint64)
+         */
+        FileSizeRole,
+        /**
+         * @brief LastModifiedRole время последнего изменения файла (QDateTime)
+         */
+        LastModifiedRole,
+        /**
+         * @brief CaptureTimeRole дата съемки EXIF (QDateTime, недействительная,
+         * если она не указана или еще не прочитана)
+         */
+        CaptureTimeRole,
+        /**
+         * @brief ImageSizeRole размер изображения в пикселях с учетом ориентации
+         * (QSize, недействительный, если он еще не прочитан)
+         */
+        ImageSizeRole,
+        /**
+         * @brief AnimatedRole может ли файл быть анимированным (bool, true для GIF);
+         * проверяется по имени без сборки полного пути
+         */
+        AnimatedRole
+    };
+
+    /**
+     * @brief The SortKey enum
+     * Ключи сортировки; при равенстве ключа файлы упорядочиваются по имени
+     */
+    enum SortKey {
+        SortByName,
+        SortByModificationTime,
+        SortByFileSize,
+        /**
+         * @brief SortByCaptureTime по дате съемки, а для файлов без нее - по времени изменения
+         */
+        SortByCaptureTime,
+        /**
+         * @brief SortByImageSize по числу пикселей изображения
+         */
+        SortByImageSize
+    };
+
     ImageListModel(QObject* parent = Q_NULLPTR);
+    ~ImageListModel();
 
     // ImageListModel interface
 public:
     /**
-     * @brief loadDirectoryImageList
+     * @brief imageNameFilters возвращает маски имен файлов изображений, которые показывает модель
+     * @return список масок
+     */
+    static QStringList imageNameFilters();
+    /**
+     * @brief loadDirectoryImageList запускает фоновую загрузку списка изображений
+     * каталога fullPath, отменяя текущую. Строки добавляются в модель пачками
+     * по мере обхода каталога. Затем каталог отслеживается до загрузки другого.
      * @param fullPath
      */
     bool loadDirectoryImageList(const QString& fullPath);
+    /**
+     * @brief loadCatalog загружает изображения всего дерева подкаталогов rootPath,
+     * отменяя текущую загрузку. Если для rootPath сохранен индекс, строки
+     * появляются сразу из него, а затем в фоне заново читаются только изменившиеся
+     * подкаталоги. Индекс сохраняется после обхода и после чтения сведений из заголовков.
+     * Изменения дерева отслеживаются только при следующей загрузке каталога.
+     * @param rootPath
+     */
+    bool loadCatalog(const QString& rootPath);
+    /**
+     * @brief isCatalog проверяет, загружен ли каталог (дерево подкаталогов)
+     * @return true, если модель загружена loadCatalog()
+     */
+    bool isCatalog() const;
+    /**
+     * @brief isLoading проверяет, выполняется ли загрузка списка изображений
+     * @return true, если обход каталога еще не завершен
+     */
+    bool isLoading() const;
+    /**
+     * @brief isMetadataLoading проверяет, выполняется ли чтение размеров и дат съемки
+     * @return true, если сведения о части файлов еще не прочитаны
+     */
+    bool isMetadataLoading() const;
+    /**
+     * @brief sortKey возвращает текущий ключ сортировки
+     * @return ключ сортировки
+     */
+    SortKey sortKey() const;
+    /**
+     * @brief sortOrder возвращает текущее направление сортировки
+     * @return направление сортировки
+     */
+    Qt::SortOrder sortOrder() const;
+    /**
+     * @brief setSorting упорядочивает строки по ключу key с сохранением постоянных
+     * индексов. Если перестановка для ключа уже вычислена, это занимает время
+     * одного прохода по строкам.
+     * @param key
+     * @param order
+     */
+    void setSorting(SortKey key, Qt::SortOrder order = Qt::AscendingOrder);
+    /**
+     * @brief filter возвращает текущие условия отбора строк
+     * @return условия отбора
+     */
+    ImageListFilter filter() const;
+    /**
+     * @brief setFilter отбирает строки по условию filter. Скрытые и показанные
+     * строки удаляются и добавляются диапазонами, при большом числе разрозненных
+     * диапазонов модель сбрасывается.
+     * @param filter
+     */
+    void setFilter(const ImageListFilter& filter);
+    /**
+     * @brief imageId возвращает постоянный идентификатор изображения строки row
+     * @param row
+     * @return идентификатор изображения
+     */
+    quint32 imageId(int row) const;
+    /**
+     * @brief fileName возвращает имя файла строки row без пути каталога
+     * @param row
+     * @return ссылка на имя в хранилище имен, действительная до изменения модели
+     */
+    QStringRef fileName(int row) const;
+    /**
+     * @brief filePath возвращает полный путь файла строки row
+     * @param row
+     * @return полный путь файла
+     */
+    QString filePath(int row) const;
+
+signals:
+    /**
+     * @brief loadingFinished сообщает о завершении загрузки списка изображений
+     */
+    void loadingFinished();
+    /**
+     * @brief metadataLoadingFinished сообщает о том, что прочитаны размеры
+     * и даты съемки всех файлов
+     */
+    void metadataLoadingFinished();
+    /**
+     * @brief imagesInvalidated сообщает, что файлы изображений imageIds изменились
+     * или удалены, включая скрытые фильтром; строки, скрытые фильтром, удаляются
+     * из модели без этого сигнала, и их эскизы остаются верными
+     * @param imageIds
+     */
+    void imagesInvalidated(const QSet<quint32>& imageIds);
+    /**
+     * @brief imageListReplaced сообщает, что загружен другой каталог или тот же
+     * каталог заново; идентификаторы прежних изображений больше не встретятся.
+     * Посылается до завершения сброса модели
+     */
+    void imageListReplaced();
 
     // QAbstractItemModel interface
 public:
@@ -44,6 +254,127 @@ public:
      */
     virtual QVariant data(const QModelIndex& index, int role) const override;
 
+private slots:
+    /**
+     * @brief appendImages добавляет в конец модели очередную пачку найденных файлов
+     * @param entries
+     */
+    void appendImages(const QFileInfoList& entries);
+    /**
+     * @brief finishLoading упорядочивает модель после завершения обхода
+     * и запускает чтение сведений о файлах
+     */
+    void finishLoading();
+    /**
+     * @brief scheduleRescan откладывает повторный обход каталога после его изменения,
+     * объединяя все изменения за интервал в один обход
+     */
+    void scheduleRescan();
+    /**
+     * @brief startRescan запускает повторный обход каталога, если не выполняется другой
+     */
+    void startRescan();
+    /**
+     * @brief appendRescannedImages накапливает очередную пачку повторного обхода
+     * @param entries
+     */
+    void appendRescannedImages(const QFileInfoList& entries);
+    /**
+     * @brief finishRescan применяет к модели отличия результата повторного обхода
+     */
+    void finishRescan();
+    /**
+     * @brief finishCatalogScan применяет к модели результат обхода каталога и сохраняет индекс
+     * @param result
+     */
+    void finishCatalogScan(const CatalogScanResult& result);
+    /**
+     * @brief applyMetadata сохраняет очередную пачку прочитанных сведений о файлах
+     * @param metadata
+     */
+    void applyMetadata(const QVector<ImageMetadata>& metadata);
+    /**
+     * @brief finishMetadataLoading упорядочивает строки, если текущий ключ
+     * сортировки зависит от прочитанных сведений
+     */
+    void finishMetadataLoading();
+
+public:
+    /**
+     * @brief The Columns struct
+     * Сведения о файлах, по массиву на каждое поле. Файл (элемент массивов) не
+     * совпадает со строкой модели: строки - это отобранные и упорядоченные файлы.
+     * Массивы разделяются неявно, поэтому снимок для фоновой сортировки не копирует данные.
+     */
+    struct Columns {
+        QString nameArena;
+        QVector<int> nameOffsets;
+        QVector<int> nameLengths;
+        /**
+         * @brief imageIds идентификаторы изображений, по возрастанию
+         */
+        QVector<quint32> imageIds;
+        QVector<qint64> fileSizes;
+        /**
+         * @brief modificationTimes время изменения в миллисекундах от начала эпохи
+         */
+        QVector<qint64> modificationTimes;
+        /**
+         * @brief captureTimes дата съемки в миллисекундах от начала эпохи
+         * или ImageMetadata::noCaptureTime
+         */
+        QVector<qint64> captureTimes;
+        QVector<QSize> imageSizes;
+        /**
+         * @brief flags признаки файла: удален, сведения из заголовков прочитаны
+         */
+        QVector<quint8> flags;
+
+        int count() const;
+        QStringRef name(int entry) const;
+    };
+
+private:
+    void clear();
+    int appendEntries(const QFileInfoList& entries);
+    void appendIndexEntries(const CatalogIndex& index);
+    QString entryName(const QFileInfo& entry) const;
+    /**
+     * @brief applyScannedEntries применяет отличия файлов entries повторного обхода
+     * каталога от модели: добавляет новые, обновляет изменившиеся и удаляет
+     * файлы, которых нет в entries
+     * @param entries
+     * @return true, если модель изменилась
+     */
+    bool applyScannedEntries(const QFileInfoList& entries);
+    /**
+     * @brief applyEntryChanges добавляет файлы addedEntries, обновляет размеры и времена
+     * изменения файлов changedEntries и удаляет файлы removedEntries
+     * @param addedEntries
+     * @param changedEntries
+     * @param changedFileSizes
+     * @param changedModificationTimes
+     * @param removedEntries
+     * @return true, если модель изменилась
+     */
+    bool applyEntryChanges(const QFileInfoList& addedEntries, const QVector<int>& changedEntries,
+        const QVector<qint64>& changedFileSizes, const QVector<qint64>& changedModificationTimes, const QVector<int>& removedEntries);
+    void compactEntries();
+    bool acceptsEntry(int entry) const;
+    const QVector<int>& entryOrder(SortKey key);
+    /**
+     * @brief mergeEntryOrders вставляет файлы entries во все вычисленные перестановки
+     * @param entries файлы, которых еще нет в перестановках
+     */
+    void mergeEntryOrders(const QVector<int>& entries);
+    QVector<int> filteredRows(const QVector<int>& order) const;
+    void updateRows();
+    void reorderRows(const QVector<int>& newRows);
+    void replaceRows(const QVector<int>& newRows);
+    void startEntryOrderBuilding();
+    void startMetadataLoading();
+    void saveCatalogIndex();
+
 private:
     /**
      * @brief imageNameFilter
@@ -51,10 +382,123 @@ private:
      */
     QStringList imageNameFilter;
     /**
-     * @brief imageFileInfoList
-     * Список файлов
+     * @brief directoryPath путь каталога с завершающим разделителем, общий для всех файлов
+     */
+    QString directoryPath;
+    /**
+     * @brief columns сведения обо всех файлах каталога, включая скрытые фильтром
+     */
+    Columns columns;
+    /**
+     * @brief removedEntryCount число файлов columns, помеченных удаленными
+     */
+    int removedEntryCount = 0;
+    /**
+     * @brief rows номера файлов columns в порядке строк модели
+     */
+    QVector<int> rows;
+    /**
+     * @brief entryOrders вычисленные перестановки всех неудаленных файлов
+     * по возрастанию каждого ключа сортировки
+     */
+    QHash<int, QVector<int>> entryOrders;
+    /**
+     * @brief staleEntryOrderKeys ключи перестановок entryOrders, вычисленных до
+     * изменения сведений из заголовков; они используются, пока новые вычисляются в фоне
+     */
+    QSet<int> staleEntryOrderKeys;
+    /**
+     * @brief columnsGeneration номер версии списка файлов, их размеров и времен
+     * изменения; перестановки, вычисленные в фоне по устаревшему снимку, отбрасываются
+     */
+    quint64 columnsGeneration = 0;
+    /**
+     * @brief metadataGeneration номер версии сведений из заголовков файлов
+     */
+    quint64 metadataGeneration = 0;
+    /**
+     * @brief entryOrderFuture фоновое вычисление перестановок
+     */
+    QFuture<void> entryOrderFuture;
+    /**
+     * @brief supersededEntryOrderFutures отмененные вычисления перестановок, которые
+     * еще выполняются и могут обратиться к модели; деструктор дожидается и их
+     */
+    QList<QFuture<void>> supersededEntryOrderFutures;
+    /**
+     * @brief entryOrderCancelled признак отмены фонового вычисления перестановок
+     */
+    std::shared_ptr<std::atomic_bool> entryOrderCancelled;
+    /**
+     * @brief entryOrderBuilding выполняется фоновое вычисление перестановок
+     */
+    bool entryOrderBuilding = false;
+    /**
+     * @brief entryOrderBuildingPending перестановки нужно вычислить заново,
+     * когда завершится текущее вычисление
+     */
+    bool entryOrderBuildingPending = false;
+    SortKey currentSortKey = SortByName;
+    Qt::SortOrder currentSortOrder = Qt::AscendingOrder;
+    ImageListFilter currentFilter;
+    /**
+     * @brief nextImageId идентификатор, который получит следующее добавленное изображение
+     */
+    quint32 nextImageId = 1;
+    /**
+     * @brief directoryScanner фоновый обход каталога
+     */
+    DirectoryScanner* directoryScanner;
+    /**
+     * @brief directoryRescanner повторный обход отслеживаемого каталога
+     */
+    DirectoryScanner* directoryRescanner;
+    /**
+     * @brief rescannedImageList файлы, найденные текущим повторным обходом
+     */
+    QFileInfoList rescannedImageList;
+    /**
+     * @brief directoryWatcher уведомления об изменениях загруженного каталога
+     */
+    DirectoryWatcher* directoryWatcher;
+    /**
+     * @brief rescanDelayTimer таймер, объединяющий уведомления об изменениях
+     * в один повторный обход
+     */
+    QTimer* rescanDelayTimer;
+    /**
+     * @brief metadataScanner фоновое чтение размеров и дат съемки
+     */
+    MetadataScanner* metadataScanner;
+    /**
+     * @brief catalogScanner фоновый обход дерева каталога
+     */
+    CatalogScanner* catalogScanner;
+    /**
+     * @brief catalog загружен каталог (дерево подкаталогов), а не один каталог
+     */
+    bool catalog = false;
+    /**
+     * @brief catalogIndexLoaded строки каталога загружены из индекса
+     */
+    bool catalogIndexLoaded = false;
+    QString catalogIndexPath;
+    /**
+     * @brief catalogDirectories времена изменения подкаталогов последнего обхода каталога
+     */
+    QHash<QString, qint64> catalogDirectories;
+    /**
+     * @brief catalogIndexFuture фоновая запись индекса каталога
+     */
+    QFuture<void> catalogIndexFuture;
+    /**
+     * @brief catalogIndexSaving выполняется фоновая запись индекса
+     */
+    bool catalogIndexSaving = false;
+    /**
+     * @brief catalogIndexSavePending индекс нужно сохранить заново, когда завершится текущая запись
      */
-    QFileInfoList imageFileInfoList;
+    bool catalogIndexSavePending = false;
 };
 
 #endif // IMAGELISTMODEL_H
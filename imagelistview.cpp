@@ -1,21 +1,61 @@
 #include "imagelistview.h"
+#include "embeddedpreviewreader.h"
+#include "imagelistmodel.h"
+#include "logging.h"
+#include "thumbnaildecoder.h"
+#include "thumbnailstore.h"
+#include "tileanimator.h"
+#include "trace.h"
 
+#include <QGuiApplication>
 #include <QImage>
 #include <QPaintEvent>
+#include <QScreen>
+#include <QtMath>
 #include <QScrollBar>
 #include <QStylePainter>
-#include <QThread>
 #include <QTimer>
-#include <QtConcurrent>
-#include <QtDebug>
+#include <QWheelEvent>
+#include <QWindow>
+
+#include <limits>
+
+namespace {
+// приоритет упреждающей загрузки всегда ниже приоритета любой видимой плитки
+const int prefetchPriority = 1 << 24;
+// насколько вперед (в секундах) упреждающая загрузка следует за скоростью прокрутки
+const qreal prefetchLookahead = 0.5;
+// прокрутка, после которой прошло больше этого времени (мс), считается остановившейся
+const qint64 scrollIdleInterval = 200;
+// при прокрутке медленнее этой скорости (экранов в секунду) загрузка начинается сразу
+const qreal slowScrollVelocity = 2;
+// максимальная задержка планирования загрузки при быстрой прокрутке (мс)
+const int maxLoadingDelay = 100;
+// наибольшее значение полосы прокрутки; при большей высоте содержимого
+// значение полосы масштабируется в смещение содержимого
+const int maxScrollBarValue = 1 << 30;
+
+int clampedToInt(qint64 value)
+{
+    // координаты далеко за пределами видового окна сжимаются так, чтобы
+    // прямоугольник с ними оставался действительным
+    const qint64 limit = std::numeric_limits<int>::max() / 2;
+    return int(qBound(-limit, value, limit));
+}
+}
 
 ImageListView::ImageListView(QWidget* parent)
     : QAbstractItemView(parent)
     , m_columnCount{ 5 }
     , m_loadingDelayTimer{ new QTimer{ this } }
     , m_updatingDelayTimer{ new QTimer{ this } }
-    , m_imageCache(1)
+    , m_imageLoader{ new ImageLoader{ this } }
+    , m_tileAnimator{ new TileAnimator{ this } }
+    , m_imageCache{ 256 }
+    , m_thumbnailStore{ std::make_shared<ThumbnailStore>() }
 {
+    m_imageLoader->setThumbnailStore(m_thumbnailStore);
+    m_passTimer.start();
     horizontalScrollBar()->setRange(0, 0);
     verticalScrollBar()->setRange(0, 0);
     setSelectionMode(ExtendedSelection);
@@ -24,73 +64,107 @@ ImageListView::ImageListView(QWidget* parent)
     //  подписываемся на таймер отложенной загрузки
     m_loadingDelayTimer->setSingleShot(true);
     connect(m_loadingDelayTimer, &QTimer::timeout, [this] {
-        qDebug() << "Scroll Delay Timer Fired";
+        qCDebug(lcImageListView) << "Scroll Delay Timer Fired";
         startAsyncImageLoading();
     });
-    connect(&m_imageLoadingFutureWatcher,
-        &QFutureWatcherBase::progressRangeChanged, [](int min, int max) {
-            qDebug() << "progressRangeChanged(" << min << ", " << max << ")";
-        });
-    connect(&m_imageLoadingFutureWatcher,
-        &QFutureWatcherBase::progressValueChanged, [](int val) {
-            qDebug() << "progressValueChanged(" << val << ")";
-        });
-    connect(&m_imageLoadingFutureWatcher,
-        &QFutureWatcherBase::started, []() {
-            qDebug() << "started()";
-        });
-    connect(&m_imageLoadingFutureWatcher,
-        &QFutureWatcherBase::finished, []() {
-            qDebug() << "finished()";
-        });
-    connect(&m_imageLoadingFutureWatcher,
-        &QFutureWatcherBase::resultReadyAt,
-        [](int index) {
-            qDebug() << "resultReadyAt(" << index << ")";
-        });
     //  подписываемся на результат загрузки
-
-    connect(&m_imageLoadingFutureWatcher,
-        &QFutureWatcherBase::resultsReadyAt,
-        [this](int begin, int end) {
-            qDebug() << "resultsReadyAt: Background Loading for images [" << begin << ":" << end << ") finished";
-            for (int index = begin; index < end; ++index) {
-                auto item = m_imageLoadingFutureWatcher.resultAt(index);
-                m_invalidatingModelRows.append(item->row);
-                m_imageCache.insert(item->imageFileName, item->image.release());
-                qDebug() << "Loading" << item->imageFileName << "finished";
+    connect(m_imageLoader, &ImageLoader::imageLoaded, this, [this](const ImageLoadingTaskSharedPtr& task) {
+        qCDebug(lcImageListView) << "Loading" << task->imageFileName << "finished";
+        m_invalidatingImageIds.insert(task->imageId);
+        ImageCacheKey key{ task->imageId, task->level };
+        if (task->sketch) {
+            if (task->image.isNull()) {
+                m_sketchlessImageIds.insert(task->imageId);
+                return;
+            }
+            // набросок рисуется вместо эскиза через peekNearest(), пока тот не загружен;
+            // готовое изображение того же уровня он не заменяет
+            if (!m_imageCache.contains(key)) {
+                m_imageCache.insert(key, task->image);
+                finishPass(task->imageId, false);
             }
             if (!m_updatingDelayTimer->isActive())
-                m_updatingDelayTimer->start(250);
-        });
+                m_updatingDelayTimer->start(frameInterval());
+            return;
+        }
+        finishPass(task->imageId, true);
+        if (task->image.isNull()) {
+            // ошибка декодирования не зависит от уровня разрешения: плитка
+            // рисуется заглушкой и больше не загружается, пока файл не изменится
+            m_failedImageIds.insert(task->imageId);
+        } else if (!m_imageCache.contains(key)) {
+            TRACE_SCOPE("cache.insert");
+            m_imageCache.insert(key, task->image);
+            TRACE_COUNTER("cache.bytes", m_imageCache.totalCost());
+        }
+        // плитка, подготовленная для прежней геометрии, уже не нужна
+        updateTileGeometry();
+        if (!task->tileImage.isNull() && task->tileSize == m_tileSize
+            && qFuzzyCompare(task->devicePixelRatio, m_tileDevicePixelRatio)) {
+            TRACE_SCOPE("tile.insert");
+            int cost = qMax(1, int(task->tileImage.sizeInBytes() / 1024));
+            m_tileCache.insert(task->imageId, new QPixmap(QPixmap::fromImage(std::move(task->tileImage))), cost);
+        }
+        // перерисовки объединяются в пределах одного кадра дисплея
+        if (!m_updatingDelayTimer->isActive())
+            m_updatingDelayTimer->start(frameInterval());
+    });
+
+    //  смена кадров анимаций перерисовывает только их плитки
+    connect(m_tileAnimator, &TileAnimator::framesChanged, this, [this](const QVector<int>& rows) {
+        QRect viewportRect = viewport()->rect();
+        for (int row : rows) {
+            QRect rect = visualRect(model()->index(row, 0, rootIndex()));
+            if (viewportRect.intersects(rect)) {
+                viewport()->update(rect);
+            }
+        }
+    });
 
-    //
+    //  перерисовываем только плитки загруженных изображений, а не их общий
+    //  описывающий прямоугольник; Qt объединит их в одну перерисовку
     m_updatingDelayTimer->setSingleShot(true);
     connect(m_updatingDelayTimer, &QTimer::timeout, [this] {
-        qDebug() << "Update Delay Timer Fired";
-        QRect invalidatingRect;
-        for (auto&& row : m_invalidatingModelRows) {
-            auto rect = visualRect(model()->index(row, 0, rootIndex()));
-            invalidatingRect = invalidatingRect.united(rect);
-        }
-        if (viewport()->rect().intersects(invalidatingRect)) {
-            qDebug() << "Update the " << invalidatingRect << "region starting..";
-            viewport()->update(invalidatingRect);
+        qCDebug(lcImageListView) << "Update Delay Timer Fired";
+        TRACE_SCOPE("viewport.update");
+        TRACE_COUNTER("viewport.update.tiles", m_invalidatingImageIds.size());
+        // строка задачи могла устареть после вставки, удаления или сортировки,
+        // поэтому текущие строки загруженных изображений ищутся среди видимых
+        QRect viewportRect = viewport()->rect();
+        QPair<int, int> modelRowRange = modelRowRangeForViewportRect(viewportRect);
+        for (int row = modelRowRange.first; row < modelRowRange.second && !m_invalidatingImageIds.isEmpty(); ++row) {
+            QModelIndex index = model()->index(row, 0, rootIndex());
+            if (m_invalidatingImageIds.remove(imageId(index))) {
+                viewport()->update(visualRect(index));
+            }
         }
+        m_invalidatingImageIds.clear();
     });
 }
 
 void ImageListView::startScrollDelayTimer()
 {
-    qDebug() << "Scroll Delay Timer Restarted";
-    stopScrollDelayTimer();
-    m_loadingDelayTimer->start(250);
+    // текущая загрузка не прерывается: по таймеру загрузчик только
+    // получит новые приоритеты для изменившегося видового окна.
+    // Медленная прокрутка или ее отсутствие - загружаем в ближайшей итерации
+    // цикла событий; при быстрой - не чаще, чем раз в интервал, пропорциональный
+    // скорости, чтобы не планировать плитки, которые пролетят мимо.
+    // Уже запущенный таймер не перезапускается, чтобы непрерывная прокрутка
+    // не откладывала загрузку бесконечно.
+    if (m_loadingDelayTimer->isActive()) {
+        return;
+    }
+    qreal velocity = scrollVelocity();
+    int delay = 0;
+    if (velocity > slowScrollVelocity) {
+        delay = qMin(qRound(velocity * frameInterval()), maxLoadingDelay);
+    }
+    qCDebug(lcImageListView) << "Scroll Delay Timer Started:" << delay << "ms";
+    m_loadingDelayTimer->start(delay);
 }
 
 void ImageListView::stopScrollDelayTimer()
 {
-    m_updatingDelayTimer->stop();
-    stopAsyncImageLoading();
     m_loadingDelayTimer->stop();
 }
 
@@ -101,79 +175,437 @@ int ImageListView::columnCount() const
 
 void ImageListView::setColumnCount(int columnCount)
 {
-    qDebug() << "Image List View setColumnCount" << columnCount << "called";
+    qCDebug(lcImageListView) << "Image List View setColumnCount" << columnCount << "called";
     m_columnCount = columnCount;
-    reset();
+    // кеш не сбрасывается: пока эскизы нового размера загружаются,
+    // рисуются эскизы ближайшего имеющегося разрешения
+    scheduleDelayedItemsLayout();
+}
+
+int ImageListView::cacheMemoryBudget() const
+{
+    return m_imageCache.memoryBudget();
 }
 
-QPair<int, int> ImageListView::modelRowRangeForViewportRect(const QRect& rect)
+void ImageListView::setCacheMemoryBudget(int megabytes)
 {
+    m_imageCache.setMemoryBudget(megabytes);
+}
+
+ImageCacheStatistics ImageListView::cacheStatistics() const
+{
+    return m_imageCache.statistics();
+}
+
+int ImageListView::prefetchScreensAhead() const
+{
+    return m_prefetchScreensAhead;
+}
+
+int ImageListView::prefetchScreensBehind() const
+{
+    return m_prefetchScreensBehind;
+}
+
+void ImageListView::setPrefetchScreens(int ahead, int behind)
+{
+    m_prefetchScreensAhead = qMax(ahead, 0);
+    m_prefetchScreensBehind = qMax(behind, 0);
+}
+
+int ImageListView::loaderThreadCount(ImageLoader::Stage stage) const
+{
+    return m_imageLoader->threadCount(stage);
+}
+
+int ImageListView::loaderQueueDepth(ImageLoader::Stage stage) const
+{
+    return m_imageLoader->queueDepth(stage);
+}
+
+void ImageListView::setLoaderStage(ImageLoader::Stage stage, int threadCount, int queueDepth)
+{
+    m_imageLoader->setThreadCount(stage, threadCount);
+    m_imageLoader->setQueueDepth(stage, queueDepth);
+}
+
+ImageLoaderStatistics ImageListView::loaderStatistics() const
+{
+    return m_imageLoader->statistics();
+}
+
+void ImageListView::resetLoaderStatistics()
+{
+    m_imageLoader->resetStatistics();
+}
+
+std::shared_ptr<const ThumbnailStore> ImageListView::thumbnailStore() const
+{
+    return m_thumbnailStore;
+}
+
+void ImageListView::setThumbnailStore(std::shared_ptr<const ThumbnailStore> thumbnailStore)
+{
+    m_thumbnailStore = std::move(thumbnailStore);
+    m_imageLoader->setThumbnailStore(m_thumbnailStore);
+}
+
+QPair<int, int> ImageListView::modelRowRangeForViewportRect(const QRect& rect) const
+{
+    // диапазон вычисляется по геометрии сетки, без обращения к модели за индексами:
+    // в него входят все плитки строк сетки, которые пересекает rect
     QRect r = rect.normalized();
     int rowCount = model()->rowCount(rootIndex());
-    int begin = 0;
-    {
-        QModelIndex startIndex = indexAt(r.topLeft());
-        if (startIndex.isValid()) {
-            begin = startIndex.row();
+    int height = itemSize().height();
+    qint64 top = m_contentOffset + r.top();
+    qint64 bottom = m_contentOffset + r.bottom();
+    if (rowCount == 0 || height <= 0 || r.isEmpty() || bottom < 0) {
+        return QPair<int, int>(0, 0);
+    }
+    qint64 begin = qMax(top, qint64(0)) / height * m_columnCount;
+    qint64 end = (bottom / height + 1) * m_columnCount;
+    return QPair<int, int>(int(qMin(begin, qint64(rowCount))), int(qMin(end, qint64(rowCount))));
+}
+
+QVector<QRect> ImageListView::visualRectsForRowRange(int first, int last) const
+{
+    QVector<QRect> rects;
+    QSize size = itemSize();
+    if (first > last || size.isEmpty()) {
+        return rects;
+    }
+    // прямоугольник в координатах содержимого (64 бита) обрезается видовым
+    // окном до перевода в int
+    QRect viewportRect = viewport()->rect();
+    auto append = [&](int left, int right, qint64 firstLine, qint64 lastLine) {
+        qint64 top = qMax(firstLine * size.height() - m_contentOffset, qint64(viewportRect.top()));
+        qint64 bottom = qMin((lastLine + 1) * size.height() - m_contentOffset, qint64(viewportRect.bottom()) + 1);
+        if (top < bottom) {
+            rects.append(QRect(left * size.width() - horizontalOffset(), int(top), (right - left + 1) * size.width(), int(bottom - top)));
         }
+    };
+    qint64 firstLine = first / m_columnCount;
+    qint64 lastLine = last / m_columnCount;
+    int firstColumn = first % m_columnCount;
+    int lastColumn = last % m_columnCount;
+    if (firstLine == lastLine) {
+        append(firstColumn, lastColumn, firstLine, firstLine);
+        return rects;
     }
-    int end = begin;
-    {
-        QModelIndex finishIndex = indexAt(r.bottomRight());
-        if (finishIndex.isValid()) {
-            end = finishIndex.row() + 1;
-        } else {
-            end = rowCount;
+    append(firstColumn, m_columnCount - 1, firstLine, firstLine);
+    if (firstLine + 1 < lastLine) {
+        append(0, m_columnCount - 1, firstLine + 1, lastLine - 1);
+    }
+    append(0, lastColumn, lastLine, lastLine);
+    return rects;
+}
+
+QBitArray ImageListView::selectedRows(int first, int last) const
+{
+    QBitArray rows{ qMax(last - first, 0) };
+    if (rows.isEmpty() || !selectionModel()) {
+        return rows;
+    }
+    // QItemSelectionModel::isSelected() перебирает все диапазоны на каждый вызов;
+    // здесь каждый диапазон пересекается с видимыми строками один раз
+    const QItemSelection selection = selectionModel()->selection();
+    for (const QItemSelectionRange& range : selection) {
+        if (range.parent() != rootIndex() || range.left() > 0 || range.right() < 0) {
+            continue;
+        }
+        int top = qMax(range.top(), first);
+        int bottom = qMin(range.bottom(), last - 1);
+        if (top <= bottom) {
+            rows.fill(true, top - first, bottom - first + 1);
         }
     }
-    return QPair<int, int>(begin, end);
+    return rows;
 }
 
-void ImageListView::startAsyncImageLoading()
+qint64 ImageListView::contentOffset() const
 {
-    class ImageLoader {
-    public:
-        typedef ImageLoadingTaskSharedPtr result_type;
+    return m_contentOffset;
+}
 
-    public:
-        ImageLoadingTaskSharedPtr operator()(ImageLoadingTaskSharedPtr task)
-        {
-            if (!task->image) {
-                task->image = std::make_unique<QImage>();
-            }
-            if (task->image->isNull()) {
-                qDebug() << "ThreadId:" << QThread::currentThreadId() << "Loading" << task->imageFileName << "..";
-                if (!task->image->load(task->imageFileName)) {
-                    qWarning() << "Loading" << task->imageFileName << "failed";
-                }
-            }
-            return task;
+void ImageListView::setContentOffset(qint64 offset)
+{
+    offset = qBound(qint64(0), offset, maximumContentOffset());
+    if (offset == m_contentOffset) {
+        return;
+    }
+    qint64 oldOffset = m_contentOffset;
+    m_contentOffset = offset;
+    // полоса прокрутки только отражает смещение; при масштабе значение может не измениться
+    m_synchronizingScrollBar = true;
+    verticalScrollBar()->setValue(scrollBarValueForOffset(offset));
+    m_synchronizingScrollBar = false;
+    contentOffsetChanged(oldOffset);
+}
+
+QSize ImageListView::itemSize() const
+{
+    int width = viewport()->width() / m_columnCount;
+    return QSize(width, qMin(width, viewport()->height()));
+}
+
+qint64 ImageListView::maximumContentOffset() const
+{
+    return m_maximumContentOffset;
+}
+
+int ImageListView::scrollBarValueForOffset(qint64 offset) const
+{
+    qint64 maximum = maximumContentOffset();
+    if (maximum <= maxScrollBarValue) {
+        return int(offset);
+    }
+    return int(qRound64(qreal(offset) * maxScrollBarValue / maximum));
+}
+
+qint64 ImageListView::offsetForScrollBarValue(int value) const
+{
+    qint64 maximum = maximumContentOffset();
+    if (maximum <= maxScrollBarValue) {
+        return value;
+    }
+    // крайние положения полосы всегда соответствуют началу и концу содержимого
+    if (value >= verticalScrollBar()->maximum()) {
+        return maximum;
+    }
+    return qRound64(qreal(value) * maximum / maxScrollBarValue);
+}
+
+void ImageListView::contentOffsetChanged(qint64 oldOffset)
+{
+    qint64 delta = m_contentOffset - oldOffset;
+    if (qAbs(delta) < viewport()->height()) {
+        QAbstractItemView::scrollContentsBy(0, int(-delta));
+    } else {
+        viewport()->update();
+    }
+    // оцениваем направление и скорость прокрутки для упреждающей загрузки
+    if (delta) {
+        m_scrollDirection = delta > 0 ? 1 : -1;
+    }
+    qint64 elapsed = m_scrollTimer.isValid() ? m_scrollTimer.restart() : 0;
+    if (!m_scrollTimer.isValid()) {
+        m_scrollTimer.start();
+    }
+    if (elapsed <= 0 || elapsed > scrollIdleInterval) {
+        m_scrollVelocity = 0;
+    } else {
+        qreal screens = qreal(qAbs(delta)) / qMax(viewport()->height(), 1);
+        m_scrollVelocity = (m_scrollVelocity + screens * 1000 / elapsed) / 2;
+    }
+    startScrollDelayTimer();
+}
+
+void ImageListView::startAsyncImageLoading()
+{
+    if (!model()) {
+        return;
+    }
+    TRACE_SCOPE("schedule");
+    int rowCount = model()->rowCount(rootIndex());
+    QPair<int, int> modelRowRange = modelRowRangeForViewportRect(viewport()->rect());
+    updateTileGeometry();
+    int level = ThumbnailDecoder::resolutionLevel(m_tileSize * m_tileDevicePixelRatio);
+    QSize size = ThumbnailDecoder::levelSize(level);
+    QPoint viewportCenter = viewport()->rect().center();
+    QList<ImageLoadingTask> tasks;
+    QHash<quint32, PendingTile> pendingTiles;
+    auto appendTask = [&](int row, int priority, bool visible) {
+        QModelIndex index = model()->index(row, 0, rootIndex());
+        quint32 id = imageId(index);
+        if (m_tileCache.contains(id)) {
+            return;
+        }
+        // эскиз того же уровня разрешения декодировать не нужно, достаточно
+        // подготовить из него плитку; статистику кеша считаем только по видимым плиткам
+        if (m_failedImageIds.contains(id)) {
+            // декодирование этого файла уже завершилось ошибкой
+            return;
+        }
+        ImageCacheKey key{ id, level };
+        QImage image = visible ? m_imageCache.object(key) : m_imageCache.peek(key);
+        // путь файла собирается только для изображений, которые действительно загружаются
+        QString imageFileName = model()->data(index).toString();
+        tasks.append(ImageLoadingTask{ row, id, imageFileName, size, level, m_tileSize, m_tileDevicePixelRatio, priority, false, !visible, image, QImage() });
+        if (!visible || !image.isNull()) {
+            return;
+        }
+        pendingTiles.insert(id, m_pendingTiles.value(id, PendingTile{ m_passTimer.nsecsElapsed(), false }));
+        // видимой плитке, которую нечем нарисовать, сначала загружается набросок,
+        // если он может найтись в хранилище или во встроенном эскизе JPEG/RAW:
+        // его данные малы, а декодирование опережает декодирование всех эскизов
+        if (level > 0 && m_imageCache.peekNearest(id, level).isNull() && !m_sketchlessImageIds.contains(id)
+            && (m_thumbnailStore || EmbeddedPreviewReader::mayContainPreviews(imageFileName))) {
+            tasks.append(ImageLoadingTask{ row, id, imageFileName, ThumbnailDecoder::levelSize(0), 0, QSize(),
+                m_tileDevicePixelRatio, priority - prefetchPriority, true, false, QImage(), QImage() });
         }
     };
-    stopAsyncImageLoading();
-    QPair<int, int> modelRowRange = modelRowRangeForViewportRect(viewport()->rect());
-    QList<ImageLoadingTaskSharedPtr> viewportItems;
-    viewportItems.reserve(modelRowRange.second - modelRowRange.first);
     for (int row = modelRowRange.first; row < modelRowRange.second; ++row) {
+        // плитки ближе к центру видового окна загружаются раньше
+        QModelIndex index = model()->index(row, 0, rootIndex());
+        appendTask(row, (visualRect(index).center() - viewportCenter).manhattanLength(), true);
+    }
+    // плитки, ушедшие из видового окна, в счетчики проходов не попадают
+    m_pendingTiles.swap(pendingTiles);
+    // анимируются только видимые плитки
+    QVector<AnimatedTile> animatedTiles;
+    for (int row = modelRowRange.first; row < modelRowRange.second; ++row) {
+        // путь файла собирается только для анимированных плиток
         QModelIndex index = model()->index(row, 0, rootIndex());
-        QVariant imageFileNameVariant = model()->data(index);
-        QString imageFileName = imageFileNameVariant.toString();
-        ImageLoadingTask item{ row, imageFileName };
-        QImage* ptr = m_imageCache.take(imageFileName);
-        if (ptr) {
-            item.image.reset(ptr);
+        if (model()->data(index, ImageListModel::AnimatedRole).toBool()) {
+            animatedTiles.append(AnimatedTile{ row, imageId(index), model()->data(index).toString() });
         }
-        viewportItems << std::make_shared<ImageLoadingTask>(std::move(item));
     }
-    QFuture<ImageLoadingTaskSharedPtr> future = QtConcurrent::mapped(viewportItems, ImageLoader{});
-    m_imageLoadingFutureWatcher.setFuture(future);
+    m_tileAnimator->setTiles(animatedTiles, m_tileSize, m_tileDevicePixelRatio);
+
+    // кольцо упреждающей загрузки: впереди по направлению прокрутки окно расширяется
+    // со скоростью прокрутки, позади остается фиксированным
+    int visibleCount = modelRowRange.second - modelRowRange.first;
+    int screenCount = qMax(visibleCount, m_columnCount);
+    int aheadScreens = m_prefetchScreensAhead;
+    if (aheadScreens) {
+        aheadScreens = qMin(aheadScreens + qCeil(scrollVelocity() * prefetchLookahead), aheadScreens * 4);
+    }
+    int aheadCount = aheadScreens * screenCount;
+    int behindCount = m_prefetchScreensBehind * screenCount;
+    // упреждающая загрузка не должна вытеснять сама себя: новые эскизы попадают в
+    // очередь новых изображений кеша, объем которой ограничен probationCapacity()
+    qint64 tileBytes = qint64(size.width()) * size.height() * 4;
+    qint64 prefetchBudget = m_imageCache.probationCapacity() / qMax(tileBytes, qint64(1)) - visibleCount;
+    prefetchBudget = qMax(prefetchBudget, qint64(0));
+    aheadCount = static_cast<int>(qMin(qint64(aheadCount), prefetchBudget));
+    behindCount = static_cast<int>(qMin(qint64(behindCount), prefetchBudget - aheadCount));
+    // готовых плиток держим столько, чтобы хватило на все кольцо упреждающей загрузки
+    int tileCost = qMax(1, int(qint64(m_tileSize.width()) * m_tileSize.height() * 4
+                                   * m_tileDevicePixelRatio * m_tileDevicePixelRatio / 1024));
+    m_tileCache.setMaxCost(qMax(1, (visibleCount + aheadCount + behindCount) * tileCost));
+    for (int distance = 0; distance < qMax(aheadCount, behindCount); ++distance) {
+        int aheadRow = m_scrollDirection > 0 ? modelRowRange.second + distance : modelRowRange.first - 1 - distance;
+        int behindRow = m_scrollDirection > 0 ? modelRowRange.first - 1 - distance : modelRowRange.second + distance;
+        if (distance < aheadCount && aheadRow >= 0 && aheadRow < rowCount) {
+            appendTask(aheadRow, prefetchPriority + distance, false);
+        }
+        if (distance < behindCount && behindRow >= 0 && behindRow < rowCount) {
+            appendTask(behindRow, prefetchPriority + distance * 2 + 1, false);
+        }
+    }
+    m_imageLoader->schedule(tasks);
+    TRACE_COUNTER("schedule.tasks", tasks.size());
 }
 
 void ImageListView::stopAsyncImageLoading()
 {
-    qDebug() << "Canceling Background Loading...";
-    m_imageLoadingFutureWatcher.cancel();
-    qDebug() << "Background Loading Canceled";
+    qCDebug(lcImageListView) << "Canceling Background Loading...";
+    m_imageLoader->cancelAll();
+    m_tileAnimator->setTiles(QVector<AnimatedTile>(), m_tileSize, m_tileDevicePixelRatio);
+    qCDebug(lcImageListView) << "Background Loading Canceled";
+}
+
+int ImageListView::frameInterval() const
+{
+    QWindow* window = this->window()->windowHandle();
+    QScreen* screen = window ? window->screen() : QGuiApplication::primaryScreen();
+    qreal refreshRate = screen ? screen->refreshRate() : 60;
+    return qMax(1, qRound(1000 / qMax(refreshRate, qreal(1))));
+}
+
+void ImageListView::updateTileGeometry()
+{
+    QSize tileSize = thumbnailSize();
+    qreal devicePixelRatio = devicePixelRatioF();
+    if (tileSize != m_tileSize || !qFuzzyCompare(devicePixelRatio, m_tileDevicePixelRatio)) {
+        m_tileCache.clear();
+        m_tileSize = tileSize;
+        m_tileDevicePixelRatio = devicePixelRatio;
+    }
+}
+
+PaintStatistics ImageListView::paintStatistics() const
+{
+    return m_paintStatistics;
+}
+
+void ImageListView::resetPaintStatistics()
+{
+    m_paintStatistics = PaintStatistics{};
+}
+
+PassStatistics ImageListView::passStatistics() const
+{
+    return m_passStatistics;
+}
+
+void ImageListView::resetPassStatistics()
+{
+    m_passStatistics = PassStatistics{};
+}
+
+void ImageListView::finishPass(quint32 imageId, bool final)
+{
+    auto pending = m_pendingTiles.find(imageId);
+    if (pending == m_pendingTiles.end()) {
+        return;
+    }
+    qint64 elapsed = m_passTimer.nsecsElapsed() - pending->requested;
+    if (!pending->firstPassDone) {
+        pending->firstPassDone = true;
+        ++m_passStatistics.firstPassCount;
+        m_passStatistics.firstPassNanoseconds += elapsed;
+        TRACE_HISTOGRAM("pass.first.us", elapsed / 1000);
+    }
+    if (final) {
+        ++m_passStatistics.finalPassCount;
+        m_passStatistics.finalPassNanoseconds += elapsed;
+        TRACE_HISTOGRAM("pass.final.us", elapsed / 1000);
+        m_pendingTiles.erase(pending);
+    }
+}
+
+bool ImageListView::isViewportFilled() const
+{
+    if (!model()) {
+        return false;
+    }
+    if (thumbnailSize() != m_tileSize || !qFuzzyCompare(devicePixelRatioF(), m_tileDevicePixelRatio)) {
+        return false;
+    }
+    int level = ThumbnailDecoder::resolutionLevel(m_tileSize * m_tileDevicePixelRatio);
+    QPair<int, int> modelRowRange = modelRowRangeForViewportRect(viewport()->rect());
+    for (int row = modelRowRange.first; row < modelRowRange.second; ++row) {
+        quint32 id = imageId(model()->index(row, 0, rootIndex()));
+        if (m_tileCache.contains(id)) {
+            continue;
+        }
+        // файл, который не удалось декодировать, плитки не получит никогда
+        if (!m_failedImageIds.contains(id)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+qreal ImageListView::scrollVelocity() const
+{
+    if (!m_scrollTimer.isValid() || m_scrollTimer.hasExpired(scrollIdleInterval)) {
+        return 0;
+    }
+    return m_scrollVelocity;
+}
+
+quint32 ImageListView::imageId(const QModelIndex& index) const
+{
+    return model()->data(index, ImageListModel::ImageIdRole).toUInt();
+}
+
+QSize ImageListView::thumbnailSize() const
+{
+    QSize size = itemSize();
+    // отрисовка оставляет по 2 пикселя поля с каждой стороны плитки
+    return QSize(qMax(size.width() - 4, 1), qMax(size.height() - 4, 1));
 }
 
 QRect ImageListView::visualRect(const QModelIndex& index) const
@@ -186,19 +618,17 @@ QRect ImageListView::visualRect(const QModelIndex& index) const
     int r = index.row() / m_columnCount;
     // колонку фото
     int c = index.row() % m_columnCount;
-    // вычисляем ширину фото
-    int width = viewport()->width() / m_columnCount;
-    // вычисляем высоту фото
-    int height = qMin(width, viewport()->height());
-    // получаем координаты фото в системе координат window
-    int x = c * width;
-    int y = r * height;
+    // вычисляем размер фото
+    QSize size = itemSize();
+    // получаем координаты фото в системе координат содержимого (64 бита)
+    int x = c * size.width();
+    qint64 y = qint64(r) * size.height();
     // переводим в систему координат видового окна
     QRect result{
         x - horizontalOffset(),
-        y - verticalOffset(),
-        width,
-        height
+        clampedToInt(y - m_contentOffset),
+        size.width(),
+        size.height()
     };
     return result;
 }
@@ -207,14 +637,16 @@ void ImageListView::scrollTo(const QModelIndex& index, ScrollHint hint)
 {
     Q_UNUSED(hint)
 
-    QRect view = viewport()->rect();
-    QRect rect = visualRect(index);
-
-    if (rect.top() < view.top()) {
-        verticalScrollBar()->setValue(verticalScrollBar()->value() + rect.top() - view.top());
-    } else if (rect.bottom() > view.bottom()) {
-        verticalScrollBar()->setValue(
-            verticalScrollBar()->value() + qMin(rect.bottom() - view.bottom(), rect.top() - view.top()));
+    if (!index.isValid()) {
+        return;
+    }
+    int height = itemSize().height();
+    qint64 top = qint64(index.row() / m_columnCount) * height;
+    qint64 bottom = top + height;
+    if (top < m_contentOffset) {
+        setContentOffset(top);
+    } else if (bottom > m_contentOffset + viewport()->height()) {
+        setContentOffset(qMin(bottom - viewport()->height(), top));
     }
 }
 
@@ -222,21 +654,23 @@ QModelIndex ImageListView::indexAt(const QPoint& point) const
 {
     if (model()) {
         // point передан в системе координат viewport-a, поэтому
-        // переводим координаты точки в систему координат window
-        QPoint p{ point.x() + horizontalOffset(), point.y() + verticalOffset() };
-        // расчитываем ширину фото
-        int width = viewport()->width() / m_columnCount;
-        // расчитываем высоту фото
-        int height = qMin(width, viewport()->height());
+        // переводим координаты точки в систему координат содержимого
+        int x = point.x() + horizontalOffset();
+        qint64 y = point.y() + m_contentOffset;
+        // расчитываем размер фото
+        QSize size = itemSize();
+        if (x < 0 || y < 0 || size.isEmpty()) {
+            return QModelIndex();
+        }
         // расчитываем колонку фото
-        int c = p.x() / width;
+        int c = x / size.width();
         // расчитываем строку фото
-        int r = p.y() / height;
+        qint64 r = y / size.height();
         // переводим в линейный индекс
-        int i = r * m_columnCount + c;
+        qint64 i = r * m_columnCount + c;
 
-        if (i >= 0 && i < model()->rowCount(rootIndex())) {
-            return model()->index(i, 0, rootIndex());
+        if (c < m_columnCount && i < model()->rowCount(rootIndex())) {
+            return model()->index(int(i), 0, rootIndex());
         }
     }
     return QModelIndex();
@@ -252,10 +686,9 @@ QModelIndex ImageListView::moveCursor(CursorAction cursorAction, Qt::KeyboardMod
     }
     int rowCount = model()->rowCount(rootIndex());
     QRect viewRect = viewport()->rect();
-    int tileWidth = viewRect.width() / m_columnCount;
-    int tileHeight = qMin(tileWidth, viewRect.height());
-    int viewColumnCount = viewRect.width() / tileWidth;
-    int viewRowCount = viewRect.height() / tileHeight;
+    QSize size = itemSize();
+    int viewColumnCount = viewRect.width() / qMax(size.width(), 1);
+    int viewRowCount = viewRect.height() / qMax(size.height(), 1);
     int pageOffset = viewColumnCount * viewRowCount;
 
     int offset = 0;
@@ -301,7 +734,9 @@ int ImageListView::horizontalOffset() const
 
 int ImageListView::verticalOffset() const
 {
-    return verticalScrollBar()->value();
+    // QAbstractItemView использует смещение только для привязки рамки выделения;
+    // вид сам работает с 64-битным contentOffset()
+    return clampedToInt(m_contentOffset);
 }
 
 bool ImageListView::isIndexHidden(const QModelIndex& index) const
@@ -312,45 +747,51 @@ bool ImageListView::isIndexHidden(const QModelIndex& index) const
 
 void ImageListView::setSelection(const QRect& rect, QItemSelectionModel::SelectionFlags command)
 {
-    QPair<int, int> rowRange = modelRowRangeForViewportRect(rect);
+    // плитки, пересекающие rect, находятся арифметикой сетки: в каждой строке
+    // сетки это один непрерывный диапазон колонок, а если rect захватывает все
+    // колонки - один диапазон на весь rect
     QItemSelection selection;
-    int begin = -1;
-    int end = -1;
-    for (int row = rowRange.first; row < rowRange.second; row++) {
-        QModelIndex index = model()->index(row, 0, rootIndex());
-        QRect indexRect = visualRect(index);
-        if (indexRect.intersects(rect)) {
-            if (begin == -1) {
-                begin = end = row;
+    QRect r = rect.normalized();
+    QSize size = itemSize();
+    int rowCount = model() ? model()->rowCount(rootIndex()) : 0;
+    qint64 top = qMax(m_contentOffset + r.top(), qint64(0));
+    qint64 bottom = m_contentOffset + r.bottom();
+    int left = qMax(r.left() + horizontalOffset(), 0);
+    int right = r.right() + horizontalOffset();
+    if (rowCount > 0 && !size.isEmpty() && bottom >= 0 && right >= 0) {
+        int firstColumn = left / size.width();
+        int lastColumn = qMin(right / size.width(), m_columnCount - 1);
+        qint64 firstLine = top / size.height();
+        qint64 lastLine = qMin(bottom / size.height(), qint64(rowCount - 1) / m_columnCount);
+        auto append = [&](qint64 first, qint64 last) {
+            last = qMin(last, qint64(rowCount - 1));
+            if (first <= last) {
+                selection.append(QItemSelectionRange(model()->index(int(first), 0, rootIndex()), model()->index(int(last), 0, rootIndex())));
+            }
+        };
+        if (firstColumn <= lastColumn) {
+            if (firstColumn == 0 && lastColumn == m_columnCount - 1) {
+                append(firstLine * m_columnCount, lastLine * m_columnCount + lastColumn);
             } else {
-                if ((end + 1) == row) {
-                    end = row;
-                } else {
-                    QModelIndex startIndex = model()->index(begin, 0, rootIndex());
-                    QModelIndex finishIndex = model()->index(end, 0, rootIndex());
-                    QItemSelection continuousSelection(startIndex, finishIndex);
-                    selection.merge(continuousSelection, command);
-                    begin = end = row;
+                for (qint64 line = firstLine; line <= lastLine; ++line) {
+                    append(line * m_columnCount + firstColumn, line * m_columnCount + lastColumn);
                 }
             }
         }
     }
-    if (begin != -1) {
-        QModelIndex startIndex = model()->index(begin, 0, rootIndex());
-        QModelIndex finishIndex = model()->index(end, 0, rootIndex());
-        QItemSelection continuousSelection(startIndex, finishIndex);
-        selection.merge(continuousSelection, command);
-    }
     selectionModel()->select(selection, command);
 }
 
 QRegion ImageListView::visualRegionForSelection(const QItemSelection& selection) const
 {
-    QModelIndexList list = selection.indexes();
+    // каждый диапазон дает не больше трех прямоугольников, а невидимые
+    // диапазоны - ни одного, поэтому индексы выделения не перечисляются
     QRegion region;
-    foreach (const QModelIndex& index, list) {
-        QRect rect = visualRect(index);
-        if (rect.isValid()) {
+    for (const QItemSelectionRange& range : selection) {
+        if (range.parent() != rootIndex() || range.left() > 0 || range.right() < 0) {
+            continue;
+        }
+        for (const QRect& rect : visualRectsForRowRange(range.top(), range.bottom())) {
             region += rect;
         }
     }
@@ -369,15 +810,23 @@ void paintOutline(QPainter& painter, const QRect& rect)
 
 void ImageListView::paintEvent(QPaintEvent* event)
 {
-    m_invalidatingModelRows.clear();
-    Q_UNUSED(event);
+    if (!model()) {
+        return;
+    }
+    TRACE_SCOPE("paint");
+    QElapsedTimer frameTimer;
+    frameTimer.start();
     QList<int> imageIndexList;
     QPair<int, int> rowRange = modelRowRangeForViewportRect(event->rect());
     for (int row = rowRange.first; row < rowRange.second; ++row) {
         imageIndexList.append(row);
     }
     QStylePainter painter(viewport());
-    painter.setRenderHints(QPainter::Antialiasing);
+    // сглаживание нужно только для запасного пути - масштабирования эскиза другого размера
+    painter.setRenderHints(QPainter::SmoothPixmapTransform);
+    updateTileGeometry();
+    int level = ThumbnailDecoder::resolutionLevel(m_tileSize * m_tileDevicePixelRatio);
+    QBitArray selected = selectedRows(rowRange.first, rowRange.second);
 
     foreach (int row, imageIndexList) {
         QModelIndex index = model()->index(row, 0, rootIndex());
@@ -387,25 +836,47 @@ void ImageListView::paintEvent(QPaintEvent* event)
         QRect rect = visualRect(index);
         if (!rect.isValid() || rect.bottom() < 0 || rect.y() > viewport()->height())
             continue;
-        QString imageFileName = model()->data(index).toString();
-        QImage* ptr = m_imageCache.object(imageFileName);
-        if (ptr) {
-            QImage* image = ptr;
-            QRectF imageRect = image->rect();
-            QRectF drawRect = rect.adjusted(2, 2, -2, -2);
-            if (imageRect.width() < imageRect.height()) {
-                auto delta = (drawRect.width() - drawRect.width() * imageRect.width() / imageRect.height()) / 2.0;
-                drawRect.adjust(delta, 0, -delta, 0);
+        quint32 id = imageId(index);
+        QRect drawRect = rect.adjusted(2, 2, -2, -2);
+        QPixmap frame = m_tileAnimator->frame(id);
+        if (!frame.isNull()) {
+            // текущий кадр анимации уже подготовлен в размер плитки
+            QRect targetRect{ QPoint(), frame.size() / frame.devicePixelRatio() };
+            targetRect.moveCenter(drawRect.center());
+            painter.drawPixmap(targetRect.topLeft(), frame);
+            ++m_paintStatistics.tileCount;
+        } else if (QPixmap* pixmap = m_tileCache.object(id)) {
+            // готовая плитка точного размера - копируем без масштабирования
+            QRect targetRect{ QPoint(), pixmap->size() / pixmap->devicePixelRatio() };
+            targetRect.moveCenter(drawRect.center());
+            painter.drawPixmap(targetRect.topLeft(), *pixmap);
+            ++m_paintStatistics.tileCount;
+        } else {
+            // пока плитка готовится, рисуем эскиз текущего или ближайшего уровня
+            QImage image = m_imageCache.peek(ImageCacheKey{ id, level });
+            if (image.isNull()) {
+                image = m_imageCache.peekNearest(id, level);
+            }
+            if (!image.isNull()) {
+                QRectF imageRect = image.rect();
+                QRectF targetRect = drawRect;
+                if (imageRect.width() < imageRect.height()) {
+                    auto delta = (targetRect.width() - targetRect.width() * imageRect.width() / imageRect.height()) / 2.0;
+                    targetRect.adjust(delta, 0, -delta, 0);
+                } else {
+                    auto delta = (targetRect.height() - targetRect.height() * imageRect.height() / imageRect.width()) / 2.0;
+                    targetRect.adjust(0, delta, 0, -delta);
+                }
+                painter.drawImage(targetRect, image, imageRect, nullptr);
+            } else if (m_failedImageIds.contains(id)) {
+                painter.setPen(QPen(QColor("darkRed"), 1));
+                painter.drawText(rect, Qt::AlignCenter, "Cannot load");
             } else {
-                auto delta = (drawRect.height() - drawRect.height() * imageRect.height() / imageRect.width()) / 2.0;
-                drawRect.adjust(0, delta, 0, -delta);
+                painter.setPen(QPen(QColor("gray"), 1));
+                painter.drawText(rect, Qt::AlignCenter, "Loading...");
             }
-            painter.drawImage(drawRect, *image, imageRect, nullptr);
-        } else {
-            painter.setPen(QPen(QColor("gray"), 1));
-            painter.drawText(rect, Qt::AlignCenter, "Loading...");
         }
-        if (selectionModel()->isSelected(index)) {
+        if (selected.testBit(row - rowRange.first)) {
             painter.setPen(QPen(QColor("red"), 1));
             paintOutline(painter, rect);
         } else {
@@ -415,11 +886,20 @@ void ImageListView::paintEvent(QPaintEvent* event)
             }
         }
     }
+
+    qint64 frameTime = frameTimer.nsecsElapsed();
+    ++m_paintStatistics.frameCount;
+    m_paintStatistics.totalNanoseconds += frameTime;
+    m_paintStatistics.maxNanoseconds = qMax(m_paintStatistics.maxNanoseconds, frameTime);
+    TRACE_HISTOGRAM("paint.us", frameTime / 1000);
 }
 
 void ImageListView::updateGeometries()
 {
-    qDebug() << "Image List View updateGeometries called";
+    qCDebug(lcImageListView) << "Image List View updateGeometries called";
+    if (!model()) {
+        return;
+    }
 
     // получаем прямоугольник, описывающий окно просмотра
     QRect viewportRect = viewport()->rect();
@@ -428,80 +908,229 @@ void ImageListView::updateGeometries()
     // получаем ширину вертикальной полосы прокрутки
     int verticalScrollBarWidth = verticalScrollBar()->width();
     // получаем количество строк модели
-    int modelRowCount = model()->rowCount(rootIndex());
+    qint64 modelRowCount = model()->rowCount(rootIndex());
     // расчитываем число строк в окне модели
-    int windowRowCount = modelRowCount / m_columnCount + ((modelRowCount % m_columnCount) ? 1 : 0);
+    qint64 windowRowCount = (modelRowCount + m_columnCount - 1) / m_columnCount;
     // расчитываем ширину фото в видовом окне
     int imageWidth = viewportWidth / m_columnCount;
     // расчитываем высоту фото в видовом окне
     int imageHeight = qMin(imageWidth, viewportRect.height());
-    if (imageHeight) {
-        int viewportRowCount = (viewportRect.height() / imageHeight + 1);
-        m_imageCache.setMaxCost(viewportRowCount * m_columnCount * 2);
-    }
-
+    // высота содержимого может превышать диапазон int, поэтому считаем в 64 битах
+    m_synchronizingScrollBar = true;
     // если высоты вида недостаточна для показа модели целиком
     if (windowRowCount * imageHeight > viewportRect.height()) {
         // корректируем ширину окна просмотра, поскольку станет видима полоса прокрутки
         viewportWidth -= verticalScrollBarWidth;
         // расчитываем новый размер фото в видовом окне
         imageWidth = viewportWidth / m_columnCount;
-        imageHeight = qMin(imageWidth, viewportRect.height());
-        // расчитываем максимальное смещение вертикальной полосы прокрутки с учетом корректировки
-        int verticalScrollBarMaximum = windowRowCount * imageHeight;
+        imageHeight = qMax(qMin(imageWidth, viewportRect.height()), 1);
+        // расчитываем максимальное смещение содержимого с учетом корректировки
+        qint64 maximumOffset = windowRowCount * imageHeight;
         // если после корректировки высоты видового окна достаточно, чтобы вместить модель целиком
-        if (verticalScrollBarMaximum < viewportRect.height()) {
+        if (maximumOffset < viewportRect.height()) {
             // оставляем один пиксель, чтобы полоса прокрутки осталась видима
-            verticalScrollBarMaximum = 1;
+            maximumOffset = 1;
         } else {
             // убираем одну страницу
-            verticalScrollBarMaximum -= viewportRect.height();
+            maximumOffset -= viewportRect.height();
+        }
+        m_maximumContentOffset = maximumOffset;
+        // настраиваем параметры вертикальной полосы прокрутки; если смещение не
+        // помещается в ее диапазон, шаги масштабируются вместе с ним
+        int pageStep = viewportRect.height() / imageHeight * imageHeight;
+        if (maximumOffset <= maxScrollBarValue) {
+            verticalScrollBar()->setRange(0, int(maximumOffset));
+            verticalScrollBar()->setPageStep(pageStep);
+            verticalScrollBar()->setSingleStep(imageHeight);
+        } else {
+            qreal scale = qreal(maxScrollBarValue) / maximumOffset;
+            verticalScrollBar()->setRange(0, maxScrollBarValue);
+            verticalScrollBar()->setPageStep(qMax(1, qRound(pageStep * scale)));
+            verticalScrollBar()->setSingleStep(qMax(1, qRound(imageHeight * scale)));
         }
-        // настраиваем параметры вертикальной полосы прокрутки
-        verticalScrollBar()->setRange(0, verticalScrollBarMaximum);
-        verticalScrollBar()->setPageStep(viewportRect.height() / imageHeight * imageHeight);
-        verticalScrollBar()->setSingleStep(imageHeight);
-
     } else {
         // окна просмотра достаточно, чтобы вместить модель целиком
         // поэтому скрываем вертикальную полосу прокрутки
+        m_maximumContentOffset = 0;
         verticalScrollBar()->setRange(0, 0);
     }
+    // при изменении масштаба прежнее значение полосы соответствует другому
+    // смещению, поэтому полоса выставляется заново по смещению содержимого
+    qint64 oldOffset = m_contentOffset;
+    m_contentOffset = qBound(qint64(0), m_contentOffset, maximumContentOffset());
+    verticalScrollBar()->setValue(scrollBarValueForOffset(m_contentOffset));
+    m_synchronizingScrollBar = false;
+    if (m_contentOffset != oldOffset) {
+        viewport()->update();
+    }
+}
+
+void ImageListView::clearImageCaches()
+{
+    m_imageCache.clear();
+    m_tileCache.clear();
+    m_failedImageIds.clear();
+    m_sketchlessImageIds.clear();
+}
+
+void ImageListView::invalidateImages(const QSet<quint32>& imageIds)
+{
+    for (quint32 id : imageIds) {
+        m_imageCache.removeImage(id);
+        m_tileCache.remove(id);
+        m_sketchlessImageIds.remove(id);
+        m_failedImageIds.remove(id);
+    }
+    m_imageLoader->cancel(imageIds);
+    m_tileAnimator->invalidate(imageIds);
+}
+
+void ImageListView::dataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles)
+{
+    qCDebug(lcImageListView) << "Image List View dataChanged" << topLeft.row() << bottomRight.row() << "called";
+    QAbstractItemView::dataChanged(topLeft, bottomRight, roles);
+    if (topLeft.parent() != rootIndex()) {
+        return;
+    }
+    // сведения из заголовков (дата съемки, размер) эскизы не меняют
+    if (!roles.isEmpty() && !roles.contains(ImageListModel::FileSizeRole) && !roles.contains(ImageListModel::LastModifiedRole)) {
+        return;
+    }
+    // эскизы изменившихся файлов уже сброшены по ImageListModel::imagesInvalidated()
+    QPair<int, int> modelRowRange = modelRowRangeForViewportRect(viewport()->rect());
+    if (topLeft.row() < modelRowRange.second && bottomRight.row() >= modelRowRange.first) {
+        viewport()->update();
+        startScrollDelayTimer();
+    }
+}
+
+void ImageListView::rowsInserted(const QModelIndex& parent, int start, int end)
+{
+    qCDebug(lcImageListView) << "Image List View rowsInserted" << start << end << "called";
+    QAbstractItemView::rowsInserted(parent, start, end);
+    if (parent != rootIndex()) {
+        return;
+    }
+    updateGeometries();
+    // строки, добавленные за пределами видового окна, загружать не нужно;
+    // видимые загружаем, не прерывая уже запланированную загрузку
+    QPair<int, int> modelRowRange = modelRowRangeForViewportRect(viewport()->rect());
+    if (start <= modelRowRange.second) {
+        viewport()->update();
+        if (!m_loadingDelayTimer->isActive()) {
+            startScrollDelayTimer();
+        }
+    }
+}
+
+void ImageListView::rowsAboutToBeRemoved(const QModelIndex& parent, int start, int end)
+{
+    qCDebug(lcImageListView) << "Image List View rowsAboutToBeRemoved" << start << end << "called";
+    QAbstractItemView::rowsAboutToBeRemoved(parent, start, end);
+    if (parent != rootIndex()) {
+        return;
+    }
+    // эскизы не сбрасываются: строка могла быть скрыта фильтром, а эскизы
+    // удаленных файлов сброшены по ImageListModel::imagesInvalidated().
+    // Геометрия и загрузка пересчитываются, когда строки будут удалены
+    scheduleDelayedItemsLayout();
 }
 
 void ImageListView::verticalScrollbarValueChanged(int value)
 {
-    qDebug() << "Image List View verticalScrollbarValueChanged" << value << "called";
-    qDebug() << "verticalScrollbarValueChanged: before QAbstractItemView::verticalScrollbarValueChanged(value)";
+    qCDebug(lcImageListView) << "Image List View verticalScrollbarValueChanged" << value << "called";
+    qCDebug(lcImageListView) << "verticalScrollbarValueChanged: before QAbstractItemView::verticalScrollbarValueChanged(value)";
     QAbstractItemView::verticalScrollbarValueChanged(value);
-    qDebug() << "verticalScrollbarValueChanged: end QAbstractItemView::verticalScrollbarValueChanged(value)";
-    startScrollDelayTimer();
+    qCDebug(lcImageListView) << "verticalScrollbarValueChanged: end QAbstractItemView::verticalScrollbarValueChanged(value)";
+}
+
+void ImageListView::scrollContentsBy(int dx, int dy)
+{
+    Q_UNUSED(dy)
+    if (dx) {
+        QAbstractItemView::scrollContentsBy(dx, 0);
+    }
+    // полосу прокрутки двигает пользователь: смещение содержимого следует за ней
+    if (m_synchronizingScrollBar) {
+        return;
+    }
+    qint64 oldOffset = m_contentOffset;
+    m_contentOffset = offsetForScrollBarValue(verticalScrollBar()->value());
+    if (m_contentOffset != oldOffset) {
+        contentOffsetChanged(oldOffset);
+    }
+}
+
+void ImageListView::wheelEvent(QWheelEvent* event)
+{
+    // при масштабированной полосе ее шаг крупнее строки сетки, поэтому
+    // колесо прокручивает содержимое напрямую с обычным шагом
+    if (maximumContentOffset() <= maxScrollBarValue || event->angleDelta().y() == 0) {
+        QAbstractItemView::wheelEvent(event);
+        return;
+    }
+    qint64 step = qint64(itemSize().height()) * event->angleDelta().y() / 120;
+    setContentOffset(m_contentOffset - step);
+    event->accept();
 }
 
 void ImageListView::resizeEvent(QResizeEvent* event)
 {
-    qDebug() << "resizeEvent: before QAbstractItemView::resizeEvent(event)";
+    qCDebug(lcImageListView) << "resizeEvent: before QAbstractItemView::resizeEvent(event)";
     QAbstractItemView::resizeEvent(event);
-    qDebug() << "resizeEvent: after QAbstractItemView::resizeEvent(event)";
+    qCDebug(lcImageListView) << "resizeEvent: after QAbstractItemView::resizeEvent(event)";
+    startScrollDelayTimer();
+
+    qCDebug(lcImageListView) << "resizeEvent:" << width() << "" << height();
+}
+
+void ImageListView::showEvent(QShowEvent* event)
+{
+    QAbstractItemView::showEvent(event);
     startScrollDelayTimer();
+}
 
-    qDebug() << "resizeEvent:" << width() << "" << height();
+void ImageListView::hideEvent(QHideEvent* event)
+{
+    QAbstractItemView::hideEvent(event);
+    // в скрытом виде анимации не воспроизводятся
+    m_tileAnimator->setTiles(QVector<AnimatedTile>(), m_tileSize, m_tileDevicePixelRatio);
 }
 
 void ImageListView::setModel(QAbstractItemModel* model)
 {
-    qDebug() << "setModel: before QAbstractItemView::setModel(model)";
+    if (auto imageListModel = qobject_cast<ImageListModel*>(this->model())) {
+        disconnect(imageListModel, &ImageListModel::imagesInvalidated, this, nullptr);
+        disconnect(imageListModel, &ImageListModel::imageListReplaced, this, nullptr);
+    }
+    qCDebug(lcImageListView) << "setModel: before QAbstractItemView::setModel(model)";
     QAbstractItemView::setModel(model);
-    qDebug() << "setModel: after QAbstractItemView::setModel(model)";
+    if (auto imageListModel = qobject_cast<ImageListModel*>(model)) {
+        connect(imageListModel, &ImageListModel::imagesInvalidated, this, &ImageListView::invalidateImages);
+        connect(imageListModel, &ImageListModel::imageListReplaced, this, &ImageListView::clearImageCaches);
+    }
+    qCDebug(lcImageListView) << "setModel: after QAbstractItemView::setModel(model)";
+}
+
+void ImageListView::doItemsLayout()
+{
+    qCDebug(lcImageListView) << "Image List View doItemsLayout called";
+    QAbstractItemView::doItemsLayout();
+    // после изменения порядка строк в видовом окне могут оказаться другие изображения
+    viewport()->update();
+    startScrollDelayTimer();
 }
 
 void ImageListView::reset()
 {
-    qDebug() << "Image List View reset called";
-    m_imageCache.clear();
-    m_invalidatingModelRows.clear();
-    qDebug() << "reset: before QAbstractItemView::reset()";
+    qCDebug(lcImageListView) << "Image List View reset called";
+    stopAsyncImageLoading();
+    // кеши очищает только загрузка каталога (clearImageCaches()): идентификаторы
+    // изображений не повторяются, поэтому после сброса модели фильтром эскизы
+    // оставшихся строк остаются верными
+    m_invalidatingImageIds.clear();
+    qCDebug(lcImageListView) << "reset: before QAbstractItemView::reset()";
     QAbstractItemView::reset();
-    qDebug() << "reset: after QAbstractItemView::reset()";
+    qCDebug(lcImageListView) << "reset: after QAbstractItemView::reset()";
     startScrollDelayTimer();
 }
@@ -1,28 +1,51 @@
 #ifndef IMAGELISTVIEW_H
 #define IMAGELISTVIEW_H
 
+#include "imagecache.h"
+#include "imageloader.h"
+
 #include <QAbstractItemView>
+#include <QBitArray>
 #include <QCache>
-#include <QFuture>
-#include <QFutureWatcher>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QImage>
 #include <QMetaObject>
+#include <QPixmap>
+#include <QSet>
 
 #include <memory>
 
 class QTimer;
+class ThumbnailStore;
+class TileAnimator;
+
+/**
+ * @brief The PaintStatistics struct
+ * Счетчики времени отрисовки кадров вида
+ */
+struct PaintStatistics {
+    quint64 frameCount = 0;
+    /**
+     * @brief tileCount число плиток, нарисованных из готовых эскизов точного размера
+     */
+    quint64 tileCount = 0;
+    qint64 totalNanoseconds = 0;
+    qint64 maxNanoseconds = 0;
+};
 
 /**
- * @brief The ImageLoadingTask struct
- * Вспомогательная структура для фоновой загрузки
+ * @brief The PassStatistics struct
+ * Счетчики двухпроходного вывода: время от запроса видимой плитки, которую
+ * нечем было нарисовать, до первого прохода (набросок или эскиз) и до
+ * окончательного эскиза
  */
-struct ImageLoadingTask {
-    int row;
-    QString imageFileName;
-    std::unique_ptr<QImage> image;
+struct PassStatistics {
+    quint64 firstPassCount = 0;
+    qint64 firstPassNanoseconds = 0;
+    quint64 finalPassCount = 0;
+    qint64 finalPassNanoseconds = 0;
 };
-using ImageLoadingTaskSharedPtr = std::shared_ptr<ImageLoadingTask>;
-using ImageLoadingTaskFutureWatcher = QFutureWatcher<ImageLoadingTaskSharedPtr>;
 
 /**
  * @brief The ImageListView class
@@ -45,6 +68,115 @@ public:
      * @param columnCount новое число колонок
      */
     void setColumnCount(int columnCount);
+    /**
+     * @brief cacheMemoryBudget возвращает бюджет памяти кеша изображений в мегабайтах
+     * @return бюджет памяти в мегабайтах
+     */
+    int cacheMemoryBudget() const;
+    /**
+     * @brief setCacheMemoryBudget устанавливает бюджет памяти кеша изображений
+     * @param megabytes бюджет памяти в мегабайтах
+     */
+    void setCacheMemoryBudget(int megabytes);
+    /**
+     * @brief cacheStatistics возвращает счетчики попаданий, промахов и вытеснений кеша
+     * @return счетчики кеша изображений
+     */
+    ImageCacheStatistics cacheStatistics() const;
+    /**
+     * @brief paintStatistics возвращает число кадров и время их отрисовки
+     * @return счетчики отрисовки
+     */
+    PaintStatistics paintStatistics() const;
+    /**
+     * @brief resetPaintStatistics обнуляет счетчики отрисовки
+     */
+    void resetPaintStatistics();
+    /**
+     * @brief passStatistics возвращает счетчики времени первого и окончательного проходов
+     * @return счетчики двухпроходного вывода
+     */
+    PassStatistics passStatistics() const;
+    /**
+     * @brief resetPassStatistics обнуляет счетчики двухпроходного вывода
+     */
+    void resetPassStatistics();
+    /**
+     * @brief isViewportFilled проверяет, готовы ли плитки всех изображений видового окна
+     * @return true, если видовое окно не содержит незагруженных плиток
+     */
+    bool isViewportFilled() const;
+    /**
+     * @brief prefetchScreensAhead возвращает число экранов упреждающей загрузки
+     * в направлении прокрутки
+     * @return число экранов
+     */
+    int prefetchScreensAhead() const;
+    /**
+     * @brief prefetchScreensBehind возвращает число экранов упреждающей загрузки
+     * против направления прокрутки
+     * @return число экранов
+     */
+    int prefetchScreensBehind() const;
+    /**
+     * @brief setPrefetchScreens устанавливает размер кольца упреждающей загрузки вокруг
+     * видового окна. При быстрой прокрутке окно впереди расширяется пропорционально скорости.
+     * @param ahead число экранов в направлении прокрутки
+     * @param behind число экранов против направления прокрутки
+     */
+    void setPrefetchScreens(int ahead, int behind);
+    /**
+     * @brief loaderThreadCount возвращает число потоков этапа загрузки stage
+     * @param stage
+     * @return число потоков
+     */
+    int loaderThreadCount(ImageLoader::Stage stage) const;
+    /**
+     * @brief loaderQueueDepth возвращает глубину очереди этапа загрузки stage
+     * @param stage
+     * @return глубина очереди
+     */
+    int loaderQueueDepth(ImageLoader::Stage stage) const;
+    /**
+     * @brief setLoaderStage настраивает этап загрузки: для HDD и сетевых дисков
+     * этапу чтения нужно мало потоков, для NVMe - больше
+     * @param stage этап чтения или декодирования
+     * @param threadCount число потоков этапа
+     * @param queueDepth глубина очереди этапа, см. ImageLoader::setQueueDepth()
+     */
+    void setLoaderStage(ImageLoader::Stage stage, int threadCount, int queueDepth);
+    /**
+     * @brief loaderStatistics возвращает счетчики пропускной способности этапов загрузки
+     * @return счетчики этапов чтения и декодирования
+     */
+    ImageLoaderStatistics loaderStatistics() const;
+    /**
+     * @brief resetLoaderStatistics обнуляет счетчики этапов загрузки
+     */
+    void resetLoaderStatistics();
+    /**
+     * @brief thumbnailStore возвращает хранилище эскизов на диске
+     * @return хранилище эскизов или nullptr, если оно отключено
+     */
+    std::shared_ptr<const ThumbnailStore> thumbnailStore() const;
+    /**
+     * @brief setThumbnailStore устанавливает хранилище эскизов на диске,
+     * в котором загрузчик ищет эскизы до декодирования исходных файлов
+     * @param thumbnailStore хранилище эскизов или nullptr, чтобы отключить его
+     */
+    void setThumbnailStore(std::shared_ptr<const ThumbnailStore> thumbnailStore);
+    /**
+     * @brief contentOffset возвращает вертикальное смещение содержимого в пикселях.
+     * Смещение 64-битное: высота сетки из миллионов плиток не помещается в int,
+     * поэтому значение полосы прокрутки при необходимости масштабируется в смещение.
+     * @return смещение верхнего края видового окна от начала сетки
+     */
+    qint64 contentOffset() const;
+    /**
+     * @brief setContentOffset прокручивает содержимое к смещению offset
+     * @param offset смещение, ограничиваемое диапазоном прокрутки
+     */
+    void setContentOffset(qint64 offset);
 
 protected:
     /**
@@ -53,14 +185,108 @@ protected:
      * @param rect
      * @return полуотркрытый диапазон модельных строк (model index row)
      */
-    QPair<int, int> modelRowRangeForViewportRect(const QRect& rect);
+    QPair<int, int> modelRowRangeForViewportRect(const QRect& rect) const;
+    /**
+     * @brief visualRectsForRowRange возвращает геометрию непрерывного диапазона
+     * модельных строк: хвост первой строки сетки, целые строки сетки между ними
+     * и начало последней - не больше трех прямоугольников независимо от длины
+     * диапазона
+     * @param first первая строка диапазона
+     * @param last последняя строка диапазона (включительно)
+     * @return прямоугольники в системе координат видового окна, обрезанные им
+     */
+    QVector<QRect> visualRectsForRowRange(int first, int last) const;
+    /**
+     * @brief selectedRows возвращает признаки выделения строк полуоткрытого
+     * диапазона [first, last) за один проход по диапазонам выделения
+     * @param first
+     * @param last
+     * @return бит i - выделена ли строка first + i
+     */
+    QBitArray selectedRows(int first, int last) const;
+    /**
+     * @brief itemSize возвращает размер ячейки сетки
+     * @return размер ячейки в пикселях видового окна
+     */
+    QSize itemSize() const;
     /**
-     * @brief startScrollDelayTimer запускает таймер отсрочки скрола
+     * @brief maximumContentOffset возвращает наибольшее смещение содержимого
+     * @return смещение, при котором видна последняя строка сетки
+     */
+    qint64 maximumContentOffset() const;
+    /**
+     * @brief scrollBarValueForOffset переводит смещение содержимого в значение полосы прокрутки
+     * @param offset
+     * @return значение полосы прокрутки
+     */
+    int scrollBarValueForOffset(qint64 offset) const;
+    /**
+     * @brief offsetForScrollBarValue переводит значение полосы прокрутки в смещение содержимого
+     * @param value
+     * @return смещение содержимого
+     */
+    qint64 offsetForScrollBarValue(int value) const;
+    /**
+     * @brief contentOffsetChanged прокручивает видовое окно после изменения смещения
+     * и обновляет оценку скорости прокрутки
+     * @param oldOffset прежнее смещение
+     */
+    void contentOffsetChanged(qint64 oldOffset);
+    /**
+     * @brief imageId возвращает постоянный идентификатор изображения строки index
+     * (ImageListModel::ImageIdRole), которым индексируются кеши эскизов и плиток
+     * @param index
+     * @return идентификатор изображения
+     */
+    quint32 imageId(const QModelIndex& index) const;
+    /**
+     * @brief thumbnailSize возвращает размер области плитки, в которую вписывается эскиз
+     * @return размер эскиза в пикселях видового окна
+     */
+    QSize thumbnailSize() const;
+    /**
+     * @brief scrollVelocity возвращает текущую скорость прокрутки
+     * @return скорость прокрутки в экранах в секунду или 0, если прокрутка остановилась
+     */
+    qreal scrollVelocity() const;
+    /**
+     * @brief frameInterval возвращает период обновления экрана, на котором показан вид
+     * @return период кадра в миллисекундах
+     */
+    int frameInterval() const;
+    /**
+     * @brief updateTileGeometry сбрасывает готовые плитки, если изменился размер
+     * плитки или devicePixelRatio
+     */
+    void updateTileGeometry();
+    /**
+     * @brief finishPass учитывает проход ожидающей плитки imageId
+     * @param imageId
+     * @param final загружен окончательный эскиз, а не набросок
+     */
+    void finishPass(quint32 imageId, bool final);
+    /**
+     * @brief startScrollDelayTimer запускает таймер отсрочки скрола, если он еще не запущен.
+     * Задержка зависит от скорости прокрутки: без прокрутки загрузка начинается сразу.
      */
     void startScrollDelayTimer();
     void stopScrollDelayTimer();
     void startAsyncImageLoading();
     void stopAsyncImageLoading();
+    /**
+     * @brief invalidateImages удаляет из кешей эскизы и плитки изображений imageIds,
+     * файлы которых изменились или удалены (ImageListModel::imagesInvalidated()),
+     * и прерывает их загрузку
+     * @param imageIds
+     */
+    void invalidateImages(const QSet<quint32>& imageIds);
+    /**
+     * @brief clearImageCaches очищает кеши эскизов и плиток и списки изображений
+     * без наброска и с ошибкой декодирования, когда модель загружает
+     * каталог (ImageListModel::imageListReplaced()): эскизы прежних изображений
+     * больше не понадобятся
+     */
+    void clearImageCaches();
 
     // QAbstractItemView interface
 public:
@@ -68,6 +294,7 @@ public:
     virtual QModelIndex indexAt(const QPoint& point) const override;
     virtual void scrollTo(const QModelIndex& index, ScrollHint hint) override;
     virtual void setModel(QAbstractItemModel* model) override;
+    virtual void doItemsLayout() override;
 
 public slots:
     virtual void reset() override;
@@ -81,13 +308,23 @@ protected:
     virtual QRegion visualRegionForSelection(const QItemSelection& selection) const override;
 
 protected slots:
+    virtual void dataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles = QVector<int>()) override;
+    virtual void rowsInserted(const QModelIndex& parent, int start, int end) override;
+    virtual void rowsAboutToBeRemoved(const QModelIndex& parent, int start, int end) override;
     virtual void updateGeometries() override;
     virtual void verticalScrollbarValueChanged(int value) override;
 
+    // QAbstractScrollArea interface
+protected:
+    virtual void scrollContentsBy(int dx, int dy) override;
+
     // QWidget interface
 protected:
     virtual void paintEvent(QPaintEvent* event) override;
     virtual void resizeEvent(QResizeEvent* event) override;
+    virtual void wheelEvent(QWheelEvent* event) override;
+    virtual void showEvent(QShowEvent* event) override;
+    virtual void hideEvent(QHideEvent* event) override;
 
     // State
 private:
@@ -96,25 +333,120 @@ private:
      */
     int m_columnCount = 5;
     /**
-     * @brief m_loadingDelayTimer таймер отсроченной реакции на скроллирование
+     * @brief m_loadingDelayTimer таймер отсроченной реакции на скроллирование,
+     * задержка которого зависит от скорости прокрутки
      */
     QTimer* m_loadingDelayTimer = nullptr;
     /**
-     * @brief m_updateDelayTimer таймер отсроченной реакции на обновление вида
+     * @brief m_updateDelayTimer таймер, объединяющий перерисовки загруженных плиток
+     * в пределах одного кадра дисплея
      */
     QTimer* m_updatingDelayTimer = nullptr;
     /**
-     * @brief m_imageLoadingFutureWatcher наблюдатель за фоновой загрузкой
+     * @brief m_imageLoader фоновый загрузчик эскизов с очередью по приоритету
+     */
+    ImageLoader* m_imageLoader = nullptr;
+    /**
+     * @brief m_tileAnimator воспроизведение анимированных изображений в видимых плитках
+     */
+    TileAnimator* m_tileAnimator = nullptr;
+    /**
+     * @brief m_invalidatingImageIds идентификаторы изображений, плитки которых
+     * надо перерисовать
+     */
+    QSet<quint32> m_invalidatingImageIds;
+    /**
+     * @brief m_sketchlessImageIds изображения, для которых набросок не нашелся;
+     * их наброски больше не загружаются, пока файл не изменится или не будет
+     * загружен другой каталог
+     */
+    QSet<quint32> m_sketchlessImageIds;
+    /**
+     * @brief m_failedImageIds изображения, декодирование которых завершилось ошибкой;
+     * их плитки рисуются заглушкой и не загружаются, пока файл не изменится
+     */
+    QSet<quint32> m_failedImageIds;
+    /**
+     * @brief m_imageCache кеш изображений, ограниченный объемом памяти
+     */
+    ImageCache m_imageCache;
+    /**
+     * @brief m_tileCache готовые к выводу плитки точного размера текущей геометрии;
+     * стоимость - размер плитки в килобайтах
+     */
+    QCache<quint32, QPixmap> m_tileCache;
+    /**
+     * @brief m_tileSize логический размер плиток m_tileCache
+     */
+    QSize m_tileSize;
+    /**
+     * @brief m_tileDevicePixelRatio devicePixelRatio плиток m_tileCache
+     */
+    qreal m_tileDevicePixelRatio = 1;
+    /**
+     * @brief m_paintStatistics счетчики времени отрисовки
+     */
+    PaintStatistics m_paintStatistics;
+    /**
+     * @brief The PendingTile struct
+     * Видимая плитка, которую при запросе нечем было нарисовать
+     */
+    struct PendingTile {
+        /**
+         * @brief requested время запроса по m_passTimer в наносекундах
+         */
+        qint64 requested;
+        bool firstPassDone;
+    };
+    /**
+     * @brief m_pendingTiles ожидающие плитки по идентификаторам изображений
+     */
+    QHash<quint32, PendingTile> m_pendingTiles;
+    /**
+     * @brief m_passTimer часы для отсчета времени проходов
+     */
+    QElapsedTimer m_passTimer;
+    /**
+     * @brief m_passStatistics счетчики двухпроходного вывода
+     */
+    PassStatistics m_passStatistics;
+    /**
+     * @brief m_thumbnailStore хранилище эскизов на диске, разделяемое с фоновыми задачами
+     */
+    std::shared_ptr<const ThumbnailStore> m_thumbnailStore;
+    /**
+     * @brief m_prefetchScreensAhead число экранов упреждающей загрузки по направлению прокрутки
+     */
+    int m_prefetchScreensAhead = 2;
+    /**
+     * @brief m_prefetchScreensBehind число экранов упреждающей загрузки против направления прокрутки
+     */
+    int m_prefetchScreensBehind = 1;
+    /**
+     * @brief m_scrollDirection направление последней прокрутки: 1 - вниз, -1 - вверх
+     */
+    int m_scrollDirection = 1;
+    /**
+     * @brief m_contentOffset вертикальное смещение содержимого, см. contentOffset()
+     */
+    qint64 m_contentOffset = 0;
+    /**
+     * @brief m_maximumContentOffset наибольшее смещение содержимого при текущей геометрии
+     */
+    qint64 m_maximumContentOffset = 0;
+    /**
+     * @brief m_synchronizingScrollBar полоса прокрутки выставляется по смещению
+     * содержимого, а не пользователем
      */
-    ImageLoadingTaskFutureWatcher m_imageLoadingFutureWatcher;
+    bool m_synchronizingScrollBar = false;
     /**
-     * @brief m_invalidatingModelRows список инвалидируемых строк модели
+     * @brief m_scrollVelocity сглаженная скорость прокрутки в экранах в секунду
      */
-    QList<int> m_invalidatingModelRows;
+    qreal m_scrollVelocity = 0;
     /**
-     * @brief m_imageCache кеш изображений фиксированного размера
+     * @brief m_scrollTimer время, прошедшее с предыдущей прокрутки
      */
-    QCache<QString, QImage> m_imageCache;
+    QElapsedTimer m_scrollTimer;
 };
 
 #endif // IMAGELISTVIEW_H
@@ -0,0 +1,379 @@
+#include "imageloader.h"
+#include "logging.h"
+#include "thumbnaildecoder.h"
+#include "thumbnailstore.h"
+#include "trace.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+
+#include <algorithm>
+
+namespace {
+// параллельные чтения перегружают HDD и сетевые диски, поэтому пул чтения невелик
+const int defaultReadThreadCount = 2;
+const int defaultReadQueueDepth = 1024;
+// в очереди декодирования достаточно держать по две задачи на поток
+const int decodeQueueDepthPerThread = 2;
+
+/**
+ * @brief jobKey возвращает ключ задачи: у изображения может быть одна задача
+ * наброска и одна задача эскиза
+ */
+quint64 jobKey(const ImageLoadingTask& task)
+{
+    return (quint64(task.imageId) << 1) | (task.sketch ? 1 : 0);
+}
+
+bool isSameWork(const ImageLoadingTask& a, const ImageLoadingTask& b)
+{
+    return a.thumbnailSize == b.thumbnailSize && a.tileSize == b.tileSize
+        && qFuzzyCompare(a.devicePixelRatio, b.devicePixelRatio);
+}
+}
+
+/**
+ * @brief The ImageLoader::Worker class
+ * Рабочий поток этапа загрузчика: выбирает задачи из очереди этапа, пока она не опустеет
+ */
+class ImageLoader::Worker : public QRunnable {
+public:
+    Worker(ImageLoader* loader, Stage stage)
+        : m_loader{ loader }
+        , m_stage{ stage }
+    {
+    }
+
+    // QRunnable interface
+public:
+    virtual void run() override
+    {
+        while (JobSharedPtr job = m_loader->takeJob(m_stage)) {
+            if (m_stage == ReadStage) {
+                m_loader->readJob(job);
+            } else {
+                m_loader->decodeJob(job);
+            }
+        }
+    }
+
+private:
+    ImageLoader* m_loader;
+    Stage m_stage;
+};
+
+ImageLoader::ImageLoader(QObject* parent)
+    : QObject(parent)
+{
+    m_stages[ReadStage].threadPool.setMaxThreadCount(defaultReadThreadCount);
+    m_stages[ReadStage].queueDepth = defaultReadQueueDepth;
+    m_stages[DecodeStage].threadPool.setMaxThreadCount(QThread::idealThreadCount());
+    m_stages[DecodeStage].queueDepth = QThread::idealThreadCount() * decodeQueueDepthPerThread;
+}
+
+ImageLoader::~ImageLoader()
+{
+    cancelAll();
+    for (StageState& stage : m_stages) {
+        stage.threadPool.waitForDone();
+    }
+}
+
+void ImageLoader::setThumbnailStore(std::shared_ptr<const ThumbnailStore> thumbnailStore)
+{
+    QMutexLocker locker{ &m_mutex };
+    m_thumbnailStore = std::move(thumbnailStore);
+}
+
+int ImageLoader::threadCount(Stage stage) const
+{
+    return m_stages[stage].threadPool.maxThreadCount();
+}
+
+void ImageLoader::setThreadCount(Stage stage, int threadCount)
+{
+    QMutexLocker locker{ &m_mutex };
+    m_stages[stage].threadPool.setMaxThreadCount(qMax(threadCount, 1));
+    startWorkers();
+}
+
+int ImageLoader::queueDepth(Stage stage) const
+{
+    QMutexLocker locker{ &m_mutex };
+    return m_stages[stage].queueDepth;
+}
+
+void ImageLoader::setQueueDepth(Stage stage, int queueDepth)
+{
+    QMutexLocker locker{ &m_mutex };
+    m_stages[stage].queueDepth = qMax(queueDepth, 1);
+    startWorkers();
+}
+
+ImageLoaderStatistics ImageLoader::statistics() const
+{
+    QMutexLocker locker{ &m_mutex };
+    return ImageLoaderStatistics{ m_stages[ReadStage].statistics, m_stages[DecodeStage].statistics };
+}
+
+void ImageLoader::resetStatistics()
+{
+    QMutexLocker locker{ &m_mutex };
+    for (StageState& stage : m_stages) {
+        stage.statistics = ImageLoaderStageStatistics{};
+    }
+}
+
+void ImageLoader::schedule(const QList<ImageLoadingTask>& tasks)
+{
+    QMutexLocker locker{ &m_mutex };
+    QHash<quint64, JobSharedPtr> queued;
+    for (const StageState& stage : m_stages) {
+        for (const JobSharedPtr& job : stage.queue) {
+            queued.insert(jobKey(*job->task), job);
+        }
+    }
+    QHash<quint64, JobSharedPtr> running;
+    for (const JobSharedPtr& job : m_running) {
+        running.insert(jobKey(*job->task), job);
+    }
+
+    JobQueue queues[2];
+    for (const ImageLoadingTask& task : tasks) {
+        // уже выполняющуюся задачу с тем же размером эскиза не трогаем; после
+        // чтения она встанет в очередь декодирования с новым приоритетом
+        quint64 key = jobKey(task);
+        JobSharedPtr job = running.value(key);
+        if (job && isSameWork(*job->task, task)) {
+            running.remove(key);
+            job->task->priority = task.priority;
+            continue;
+        }
+        // поставленной в очередь задаче только меняем приоритет
+        job = queued.value(key);
+        if (job && isSameWork(*job->task, task)) {
+            queued.remove(key);
+            job->task->priority = task.priority;
+            job->task->prefetch = task.prefetch;
+            queues[job->stage].append(job);
+            continue;
+        }
+        job = std::make_shared<Job>();
+        job->task = std::make_shared<ImageLoadingTask>(task);
+        job->store = m_thumbnailStore;
+        // задаче с готовым эскизом уровня читать нечего, ей нужна только плитка
+        job->stage = task.image.isNull() ? ReadStage : DecodeStage;
+        queues[job->stage].append(job);
+    }
+    // задачи, которые больше не нужны, отменяем: поставленные просто не попадут
+    // в новые очереди, выполняющиеся прервут чтение файла
+    for (const JobSharedPtr& job : queued) {
+        job->cancelled = true;
+    }
+    for (const JobSharedPtr& job : running) {
+        job->cancelled = true;
+    }
+    for (JobQueue& queue : queues) {
+        std::stable_sort(queue.begin(), queue.end(), [](const JobSharedPtr& a, const JobSharedPtr& b) {
+            return a->task->priority > b->task->priority;
+        });
+    }
+    // наименее приоритетные задачи сверх глубины очереди чтения отбрасываются
+    JobQueue& readQueue = queues[ReadStage];
+    int excess = readQueue.size() - m_stages[ReadStage].queueDepth;
+    for (int i = 0; i < excess; ++i) {
+        readQueue.at(i)->cancelled = true;
+    }
+    if (excess > 0) {
+        readQueue.remove(0, excess);
+    }
+    m_stages[ReadStage].queue = queues[ReadStage];
+    m_stages[DecodeStage].queue = queues[DecodeStage];
+    TRACE_COUNTER("loader.read.queue", m_stages[ReadStage].queue.size());
+    TRACE_COUNTER("loader.decode.queue", m_stages[DecodeStage].queue.size());
+    startWorkers();
+}
+
+void ImageLoader::cancelAll()
+{
+    QMutexLocker locker{ &m_mutex };
+    for (StageState& stage : m_stages) {
+        for (const JobSharedPtr& job : stage.queue) {
+            job->cancelled = true;
+        }
+        stage.queue.clear();
+    }
+    for (const JobSharedPtr& job : m_running) {
+        job->cancelled = true;
+    }
+    for (const JobSharedPtr& job : m_delivering) {
+        job->cancelled = true;
+    }
+}
+
+void ImageLoader::cancel(const QSet<quint32>& imageIds)
+{
+    QMutexLocker locker{ &m_mutex };
+    auto isCancelled = [&imageIds](const JobSharedPtr& job) {
+        if (!imageIds.contains(job->task->imageId)) {
+            return false;
+        }
+        job->cancelled = true;
+        return true;
+    };
+    for (StageState& stage : m_stages) {
+        stage.queue.erase(std::remove_if(stage.queue.begin(), stage.queue.end(), isCancelled), stage.queue.end());
+    }
+    for (const JobSharedPtr& job : m_running) {
+        isCancelled(job);
+    }
+    // результат, полученный из прежнего содержимого файла, может уже ждать доставки
+    for (const JobSharedPtr& job : m_delivering) {
+        isCancelled(job);
+    }
+}
+
+int ImageLoader::pendingCount() const
+{
+    QMutexLocker locker{ &m_mutex };
+    return m_stages[ReadStage].queue.size() + m_stages[DecodeStage].queue.size() + m_running.size() + m_delivering.size();
+}
+
+ImageLoader::JobSharedPtr ImageLoader::takeJob(Stage stage)
+{
+    QMutexLocker locker{ &m_mutex };
+    StageState& state = m_stages[stage];
+    if (state.queue.isEmpty() || (stage == ReadStage && isReadingSuspended())) {
+        --state.workerCount;
+        return nullptr;
+    }
+    JobSharedPtr job = state.queue.takeLast();
+    m_running.append(job);
+    if (stage == DecodeStage) {
+        // в очереди декодирования освободилось место - чтение можно продолжить
+        startWorkers();
+    }
+    return job;
+}
+
+void ImageLoader::readJob(const JobSharedPtr& job)
+{
+    QElapsedTimer timer;
+    timer.start();
+    ImageLoadingTask& task = *job->task;
+    ThumbnailDecoder decoder{ task.thumbnailSize, job->store.get() };
+    qCDebug(lcImageLoader) << "Reading" << task.imageFileName << "..";
+    if (task.sketch) {
+        job->encoded = decoder.readSketch(task.imageFileName, &job->cancelled);
+    } else {
+        job->encoded = decoder.read(task.imageFileName, &job->cancelled, task.prefetch);
+    }
+    qint64 elapsed = timer.nsecsElapsed();
+
+    QMutexLocker locker{ &m_mutex };
+    m_running.removeOne(job);
+    ImageLoaderStageStatistics& statistics = m_stages[ReadStage].statistics;
+    ++statistics.jobs;
+    statistics.bytes += job->encoded.data.size() + job->encoded.storedThumbnail.sizeInBytes();
+    statistics.nanoseconds += elapsed;
+    if (job->cancelled) {
+        qCDebug(lcImageLoader) << "Reading" << task.imageFileName << "canceled";
+        return;
+    }
+    if (task.sketch && job->encoded.data.isEmpty() && job->encoded.storedThumbnail.isNull()) {
+        // наброска нет: пустой результат доставляется сразу, чтобы вид
+        // больше не ставил набросок этого изображения
+        m_delivering.append(job);
+        locker.unlock();
+        deliver(job);
+        return;
+    }
+    // ошибка чтения тоже передается дальше: декодирование вернет пустой эскиз
+    job->stage = DecodeStage;
+    enqueue(job);
+    startWorkers();
+}
+
+void ImageLoader::decodeJob(const JobSharedPtr& job)
+{
+    QElapsedTimer timer;
+    timer.start();
+    ImageLoadingTask& task = *job->task;
+    if (task.sketch) {
+        ThumbnailDecoder decoder{ task.thumbnailSize, job->store.get() };
+        task.image = decoder.decodeSketch(job->encoded);
+        job->encoded = EncodedImage();
+    } else if (task.image.isNull()) {
+        ThumbnailDecoder decoder{ task.thumbnailSize, job->store.get() };
+        qCDebug(lcImageLoader) << "Decoding" << task.imageFileName << "..";
+        task.image = decoder.decode(job->encoded, &job->cancelled);
+        job->encoded = EncodedImage();
+    }
+    if (!job->cancelled && !task.image.isNull() && task.tileSize.isValid()) {
+        task.tileImage = ThumbnailDecoder::renderTile(task.image, task.tileSize, task.devicePixelRatio);
+    }
+    qint64 elapsed = timer.nsecsElapsed();
+    {
+        QMutexLocker locker{ &m_mutex };
+        m_running.removeOne(job);
+        ImageLoaderStageStatistics& statistics = m_stages[DecodeStage].statistics;
+        ++statistics.jobs;
+        statistics.bytes += task.image.sizeInBytes() + task.tileImage.sizeInBytes();
+        statistics.nanoseconds += elapsed;
+        if (job->cancelled) {
+            qCDebug(lcImageLoader) << "Loading" << task.imageFileName << "canceled";
+            return;
+        }
+        // задача переходит в m_delivering под той же блокировкой, поэтому
+        // cancel() застает ее либо выполняющейся, либо ожидающей доставки
+        m_delivering.append(job);
+    }
+    deliver(job);
+}
+
+void ImageLoader::deliver(const JobSharedPtr& job)
+{
+    // результат доставляется в поток объекта; задача могла быть отменена и там
+    QMetaObject::invokeMethod(this, [this, job] {
+        {
+            QMutexLocker locker{ &m_mutex };
+            m_delivering.removeOne(job);
+        }
+        if (!job->cancelled) {
+            emit imageLoaded(job->task);
+        }
+    }, Qt::QueuedConnection);
+}
+
+void ImageLoader::enqueue(const JobSharedPtr& job)
+{
+    // очередь упорядочена по убыванию значения приоритета
+    JobQueue& queue = m_stages[job->stage].queue;
+    auto position = std::upper_bound(queue.begin(), queue.end(), job, [](const JobSharedPtr& a, const JobSharedPtr& b) {
+        return a->task->priority > b->task->priority;
+    });
+    queue.insert(position, job);
+}
+
+bool ImageLoader::isReadingSuspended() const
+{
+    const StageState& decodeStage = m_stages[DecodeStage];
+    return decodeStage.queue.size() >= decodeStage.queueDepth;
+}
+
+void ImageLoader::startWorkers()
+{
+    for (int stage = ReadStage; stage <= DecodeStage; ++stage) {
+        StageState& state = m_stages[stage];
+        int wantedWorkerCount = qMin(state.queue.size(), state.threadPool.maxThreadCount());
+        if (stage == ReadStage && isReadingSuspended()) {
+            wantedWorkerCount = 0;
+        }
+        while (state.workerCount < wantedWorkerCount) {
+            ++state.workerCount;
+            state.threadPool.start(new Worker{ this, Stage(stage) });
+        }
+    }
+}
@@ -0,0 +1,291 @@
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include "thumbnaildecoder.h"
+
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QThreadPool>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+
+class ThumbnailStore;
+
+/**
+ * @brief The ImageLoadingTask struct
+ * Вспомогательная структура для фоновой загрузки
+ */
+struct ImageLoadingTask {
+    int row;
+    /**
+     * @brief imageId постоянный идентификатор изображения, см. ImageListModel::ImageIdRole
+     */
+    quint32 imageId;
+    QString imageFileName;
+    QSize thumbnailSize;
+    /**
+     * @brief level уровень разрешения эскиза, см. ThumbnailDecoder::resolutionLevel()
+     */
+    int level;
+    /**
+     * @brief tileSize логический размер плитки для tileImage или пустой размер,
+     * если готовая плитка не нужна
+     */
+    QSize tileSize;
+    qreal devicePixelRatio;
+    /**
+     * @brief priority приоритет задачи, меньшее значение загружается раньше
+     */
+    int priority;
+    /**
+     * @brief sketch задача первого прохода: только набросок нулевого уровня
+     * (ThumbnailDecoder::readSketch() и decodeSketch()); если наброска нет,
+     * доставляется пустое изображение
+     */
+    bool sketch;
+    /**
+     * @brief prefetch задача упреждающей загрузки строки вне видового окна
+     */
+    bool prefetch;
+    /**
+     * @brief image эскиз уровня level; если задан заранее, задача его только масштабирует
+     */
+    QImage image;
+    /**
+     * @brief tileImage эскиз точно в размер плитки в физических пикселях,
+     * готовый к преобразованию в QPixmap без масштабирования и смены формата
+     */
+    QImage tileImage;
+};
+using ImageLoadingTaskSharedPtr = std::shared_ptr<ImageLoadingTask>;
+
+/**
+ * @brief The ImageLoaderStageStatistics struct
+ * Счетчики этапа загрузчика: число выполненных задач, объем их результатов
+ * (прочитанных данных или декодированных изображений) и суммарное время работы
+ * потоков этапа. Пропускная способность этапа - jobs / nanoseconds * threadCount.
+ */
+struct ImageLoaderStageStatistics {
+    quint64 jobs = 0;
+    qint64 bytes = 0;
+    qint64 nanoseconds = 0;
+};
+
+/**
+ * @brief The ImageLoaderStatistics struct
+ * Счетчики этапов чтения и декодирования загрузчика
+ */
+struct ImageLoaderStatistics {
+    ImageLoaderStageStatistics read;
+    ImageLoaderStageStatistics decode;
+};
+
+/**
+ * @brief The ImageLoader class
+ * ImageLoader - загрузчик эскизов с очередями по приоритету, разделенный на два этапа
+ * с собственными пулами потоков. Этап чтения (небольшой пул, по умолчанию 2 потока)
+ * читает данные файлов в память, чтобы параллельные чтения не перегружали
+ * HDD и сетевые диски; этап декодирования (пул по числу ядер) декодирует их из
+ * памяти через CancellableBuffer. Очередь декодирования ограничена по глубине: когда она
+ * заполнена, чтение приостанавливается, поэтому прочитанные, но еще не
+ * декодированные данные не накапливаются в памяти.
+ * Каждый вызов schedule() задает полный набор нужных задач: приоритеты уже
+ * поставленных задач обновляются, задачи вне набора удаляются из очередей,
+ * а выполняющиеся - прерываются кооперативно через CancellableFile.
+ * Помимо эскиза уровня разрешения задача готовит в рабочем потоке плитку
+ * точного размера, чтобы потоку GUI оставалось только скопировать ее на экран.
+ * Задачи набросков (ImageLoadingTask::sketch) существуют независимо от задач
+ * эскизов того же изображения; этап чтения лишь читает их данные, а декодируются
+ * они на этапе декодирования раньше эскизов благодаря меньшему значению приоритета.
+ */
+class ImageLoader : public QObject {
+    Q_OBJECT
+public:
+    /**
+     * @brief The Stage enum
+     * Этапы загрузки
+     */
+    enum Stage {
+        ReadStage,
+        DecodeStage
+    };
+
+    explicit ImageLoader(QObject* parent = Q_NULLPTR);
+    ~ImageLoader();
+
+    // ImageLoader interface
+public:
+    /**
+     * @brief setThumbnailStore устанавливает хранилище эскизов для новых задач
+     * @param thumbnailStore хранилище эскизов или nullptr
+     */
+    void setThumbnailStore(std::shared_ptr<const ThumbnailStore> thumbnailStore);
+    /**
+     * @brief threadCount возвращает число потоков этапа stage
+     * @param stage
+     * @return число потоков
+     */
+    int threadCount(Stage stage) const;
+    /**
+     * @brief setThreadCount устанавливает число потоков этапа stage
+     * @param stage
+     * @param threadCount
+     */
+    void setThreadCount(Stage stage, int threadCount);
+    /**
+     * @brief queueDepth возвращает глубину очереди этапа stage
+     * @param stage
+     * @return наибольшее число задач в очереди этапа
+     */
+    int queueDepth(Stage stage) const;
+    /**
+     * @brief setQueueDepth устанавливает глубину очереди этапа stage. Из очереди
+     * чтения задачи сверх глубины отбрасываются начиная с наименее приоритетных;
+     * при заполненной очереди декодирования чтение приостанавливается.
+     * @param stage
+     * @param queueDepth
+     */
+    void setQueueDepth(Stage stage, int queueDepth);
+    /**
+     * @brief statistics возвращает счетчики этапов
+     * @return счетчики этапов чтения и декодирования
+     */
+    ImageLoaderStatistics statistics() const;
+    /**
+     * @brief resetStatistics обнуляет счетчики этапов
+     */
+    void resetStatistics();
+    /**
+     * @brief schedule заменяет набор нужных задач набором tasks
+     * @param tasks задачи; задачи с тем же файлом и размером эскиза не перезапускаются
+     */
+    void schedule(const QList<ImageLoadingTask>& tasks);
+    /**
+     * @brief cancelAll удаляет все задачи из очереди и прерывает выполняющиеся
+     */
+    void cancelAll();
+    /**
+     * @brief cancel удаляет из очереди и прерывает задачи изображений imageIds,
+     * чтобы их результаты, полученные из прежнего содержимого файлов, не были доставлены
+     * @param imageIds
+     */
+    void cancel(const QSet<quint32>& imageIds);
+    /**
+     * @brief pendingCount возвращает число поставленных, выполняющихся и еще не
+     * доставленных задач
+     * @return число незавершенных задач
+     */
+    int pendingCount() const;
+
+signals:
+    /**
+     * @brief imageLoaded сообщает о загрузке эскиза (в потоке объекта)
+     * @param task задача с загруженным изображением
+     */
+    void imageLoaded(const ImageLoadingTaskSharedPtr& task);
+
+private:
+    class Worker;
+    struct Job {
+        ImageLoadingTaskSharedPtr task;
+        std::shared_ptr<const ThumbnailStore> store;
+        std::atomic_bool cancelled{ false };
+        Stage stage;
+        /**
+         * @brief encoded данные, прочитанные этапом чтения для этапа декодирования
+         */
+        EncodedImage encoded;
+    };
+    using JobSharedPtr = std::shared_ptr<Job>;
+    using JobQueue = QVector<JobSharedPtr>;
+
+    /**
+     * @brief The StageState struct
+     * Пул потоков, очередь и счетчики этапа
+     */
+    struct StageState {
+        QThreadPool threadPool;
+        /**
+         * @brief queue очередь задач, отсортированная по убыванию значения приоритета
+         * (следующая задача - последняя)
+         */
+        JobQueue queue;
+        int queueDepth = 0;
+        /**
+         * @brief workerCount число запущенных рабочих потоков
+         */
+        int workerCount = 0;
+        ImageLoaderStageStatistics statistics;
+    };
+
+    /**
+     * @brief takeJob извлекает из очереди этапа stage задачу с наименьшим значением
+     * приоритета; вызывающий рабочий поток завершается, если задачи нет
+     * @param stage
+     * @return задача или nullptr, если очередь пуста или чтение приостановлено
+     */
+    JobSharedPtr takeJob(Stage stage);
+    /**
+     * @brief readJob выполняет этап чтения задачи и передает ее на декодирование
+     * @param job
+     */
+    void readJob(const JobSharedPtr& job);
+    /**
+     * @brief decodeJob выполняет этап декодирования задачи и доставляет результат
+     * @param job
+     */
+    void decodeJob(const JobSharedPtr& job);
+    /**
+     * @brief deliver передает результат задачи в поток объекта сигналом imageLoaded();
+     * задача к этому времени уже перенесена из m_running в m_delivering
+     * @param job
+     */
+    void deliver(const JobSharedPtr& job);
+    /**
+     * @brief enqueue ставит задачу в очередь ее этапа с учетом приоритета,
+     * вызывается под m_mutex
+     * @param job
+     */
+    void enqueue(const JobSharedPtr& job);
+    /**
+     * @brief isReadingSuspended проверяет, заполнена ли очередь декодирования,
+     * вызывается под m_mutex
+     * @return true, если чтение надо приостановить
+     */
+    bool isReadingSuspended() const;
+    /**
+     * @brief startWorkers запускает недостающие рабочие потоки этапов, вызывается под m_mutex
+     */
+    void startWorkers();
+
+private:
+    /**
+     * @brief m_stages состояние этапов чтения и декодирования
+     */
+    StageState m_stages[2];
+    /**
+     * @brief m_thumbnailStore хранилище эскизов для новых задач
+     */
+    std::shared_ptr<const ThumbnailStore> m_thumbnailStore;
+    /**
+     * @brief m_mutex защищает очереди, списки выполняющихся задач и счетчики
+     */
+    mutable QMutex m_mutex;
+    /**
+     * @brief m_running выполняющиеся задачи обоих этапов
+     */
+    QList<JobSharedPtr> m_running;
+    /**
+     * @brief m_delivering выполненные задачи, результат которых еще не доставлен
+     * в поток объекта; cancel() отменяет и их
+     */
+    QList<JobSharedPtr> m_delivering;
+};
+
+#endif // IMAGELOADER_H
@@ -0,0 +1,329 @@
+#include "imagescaler.h"
+
+#include <QVector>
+#include <QtMath>
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGESCALER_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define IMAGESCALER_AVX2
+#define IMAGESCALER_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER)
+#define IMAGESCALER_AVX2
+#define IMAGESCALER_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IMAGESCALER_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+/**
+ * @brief The Contribution struct
+ * Пиксели источника, покрываемые одним пикселем результата: first, first + 1, ...
+ * с весами weights[weightOffset], weights[weightOffset + 1], ...
+ */
+struct Contribution {
+    int first;
+    int count;
+    int weightOffset;
+};
+
+/**
+ * @brief The BoxFilter struct
+ * Веса усреднения по площади вдоль одной оси
+ */
+struct BoxFilter {
+    QVector<Contribution> contributions;
+    QVector<float> weights;
+};
+
+// веса меньше этой доли пикселя не учитываются
+const double minCoverage = 1e-6;
+
+BoxFilter boxFilter(int sourceSize, int targetSize)
+{
+    // пиксель результата i покрывает отрезок источника [i * scale, (i + 1) * scale)
+    BoxFilter filter;
+    filter.contributions.reserve(targetSize);
+    double scale = double(sourceSize) / targetSize;
+    for (int i = 0; i < targetSize; ++i) {
+        double begin = i * scale;
+        double end = qMin((i + 1) * scale, double(sourceSize));
+        int first = qMin(int(begin), sourceSize - 1);
+        int last = qMin(int(std::ceil(end)), sourceSize) - 1;
+        Contribution contribution{ -1, 0, filter.weights.size() };
+        for (int j = first; j <= last; ++j) {
+            double coverage = qMin(end, j + 1.0) - qMax(begin, double(j));
+            if (coverage < minCoverage) {
+                continue;
+            }
+            if (contribution.first < 0) {
+                contribution.first = j;
+            }
+            ++contribution.count;
+            filter.weights.append(float(coverage / (end - begin)));
+        }
+        filter.contributions.append(contribution);
+    }
+    return filter;
+}
+
+// accumulator[i] = сумма rows[r][i] * weights[r] по rowCount строкам источника для
+// count байтов; столбец из нескольких регистров суммируется по всем строкам сразу,
+// поэтому сумматор записывается в память один раз на строку результата
+using AccumulateFunction = void (*)(float* accumulator, const uchar* const* rows, const float* weights, int rowCount, int count);
+
+void accumulateScalar(float* accumulator, const uchar* const* rows, const float* weights, int rowCount, int count, int first = 0)
+{
+    for (int i = first; i < count; ++i) {
+        float sum = 0;
+        for (int r = 0; r < rowCount; ++r) {
+            sum += rows[r][i] * weights[r];
+        }
+        accumulator[i] = sum;
+    }
+}
+
+void accumulateScalarKernel(float* accumulator, const uchar* const* rows, const float* weights, int rowCount, int count)
+{
+    accumulateScalar(accumulator, rows, weights, rowCount, count);
+}
+
+#if defined(IMAGESCALER_SSE2)
+void accumulateSse2(float* accumulator, const uchar* const* rows, const float* weights, int rowCount, int count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        __m128 sum2 = _mm_setzero_ps();
+        __m128 sum3 = _mm_setzero_ps();
+        for (int r = 0; r < rowCount; ++r) {
+            const __m128 w = _mm_set1_ps(weights[r]);
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[r] + i));
+            __m128i low = _mm_unpacklo_epi8(bytes, zero);
+            __m128i high = _mm_unpackhi_epi8(bytes, zero);
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), w));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), w));
+            sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), w));
+            sum3 = _mm_add_ps(sum3, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), w));
+        }
+        _mm_storeu_ps(accumulator + i, sum0);
+        _mm_storeu_ps(accumulator + i + 4, sum1);
+        _mm_storeu_ps(accumulator + i + 8, sum2);
+        _mm_storeu_ps(accumulator + i + 12, sum3);
+    }
+    accumulateScalar(accumulator, rows, weights, rowCount, count, i);
+}
+#endif
+
+#if defined(IMAGESCALER_AVX2)
+IMAGESCALER_TARGET_AVX2 void accumulateAvx2(float* accumulator, const uchar* const* rows, const float* weights, int rowCount, int count)
+{
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        __m256 sum2 = _mm256_setzero_ps();
+        __m256 sum3 = _mm256_setzero_ps();
+        for (int r = 0; r < rowCount; ++r) {
+            const __m256 w = _mm256_set1_ps(weights[r]);
+            __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[r] + i));
+            __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[r] + i + 16));
+            sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(low)), w));
+            sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(low, 8))), w));
+            sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(high)), w));
+            sum3 = _mm256_add_ps(sum3, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(high, 8))), w));
+        }
+        _mm256_storeu_ps(accumulator + i, sum0);
+        _mm256_storeu_ps(accumulator + i + 8, sum1);
+        _mm256_storeu_ps(accumulator + i + 16, sum2);
+        _mm256_storeu_ps(accumulator + i + 24, sum3);
+    }
+    accumulateScalar(accumulator, rows, weights, rowCount, count, i);
+}
+
+bool cpuHasAvx2()
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    int info[4];
+    __cpuid(info, 1);
+    // OSXSAVE и AVX: система сохраняет регистры YMM
+    bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#endif
+}
+#endif
+
+#if defined(IMAGESCALER_NEON)
+void accumulateNeon(float* accumulator, const uchar* const* rows, const float* weights, int rowCount, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        float32x4_t sum0 = vdupq_n_f32(0);
+        float32x4_t sum1 = vdupq_n_f32(0);
+        float32x4_t sum2 = vdupq_n_f32(0);
+        float32x4_t sum3 = vdupq_n_f32(0);
+        for (int r = 0; r < rowCount; ++r) {
+            const float32x4_t w = vdupq_n_f32(weights[r]);
+            uint8x16_t bytes = vld1q_u8(rows[r] + i);
+            uint16x8_t low = vmovl_u8(vget_low_u8(bytes));
+            uint16x8_t high = vmovl_u8(vget_high_u8(bytes));
+            sum0 = vmlaq_f32(sum0, vcvtq_f32_u32(vmovl_u16(vget_low_u16(low))), w);
+            sum1 = vmlaq_f32(sum1, vcvtq_f32_u32(vmovl_u16(vget_high_u16(low))), w);
+            sum2 = vmlaq_f32(sum2, vcvtq_f32_u32(vmovl_u16(vget_low_u16(high))), w);
+            sum3 = vmlaq_f32(sum3, vcvtq_f32_u32(vmovl_u16(vget_high_u16(high))), w);
+        }
+        vst1q_f32(accumulator + i, sum0);
+        vst1q_f32(accumulator + i + 4, sum1);
+        vst1q_f32(accumulator + i + 8, sum2);
+        vst1q_f32(accumulator + i + 12, sum3);
+    }
+    accumulateScalar(accumulator, rows, weights, rowCount, count, i);
+}
+#endif
+
+AccumulateFunction accumulateFunction(ImageScaler::Kernel kernel)
+{
+    switch (kernel) {
+#if defined(IMAGESCALER_SSE2)
+    case ImageScaler::Sse2Kernel:
+        return accumulateSse2;
+#endif
+#if defined(IMAGESCALER_AVX2)
+    case ImageScaler::Avx2Kernel:
+        return accumulateAvx2;
+#endif
+#if defined(IMAGESCALER_NEON)
+    case ImageScaler::NeonKernel:
+        return accumulateNeon;
+#endif
+    default:
+        return accumulateScalarKernel;
+    }
+}
+
+uchar roundedByte(float value)
+{
+    return uchar(qBound(0, int(value + 0.5f), 255));
+}
+}
+
+ImageScaler::Kernel ImageScaler::defaultKernel()
+{
+    static const Kernel kernel = [] {
+        for (Kernel kernel : { Avx2Kernel, NeonKernel, Sse2Kernel }) {
+            if (isKernelSupported(kernel)) {
+                return kernel;
+            }
+        }
+        return ScalarKernel;
+    }();
+    return kernel;
+}
+
+bool ImageScaler::isKernelSupported(Kernel kernel)
+{
+    switch (kernel) {
+    case ScalarKernel:
+        return true;
+#if defined(IMAGESCALER_SSE2)
+    case Sse2Kernel:
+        return true;
+#endif
+#if defined(IMAGESCALER_AVX2)
+    case Avx2Kernel: {
+        static const bool supported = cpuHasAvx2();
+        return supported;
+    }
+#endif
+#if defined(IMAGESCALER_NEON)
+    case NeonKernel:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+const char* ImageScaler::kernelName(Kernel kernel)
+{
+    switch (kernel) {
+    case Sse2Kernel:
+        return "sse2";
+    case Avx2Kernel:
+        return "avx2";
+    case NeonKernel:
+        return "neon";
+    default:
+        return "scalar";
+    }
+}
+
+QImage ImageScaler::scaled(const QImage& image, const QSize& size, Kernel kernel)
+{
+    if (image.isNull() || size.isEmpty()) {
+        return QImage();
+    }
+    if (size.width() > image.width() || size.height() > image.height()) {
+        return image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+    QImage::Format format = image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    QImage source = image.format() == format ? image : image.convertToFormat(format);
+    if (size == source.size()) {
+        return source;
+    }
+    QImage result{ size, format };
+    if (result.isNull()) {
+        return result;
+    }
+    AccumulateFunction accumulate = accumulateFunction(isKernelSupported(kernel) ? kernel : ScalarKernel);
+    BoxFilter horizontal = boxFilter(source.width(), size.width());
+    BoxFilter vertical = boxFilter(source.height(), size.height());
+    int rowLength = source.width() * 4;
+    QVector<float> accumulator(rowLength);
+    QVector<const uchar*> rowPointers;
+    for (int y = 0; y < size.height(); ++y) {
+        // вертикальный проход: взвешенная сумма строк источника, покрываемых строкой y
+        const Contribution& rows = vertical.contributions.at(y);
+        rowPointers.resize(rows.count);
+        for (int k = 0; k < rows.count; ++k) {
+            rowPointers[k] = source.constScanLine(rows.first + k);
+        }
+        accumulate(accumulator.data(), rowPointers.constData(), vertical.weights.constData() + rows.weightOffset, rows.count, rowLength);
+        // горизонтальный проход по уже уменьшенной по высоте строке
+        uchar* target = result.scanLine(y);
+        for (int x = 0; x < size.width(); ++x) {
+            const Contribution& columns = horizontal.contributions.at(x);
+            const float* pixel = accumulator.constData() + columns.first * 4;
+            const float* weight = horizontal.weights.constData() + columns.weightOffset;
+            float sum[4] = { 0, 0, 0, 0 };
+            for (int k = 0; k < columns.count; ++k, pixel += 4) {
+                sum[0] += pixel[0] * weight[k];
+                sum[1] += pixel[1] * weight[k];
+                sum[2] += pixel[2] * weight[k];
+                sum[3] += pixel[3] * weight[k];
+            }
+            target[x * 4] = roundedByte(sum[0]);
+            target[x * 4 + 1] = roundedByte(sum[1]);
+            target[x * 4 + 2] = roundedByte(sum[2]);
+            target[x * 4 + 3] = roundedByte(sum[3]);
+        }
+    }
+    result.setDevicePixelRatio(image.devicePixelRatio());
+    return result;
+}
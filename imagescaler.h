@@ -0,0 +1,64 @@
+#ifndef IMAGESCALER_H
+#define IMAGESCALER_H
+
+#include <QImage>
+#include <QSize>
+
+/**
+ * @brief The ImageScaler class
+ * ImageScaler - уменьшение изображений усреднением по площади (box-фильтр с
+ * дробным покрытием пикселей, то же, что Qt::SmoothTransformation при уменьшении).
+ * Фильтр раздельный: вертикальный проход суммирует строки источника с весами
+ * векторными инструкциями (SSE2, AVX2 или NEON, выбираются во время выполнения),
+ * горизонтальный проход выполняется уже над уменьшенным по высоте рядом.
+ * Работает с форматами ARGB32_Premultiplied и RGB32, прочие форматы
+ * предварительно преобразуются. Методы класса безопасны для вызова из
+ * нескольких потоков одновременно.
+ */
+class ImageScaler {
+public:
+    /**
+     * @brief The Kernel enum
+     * Реализации вертикального прохода
+     */
+    enum Kernel {
+        ScalarKernel,
+        Sse2Kernel,
+        Avx2Kernel,
+        NeonKernel
+    };
+
+    // ImageScaler interface
+public:
+    /**
+     * @brief defaultKernel возвращает самую быструю реализацию, поддерживаемую процессором
+     * @return реализация вертикального прохода
+     */
+    static Kernel defaultKernel();
+    /**
+     * @brief isKernelSupported проверяет, собрана ли реализация kernel и поддерживает
+     * ли ее процессор
+     * @param kernel
+     * @return true, если реализацию можно использовать
+     */
+    static bool isKernelSupported(Kernel kernel);
+    /**
+     * @brief kernelName возвращает имя реализации для отчетов
+     * @param kernel
+     * @return имя реализации
+     */
+    static const char* kernelName(Kernel kernel);
+    /**
+     * @brief scaled масштабирует image до размера size без сохранения пропорций.
+     * Уменьшение выполняется усреднением по площади, увеличение (по любой из осей)
+     * передается QImage::scaled() с Qt::SmoothTransformation.
+     * @param image
+     * @param size
+     * @param kernel реализация вертикального прохода; неподдерживаемая заменяется скалярной
+     * @return изображение размера size в формате ARGB32_Premultiplied или RGB32
+     * с devicePixelRatio исходного изображения
+     */
+    static QImage scaled(const QImage& image, const QSize& size, Kernel kernel = defaultKernel());
+};
+
+#endif // IMAGESCALER_H
@@ -0,0 +1,374 @@
+#include "imagetileview.h"
+#include "logging.h"
+#include "tiledimagesource.h"
+#include "trace.h"
+
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <QWheelEvent>
+#include <QtConcurrent>
+#include <QtMath>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// наибольшее увеличение: пикселей экрана на пиксель изображения
+const qreal maxScale = 32;
+// изменение масштаба на одно деление колеса и нажатие клавиши
+const qreal scaleStep = 1.25;
+}
+
+ImageTileView::ImageTileView(QWidget* parent)
+    : QAbstractScrollArea(parent)
+{
+    setCacheMemoryBudget(128);
+    viewport()->setCursor(Qt::OpenHandCursor);
+    setFocusPolicy(Qt::StrongFocus);
+}
+
+ImageTileView::~ImageTileView()
+{
+    for (auto&& cancelled : m_pendingTiles) {
+        *cancelled = true;
+    }
+    m_threadPool.clear();
+    m_threadPool.waitForDone();
+}
+
+bool ImageTileView::open(const QString& fileName)
+{
+    for (auto&& cancelled : m_pendingTiles) {
+        *cancelled = true;
+    }
+    m_pendingTiles.clear();
+    m_tileCache.clear();
+    auto source = std::make_shared<TiledImageSource>(fileName);
+    if (!source->isValid()) {
+        m_errorString = source->errorString();
+        m_source.reset();
+        viewport()->update();
+        return false;
+    }
+    m_errorString.clear();
+    m_source = source;
+    qCDebug(lcImageTileView) << "Opened" << fileName << m_source->size() << "levels:" << m_source->levelCount()
+                             << "region decoding:" << m_source->hasRegionDecoding();
+    fitToWindow();
+    return true;
+}
+
+QString ImageTileView::errorString() const
+{
+    return m_errorString;
+}
+
+qreal ImageTileView::scale() const
+{
+    return m_scale;
+}
+
+void ImageTileView::setScale(qreal scale, const QPoint& anchor)
+{
+    if (!m_source) {
+        return;
+    }
+    m_fitToWindow = false;
+    QSize size = displaySize();
+    qreal fitScale = qMin(qreal(viewport()->width()) / size.width(), qreal(viewport()->height()) / size.height());
+    QPointF imagePoint = imageTransform().inverted().map(QPointF(anchor));
+    m_scale = qBound(qMin(fitScale, qreal(1)), scale, maxScale);
+    updateScrollBars();
+    // точка изображения под anchor остается на месте
+    QPointF offset = imageTransform().map(imagePoint) - QPointF(anchor);
+    horizontalScrollBar()->setValue(horizontalScrollBar()->value() + qRound(offset.x()));
+    verticalScrollBar()->setValue(verticalScrollBar()->value() + qRound(offset.y()));
+    viewport()->update();
+    requestVisibleTiles();
+}
+
+void ImageTileView::fitToWindow()
+{
+    if (!m_source) {
+        return;
+    }
+    m_fitToWindow = true;
+    QSize size = displaySize();
+    m_scale = qMin(qreal(viewport()->width()) / size.width(), qreal(viewport()->height()) / size.height());
+    m_scale = qBound(qreal(1) / (1 << 24), m_scale, maxScale);
+    updateScrollBars();
+    viewport()->update();
+    requestVisibleTiles();
+}
+
+int ImageTileView::cacheMemoryBudget() const
+{
+    return m_tileCache.maxCost() / 1024;
+}
+
+void ImageTileView::setCacheMemoryBudget(int megabytes)
+{
+    m_tileCache.setMaxCost(qMax(1, megabytes) * 1024);
+}
+
+void ImageTileView::scrollContentsBy(int dx, int dy)
+{
+    Q_UNUSED(dx);
+    Q_UNUSED(dy);
+    // плитки рисуются по преобразованию, а не сдвигом уже нарисованного
+    viewport()->update();
+    requestVisibleTiles();
+}
+
+void ImageTileView::paintEvent(QPaintEvent* event)
+{
+    TRACE_SCOPE("tileview.paint");
+    QPainter painter{ viewport() };
+    painter.fillRect(event->rect(), palette().dark());
+    if (!m_source) {
+        painter.setPen(palette().color(QPalette::BrightText));
+        painter.drawText(viewport()->rect(), Qt::AlignCenter | Qt::TextWordWrap, m_errorString);
+        return;
+    }
+    painter.setTransform(imageTransform());
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    int level = levelForScale();
+    auto drawLevel = [&](int drawnLevel) {
+        int scale = 1 << drawnLevel;
+        QRect tiles = visibleTiles(drawnLevel);
+        for (int row = tiles.top(); row <= tiles.bottom(); ++row) {
+            for (int column = tiles.left(); column <= tiles.right(); ++column) {
+                QPixmap* pixmap = m_tileCache.object(tileKey(drawnLevel, column, row));
+                if (pixmap) {
+                    QRect rect = m_source->tileRect(drawnLevel, column, row);
+                    painter.drawPixmap(QRectF(rect.x() * scale, rect.y() * scale, rect.width() * scale, rect.height() * scale),
+                        *pixmap, QRectF(pixmap->rect()));
+                }
+            }
+        }
+    };
+    // недостающие плитки уровня закрываются плитками менее подробных уровней,
+    // нарисованными под ним от грубого к подробному
+    QRect tiles = visibleTiles(level);
+    bool complete = true;
+    for (int row = tiles.top(); row <= tiles.bottom() && complete; ++row) {
+        for (int column = tiles.left(); column <= tiles.right() && complete; ++column) {
+            complete = m_tileCache.contains(tileKey(level, column, row));
+        }
+    }
+    if (!complete) {
+        for (int coarserLevel = m_source->levelCount() - 1; coarserLevel > level; --coarserLevel) {
+            drawLevel(coarserLevel);
+        }
+    }
+    drawLevel(level);
+}
+
+void ImageTileView::resizeEvent(QResizeEvent* event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    if (m_fitToWindow) {
+        fitToWindow();
+    } else {
+        updateScrollBars();
+        requestVisibleTiles();
+    }
+}
+
+void ImageTileView::wheelEvent(QWheelEvent* event)
+{
+    if (!m_source || event->angleDelta().y() == 0) {
+        QAbstractScrollArea::wheelEvent(event);
+        return;
+    }
+    setScale(m_scale * qPow(scaleStep, event->angleDelta().y() / 120.0), event->pos());
+    event->accept();
+}
+
+void ImageTileView::mousePressEvent(QMouseEvent* event)
+{
+    if (event->button() != Qt::LeftButton) {
+        QAbstractScrollArea::mousePressEvent(event);
+        return;
+    }
+    m_dragging = true;
+    m_dragPosition = event->pos();
+    viewport()->setCursor(Qt::ClosedHandCursor);
+}
+
+void ImageTileView::mouseMoveEvent(QMouseEvent* event)
+{
+    if (!m_dragging) {
+        QAbstractScrollArea::mouseMoveEvent(event);
+        return;
+    }
+    QPoint delta = event->pos() - m_dragPosition;
+    m_dragPosition = event->pos();
+    horizontalScrollBar()->setValue(horizontalScrollBar()->value() - delta.x());
+    verticalScrollBar()->setValue(verticalScrollBar()->value() - delta.y());
+}
+
+void ImageTileView::mouseReleaseEvent(QMouseEvent* event)
+{
+    if (!m_dragging || event->button() != Qt::LeftButton) {
+        QAbstractScrollArea::mouseReleaseEvent(event);
+        return;
+    }
+    m_dragging = false;
+    viewport()->setCursor(Qt::OpenHandCursor);
+}
+
+void ImageTileView::keyPressEvent(QKeyEvent* event)
+{
+    QPoint center = viewport()->rect().center();
+    switch (event->key()) {
+    case Qt::Key_Plus:
+    case Qt::Key_Equal:
+        setScale(m_scale * scaleStep, center);
+        break;
+    case Qt::Key_Minus:
+        setScale(m_scale / scaleStep, center);
+        break;
+    case Qt::Key_0:
+        fitToWindow();
+        break;
+    default:
+        QAbstractScrollArea::keyPressEvent(event);
+    }
+}
+
+quint64 ImageTileView::tileKey(int level, int column, int row)
+{
+    return (quint64(level) << 56) | (quint64(quint32(column)) << 28) | quint64(quint32(row));
+}
+
+QTransform ImageTileView::imageTransform() const
+{
+    QSize size = displaySize();
+    QSizeF content = QSizeF(size) * m_scale;
+    // изображение меньше окна выравнивается по центру
+    qreal x = content.width() < viewport()->width() ? (viewport()->width() - content.width()) / 2 : -horizontalScrollBar()->value();
+    qreal y = content.height() < viewport()->height() ? (viewport()->height() - content.height()) / 2 : -verticalScrollBar()->value();
+    return m_source->transform() * QTransform::fromScale(m_scale, m_scale) * QTransform::fromTranslate(x, y);
+}
+
+QSize ImageTileView::displaySize() const
+{
+    QSize size = m_source->size();
+    if (m_source->transform().isRotating()) {
+        size.transpose();
+    }
+    return size;
+}
+
+int ImageTileView::levelForScale() const
+{
+    qreal deviceScale = m_scale * devicePixelRatioF();
+    int level = deviceScale < 1 ? qFloor(std::log2(1 / deviceScale)) : 0;
+    return qBound(m_source->finestLevel(), level, m_source->levelCount() - 1);
+}
+
+QRect ImageTileView::visibleTiles(int level) const
+{
+    QRectF imageRect = imageTransform().inverted().mapRect(QRectF(viewport()->rect()));
+    qreal tileSide = qreal(TiledImageSource::tileSide << level);
+    QSize levelSize = m_source->levelSize(level);
+    int columnCount = (levelSize.width() + TiledImageSource::tileSide - 1) / TiledImageSource::tileSide;
+    int rowCount = (levelSize.height() + TiledImageSource::tileSide - 1) / TiledImageSource::tileSide;
+    int left = qMax(0, qFloor(imageRect.left() / tileSide));
+    int top = qMax(0, qFloor(imageRect.top() / tileSide));
+    int right = qMin(columnCount - 1, qFloor(imageRect.right() / tileSide));
+    int bottom = qMin(rowCount - 1, qFloor(imageRect.bottom() / tileSide));
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
+
+void ImageTileView::updateScrollBars()
+{
+    QSize content = (QSizeF(displaySize()) * m_scale).toSize();
+    horizontalScrollBar()->setRange(0, qMax(0, content.width() - viewport()->width()));
+    verticalScrollBar()->setRange(0, qMax(0, content.height() - viewport()->height()));
+    horizontalScrollBar()->setPageStep(viewport()->width());
+    verticalScrollBar()->setPageStep(viewport()->height());
+    horizontalScrollBar()->setSingleStep(qMax(1, viewport()->width() / 10));
+    verticalScrollBar()->setSingleStep(qMax(1, viewport()->height() / 10));
+}
+
+void ImageTileView::requestVisibleTiles()
+{
+    if (!m_source) {
+        return;
+    }
+    TRACE_SCOPE("tileview.request");
+    struct Tile {
+        int level;
+        int column;
+        int row;
+        qreal distance;
+    };
+    QVector<Tile> tiles;
+    // плитка самого грубого уровня нужна всегда: ее рисуют вместо недостающих
+    int coarsestLevel = m_source->levelCount() - 1;
+    tiles.append(Tile{ coarsestLevel, 0, 0, -1 });
+    int level = levelForScale();
+    if (level != coarsestLevel) {
+        QTransform transform = imageTransform();
+        QPointF viewportCenter = QRectF(viewport()->rect()).center();
+        QRect visible = visibleTiles(level);
+        int scale = 1 << level;
+        for (int row = visible.top(); row <= visible.bottom(); ++row) {
+            for (int column = visible.left(); column <= visible.right(); ++column) {
+                QRect rect = m_source->tileRect(level, column, row);
+                QPointF center = transform.map(QPointF(rect.center().x() * scale, rect.center().y() * scale));
+                tiles.append(Tile{ level, column, row, QLineF(center, viewportCenter).length() });
+            }
+        }
+    }
+    // плитки ближе к центру окна декодируются раньше
+    std::sort(tiles.begin(), tiles.end(), [](const Tile& a, const Tile& b) { return a.distance < b.distance; });
+
+    QHash<quint64, std::shared_ptr<std::atomic_bool>> pendingTiles;
+    for (const Tile& tile : tiles) {
+        quint64 key = tileKey(tile.level, tile.column, tile.row);
+        if (m_tileCache.contains(key)) {
+            continue;
+        }
+        auto pending = m_pendingTiles.constFind(key);
+        if (pending != m_pendingTiles.constEnd()) {
+            pendingTiles.insert(key, pending.value());
+            continue;
+        }
+        auto cancelled = std::make_shared<std::atomic_bool>(false);
+        pendingTiles.insert(key, cancelled);
+        std::shared_ptr<const TiledImageSource> source = m_source;
+        QtConcurrent::run(&m_threadPool, [this, source, tile, key, cancelled] {
+            if (*cancelled) {
+                return;
+            }
+            QImage image = source->readTile(tile.level, tile.column, tile.row, cancelled.get());
+            if (*cancelled) {
+                return;
+            }
+            QMetaObject::invokeMethod(this, [this, key, cancelled, image] {
+                if (*cancelled) {
+                    return;
+                }
+                m_pendingTiles.remove(key);
+                if (!image.isNull()) {
+                    int cost = qMax(1, int(image.sizeInBytes() / 1024));
+                    m_tileCache.insert(key, new QPixmap(QPixmap::fromImage(image)), cost);
+                }
+                viewport()->update();
+            }, Qt::QueuedConnection);
+        });
+    }
+    // плитки, ушедшие из окна, не декодируются
+    for (auto it = m_pendingTiles.constBegin(); it != m_pendingTiles.constEnd(); ++it) {
+        if (!pendingTiles.contains(it.key())) {
+            *it.value() = true;
+        }
+    }
+    m_pendingTiles.swap(pendingTiles);
+    TRACE_COUNTER("tileview.pending", m_pendingTiles.size());
+}
@@ -0,0 +1,158 @@
+#ifndef IMAGETILEVIEW_H
+#define IMAGETILEVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QCache>
+#include <QHash>
+#include <QPixmap>
+#include <QPoint>
+#include <QThreadPool>
+#include <QTransform>
+
+#include <atomic>
+#include <memory>
+
+class TiledImageSource;
+
+/**
+ * @brief The ImageTileView class
+ * ImageTileView - просмотр одного изображения с масштабированием.
+ * Изображение показывается по плиткам пирамиды TiledImageSource: для текущего
+ * масштаба выбирается уровень, разрешения которого хватает для экрана, и
+ * декодируются только плитки, пересекающие видовое окно, - параллельно,
+ * от центра окна к краям. Плитки, ушедшие из окна до начала декодирования,
+ * отменяются. Готовые плитки хранятся в LRU-кеше, ограниченном объемом памяти;
+ * пока плитка не готова, на ее месте рисуются плитки менее подробных уровней.
+ * Колесо мыши масштабирует относительно курсора, перетаскивание и полосы
+ * прокрутки перемещают изображение, клавиши +, - и 0 меняют масштаб и
+ * вписывают изображение в окно.
+ */
+class ImageTileView : public QAbstractScrollArea {
+    Q_OBJECT
+public:
+    explicit ImageTileView(QWidget* parent = Q_NULLPTR);
+    ~ImageTileView();
+
+    // ImageTileView interface
+public:
+    /**
+     * @brief open показывает изображение fileName, вписанное в окно
+     * @param fileName
+     * @return true, если изображение можно показать
+     */
+    bool open(const QString& fileName);
+    /**
+     * @brief errorString возвращает причину, по которой изображение не открылось
+     * @return описание ошибки
+     */
+    QString errorString() const;
+    /**
+     * @brief scale возвращает масштаб: логических пикселей экрана на пиксель изображения
+     * @return масштаб
+     */
+    qreal scale() const;
+    /**
+     * @brief setScale устанавливает масштаб, сохраняя на месте точку anchor видового окна
+     * @param scale
+     * @param anchor точка видового окна
+     */
+    void setScale(qreal scale, const QPoint& anchor);
+    /**
+     * @brief fitToWindow вписывает изображение в видовое окно
+     */
+    void fitToWindow();
+    /**
+     * @brief cacheMemoryBudget возвращает бюджет памяти кеша плиток в мегабайтах
+     * @return бюджет памяти в мегабайтах
+     */
+    int cacheMemoryBudget() const;
+    /**
+     * @brief setCacheMemoryBudget устанавливает бюджет памяти кеша плиток
+     * @param megabytes бюджет памяти в мегабайтах
+     */
+    void setCacheMemoryBudget(int megabytes);
+
+    // QAbstractScrollArea interface
+protected:
+    virtual void scrollContentsBy(int dx, int dy) override;
+
+    // QWidget interface
+protected:
+    virtual void paintEvent(QPaintEvent* event) override;
+    virtual void resizeEvent(QResizeEvent* event) override;
+    virtual void wheelEvent(QWheelEvent* event) override;
+    virtual void mousePressEvent(QMouseEvent* event) override;
+    virtual void mouseMoveEvent(QMouseEvent* event) override;
+    virtual void mouseReleaseEvent(QMouseEvent* event) override;
+    virtual void keyPressEvent(QKeyEvent* event) override;
+
+private:
+    /**
+     * @brief tileKey упаковывает уровень и положение плитки в ключ кеша
+     */
+    static quint64 tileKey(int level, int column, int row);
+    /**
+     * @brief imageTransform возвращает преобразование координат уровня 0 в координаты видового окна
+     * @return преобразование с учетом ориентации, масштаба и прокрутки
+     */
+    QTransform imageTransform() const;
+    /**
+     * @brief displaySize возвращает размер изображения в ориентации EXIF
+     * @return размер в пикселях изображения
+     */
+    QSize displaySize() const;
+    /**
+     * @brief levelForScale возвращает уровень пирамиды для текущего масштаба
+     * @return наименее подробный уровень, разрешения которого хватает для экрана
+     */
+    int levelForScale() const;
+    /**
+     * @brief visibleTiles возвращает плитки уровня level, пересекающие видовое окно
+     * @param level
+     * @return прямоугольник номеров плиток (колонки по x, ряды по y)
+     */
+    QRect visibleTiles(int level) const;
+    /**
+     * @brief updateScrollBars выставляет диапазоны полос прокрутки по масштабу
+     */
+    void updateScrollBars();
+    /**
+     * @brief requestVisibleTiles ставит в очередь декодирование недостающих видимых
+     * плиток и отменяет ненужные
+     */
+    void requestVisibleTiles();
+
+private:
+    /**
+     * @brief m_source показываемое изображение, разделяемое с фоновыми задачами
+     */
+    std::shared_ptr<const TiledImageSource> m_source;
+    QString m_errorString;
+    /**
+     * @brief m_scale масштаб, см. scale()
+     */
+    qreal m_scale = 1;
+    /**
+     * @brief m_fitToWindow изображение вписывается в окно и при изменении его размера
+     */
+    bool m_fitToWindow = true;
+    /**
+     * @brief m_tileCache готовые плитки по tileKey(); стоимость - размер в килобайтах
+     */
+    QCache<quint64, QPixmap> m_tileCache;
+    /**
+     * @brief m_pendingTiles признаки отмены декодируемых плиток по tileKey()
+     */
+    QHash<quint64, std::shared_ptr<std::atomic_bool>> m_pendingTiles;
+    /**
+     * @brief m_threadPool потоки декодирования плиток
+     */
+    QThreadPool m_threadPool;
+    /**
+     * @brief m_dragPosition предыдущее положение курсора при перетаскивании
+     */
+    QPoint m_dragPosition;
+    bool m_dragging = false;
+};
+
+#endif // IMAGETILEVIEW_H
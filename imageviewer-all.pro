@@ -0,0 +1,16 @@
+#-------------------------------------------------
+#
+# The application and its benchmarks in one build:
+#   qmake imageviewer-all.pro && make
+# imageviewer.pro alone still builds only the application.
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    app \
+    benchmarks
+
+app.file = imageviewer.pro
+benchmarks.file = benchmarks/benchmarks.pro
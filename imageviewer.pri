@@ -0,0 +1,62 @@
+# Sources shared by the application and the benchmarks
+
+QT       += core gui concurrent
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+# qmake CONFIG+=tracing compiles in the tracing macros of trace.h;
+# without it they expand to nothing
+tracing {
+    DEFINES += IMAGEVIEWER_TRACING
+    SOURCES += $$PWD/trace.cpp
+}
+
+SOURCES += \
+    $$PWD/imagelistmodel.cpp \
+    $$PWD/imagelistview.cpp \
+    $$PWD/cancellablebuffer.cpp \
+    $$PWD/cancellablefile.cpp \
+    $$PWD/catalogindex.cpp \
+    $$PWD/catalogscanner.cpp \
+    $$PWD/directoryscanner.cpp \
+    $$PWD/directorywatcher.cpp \
+    $$PWD/embeddedpreviewreader.cpp \
+    $$PWD/imagecache.cpp \
+    $$PWD/imageloader.cpp \
+    $$PWD/imagescaler.cpp \
+    $$PWD/imagetileview.cpp \
+    $$PWD/logging.cpp \
+    $$PWD/metadatascanner.cpp \
+    $$PWD/thumbnaildecoder.cpp \
+    $$PWD/thumbnailpregenerator.cpp \
+    $$PWD/thumbnailstore.cpp \
+    $$PWD/tiffreader.cpp \
+    $$PWD/tiledimagesource.cpp \
+    $$PWD/tileanimator.cpp
+
+HEADERS += \
+    $$PWD/imagelistmodel.h \
+    $$PWD/imagelistview.h \
+    $$PWD/cancellablebuffer.h \
+    $$PWD/cancellablefile.h \
+    $$PWD/catalogindex.h \
+    $$PWD/catalogscanner.h \
+    $$PWD/directoryscanner.h \
+    $$PWD/directorywatcher.h \
+    $$PWD/embeddedpreviewreader.h \
+    $$PWD/imagecache.h \
+    $$PWD/imageloader.h \
+    $$PWD/imagescaler.h \
+    $$PWD/imagetileview.h \
+    $$PWD/logging.h \
+    $$PWD/metadatascanner.h \
+    $$PWD/thumbnaildecoder.h \
+    $$PWD/thumbnailpregenerator.h \
+    $$PWD/thumbnailstore.h \
+    $$PWD/tiffreader.h \
+    $$PWD/tiledimagesource.h \
+    $$PWD/tileanimator.h \
+    $$PWD/trace.h \
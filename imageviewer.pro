@@ -25,16 +25,14 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 
+include(imageviewer.pri)
+
 SOURCES += \
         main.cpp \
-        mainwindow.cpp \
-    imagelistmodel.cpp \
-    imagelistview.cpp
+        mainwindow.cpp
 
 HEADERS += \
-        mainwindow.h \
-    imagelistmodel.h \
-    imagelistview.h \
+        mainwindow.h
 
 FORMS += \
         mainwindow.ui
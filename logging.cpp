@@ -0,0 +1,6 @@
+#include "logging.h"
+
+Q_LOGGING_CATEGORY(lcImageListView, "imageviewer.view", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcImageLoader, "imageviewer.loader", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcImageTileView, "imageviewer.tileview", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcMainWindow, "imageviewer.ui", QtInfoMsg)
@@ -0,0 +1,16 @@
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <QLoggingCategory>
+
+/**
+ * Категории отладочного журнала. Отладочные сообщения всех категорий по умолчанию
+ * отключены и включаются правилами QLoggingCategory, например
+ * QT_LOGGING_RULES="imageviewer.view.debug=true".
+ */
+Q_DECLARE_LOGGING_CATEGORY(lcImageListView)
+Q_DECLARE_LOGGING_CATEGORY(lcImageLoader)
+Q_DECLARE_LOGGING_CATEGORY(lcImageTileView)
+Q_DECLARE_LOGGING_CATEGORY(lcMainWindow)
+
+#endif // LOGGING_H
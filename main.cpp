@@ -1,11 +1,98 @@
 #include "mainwindow.h"
+#include "thumbnailpregenerator.h"
+#include "trace.h"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QThread>
+#include <QTimer>
+#include <QtDebug>
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+/**
+ * @brief isPregenerateArgument проверяет, включает ли аргумент режим заполнения хранилища эскизов
+ */
+bool isPregenerateArgument(const char* argument)
+{
+    QByteArray option{ argument };
+    return option == "--pregenerate" || option.startsWith("--pregenerate=");
+}
+
+/**
+ * @brief printStatistics выводит счетчики и скорость заполнения: число изображений
+ * и мегабайт прочитанных файлов в секунду
+ * @param end окончание строки: "\r" для строки хода работы, "\n" для итога
+ */
+void printStatistics(const PregenerationStatistics& statistics, const char* end)
+{
+    double seconds = qMax(qint64(1), statistics.elapsedMs) / 1000.0;
+    fprintf(stderr, "%llu/%llu images (%llu generated, %llu skipped, %llu failed), %.1f images/s, %.1f MB/s%s",
+        statistics.processed, statistics.found, statistics.generated, statistics.skipped, statistics.failed,
+        statistics.generated / seconds, statistics.bytesRead / seconds / (1024 * 1024), end);
+    fflush(stderr);
+}
+
+/**
+ * @brief pregenerate заполняет хранилище эскизов без окон:
+ * imageviewer --pregenerate <dir> [--recursive] [--size N] [--jobs N]
+ * @return код завершения процесса
+ */
+int pregenerate(int argc, char* argv[])
+{
+    QCoreApplication application(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Fills the thumbnail store without opening windows"));
+    parser.addHelpOption();
+    QCommandLineOption directoryOption{ "pregenerate", "Directory whose thumbnails are generated.", "dir" };
+    QCommandLineOption recursiveOption{ "recursive", "Include subdirectories." };
+    QCommandLineOption sizeOption{ "size", "Tile size in pixels.", "n", "256" };
+    QCommandLineOption jobsOption{ "jobs", "Number of decoding threads.", "n", QString::number(QThread::idealThreadCount()) };
+    parser.addOptions({ directoryOption, recursiveOption, sizeOption, jobsOption });
+    parser.process(application);
+
+    int size = parser.value(sizeOption).toInt();
+    int jobs = parser.value(jobsOption).toInt();
+    if (jobs <= 0) {
+        qCritical() << "Invalid job count" << parser.value(jobsOption);
+        return 1;
+    }
+    if (size <= 0) {
+        qCritical() << "Invalid tile size" << parser.value(sizeOption);
+        return 1;
+    }
+    ThumbnailPregenerator pregenerator;
+    if (!pregenerator.start(parser.value(directoryOption), parser.isSet(recursiveOption), QSize(size, size), jobs)) {
+        qCritical().noquote() << pregenerator.errorString();
+        return 1;
+    }
+    QTimer progressTimer;
+    QObject::connect(&progressTimer, &QTimer::timeout, [&pregenerator] {
+        printStatistics(pregenerator.statistics(), "\r");
+    });
+    progressTimer.start(1000);
+    QObject::connect(&pregenerator, &ThumbnailPregenerator::finished, &application, &QCoreApplication::quit);
+    int result = application.exec();
+    printStatistics(pregenerator.statistics(), "\n");
+    return result;
+}
+}
 
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
-    MainWindow w;
-    w.show();
+    int result;
+    // режим заполнения хранилища не создает QApplication и потому работает без дисплея
+    if (std::any_of(argv + 1, argv + argc, isPregenerateArgument)) {
+        result = pregenerate(argc, argv);
+    } else {
+        QApplication a(argc, argv);
+        MainWindow w;
+        w.show();
 
-    return a.exec();
+        result = a.exec();
+    }
+    // в сборке с CONFIG += tracing трасса записывается в файл IMAGEVIEWER_TRACE_FILE
+    TRACE_WRITE(QString::fromLocal8Bit(qgetenv("IMAGEVIEWER_TRACE_FILE")));
+    return result;
 }
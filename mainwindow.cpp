@@ -1,10 +1,13 @@
 #include "mainwindow.h"
 #include "imagelistmodel.h"
+#include "imagetileview.h"
+#include "logging.h"
 #include "ui_mainwindow.h"
 
-#include <QDebug>
+#include <QComboBox>
 #include <QFileInfo>
 #include <QFileSystemModel>
+#include <QLineEdit>
 
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent)
@@ -23,6 +26,27 @@ MainWindow::MainWindow(QWidget* parent)
     ui->listView->setColumnCount(3);
     ui->actionThree_Columns->setChecked(true);
     ui->listView->setModel(imageListModel);
+
+    sortKeyComboBox = new QComboBox{ this };
+    sortKeyComboBox->addItem(tr("Name"), ImageListModel::SortByName);
+    sortKeyComboBox->addItem(tr("Modified"), ImageListModel::SortByModificationTime);
+    sortKeyComboBox->addItem(tr("File size"), ImageListModel::SortByFileSize);
+    sortKeyComboBox->addItem(tr("Capture date"), ImageListModel::SortByCaptureTime);
+    sortKeyComboBox->addItem(tr("Dimensions"), ImageListModel::SortByImageSize);
+    sortOrderComboBox = new QComboBox{ this };
+    sortOrderComboBox->addItem(tr("Ascending"), Qt::AscendingOrder);
+    sortOrderComboBox->addItem(tr("Descending"), Qt::DescendingOrder);
+    nameFilterEdit = new QLineEdit{ this };
+    nameFilterEdit->setPlaceholderText(tr("Filter by name"));
+    nameFilterEdit->setClearButtonEnabled(true);
+    nameFilterEdit->setMaximumWidth(200);
+    ui->mainToolBar->addSeparator();
+    ui->mainToolBar->addWidget(sortKeyComboBox);
+    ui->mainToolBar->addWidget(sortOrderComboBox);
+    ui->mainToolBar->addWidget(nameFilterEdit);
+    connect(sortKeyComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MainWindow::updateSorting);
+    connect(sortOrderComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MainWindow::updateSorting);
+    connect(nameFilterEdit, &QLineEdit::textChanged, this, &MainWindow::updateFilter);
 }
 
 MainWindow::~MainWindow()
@@ -45,9 +69,13 @@ void MainWindow::changeEvent(QEvent* e)
 void MainWindow::on_treeView_clicked(const QModelIndex& index)
 {
     QFileInfo fileInfo = fileSystemModel->fileInfo(index);
-    qDebug() << "New folder " << fileInfo.absoluteFilePath() << "has been selected";
+    qCDebug(lcMainWindow) << "New folder " << fileInfo.absoluteFilePath() << "has been selected";
     if (fileInfo.isDir()) {
-        imageListModel->loadDirectoryImageList(fileInfo.absoluteFilePath());
+        if (ui->actionCatalog->isChecked()) {
+            imageListModel->loadCatalog(fileInfo.absoluteFilePath());
+        } else {
+            imageListModel->loadDirectoryImageList(fileInfo.absoluteFilePath());
+        }
     }
 }
 
@@ -64,3 +92,40 @@ void MainWindow::on_actionThree_Columns_triggered()
     ui->actionThree_Columns->setChecked(true);
     ui->listView->setColumnCount(3);
 }
+
+void MainWindow::on_actionCatalog_triggered()
+{
+    QModelIndex index = ui->treeView->currentIndex();
+    if (index.isValid()) {
+        on_treeView_clicked(index);
+    }
+}
+
+void MainWindow::on_listView_activated(const QModelIndex& index)
+{
+    QString fileName = index.data().toString();
+    qCDebug(lcMainWindow) << "Opening" << fileName;
+    // каждое изображение открывается в отдельном окне, которое удаляется при закрытии
+    ImageTileView* view = new ImageTileView{ this };
+    view->setWindowFlags(Qt::Window);
+    view->setAttribute(Qt::WA_DeleteOnClose);
+    view->setWindowTitle(QFileInfo{ fileName }.fileName());
+    view->resize(size());
+    if (!view->open(fileName)) {
+        qWarning() << "Opening" << fileName << "failed:" << view->errorString();
+    }
+    view->show();
+}
+
+void MainWindow::updateSorting()
+{
+    imageListModel->setSorting(ImageListModel::SortKey(sortKeyComboBox->currentData().toInt()),
+        Qt::SortOrder(sortOrderComboBox->currentData().toInt()));
+}
+
+void MainWindow::updateFilter()
+{
+    ImageListFilter filter = imageListModel->filter();
+    filter.nameSubstring = nameFilterEdit->text();
+    imageListModel->setFilter(filter);
+}
@@ -7,7 +7,9 @@ namespace Ui {
 class MainWindow;
 }
 
+class QComboBox;
 class QFileSystemModel;
+class QLineEdit;
 class ImageListModel;
 
 class MainWindow : public QMainWindow {
@@ -27,10 +29,21 @@ private slots:
 
     void on_actionThree_Columns_triggered();
 
+    void on_actionCatalog_triggered();
+
+    void on_listView_activated(const QModelIndex& index);
+
+    void updateSorting();
+
+    void updateFilter();
+
 private:
     Ui::MainWindow* ui;
     QFileSystemModel* fileSystemModel;
     ImageListModel* imageListModel;
+    QComboBox* sortKeyComboBox;
+    QComboBox* sortOrderComboBox;
+    QLineEdit* nameFilterEdit;
 };
 
 #endif // MAINWINDOW_H
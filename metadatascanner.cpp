@@ -0,0 +1,129 @@
+#include "metadatascanner.h"
+#include "embeddedpreviewreader.h"
+#include "trace.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImageIOHandler>
+#include <QImageReader>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+// как и при обходе каталога, пачка публикуется по заполнении или по интервалу
+const int maxBatchSize = 1024;
+const qint64 batchInterval = 100;
+}
+
+const qint64 ImageMetadata::noCaptureTime = std::numeric_limits<qint64>::min();
+
+MetadataScanner::MetadataScanner(QObject* parent)
+    : QObject(parent)
+{
+}
+
+MetadataScanner::~MetadataScanner()
+{
+    cancel();
+    m_future.waitForFinished();
+    for (QFuture<void>& future : m_supersededFutures) {
+        future.waitForFinished();
+    }
+}
+
+ImageMetadata MetadataScanner::read(const QString& filePath)
+{
+    ImageMetadata metadata{ 0, QSize(), ImageMetadata::noCaptureTime };
+    QFile file{ filePath };
+    if (!file.open(QIODevice::ReadOnly)) {
+        return metadata;
+    }
+    EmbeddedPreviewReader previewReader{ &file };
+    QDateTime captureTime = previewReader.captureTime();
+    if (captureTime.isValid()) {
+        metadata.captureTime = captureTime.toMSecsSinceEpoch();
+    }
+    if (EmbeddedPreviewReader::isRawFileName(filePath)) {
+        // заголовки RAW Qt не читает: размер берется по самому крупному
+        // встроенному эскизу, который обычно совпадает с размером снимка
+        QList<EmbeddedPreview> previews = previewReader.previews();
+        if (!previews.isEmpty()) {
+            metadata.imageSize = previews.last().size;
+            if (previewReader.orientation() >= 5) {
+                metadata.imageSize.transpose();
+            }
+        }
+        return metadata;
+    }
+    file.seek(0);
+    QImageReader reader{ &file };
+    reader.setAutoTransform(true);
+    metadata.imageSize = reader.size();
+    if (metadata.imageSize.isValid() && (reader.transformation() & QImageIOHandler::TransformationRotate90)) {
+        metadata.imageSize.transpose();
+    }
+    return metadata;
+}
+
+void MetadataScanner::start(const QString& directoryPath, const QVector<quint32>& imageIds, const QStringList& fileNames)
+{
+    cancel();
+    // отмененная задача завершится на ближайшей проверке признака отмены:
+    // UI-поток ее не ждет, но объект не удаляется, пока она выполняется
+    m_supersededFutures.erase(std::remove_if(m_supersededFutures.begin(), m_supersededFutures.end(), [](const QFuture<void>& future) {
+        return future.isFinished();
+    }), m_supersededFutures.end());
+    if (!m_future.isFinished()) {
+        m_supersededFutures.append(m_future);
+    }
+    auto cancelled = std::make_shared<std::atomic_bool>(false);
+    m_cancelled = cancelled;
+    m_future = QtConcurrent::run([this, cancelled, directoryPath, imageIds, fileNames] {
+        auto publish = [this, cancelled](const QVector<ImageMetadata>& metadata) {
+            QMetaObject::invokeMethod(this, [this, cancelled, metadata] {
+                if (!*cancelled) {
+                    emit metadataFound(metadata);
+                }
+            }, Qt::QueuedConnection);
+        };
+        TRACE_SCOPE("metadata");
+        QVector<ImageMetadata> batch;
+        QElapsedTimer batchTimer;
+        batchTimer.start();
+        for (int i = 0; i < imageIds.size() && !*cancelled; ++i) {
+            ImageMetadata metadata = read(directoryPath + fileNames.at(i));
+            metadata.imageId = imageIds.at(i);
+            batch.append(metadata);
+            if (batch.size() >= maxBatchSize || batchTimer.hasExpired(batchInterval)) {
+                publish(batch);
+                batch.clear();
+                batchTimer.restart();
+            }
+        }
+        if (*cancelled) {
+            return;
+        }
+        if (!batch.isEmpty()) {
+            publish(batch);
+        }
+        QMetaObject::invokeMethod(this, [this, cancelled] {
+            if (!*cancelled) {
+                emit finished();
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void MetadataScanner::cancel()
+{
+    if (m_cancelled) {
+        *m_cancelled = true;
+    }
+}
+
+bool MetadataScanner::isRunning() const
+{
+    return m_future.isRunning();
+}
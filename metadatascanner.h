@@ -0,0 +1,104 @@
+#ifndef METADATASCANNER_H
+#define METADATASCANNER_H
+
+#include <QFuture>
+#include <QList>
+#include <QObject>
+#include <QSize>
+#include <QStringList>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+
+/**
+ * @brief The ImageMetadata struct
+ * Сведения об изображении, прочитанные из заголовков файла
+ */
+struct ImageMetadata {
+    /**
+     * @brief imageId идентификатор изображения, см. ImageListModel::ImageIdRole
+     */
+    quint32 imageId;
+    /**
+     * @brief imageSize размер изображения с учетом ориентации EXIF
+     * или недействительный размер, если его не удалось прочитать
+     */
+    QSize imageSize;
+    /**
+     * @brief captureTime дата съемки EXIF в миллисекундах от начала эпохи
+     * или noCaptureTime, если она не указана
+     */
+    qint64 captureTime;
+
+    static const qint64 noCaptureTime;
+};
+
+/**
+ * @brief The MetadataScanner class
+ * MetadataScanner - фоновое чтение размеров и дат съемки изображений.
+ * Читаются только заголовки файлов (QImageReader::size(), EXIF), поэтому
+ * проход по каталогу в сотни тысяч файлов не декодирует ни одного изображения.
+ * Результаты публикуются пачками в потоке объекта; новый запуск или cancel()
+ * отменяет текущий проход, и его необработанные пачки отбрасываются.
+ */
+class MetadataScanner : public QObject {
+    Q_OBJECT
+public:
+    explicit MetadataScanner(QObject* parent = Q_NULLPTR);
+    ~MetadataScanner();
+
+    // MetadataScanner interface
+public:
+    /**
+     * @brief read читает сведения об изображении из заголовков файла filePath
+     * @param filePath
+     * @return сведения об изображении с нулевым идентификатором
+     */
+    static ImageMetadata read(const QString& filePath);
+    /**
+     * @brief start запускает чтение сведений о файлах fileNames каталога
+     * directoryPath, отменяя текущее
+     * @param directoryPath путь каталога с завершающим разделителем
+     * @param imageIds идентификаторы изображений
+     * @param fileNames имена файлов в том же порядке
+     */
+    void start(const QString& directoryPath, const QVector<quint32>& imageIds, const QStringList& fileNames);
+    /**
+     * @brief cancel отменяет текущее чтение
+     */
+    void cancel();
+    /**
+     * @brief isRunning проверяет, выполняется ли чтение
+     * @return true, если чтение выполняется
+     */
+    bool isRunning() const;
+
+signals:
+    /**
+     * @brief metadataFound сообщает об очередной пачке прочитанных сведений
+     * @param metadata
+     */
+    void metadataFound(const QVector<ImageMetadata>& metadata);
+    /**
+     * @brief finished сообщает о завершении чтения (кроме отмененного)
+     */
+    void finished();
+
+private:
+    /**
+     * @brief m_cancelled признак отмены текущего чтения
+     */
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+    /**
+     * @brief m_future текущее чтение
+     */
+    QFuture<void> m_future;
+    /**
+     * @brief m_supersededFutures отмененные чтения, которые еще выполняются и могут
+     * обратиться к объекту; деструктор дожидается и их
+     */
+    QList<QFuture<void>> m_supersededFutures;
+};
+
+#endif // METADATASCANNER_H
@@ -0,0 +1,374 @@
+#include "thumbnaildecoder.h"
+#include "cancellablebuffer.h"
+#include "cancellablefile.h"
+#include "embeddedpreviewreader.h"
+#include "imagescaler.h"
+#include "thumbnailstore.h"
+#include "trace.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QImageIOHandler>
+#include <QImageReader>
+#include <QtDebug>
+#include <QtMath>
+
+#include <cmath>
+
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#endif
+#if defined(Q_OS_UNIX)
+#include <sys/mman.h>
+#endif
+
+namespace {
+// сторона эскиза нулевого уровня разрешения
+const int levelBase = 16;
+// число уровней разрешения на каждое удвоение размера
+const int levelsPerOctave = 6;
+// порция чтения файла: между порциями проверяется признак отмены
+const qint64 readChunkSize = 1024 * 1024;
+// файлы крупнее не отображаются в память
+const qint64 maxFileSize = 1024 * 1024 * 1024;
+// файлы крупнее не копируются в память: каждый поток чтения держал бы такой
+// буфер, поэтому их читает сам этап декодирования порциями прямо из файла
+const qint64 maxReadFileSize = 64 * 1024 * 1024;
+// файлы меньше дешевле прочитать одним вызовом, чем отображать в память
+const qint64 minMappedFileSize = 64 * 1024;
+// файл, измененный меньше этого числа секунд назад, может еще дописываться или перезаписываться
+// (например, в наблюдаемом каталоге), а усечение отображенного файла во время
+// декодирования вызывает SIGBUS: такие файлы читаются копированием
+const qint64 minMappedFileAge = 60;
+
+/**
+ * @brief mapFile отображает файл в память. Страницы не подгружаются заранее:
+ * их читает ядро по мере того, как к ним обращается декодер
+ * @param file открытый файл
+ * @param fileInfo сведения о файле
+ * @param willNeed файл понадобится целиком: ядро начинает читать его сразу, не
+ * блокируя поток
+ * @return данные файла без копирования или пустой массив, если отображение
+ * не удалось или не нужно
+ */
+QByteArray mapFile(QFile& file, const QFileInfo& fileInfo, bool willNeed)
+{
+    qint64 size = file.size();
+    if (size < minMappedFileSize || size > maxFileSize) {
+        return QByteArray();
+    }
+    if (fileInfo.lastModified().secsTo(QDateTime::currentDateTime()) < minMappedFileAge) {
+        return QByteArray();
+    }
+    uchar* data = file.map(0, size);
+    if (!data) {
+        return QByteArray();
+    }
+#if defined(Q_OS_UNIX)
+    // декодер читает файл последовательно: ядро может читать вперед агрессивнее
+    madvise(data, size_t(size), MADV_SEQUENTIAL);
+    if (willNeed) {
+        madvise(data, size_t(size), MADV_WILLNEED);
+    }
+#endif
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(data), int(size));
+}
+
+QByteArray readFile(CancellableFile& file)
+{
+    qint64 size = file.size();
+    if (size > maxReadFileSize || !file.seek(0)) {
+        return QByteArray();
+    }
+#if defined(Q_OS_LINUX)
+    // файл читается от начала до конца: просим ядро читать вперед агрессивнее
+    posix_fadvise(file.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    QByteArray data(int(size), Qt::Uninitialized);
+    qint64 offset = 0;
+    while (offset < size) {
+        qint64 count = file.read(data.data() + offset, qMin(readChunkSize, size - offset));
+        if (count <= 0) {
+            break;
+        }
+        offset += count;
+    }
+    data.resize(int(offset));
+    return data;
+}
+}
+
+ThumbnailDecoder::ThumbnailDecoder(const QSize& tileSize, const ThumbnailStore* store)
+    : m_tileSize{ tileSize }
+    , m_store{ store }
+{
+}
+
+QSize ThumbnailDecoder::tileSize() const
+{
+    return m_tileSize;
+}
+
+QSize ThumbnailDecoder::fittedSize(const QSize& imageSize, const QSize& tileSize)
+{
+    if (imageSize.isEmpty() || tileSize.isEmpty()) {
+        return imageSize;
+    }
+    // маленькие изображения не увеличиваем - это сделает отрисовка
+    if (imageSize.width() <= tileSize.width() && imageSize.height() <= tileSize.height()) {
+        return imageSize;
+    }
+    return imageSize.scaled(tileSize, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+}
+
+int ThumbnailDecoder::resolutionLevel(const QSize& tileSize)
+{
+    int side = qMax(tileSize.width(), tileSize.height());
+    if (side <= levelBase) {
+        return 0;
+    }
+    return qCeil(levelsPerOctave * std::log2(qreal(side) / levelBase));
+}
+
+QSize ThumbnailDecoder::levelSize(int level)
+{
+    int side = qCeil(levelBase * std::exp2(qreal(level) / levelsPerOctave));
+    return QSize(side, side);
+}
+
+QImage ThumbnailDecoder::renderTile(const QImage& image, const QSize& tileSize, qreal devicePixelRatio)
+{
+    TRACE_SCOPE_HISTOGRAM("scale.tile", "scale.tile.us");
+    QSize deviceTileSize = tileSize * devicePixelRatio;
+    // в отличие от эскиза, плитка заполняет всю доступную область,
+    // поэтому маленькие изображения здесь увеличиваются
+    QSize scaledSize = image.size().scaled(deviceTileSize, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+    QImage tile = scaledSize == image.size() ? image : ImageScaler::scaled(image, scaledSize);
+    QImage::Format format = tile.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    if (tile.format() != format) {
+        tile = tile.convertToFormat(format);
+    }
+    tile.setDevicePixelRatio(devicePixelRatio);
+    return tile;
+}
+
+QImage ThumbnailDecoder::decode(const QString& fileName, const std::atomic_bool* cancelled) const
+{
+    return decode(read(fileName, cancelled), cancelled);
+}
+
+EncodedImage ThumbnailDecoder::read(const QString& fileName, const std::atomic_bool* cancelled, bool prefetch) const
+{
+    TRACE_SCOPE_HISTOGRAM("read", "read.us");
+    EncodedImage encoded;
+    encoded.fileInfo = QFileInfo{ fileName };
+    if (m_store && ThumbnailStore::bucketSize(m_tileSize)) {
+        TRACE_SCOPE_HISTOGRAM("store.load", "store.load.us");
+        encoded.storedThumbnail = m_store->load(encoded.fileInfo, m_tileSize);
+        if (!encoded.storedThumbnail.isNull()) {
+            return encoded;
+        }
+    }
+    bool raw = EmbeddedPreviewReader::isRawFileName(fileName);
+    auto mappedFile = std::make_shared<CancellableFile>(fileName, cancelled);
+    CancellableFile& file = *mappedFile;
+    // заголовки читаются мелкими порциями через буфер QFile,
+    // файл целиком - отображается в память или читается крупными порциями
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Opening" << fileName << "failed:" << file.errorString();
+        return encoded;
+    }
+    // встроенный эскиз ищется до чтения файла: если его разрешения хватает,
+    // читаются только заголовки и байты эскиза, а не весь файл. RAW-файл Qt
+    // не декодирует, поэтому для него берется самый крупный эскиз
+    EmbeddedPreviewReader previewReader{ &file };
+    QList<EmbeddedPreview> previews = previewReader.previews();
+    int preview = raw ? previews.size() - 1 : previewReader.suitablePreview(boundingSize());
+    if (preview >= 0) {
+        encoded.data = previewReader.readData(previews.at(preview));
+        encoded.previewSize = previews.at(preview).size;
+        encoded.orientation = previewReader.orientation();
+    } else if (raw) {
+        if (!file.isCancelled()) {
+            qWarning() << "Reading" << fileName << "failed: no embedded preview";
+        }
+    } else if (!file.isCancelled()) {
+        // отображение снимается, когда освобождается последняя копия encoded,
+        // то есть сразу после декодирования
+        // файл упреждающей загрузки декодируется не сразу: пока он ждет в очереди
+        // декодирования, ядро успевает прочитать его в фоне
+        encoded.data = mapFile(file, encoded.fileInfo, prefetch);
+        if (!encoded.data.isNull()) {
+            encoded.mappedFile = mappedFile;
+        } else if (file.size() > maxReadFileSize) {
+            encoded.streamed = true;
+        } else if (!file.isCancelled()) {
+            encoded.data = readFile(file);
+        }
+    }
+    if (file.isCancelled()) {
+        return EncodedImage();
+    }
+    return encoded;
+}
+
+QImage ThumbnailDecoder::decode(const EncodedImage& encoded, const std::atomic_bool* cancelled) const
+{
+    if (!encoded.storedThumbnail.isNull()) {
+        return scaledToTile(encoded.storedThumbnail);
+    }
+    if (encoded.data.isEmpty() && !encoded.streamed) {
+        return QImage();
+    }
+    QImage image = decodeImage(encoded, boundingSize(), cancelled);
+    if (image.isNull()) {
+        return image;
+    }
+    int bucket = m_store ? ThumbnailStore::bucketSize(m_tileSize) : 0;
+    if (bucket) {
+        TRACE_SCOPE("store.save");
+        m_store->save(encoded.fileInfo, bucket, image);
+    }
+    return scaledToTile(image);
+}
+
+EncodedImage ThumbnailDecoder::readSketch(const QString& fileName, const std::atomic_bool* cancelled) const
+{
+    TRACE_SCOPE_HISTOGRAM("read.sketch", "read.sketch.us");
+    EncodedImage encoded;
+    encoded.fileInfo = QFileInfo{ fileName };
+    if (m_store) {
+        encoded.storedThumbnail = m_store->loadSketch(encoded.fileInfo);
+        if (!encoded.storedThumbnail.isNull()) {
+            return encoded;
+        }
+    }
+    // в файлах других форматов встроенных эскизов нет - не открываем их зря
+    if (!EmbeddedPreviewReader::mayContainPreviews(fileName)) {
+        return encoded;
+    }
+    CancellableFile file{ fileName, cancelled };
+    if (!file.open(QIODevice::ReadOnly)) {
+        return encoded;
+    }
+    // встроенный эскиз EXIF обычно около 160x120 и в несколько килобайт:
+    // он читается вместе с заголовками, а декодируется на этапе декодирования
+    EmbeddedPreviewReader previewReader{ &file };
+    QList<EmbeddedPreview> previews = previewReader.previews();
+    if (previews.isEmpty() || file.isCancelled()) {
+        return encoded;
+    }
+    encoded.data = previewReader.readData(previews.first());
+    encoded.previewSize = previews.first().size;
+    encoded.orientation = previewReader.orientation();
+    if (file.isCancelled()) {
+        return EncodedImage();
+    }
+    return encoded;
+}
+
+QImage ThumbnailDecoder::decodeSketch(const EncodedImage& encoded) const
+{
+    TRACE_SCOPE_HISTOGRAM("decode.sketch", "decode.sketch.us");
+    if (!encoded.storedThumbnail.isNull()) {
+        return encoded.storedThumbnail;
+    }
+    if (encoded.data.isEmpty()) {
+        return QImage();
+    }
+    // встроенный эскиз декодируется в DCT-области за доли миллисекунды
+    return EmbeddedPreviewReader::decodeData(encoded.data, encoded.previewSize, encoded.orientation, levelSize(0));
+}
+
+QSize ThumbnailDecoder::boundingSize() const
+{
+    // при наличии хранилища эскиз декодируется в размер его категории,
+    // чтобы его можно было использовать для любой плитки этой категории
+    int bucket = m_store ? ThumbnailStore::bucketSize(m_tileSize) : 0;
+    return bucket ? QSize(bucket, bucket) : m_tileSize;
+}
+
+QImage ThumbnailDecoder::scaledToTile(const QImage& image) const
+{
+    TRACE_SCOPE_HISTOGRAM("scale", "scale.us");
+    QSize scaledSize = fittedSize(image.size(), m_tileSize);
+    if (scaledSize == image.size()) {
+        return image;
+    }
+    return ImageScaler::scaled(image, scaledSize);
+}
+
+QImage ThumbnailDecoder::decodeImage(const EncodedImage& encoded, const QSize& boundingSize, const std::atomic_bool* cancelled)
+{
+    TRACE_SCOPE_HISTOGRAM("decode", "decode.us");
+    QString fileName = encoded.fileInfo.filePath();
+    QImage image;
+    if (encoded.previewSize.isValid()) {
+        image = EmbeddedPreviewReader::decodeData(encoded.data, encoded.previewSize, encoded.orientation, boundingSize);
+        if (image.isNull()) {
+            qWarning() << "Decoding embedded preview of" << fileName << "failed";
+        }
+    } else if (encoded.streamed) {
+        CancellableFile file{ fileName, cancelled };
+        if (!file.open(QIODevice::ReadOnly)) {
+            qWarning() << "Opening" << fileName << "failed:" << file.errorString();
+            return QImage();
+        }
+        image = decodeDevice(&file, fileName, boundingSize);
+    } else {
+        // декодер читает данные через устройство, проверяющее признак отмены,
+        // поэтому отмененное декодирование прерывается, как и при чтении из файла
+        QByteArray data = encoded.data;
+        CancellableBuffer buffer{ &data, cancelled };
+        buffer.open(QIODevice::ReadOnly);
+        image = decodeDevice(&buffer, fileName, boundingSize);
+    }
+    if (cancelled && *cancelled) {
+        return QImage();
+    }
+    return image;
+}
+
+QImage ThumbnailDecoder::decodeDevice(QIODevice* device, const QString& fileName, const QSize& boundingSize)
+{
+    if (!boundingSize.isEmpty()) {
+        // встроенный эскиз EXIF читается без декодирования основного
+        // изображения, если его разрешения хватает для плитки
+        EmbeddedPreviewReader previewReader{ device };
+        QImage preview = previewReader.read(boundingSize);
+        if (!preview.isNull()) {
+            return preview;
+        }
+        device->seek(0);
+    }
+    QImageReader reader{ device };
+    reader.setAutoTransform(true);
+    QSize imageSize = reader.size();
+    if (imageSize.isValid() && !boundingSize.isEmpty()) {
+        // масштабирование выполняется до применения ориентации EXIF,
+        // поэтому для повернутых изображений плитку тоже поворачиваем
+        QSize tileSize = boundingSize;
+        if (reader.transformation() & QImageIOHandler::TransformationRotate90) {
+            tileSize.transpose();
+        }
+        QSize scaledSize = fittedSize(imageSize, tileSize);
+        if (scaledSize != imageSize) {
+            // для JPEG плагин Qt выполняет масштабирование в DCT-области (1/2, 1/4, 1/8)
+            // и декодирует только нужное разрешение
+            reader.setScaledSize(scaledSize);
+        }
+    }
+    QImage image = reader.read();
+    if (image.isNull()) {
+        qWarning() << "Decoding" << fileName << "failed:" << reader.errorString();
+        return image;
+    }
+    // формат без поддержки размера в заголовке - масштабируем после декодирования
+    if (!imageSize.isValid()) {
+        QSize scaledSize = fittedSize(image.size(), boundingSize);
+        if (scaledSize != image.size()) {
+            image = ImageScaler::scaled(image, scaledSize);
+        }
+    }
+    return image;
+}
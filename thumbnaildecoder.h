@@ -0,0 +1,199 @@
+#ifndef THUMBNAILDECODER_H
+#define THUMBNAILDECODER_H
+
+#include <QByteArray>
+#include <QFileInfo>
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+#include <atomic>
+#include <memory>
+
+class QFile;
+class QIODevice;
+class ThumbnailStore;
+
+/**
+ * @brief The EncodedImage struct
+ * Результат этапа чтения: сжатые данные изображения в памяти или готовый эскиз
+ * из хранилища, которые этап декодирования обрабатывает без обращения к диску
+ */
+struct EncodedImage {
+    QFileInfo fileInfo;
+    /**
+     * @brief data содержимое файла или, если previewSize задан, данные встроенного эскиза JPEG
+     */
+    QByteArray data;
+    /**
+     * @brief mappedFile файл, отображение которого в память без копирования
+     * ссылается data, или nullptr; отображение снимается вместе с файлом.
+     * Как и при любом отображении, усечение файла во время декодирования
+     * приводит к SIGBUS, поэтому отображаются только файлы, не менявшиеся
+     * последнюю минуту, а данные держатся лишь до конца декодирования.
+     */
+    std::shared_ptr<QFile> mappedFile;
+    /**
+     * @brief streamed файл слишком велик, чтобы копировать его в память:
+     * data пуст, и этап декодирования читает файл сам
+     */
+    bool streamed = false;
+    /**
+     * @brief previewSize размер встроенного эскиза в data или пустой размер
+     */
+    QSize previewSize;
+    /**
+     * @brief orientation ориентация EXIF встроенного эскиза
+     */
+    int orientation = 1;
+    /**
+     * @brief storedThumbnail эскиз, найденный в хранилище; data в этом случае не читается
+     */
+    QImage storedThumbnail;
+};
+
+/**
+ * @brief The ThumbnailDecoder class
+ * ThumbnailDecoder - декодер эскизов, который декодирует изображение сразу
+ * в размер плитки вида, не создавая промежуточного изображения в полном разрешении.
+ * Если задано хранилище эскизов, декодер сначала ищет эскиз в нем и сохраняет
+ * туда вновь декодированные эскизы.
+ */
+class ThumbnailDecoder {
+public:
+    /**
+     * @brief ThumbnailDecoder
+     * @param tileSize размер плитки, в которую вписывается эскиз
+     * @param store хранилище эскизов на диске или nullptr
+     */
+    explicit ThumbnailDecoder(const QSize& tileSize, const ThumbnailStore* store = nullptr);
+
+    // ThumbnailDecoder interface
+public:
+    /**
+     * @brief tileSize возвращает размер плитки
+     * @return размер плитки
+     */
+    QSize tileSize() const;
+    /**
+     * @brief decode декодирует файл fileName в размер, вписанный в плитку;
+     * то же, что read() и затем decode() прочитанного
+     * @param fileName
+     * @param cancelled признак отмены, прерывающий чтение файла, или nullptr
+     * @return эскиз или пустое изображение в случае ошибки или отмены
+     */
+    QImage decode(const QString& fileName, const std::atomic_bool* cancelled = nullptr) const;
+    /**
+     * @brief read выполняет этап чтения: ищет эскиз в хранилище, а если его нет,
+     * читает встроенный эскиз, если его разрешения хватает (для RAW - самый
+     * крупный), и только иначе отображает файл в память (мелкие файлы читаются
+     * обычным образом, очень крупные оставляются этапу декодирования)
+     * @param fileName
+     * @param cancelled признак отмены, прерывающий чтение файла, или nullptr
+     * @param prefetch файл читается упреждающе: страницы отображенного файла
+     * запрашиваются у ядра заранее (MADV_WILLNEED)
+     * @return прочитанные данные; пустые данные без эскиза означают ошибку или отмену
+     */
+    EncodedImage read(const QString& fileName, const std::atomic_bool* cancelled = nullptr, bool prefetch = false) const;
+    /**
+     * @brief decode выполняет этап декодирования данных, прочитанных read(),
+     * и сохраняет новый эскиз в хранилище
+     * @param encoded
+     * @param cancelled признак отмены или nullptr
+     * @return эскиз или пустое изображение в случае ошибки или отмены
+     */
+    QImage decode(const EncodedImage& encoded, const std::atomic_bool* cancelled = nullptr) const;
+    /**
+     * @brief readSketch выполняет этап чтения наброска для первого прохода отрисовки:
+     * ищет набросок в хранилище эскизов, а для JPEG и RAW-файлов - читает данные
+     * наименьшего встроенного эскиза EXIF/RAW; остальные файлы не открываются
+     * @param fileName
+     * @param cancelled признак отмены или nullptr
+     * @return прочитанные данные; пустые данные без эскиза означают, что
+     * дешево получить набросок нельзя
+     */
+    EncodedImage readSketch(const QString& fileName, const std::atomic_bool* cancelled = nullptr) const;
+    /**
+     * @brief decodeSketch выполняет этап декодирования наброска, прочитанного readSketch()
+     * @param encoded
+     * @return набросок размера нулевого уровня разрешения или пустое изображение
+     */
+    QImage decodeSketch(const EncodedImage& encoded) const;
+    /**
+     * @brief resolutionLevel возвращает уровень разрешения, в который декодируются
+     * эскизы для плитки tileSize. Уровни идут с шагом 2^(1/6) (около 12%), поэтому
+     * небольшое изменение размера плитки не требует повторного декодирования,
+     * а эскиз превышает плитку не более чем на 12% по стороне.
+     * @param tileSize
+     * @return уровень разрешения
+     */
+    static int resolutionLevel(const QSize& tileSize);
+    /**
+     * @brief levelSize возвращает квадрат, в который вписываются эскизы уровня level
+     * @param level
+     * @return размер квадрата уровня
+     */
+    static QSize levelSize(int level);
+    /**
+     * @brief fittedSize возвращает размер, в который надо декодировать изображение
+     * размера imageSize, чтобы оно вписалось в плитку tileSize с сохранением пропорций.
+     * Изображения меньше плитки не увеличиваются.
+     * @param imageSize
+     * @param tileSize
+     * @return размер эскиза
+     */
+    static QSize fittedSize(const QSize& imageSize, const QSize& tileSize);
+    /**
+     * @brief renderTile готовит плитку для отрисовки: вписывает image в логический
+     * размер tileSize с учетом devicePixelRatio и приводит к формату, который
+     * QPixmap::fromImage() принимает без преобразования
+     * @param image
+     * @param tileSize
+     * @param devicePixelRatio
+     * @return плитка с установленным devicePixelRatio
+     */
+    static QImage renderTile(const QImage& image, const QSize& tileSize, qreal devicePixelRatio);
+
+private:
+    /**
+     * @brief decodeImage декодирует данные encoded в размер, вписанный в boundingSize
+     * @param encoded
+     * @param boundingSize
+     * @param cancelled признак отмены или nullptr
+     * @return изображение или пустое изображение в случае ошибки или отмены
+     */
+    static QImage decodeImage(const EncodedImage& encoded, const QSize& boundingSize, const std::atomic_bool* cancelled);
+    /**
+     * @brief decodeDevice декодирует изображение из device, предпочитая встроенный
+     * эскиз, если его разрешения хватает
+     * @param device
+     * @param fileName имя файла для сообщений об ошибках
+     * @param boundingSize
+     * @return изображение или пустое изображение в случае ошибки
+     */
+    static QImage decodeDevice(QIODevice* device, const QString& fileName, const QSize& boundingSize);
+    /**
+     * @brief boundingSize возвращает размер, в который декодируется изображение:
+     * квадрат категории хранилища или размер плитки, если хранилища нет
+     * @return размер декодирования
+     */
+    QSize boundingSize() const;
+    /**
+     * @brief scaledToTile уменьшает изображение image до размера плитки
+     * @param image
+     * @return изображение, вписанное в плитку
+     */
+    QImage scaledToTile(const QImage& image) const;
+
+private:
+    /**
+     * @brief m_tileSize размер плитки
+     */
+    QSize m_tileSize;
+    /**
+     * @brief m_store хранилище эскизов на диске
+     */
+    const ThumbnailStore* m_store;
+};
+
+#endif // THUMBNAILDECODER_H
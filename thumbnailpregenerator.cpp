@@ -0,0 +1,145 @@
+#include "thumbnailpregenerator.h"
+#include "catalogscanner.h"
+#include "directoryscanner.h"
+#include "imagelistmodel.h"
+#include "trace.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QtConcurrent>
+
+ThumbnailPregenerator::ThumbnailPregenerator(QObject* parent)
+    : QObject(parent)
+    , m_directoryScanner{ new DirectoryScanner{ this } }
+    , m_catalogScanner{ new CatalogScanner{ this } }
+    , m_decoder{ QSize(), &m_store }
+{
+    connect(m_directoryScanner, &DirectoryScanner::entriesFound, this, &ThumbnailPregenerator::enqueue);
+    connect(m_catalogScanner, &CatalogScanner::entriesFound, this, &ThumbnailPregenerator::enqueue);
+    connect(m_directoryScanner, &DirectoryScanner::finished, this, [this] {
+        m_scanFinished = true;
+        finishIfDone();
+    });
+    connect(m_catalogScanner, &CatalogScanner::finished, this, [this] {
+        m_scanFinished = true;
+        finishIfDone();
+    });
+}
+
+ThumbnailPregenerator::~ThumbnailPregenerator()
+{
+    // рабочие потоки выходят, взяв следующий файл после отмены
+    m_cancelled = true;
+    m_threadPool.waitForDone();
+}
+
+bool ThumbnailPregenerator::start(const QString& path, bool recursive, const QSize& tileSize, int jobs)
+{
+    if (!QFileInfo{ path }.isDir()) {
+        m_errorString = QCoreApplication::translate("ThumbnailPregenerator", "Directory %1 does not exist").arg(path);
+        return false;
+    }
+    if (!ThumbnailStore::bucketSize(tileSize)) {
+        m_errorString = QCoreApplication::translate("ThumbnailPregenerator", "Unsupported tile size %1").arg(tileSize.width());
+        return false;
+    }
+    if (!QDir{}.mkpath(m_store.rootPath())) {
+        m_errorString = QCoreApplication::translate("ThumbnailPregenerator", "Cannot create thumbnail store directory %1").arg(m_store.rootPath());
+        return false;
+    }
+    m_decoder = ThumbnailDecoder{ tileSize, &m_store };
+    m_jobs = qMax(1, jobs);
+    m_threadPool.setMaxThreadCount(m_jobs);
+    m_timer.start();
+    QStringList nameFilters = ImageListModel::imageNameFilters();
+    if (recursive) {
+        QString rootPath = QDir::cleanPath(QDir{ path }.absolutePath());
+        if (!rootPath.endsWith(QLatin1Char('/'))) {
+            rootPath += QLatin1Char('/');
+        }
+        // без индекса прошлого обхода публикуются все файлы дерева, а не только изменившиеся
+        m_catalogScanner->start(rootPath, nameFilters, nullptr);
+    } else {
+        m_directoryScanner->start(path, nameFilters);
+    }
+    return true;
+}
+
+QString ThumbnailPregenerator::errorString() const
+{
+    return m_errorString;
+}
+
+PregenerationStatistics ThumbnailPregenerator::statistics() const
+{
+    quint64 generated = m_generated;
+    quint64 skipped = m_skipped;
+    quint64 failed = m_failed;
+    return PregenerationStatistics{ m_found, generated + skipped + failed, generated, skipped, failed,
+        m_bytesRead, m_timer.isValid() ? m_timer.elapsed() : 0 };
+}
+
+void ThumbnailPregenerator::enqueue(const QFileInfoList& entries)
+{
+    m_found += quint64(entries.size());
+    m_pending += quint64(entries.size());
+    TRACE_COUNTER("pregenerate.found", qint64(m_found));
+    QMutexLocker locker{ &m_queueMutex };
+    for (const QFileInfo& fileInfo : entries) {
+        m_queue.enqueue(fileInfo);
+    }
+    for (; m_workerCount < qMin(m_jobs, m_queue.size()); ++m_workerCount) {
+        QtConcurrent::run(&m_threadPool, [this] { work(); });
+    }
+}
+
+void ThumbnailPregenerator::work()
+{
+    QFileInfo fileInfo;
+    while (takeFile(fileInfo)) {
+        generate(fileInfo);
+        if (--m_pending == 0) {
+            QMetaObject::invokeMethod(this, [this] { finishIfDone(); }, Qt::QueuedConnection);
+        }
+    }
+}
+
+bool ThumbnailPregenerator::takeFile(QFileInfo& fileInfo)
+{
+    QMutexLocker locker{ &m_queueMutex };
+    if (m_cancelled || m_queue.isEmpty()) {
+        --m_workerCount;
+        return false;
+    }
+    fileInfo = m_queue.dequeue();
+    return true;
+}
+
+void ThumbnailPregenerator::generate(const QFileInfo& fileInfo)
+{
+    TRACE_SCOPE_HISTOGRAM("pregenerate", "pregenerate.us");
+    // эскиз, записанный прерванным запуском, пропускается без декодирования
+    if (m_store.contains(fileInfo, m_decoder.tileSize())) {
+        ++m_skipped;
+        return;
+    }
+    EncodedImage encoded = m_decoder.read(fileInfo.filePath(), &m_cancelled);
+    if (m_decoder.decode(encoded, &m_cancelled).isNull()) {
+        ++m_failed;
+        return;
+    }
+    // очень крупные файлы читает этап декодирования, минуя encoded.data
+    m_bytesRead += quint64(encoded.streamed ? fileInfo.size() : encoded.data.size());
+    ++m_generated;
+}
+
+void ThumbnailPregenerator::finishIfDone()
+{
+    if (m_finished || !m_scanFinished || m_pending != 0) {
+        return;
+    }
+    m_finished = true;
+    emit finished();
+}
@@ -0,0 +1,154 @@
+#ifndef THUMBNAILPREGENERATOR_H
+#define THUMBNAILPREGENERATOR_H
+
+#include "thumbnaildecoder.h"
+#include "thumbnailstore.h"
+
+#include <QElapsedTimer>
+#include <QFileInfoList>
+#include <QMutex>
+#include <QObject>
+#include <QQueue>
+#include <QThreadPool>
+
+#include <atomic>
+
+class CatalogScanner;
+class DirectoryScanner;
+
+/**
+ * @brief The PregenerationStatistics struct
+ * Счетчики заполнения хранилища эскизов
+ */
+struct PregenerationStatistics {
+    /**
+     * @brief found число найденных файлов изображений
+     */
+    quint64 found;
+    /**
+     * @brief processed число обработанных файлов, включая пропущенные и ошибки
+     */
+    quint64 processed;
+    quint64 generated;
+    /**
+     * @brief skipped число файлов, действительный эскиз которых уже был в хранилище
+     */
+    quint64 skipped;
+    quint64 failed;
+    /**
+     * @brief bytesRead прочитано байт файлов при создании эскизов
+     */
+    quint64 bytesRead;
+    qint64 elapsedMs;
+};
+
+/**
+ * @brief The ThumbnailPregenerator class
+ * ThumbnailPregenerator - заполнение хранилища эскизов без окон.
+ * Файлы находятся теми же DirectoryScanner и CatalogScanner, что и у
+ * ImageListModel, а эскизы создаются тем же ThumbnailDecoder, что и у
+ * ImageListView, и сохраняются в ThumbnailStore, поэтому просмотр каталога
+ * после заполнения сразу находит эскизы. Каждая пачка найденных файлов сразу
+ * ставится в общую очередь, которую, пока обход продолжается, разбирают рабочие
+ * потоки собственного пула - не больше jobs, по одной задаче пула на поток, а не на файл.
+ * Файлы, действительный эскиз которых уже есть в хранилище, пропускаются
+ * по текстовым блокам PNG без декодирования, а эскизы записываются атомарно,
+ * поэтому прерванное заполнение при повторном запуске продолжается с места
+ * остановки.
+ */
+class ThumbnailPregenerator : public QObject {
+    Q_OBJECT
+public:
+    explicit ThumbnailPregenerator(QObject* parent = Q_NULLPTR);
+    ~ThumbnailPregenerator();
+
+    // ThumbnailPregenerator interface
+public:
+    /**
+     * @brief start запускает заполнение
+     * @param path каталог изображений
+     * @param recursive обходить и подкаталоги
+     * @param tileSize размер плитки, для которой создаются эскизы
+     * @param jobs число потоков создания эскизов
+     * @return false, если заполнение не запущено; причина - в errorString()
+     */
+    bool start(const QString& path, bool recursive, const QSize& tileSize, int jobs);
+    /**
+     * @brief errorString возвращает причину, по которой start() не запустил заполнение
+     * @return описание ошибки
+     */
+    QString errorString() const;
+    /**
+     * @brief statistics возвращает текущие счетчики; можно вызывать во время заполнения
+     * @return счетчики
+     */
+    PregenerationStatistics statistics() const;
+
+signals:
+    /**
+     * @brief finished сообщает, что обход завершен и все найденные файлы обработаны
+     */
+    void finished();
+
+private:
+    void enqueue(const QFileInfoList& entries);
+    /**
+     * @brief work разбирает очередь файлов до ее опустошения; выполняется в рабочем потоке
+     */
+    void work();
+    /**
+     * @brief takeFile извлекает из очереди следующий файл; рабочий поток, которому
+     * файла не досталось, учитывается завершенным
+     * @param fileInfo
+     * @return false, если очередь пуста или заполнение отменено
+     */
+    bool takeFile(QFileInfo& fileInfo);
+    /**
+     * @brief generate создает эскиз файла fileInfo; выполняется в рабочем потоке
+     * @param fileInfo
+     */
+    void generate(const QFileInfo& fileInfo);
+    /**
+     * @brief finishIfDone сообщает о завершении, если обход закончен и очередь пуста
+     */
+    void finishIfDone();
+
+private:
+    DirectoryScanner* m_directoryScanner;
+    CatalogScanner* m_catalogScanner;
+    ThumbnailStore m_store;
+    ThumbnailDecoder m_decoder;
+    QThreadPool m_threadPool;
+    QElapsedTimer m_timer;
+    QString m_errorString;
+    /**
+     * @brief m_queueMutex защищает m_queue и m_workerCount
+     */
+    QMutex m_queueMutex;
+    /**
+     * @brief m_queue найденные и еще не взятые рабочими потоками файлы
+     */
+    QQueue<QFileInfo> m_queue;
+    /**
+     * @brief m_workerCount число запущенных рабочих потоков, не больше m_jobs
+     */
+    int m_workerCount = 0;
+    int m_jobs = 1;
+    /**
+     * @brief m_cancelled признак отмены задач при удалении объекта
+     */
+    std::atomic_bool m_cancelled{ false };
+    bool m_scanFinished = false;
+    bool m_finished = false;
+    quint64 m_found = 0;
+    /**
+     * @brief m_pending число поставленных в очередь и еще не обработанных файлов
+     */
+    std::atomic<quint64> m_pending{ 0 };
+    std::atomic<quint64> m_generated{ 0 };
+    std::atomic<quint64> m_skipped{ 0 };
+    std::atomic<quint64> m_failed{ 0 };
+    std::atomic<quint64> m_bytesRead{ 0 };
+};
+
+#endif // THUMBNAILPREGENERATOR_H
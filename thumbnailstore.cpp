@@ -0,0 +1,228 @@
+#include "thumbnailstore.h"
+#include "imagescaler.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QStringList>
+#include <QUrl>
+#include <QtDebug>
+
+#include <cstring>
+
+namespace {
+struct Bucket {
+    int size;
+    const char* directory;
+};
+// категории эскизов по спецификации freedesktop.org, по возрастанию размера
+const Bucket buckets[] = {
+    { 128, "normal" },
+    { 256, "large" },
+    { 512, "x-large" },
+    { 1024, "xx-large" },
+};
+
+const char* bucketDirectory(int bucket)
+{
+    for (const Bucket& b : buckets) {
+        if (b.size == bucket) {
+            return b.directory;
+        }
+    }
+    return nullptr;
+}
+
+// набросок хранится в текстовом блоке PNG, который читается вместе с заголовком
+const char sketchKey[] = "X-ImageViewer::Sketch";
+// сторона наброска совпадает с нулевым уровнем разрешения ThumbnailDecoder
+const int sketchSide = 16;
+
+/**
+ * @brief encodeSketch уменьшает эскиз до наброска и записывает его
+ * в текстовом виде "ширина x высота : base64(RGB888)"
+ */
+QString encodeSketch(const QImage& thumbnail)
+{
+    QSize size = thumbnail.size().scaled(sketchSide, sketchSide, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+    QImage sketch = ImageScaler::scaled(thumbnail, size).convertToFormat(QImage::Format_RGB888);
+    QByteArray pixels;
+    pixels.reserve(size.width() * size.height() * 3);
+    for (int y = 0; y < sketch.height(); ++y) {
+        pixels.append(reinterpret_cast<const char*>(sketch.constScanLine(y)), sketch.width() * 3);
+    }
+    return QString("%1x%2:%3").arg(size.width()).arg(size.height()).arg(QLatin1String(pixels.toBase64()));
+}
+
+QImage decodeSketch(const QString& text)
+{
+    int separator = text.indexOf(QLatin1Char(':'));
+    QStringList size = text.left(separator).split(QLatin1Char('x'));
+    if (separator < 0 || size.size() != 2) {
+        return QImage();
+    }
+    int width = size.at(0).toInt();
+    int height = size.at(1).toInt();
+    QByteArray pixels = QByteArray::fromBase64(text.mid(separator + 1).toLatin1());
+    if (width <= 0 || height <= 0 || width > sketchSide || height > sketchSide || pixels.size() != width * height * 3) {
+        return QImage();
+    }
+    QImage sketch{ width, height, QImage::Format_RGB888 };
+    for (int y = 0; y < height; ++y) {
+        memcpy(sketch.scanLine(y), pixels.constData() + y * width * 3, size_t(width) * 3);
+    }
+    return sketch.convertToFormat(QImage::Format_RGB32);
+}
+
+QByteArray fileUri(const QFileInfo& fileInfo)
+{
+    return QUrl::fromLocalFile(fileInfo.absoluteFilePath()).toEncoded();
+}
+
+/**
+ * @brief isCurrent проверяет по тексту PNG, что эскиз сделан с текущего
+ * содержимого файла; текстовые блоки читаются до декодирования пикселей
+ */
+bool isCurrent(QImageReader& reader, const QString& mtime, const QString& size)
+{
+    if (!reader.canRead() || reader.text("Thumb::MTime") != mtime) {
+        return false;
+    }
+    QString storedSize = reader.text("Thumb::Size");
+    return storedSize.isEmpty() || storedSize == size;
+}
+}
+
+ThumbnailStore::ThumbnailStore(const QString& rootPath)
+    : m_rootPath{ rootPath }
+{
+    for (const Bucket& b : buckets) {
+        QDir{}.mkpath(QDir{ m_rootPath }.filePath(QLatin1String(b.directory)));
+    }
+}
+
+QString ThumbnailStore::defaultRootPath()
+{
+    return QDir{ QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) }.filePath("thumbnails");
+}
+
+int ThumbnailStore::bucketSize(const QSize& tileSize)
+{
+    int side = qMax(tileSize.width(), tileSize.height());
+    for (const Bucket& b : buckets) {
+        if (side <= b.size) {
+            return b.size;
+        }
+    }
+    return 0;
+}
+
+QString ThumbnailStore::rootPath() const
+{
+    return m_rootPath;
+}
+
+QString ThumbnailStore::thumbnailPath(const QFileInfo& fileInfo, int bucket) const
+{
+    QByteArray hash = QCryptographicHash::hash(fileUri(fileInfo), QCryptographicHash::Md5).toHex();
+    return QDir{ m_rootPath }.filePath(QString("%1/%2.png").arg(QLatin1String(bucketDirectory(bucket)), QLatin1String(hash)));
+}
+
+QImage ThumbnailStore::load(const QFileInfo& fileInfo, const QSize& tileSize) const
+{
+    int smallest = bucketSize(tileSize);
+    if (!smallest) {
+        return QImage();
+    }
+    QString mtime = QString::number(fileInfo.lastModified().toSecsSinceEpoch());
+    QString size = QString::number(fileInfo.size());
+    // эскиз большей категории тоже подходит - его достаточно уменьшить
+    for (const Bucket& b : buckets) {
+        if (b.size < smallest) {
+            continue;
+        }
+        QImageReader reader{ thumbnailPath(fileInfo, b.size), "png" };
+        if (!isCurrent(reader, mtime, size)) {
+            continue;
+        }
+        QImage thumbnail = reader.read();
+        if (!thumbnail.isNull()) {
+            return thumbnail;
+        }
+    }
+    return QImage();
+}
+
+bool ThumbnailStore::contains(const QFileInfo& fileInfo, const QSize& tileSize) const
+{
+    int smallest = bucketSize(tileSize);
+    if (!smallest) {
+        return false;
+    }
+    QString mtime = QString::number(fileInfo.lastModified().toSecsSinceEpoch());
+    QString size = QString::number(fileInfo.size());
+    for (const Bucket& b : buckets) {
+        if (b.size < smallest) {
+            continue;
+        }
+        QImageReader reader{ thumbnailPath(fileInfo, b.size), "png" };
+        if (isCurrent(reader, mtime, size)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QImage ThumbnailStore::loadSketch(const QFileInfo& fileInfo) const
+{
+    QString mtime = QString::number(fileInfo.lastModified().toSecsSinceEpoch());
+    QString size = QString::number(fileInfo.size());
+    for (const Bucket& b : buckets) {
+        QImageReader reader{ thumbnailPath(fileInfo, b.size), "png" };
+        if (!isCurrent(reader, mtime, size)) {
+            continue;
+        }
+        // пиксели эскиза не декодируются: набросок целиком в заголовке
+        QImage sketch = decodeSketch(reader.text(QLatin1String(sketchKey)));
+        if (!sketch.isNull()) {
+            return sketch;
+        }
+    }
+    return QImage();
+}
+
+bool ThumbnailStore::save(const QFileInfo& fileInfo, int bucket, const QImage& thumbnail) const
+{
+    if (!bucketDirectory(bucket) || thumbnail.isNull()) {
+        return false;
+    }
+    QString path = thumbnailPath(fileInfo, bucket);
+    // QSaveFile пишет во временный файл и атомарно переименовывает его,
+    // поэтому другие программы никогда не увидят недописанный эскиз
+    QSaveFile file{ path };
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Saving thumbnail" << path << "failed:" << file.errorString();
+        return false;
+    }
+    QImageWriter writer{ &file, "png" };
+    writer.setText("Thumb::URI", QString::fromLatin1(fileUri(fileInfo)));
+    writer.setText("Thumb::MTime", QString::number(fileInfo.lastModified().toSecsSinceEpoch()));
+    writer.setText("Thumb::Size", QString::number(fileInfo.size()));
+    writer.setText("Software", "imageviewer");
+    writer.setText(QLatin1String(sketchKey), encodeSketch(thumbnail));
+    if (!writer.write(thumbnail)) {
+        qWarning() << "Saving thumbnail" << path << "failed:" << writer.errorString();
+        file.cancelWriting();
+        return false;
+    }
+    if (!file.commit()) {
+        return false;
+    }
+    QFile::setPermissions(path, QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+    return true;
+}
@@ -0,0 +1,95 @@
+#ifndef THUMBNAILSTORE_H
+#define THUMBNAILSTORE_H
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+class QFileInfo;
+
+/**
+ * @brief The ThumbnailStore class
+ * ThumbnailStore - постоянное хранилище эскизов на диске, совместимое со
+ * спецификацией freedesktop.org Thumbnail Managing Standard
+ * (~/.cache/thumbnails/{normal,large,x-large,xx-large}/<md5(uri)>.png).
+ * Эскиз действителен, пока совпадают путь, время модификации и размер файла,
+ * сохраненные в тексте PNG (Thumb::URI, Thumb::MTime, Thumb::Size).
+ * Вместе с эскизом в тексте PNG сохраняется набросок 16x16 (X-ImageViewer::Sketch),
+ * который читается без декодирования пикселей эскиза.
+ * Методы класса только читают и пишут файлы, поэтому безопасны для вызова из
+ * нескольких потоков одновременно.
+ */
+class ThumbnailStore {
+public:
+    /**
+     * @brief ThumbnailStore
+     * @param rootPath каталог хранилища, по умолчанию defaultRootPath()
+     */
+    explicit ThumbnailStore(const QString& rootPath = defaultRootPath());
+
+    // ThumbnailStore interface
+public:
+    /**
+     * @brief defaultRootPath возвращает каталог эскизов freedesktop ($XDG_CACHE_HOME/thumbnails)
+     * @return путь каталога эскизов
+     */
+    static QString defaultRootPath();
+    /**
+     * @brief bucketSize возвращает размер наименьшей категории эскизов
+     * (128, 256, 512, 1024), в которую вписывается плитка tileSize
+     * @param tileSize
+     * @return размер стороны эскиза или 0, если плитка больше самой крупной категории
+     */
+    static int bucketSize(const QSize& tileSize);
+    /**
+     * @brief rootPath возвращает каталог хранилища
+     * @return путь каталога хранилища
+     */
+    QString rootPath() const;
+    /**
+     * @brief load ищет действительный эскиз файла fileInfo, пригодный для плитки tileSize
+     * @param fileInfo
+     * @param tileSize
+     * @return эскиз или пустое изображение, если эскиза нет или он устарел
+     */
+    QImage load(const QFileInfo& fileInfo, const QSize& tileSize) const;
+    /**
+     * @brief save сохраняет эскиз файла fileInfo в категорию bucket
+     * @param fileInfo
+     * @param bucket размер категории, возвращенный bucketSize()
+     * @param thumbnail эскиз, вписанный в квадрат bucket x bucket
+     * @return true в случае успеха
+     */
+    bool save(const QFileInfo& fileInfo, int bucket, const QImage& thumbnail) const;
+    /**
+     * @brief contains проверяет, есть ли действительный эскиз файла fileInfo,
+     * пригодный для плитки tileSize, не декодируя его
+     * @param fileInfo
+     * @param tileSize
+     * @return true, если load() найдет эскиз
+     */
+    bool contains(const QFileInfo& fileInfo, const QSize& tileSize) const;
+    /**
+     * @brief loadSketch ищет набросок действительного эскиза файла fileInfo любой категории
+     * @param fileInfo
+     * @return набросок не больше 16x16 или пустое изображение, если его нет
+     */
+    QImage loadSketch(const QFileInfo& fileInfo) const;
+
+private:
+    /**
+     * @brief thumbnailPath возвращает путь эскиза файла fileInfo в категории bucket
+     * @param fileInfo
+     * @param bucket
+     * @return путь файла эскиза
+     */
+    QString thumbnailPath(const QFileInfo& fileInfo, int bucket) const;
+
+private:
+    /**
+     * @brief m_rootPath каталог хранилища
+     */
+    QString m_rootPath;
+};
+
+#endif // THUMBNAILSTORE_H
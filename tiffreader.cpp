@@ -0,0 +1,515 @@
+#include "tiffreader.h"
+#include "imagescaler.h"
+#include "trace.h"
+
+#include <QHash>
+#include <QIODevice>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace {
+// теги TIFF
+const quint16 tagImageWidth = 256;
+const quint16 tagImageLength = 257;
+const quint16 tagBitsPerSample = 258;
+const quint16 tagCompression = 259;
+const quint16 tagPhotometricInterpretation = 262;
+const quint16 tagStripOffsets = 273;
+const quint16 tagSamplesPerPixel = 277;
+const quint16 tagRowsPerStrip = 278;
+const quint16 tagStripByteCounts = 279;
+const quint16 tagPlanarConfiguration = 284;
+const quint16 tagPredictor = 317;
+const quint16 tagTileWidth = 322;
+const quint16 tagTileLength = 323;
+const quint16 tagTileOffsets = 324;
+const quint16 tagTileByteCounts = 325;
+const quint16 tagExtraSamples = 338;
+const quint16 tagSampleFormat = 339;
+
+// типы значений TIFF
+const quint16 typeByte = 1;
+const quint16 typeShort = 3;
+const quint16 typeLong = 4;
+
+const int compressionNone = 1;
+const int compressionLzw = 5;
+const int compressionDeflate = 8;
+const int compressionAdobeDeflate = 32946;
+const int compressionPackBits = 32773;
+
+const int photometricMinIsWhite = 0;
+const int photometricMinIsBlack = 1;
+const int photometricRgb = 2;
+
+const int predictorHorizontal = 2;
+
+// ExtraSamples: 1 - альфа, уже умноженная на нее, 2 - неумноженная альфа
+const quint32 extraSampleAssociatedAlpha = 1;
+
+// наибольший объем одной полосы или плитки - защита от поврежденных файлов
+const qint64 maxChunkBytes = 256 * 1024 * 1024;
+
+/**
+ * @brief The Entry struct
+ * Запись каталога тегов (IFD)
+ */
+struct Entry {
+    quint16 type;
+    quint32 count;
+    uchar value[4];
+};
+
+quint16 readUInt16(const uchar* data, bool littleEndian)
+{
+    return littleEndian ? qFromLittleEndian<quint16>(data) : qFromBigEndian<quint16>(data);
+}
+
+quint32 readUInt32(const uchar* data, bool littleEndian)
+{
+    return littleEndian ? qFromLittleEndian<quint32>(data) : qFromBigEndian<quint32>(data);
+}
+
+int typeSize(quint16 type)
+{
+    switch (type) {
+    case typeByte:
+        return 1;
+    case typeShort:
+        return 2;
+    case typeLong:
+        return 4;
+    }
+    return 0;
+}
+
+bool readValues(QIODevice* device, bool littleEndian, const Entry& entry, QVector<quint32>& values)
+{
+    int size = typeSize(entry.type);
+    if (!size || entry.count == 0 || entry.count > (1u << 24)) {
+        return false;
+    }
+    // значения длиной до 4 байт хранятся в самой записи, остальные - по смещению
+    QByteArray data;
+    const uchar* source = entry.value;
+    if (qint64(size) * entry.count > 4) {
+        if (!device->seek(readUInt32(entry.value, littleEndian))) {
+            return false;
+        }
+        data = device->read(qint64(size) * entry.count);
+        if (data.size() != qint64(size) * entry.count) {
+            return false;
+        }
+        source = reinterpret_cast<const uchar*>(data.constData());
+    }
+    values.resize(int(entry.count));
+    for (int i = 0; i < values.size(); ++i) {
+        values[i] = size == 1 ? source[i] : size == 2 ? readUInt16(source + 2 * i, littleEndian) : readUInt32(source + 4 * i, littleEndian);
+    }
+    return true;
+}
+
+QByteArray decodeLzw(const QByteArray& encoded, qint64 expected)
+{
+    struct Code {
+        qint16 prefix;
+        uchar suffix;
+        uchar first;
+        quint16 length;
+    };
+    const int clearCode = 256;
+    const int endCode = 257;
+    QVector<Code> table(4096);
+    for (int i = 0; i < 256; ++i) {
+        table[i] = Code{ -1, uchar(i), uchar(i), 1 };
+    }
+    QByteArray output;
+    output.reserve(int(expected));
+    auto append = [&table, &output](int code) {
+        int end = output.size() + table.at(code).length;
+        output.resize(end);
+        char* data = output.data();
+        for (int i = end - 1; code >= 0; code = table.at(code).prefix, --i) {
+            data[i] = char(table.at(code).suffix);
+        }
+    };
+    const uchar* input = reinterpret_cast<const uchar*>(encoded.constData());
+    int position = 0;
+    quint32 buffer = 0;
+    int bufferBits = 0;
+    int nextCode = 258;
+    int codeWidth = 9;
+    int previous = -1;
+    while (output.size() < expected) {
+        // коды записаны начиная со старшего бита
+        while (bufferBits < codeWidth && position < encoded.size()) {
+            buffer = (buffer << 8) | input[position++];
+            bufferBits += 8;
+        }
+        if (bufferBits < codeWidth) {
+            break;
+        }
+        int code = int((buffer >> (bufferBits - codeWidth)) & ((1u << codeWidth) - 1));
+        bufferBits -= codeWidth;
+        if (code == endCode) {
+            break;
+        }
+        if (code == clearCode) {
+            nextCode = 258;
+            codeWidth = 9;
+            previous = -1;
+            continue;
+        }
+        if (previous < 0) {
+            if (code > 255) {
+                break;
+            }
+            output.append(char(code));
+            previous = code;
+            continue;
+        }
+        uchar first;
+        if (code < nextCode) {
+            append(code);
+            first = table.at(code).first;
+        } else if (code == nextCode) {
+            first = table.at(previous).first;
+            append(previous);
+            output.append(char(first));
+        } else {
+            break;
+        }
+        if (nextCode < table.size()) {
+            table[nextCode] = Code{ qint16(previous), first, table.at(previous).first, quint16(table.at(previous).length + 1) };
+            ++nextCode;
+        }
+        // в TIFF ширина кода увеличивается на один код раньше (early change)
+        if (nextCode >= (1 << codeWidth) - 1 && codeWidth < 12) {
+            ++codeWidth;
+        }
+        previous = code;
+    }
+    return output;
+}
+
+QByteArray decodeDeflate(const QByteArray& encoded, qint64 expected)
+{
+    // qUncompress ожидает перед потоком zlib размер распакованных данных
+    QByteArray prefixed(4, 0);
+    qToBigEndian<quint32>(quint32(expected), prefixed.data());
+    prefixed += encoded;
+    return qUncompress(prefixed);
+}
+
+QByteArray decodePackBits(const QByteArray& encoded, qint64 expected)
+{
+    QByteArray output;
+    output.reserve(int(expected));
+    int position = 0;
+    while (position < encoded.size() && output.size() < expected) {
+        int header = qint8(encoded.at(position++));
+        if (header >= 0) {
+            int count = qMin(header + 1, encoded.size() - position);
+            output.append(encoded.constData() + position, count);
+            position += count;
+        } else if (header != -128 && position < encoded.size()) {
+            output.append(1 - header, encoded.at(position++));
+        }
+    }
+    return output;
+}
+}
+
+TiffReader::TiffReader(QIODevice* device)
+{
+    if (!device->seek(0)) {
+        return;
+    }
+    QByteArray header = device->read(8);
+    if (header.size() != 8) {
+        return;
+    }
+    const uchar* headerData = reinterpret_cast<const uchar*>(header.constData());
+    if (header.startsWith("II")) {
+        m_littleEndian = true;
+    } else if (header.startsWith("MM")) {
+        m_littleEndian = false;
+    } else {
+        return;
+    }
+    // BigTIFF (43) не поддерживается
+    if (readUInt16(headerData + 2, m_littleEndian) != 42 || !device->seek(readUInt32(headerData + 4, m_littleEndian))) {
+        return;
+    }
+    QByteArray countData = device->read(2);
+    if (countData.size() != 2) {
+        return;
+    }
+    int entryCount = readUInt16(reinterpret_cast<const uchar*>(countData.constData()), m_littleEndian);
+    QByteArray entryData = device->read(qint64(entryCount) * 12);
+    if (entryData.size() != entryCount * 12) {
+        return;
+    }
+    QHash<quint16, Entry> entries;
+    for (int i = 0; i < entryCount; ++i) {
+        const uchar* data = reinterpret_cast<const uchar*>(entryData.constData()) + i * 12;
+        Entry entry{ readUInt16(data + 2, m_littleEndian), readUInt32(data + 4, m_littleEndian), {} };
+        std::memcpy(entry.value, data + 8, 4);
+        entries.insert(readUInt16(data, m_littleEndian), entry);
+    }
+    auto values = [this, device, &entries](quint16 tag) {
+        QVector<quint32> result;
+        auto it = entries.constFind(tag);
+        if (it != entries.constEnd() && !readValues(device, m_littleEndian, it.value(), result)) {
+            result.clear();
+        }
+        return result;
+    };
+    auto value = [&values, &entries](quint16 tag, quint32 defaultValue) {
+        QVector<quint32> result = entries.contains(tag) ? values(tag) : QVector<quint32>();
+        return result.isEmpty() ? defaultValue : result.first();
+    };
+
+    quint32 width = value(tagImageWidth, 0);
+    quint32 height = value(tagImageLength, 0);
+    if (width == 0 || height == 0 || width > (1u << 20) || height > (1u << 20)) {
+        return;
+    }
+    m_samplesPerPixel = int(value(tagSamplesPerPixel, 1));
+    QVector<quint32> bitsPerSample = values(tagBitsPerSample);
+    m_bitsPerSample = bitsPerSample.isEmpty() ? 1 : int(bitsPerSample.first());
+    for (quint32 bits : bitsPerSample) {
+        if (int(bits) != m_bitsPerSample) {
+            return;
+        }
+    }
+    m_compression = int(value(tagCompression, compressionNone));
+    m_photometric = int(value(tagPhotometricInterpretation, 0xffff));
+    m_predictor = int(value(tagPredictor, 1));
+    if ((m_bitsPerSample != 8 && m_bitsPerSample != 16) || value(tagSampleFormat, 1) != 1
+        || (m_samplesPerPixel > 1 && value(tagPlanarConfiguration, 1) != 1)
+        || (m_predictor != 1 && m_predictor != predictorHorizontal)) {
+        return;
+    }
+    if (m_compression != compressionNone && m_compression != compressionLzw && m_compression != compressionDeflate
+        && m_compression != compressionAdobeDeflate && m_compression != compressionPackBits) {
+        return;
+    }
+    int colorSamples = m_photometric == photometricRgb ? 3 : 1;
+    if ((m_photometric != photometricMinIsWhite && m_photometric != photometricMinIsBlack && m_photometric != photometricRgb)
+        || m_samplesPerPixel < colorSamples || m_samplesPerPixel > colorSamples + 1) {
+        return;
+    }
+    // дополнительный канал без указанного смысла не показывается
+    QVector<quint32> extraSamples = values(tagExtraSamples);
+    m_alpha = m_samplesPerPixel > colorSamples && !extraSamples.isEmpty() && extraSamples.first() != 0;
+    m_associatedAlpha = m_alpha && extraSamples.first() == extraSampleAssociatedAlpha;
+
+    int chunkCount;
+    if (entries.contains(tagTileWidth)) {
+        m_tiled = true;
+        m_chunkSize = QSize(int(value(tagTileWidth, 0)), int(value(tagTileLength, 0)));
+        if (m_chunkSize.isEmpty() || m_chunkSize.width() > int(width) * 2 || m_chunkSize.height() > int(height) * 2) {
+            return;
+        }
+        chunkCount = ((int(width) + m_chunkSize.width() - 1) / m_chunkSize.width())
+            * ((int(height) + m_chunkSize.height() - 1) / m_chunkSize.height());
+        m_chunkOffsets = values(tagTileOffsets);
+        m_chunkByteCounts = values(tagTileByteCounts);
+    } else {
+        int rowsPerStrip = int(qBound(quint32(1), value(tagRowsPerStrip, height), height));
+        m_chunkSize = QSize(int(width), rowsPerStrip);
+        chunkCount = (int(height) + rowsPerStrip - 1) / rowsPerStrip;
+        m_chunkOffsets = values(tagStripOffsets);
+        m_chunkByteCounts = values(tagStripByteCounts);
+    }
+    if (m_chunkOffsets.size() < chunkCount || m_chunkByteCounts.size() < chunkCount
+        || qint64(m_chunkSize.width()) * m_chunkSize.height() * m_samplesPerPixel * m_bitsPerSample / 8 > maxChunkBytes) {
+        return;
+    }
+    m_size = QSize(int(width), int(height));
+}
+
+bool TiffReader::isValid() const
+{
+    return !m_size.isEmpty();
+}
+
+QSize TiffReader::size() const
+{
+    return m_size;
+}
+
+QImage TiffReader::read(QIODevice* device, const QRect& rect, int shift, const std::atomic_bool* cancelled) const
+{
+    TRACE_SCOPE_HISTOGRAM("tiff.read", "tiff.read.us");
+    QRect area = rect & QRect(QPoint(0, 0), m_size);
+    if (!isValid() || area.isEmpty()) {
+        return QImage();
+    }
+    int block = 1 << shift;
+    QImage::Format format = m_alpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    QImage result{ (area.width() + block - 1) >> shift, (area.height() + block - 1) >> shift, format };
+    if (result.isNull()) {
+        return result;
+    }
+    // строки полос накапливаются, пока не наберется целое число блоков усреднения:
+    // в памяти одновременно не больше одной полосы (ряда плиток) и одного блока
+    QImage pending{ area.width(), m_chunkSize.height() + block, format };
+    int pendingRows = 0;
+    int resultRow = 0;
+    int lastChunkRow = area.bottom() / m_chunkSize.height();
+    for (int chunkRow = area.top() / m_chunkSize.height(); chunkRow <= lastChunkRow; ++chunkRow) {
+        if (cancelled && *cancelled) {
+            return QImage();
+        }
+        QImage rows = readChunkRows(device, chunkRow, area.left(), area.width());
+        if (rows.isNull()) {
+            return QImage();
+        }
+        int top = chunkRow * m_chunkSize.height();
+        int last = qMin(area.bottom() - top, rows.height() - 1);
+        for (int y = qMax(area.top() - top, 0); y <= last; ++y) {
+            std::memcpy(pending.scanLine(pendingRows++), rows.constScanLine(y), size_t(area.width()) * 4);
+        }
+        int ready = chunkRow == lastChunkRow ? pendingRows : pendingRows & ~(block - 1);
+        if (ready == 0) {
+            continue;
+        }
+        int readyResultRows = (ready + block - 1) >> shift;
+        QImage scaled = pending.copy(0, 0, area.width(), ready);
+        if (shift) {
+            scaled = ImageScaler::scaled(scaled, QSize(result.width(), readyResultRows));
+            if (scaled.format() != format) {
+                scaled = scaled.convertToFormat(format);
+            }
+        }
+        for (int y = 0; y < readyResultRows; ++y) {
+            std::memcpy(result.scanLine(resultRow++), scaled.constScanLine(y), size_t(result.width()) * 4);
+        }
+        // строки неполного блока переносятся в начало
+        for (int y = ready; y < pendingRows; ++y) {
+            std::memcpy(pending.scanLine(y - ready), pending.constScanLine(y), size_t(area.width()) * 4);
+        }
+        pendingRows -= ready;
+    }
+    return result;
+}
+
+QImage TiffReader::readChunkRows(QIODevice* device, int chunkRow, int left, int width) const
+{
+    int top = chunkRow * m_chunkSize.height();
+    int rowCount = qMin(m_chunkSize.height(), m_size.height() - top);
+    QImage rows{ width, rowCount, m_alpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32 };
+    if (rows.isNull()) {
+        return rows;
+    }
+    int bytesPerPixel = m_samplesPerPixel * m_bitsPerSample / 8;
+    int rowBytes = m_chunkSize.width() * bytesPerPixel;
+    // полоса занимает всю ширину изображения, ряд плиток - несколько плиток
+    int chunkColumnCount = (m_size.width() + m_chunkSize.width() - 1) / m_chunkSize.width();
+    int lastColumn = (left + width - 1) / m_chunkSize.width();
+    for (int column = left / m_chunkSize.width(); column <= lastColumn; ++column) {
+        // плитка хранится целиком, включая строки за нижней границей изображения
+        QByteArray data = readChunk(device, chunkRow * chunkColumnCount + column, m_tiled ? m_chunkSize.height() : rowCount);
+        if (data.isEmpty()) {
+            return QImage();
+        }
+        int chunkLeft = column * m_chunkSize.width();
+        int from = qMax(left, chunkLeft);
+        int to = qMin(qMin(left + width, chunkLeft + m_chunkSize.width()), m_size.width());
+        for (int y = 0; y < rowCount; ++y) {
+            const uchar* source = reinterpret_cast<const uchar*>(data.constData()) + qint64(y) * rowBytes + (from - chunkLeft) * bytesPerPixel;
+            convertRow(source, reinterpret_cast<QRgb*>(rows.scanLine(y)) + (from - left), to - from);
+        }
+    }
+    return rows;
+}
+
+QByteArray TiffReader::readChunk(QIODevice* device, int chunk, int rowCount) const
+{
+    int rowBytes = m_chunkSize.width() * m_samplesPerPixel * m_bitsPerSample / 8;
+    qint64 expected = qint64(rowBytes) * rowCount;
+    quint32 byteCount = m_chunkByteCounts.at(chunk);
+    if (byteCount == 0 || byteCount > maxChunkBytes || !device->seek(m_chunkOffsets.at(chunk))) {
+        return QByteArray();
+    }
+    QByteArray encoded = device->read(byteCount);
+    if (encoded.size() != int(byteCount)) {
+        return QByteArray();
+    }
+    QByteArray data;
+    switch (m_compression) {
+    case compressionNone:
+        data = encoded;
+        break;
+    case compressionLzw:
+        data = decodeLzw(encoded, expected);
+        break;
+    case compressionDeflate:
+    case compressionAdobeDeflate:
+        data = decodeDeflate(encoded, expected);
+        break;
+    case compressionPackBits:
+        data = decodePackBits(encoded, expected);
+        break;
+    }
+    if (data.isEmpty()) {
+        return data;
+    }
+    // недостающие в поврежденной полосе строки остаются черными
+    if (data.size() < expected) {
+        data.append(int(expected - data.size()), '\0');
+    }
+    data.truncate(int(expected));
+    if (m_predictor == predictorHorizontal) {
+        // горизонтальный предиктор хранит разности соседних отсчетов строки
+        uchar* bytes = reinterpret_cast<uchar*>(data.data());
+        for (int y = 0; y < rowCount; ++y) {
+            uchar* row = bytes + qint64(y) * rowBytes;
+            if (m_bitsPerSample == 8) {
+                for (int i = m_samplesPerPixel; i < rowBytes; ++i) {
+                    row[i] = uchar(row[i] + row[i - m_samplesPerPixel]);
+                }
+                continue;
+            }
+            for (int i = m_samplesPerPixel; i < rowBytes / 2; ++i) {
+                quint16 sample = quint16(readUInt16(row + 2 * i, m_littleEndian) + readUInt16(row + 2 * (i - m_samplesPerPixel), m_littleEndian));
+                if (m_littleEndian) {
+                    qToLittleEndian<quint16>(sample, row + 2 * i);
+                } else {
+                    qToBigEndian<quint16>(sample, row + 2 * i);
+                }
+            }
+        }
+    }
+    return data;
+}
+
+void TiffReader::convertRow(const uchar* source, QRgb* target, int count) const
+{
+    int bytesPerSample = m_bitsPerSample / 8;
+    // из 16-битного отсчета берется старший байт
+    int highByte = bytesPerSample == 2 && m_littleEndian ? 1 : 0;
+    for (int i = 0; i < count; ++i) {
+        const uchar* pixel = source + i * m_samplesPerPixel * bytesPerSample + highByte;
+        int red;
+        int green;
+        int blue;
+        if (m_photometric == photometricRgb) {
+            red = pixel[0];
+            green = pixel[bytesPerSample];
+            blue = pixel[2 * bytesPerSample];
+        } else {
+            red = green = blue = m_photometric == photometricMinIsWhite ? 255 - pixel[0] : pixel[0];
+        }
+        if (!m_alpha) {
+            target[i] = qRgb(red, green, blue);
+            continue;
+        }
+        int alpha = pixel[(m_samplesPerPixel - 1) * bytesPerSample];
+        target[i] = m_associatedAlpha ? qRgba(qMin(red, alpha), qMin(green, alpha), qMin(blue, alpha), alpha)
+                                      : qPremultiply(qRgba(red, green, blue, alpha));
+    }
+}
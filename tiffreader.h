@@ -0,0 +1,107 @@
+#ifndef TIFFREADER_H
+#define TIFFREADER_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <QVector>
+
+#include <atomic>
+
+class QIODevice;
+
+/**
+ * @brief The TiffReader class
+ * TiffReader - чтение областей изображения TIFF по полосам (strips) или плиткам
+ * (tiles) с уменьшением в 2^shift раз на лету. Декодируются только полосы и
+ * плитки, пересекающие область, а уменьшение выполняется порциями строк, поэтому
+ * память не зависит от размера изображения. Плагин Qt декодирует TIFF только
+ * целиком и не умеет ни ClipRect, ни ScaledSize.
+ * Поддерживается первое изображение файла: 8 или 16 бит на канал без знака,
+ * оттенки серого или RGB с альфа-каналом или без, чередующиеся каналы,
+ * сжатие None, LZW, Deflate и PackBits, горизонтальный предиктор. Остальные
+ * файлы (BigTIFF, палитра, CMYK, YCbCr, JPEG внутри TIFF) считаются
+ * неподдерживаемыми.
+ * Разметка файла читается в конструкторе; read() получает устройство при
+ * каждом вызове и безопасен для вызова из нескольких потоков с разными устройствами.
+ */
+class TiffReader {
+public:
+    /**
+     * @brief TiffReader создает читатель неподдерживаемого файла
+     */
+    TiffReader() = default;
+    /**
+     * @brief TiffReader читает разметку файла, открытого на device
+     * @param device
+     */
+    explicit TiffReader(QIODevice* device);
+
+    // TiffReader interface
+public:
+    /**
+     * @brief isValid проверяет, поддерживается ли файл
+     * @return true, если области файла можно читать read()
+     */
+    bool isValid() const;
+    /**
+     * @brief size возвращает размер изображения
+     * @return размер в пикселях
+     */
+    QSize size() const;
+    /**
+     * @brief read декодирует область rect, уменьшая ее усреднением в 2^shift раз
+     * @param device файл, из которого прочитана разметка
+     * @param rect область в координатах полного разрешения; ее левый верхний угол
+     * кратен 2^shift
+     * @param shift
+     * @param cancelled признак отмены или nullptr
+     * @return изображение размера rect, деленного на 2^shift с округлением вверх,
+     * в формате RGB32 или ARGB32_Premultiplied, или пустое изображение при ошибке и отмене
+     */
+    QImage read(QIODevice* device, const QRect& rect, int shift, const std::atomic_bool* cancelled = nullptr) const;
+
+private:
+    /**
+     * @brief readChunkRows декодирует строки полосы или ряда плиток chunkRow
+     * в столбцах left..left + width - 1
+     * @return строки полосы или ряда плиток, обрезанные границей изображения
+     */
+    QImage readChunkRows(QIODevice* device, int chunkRow, int left, int width) const;
+    /**
+     * @brief readChunk читает и распаковывает полосу или плитку chunk
+     * @return данные строк полосы или плитки или пустой массив при ошибке
+     */
+    QByteArray readChunk(QIODevice* device, int chunk, int rowCount) const;
+    /**
+     * @brief convertRow переводит count пикселей строки данных в пиксели изображения
+     */
+    void convertRow(const uchar* source, QRgb* target, int count) const;
+
+private:
+    QSize m_size;
+    bool m_littleEndian = true;
+    int m_bitsPerSample = 0;
+    int m_samplesPerPixel = 0;
+    int m_photometric = 0;
+    int m_compression = 0;
+    int m_predictor = 1;
+    /**
+     * @brief m_alpha последний канал - альфа; m_associatedAlpha - уже умноженная на нее
+     */
+    bool m_alpha = false;
+    bool m_associatedAlpha = false;
+    /**
+     * @brief m_tiled файл разбит на плитки, а не на полосы
+     */
+    bool m_tiled = false;
+    /**
+     * @brief m_chunkSize размер плитки или ширина изображения и число строк полосы
+     */
+    QSize m_chunkSize;
+    QVector<quint32> m_chunkOffsets;
+    QVector<quint32> m_chunkByteCounts;
+};
+
+#endif // TIFFREADER_H
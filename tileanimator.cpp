@@ -0,0 +1,268 @@
+#include "tileanimator.h"
+#include "cancellablefile.h"
+#include "thumbnaildecoder.h"
+#include "trace.h"
+
+#include <QImageReader>
+#include <QThread>
+#include <QTimer>
+#include <QtConcurrent>
+
+#include <limits>
+
+namespace {
+// кадры с нулевой или почти нулевой задержкой показываются, как в браузерах, по 100 мс
+const int minFrameDelay = 10;
+const int defaultFrameDelay = 100;
+}
+
+/**
+ * @brief The TileAnimator::Stream struct
+ * Открытый файл анимации, читаемый от кадра к кадру
+ */
+struct TileAnimator::Stream {
+    QString fileName;
+    QSize tileSize;
+    qreal devicePixelRatio = 1;
+    std::unique_ptr<CancellableFile> file;
+    std::unique_ptr<QImageReader> reader;
+    /**
+     * @brief opened файл уже открывался, и число кадров проверено
+     */
+    bool opened = false;
+    /**
+     * @brief repeatsLeft оставшееся число повторов, -1 - бесконечно
+     */
+    int repeatsLeft = -1;
+};
+
+TileAnimator::TileAnimator(QObject* parent)
+    : QObject(parent)
+    , m_clockTimer{ new QTimer{ this } }
+{
+    // декодирование анимаций не должно отнимать все ядра у загрузки эскизов
+    m_threadPool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+    m_clock.start();
+    m_clockTimer->setSingleShot(true);
+    m_clockTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_clockTimer, &QTimer::timeout, this, &TileAnimator::advance);
+}
+
+TileAnimator::~TileAnimator()
+{
+    for (auto&& animation : m_animations) {
+        *animation.cancelled = true;
+    }
+    m_threadPool.clear();
+    m_threadPool.waitForDone();
+}
+
+void TileAnimator::setTiles(const QVector<AnimatedTile>& tiles, const QSize& tileSize, qreal devicePixelRatio)
+{
+    if (tileSize != m_tileSize || !qFuzzyCompare(devicePixelRatio, m_devicePixelRatio)) {
+        // кадры прежнего размера уже не нужны
+        for (auto&& animation : m_animations) {
+            stop(animation);
+        }
+        m_animations.clear();
+        m_tileSize = tileSize;
+        m_devicePixelRatio = devicePixelRatio;
+    }
+    QHash<quint32, Animation> animations;
+    animations.reserve(tiles.size());
+    for (const AnimatedTile& tile : tiles) {
+        if (m_staticImages.contains(tile.imageId)) {
+            continue;
+        }
+        auto animation = m_animations.find(tile.imageId);
+        if (animation != m_animations.end()) {
+            animation->row = tile.row;
+            animations.insert(tile.imageId, *animation);
+            m_animations.erase(animation);
+            continue;
+        }
+        auto stream = std::make_shared<Stream>();
+        stream->fileName = tile.imageFileName;
+        stream->tileSize = m_tileSize;
+        stream->devicePixelRatio = m_devicePixelRatio;
+        animations.insert(tile.imageId, Animation{ tile.row, stream, std::make_shared<std::atomic_bool>(false),
+                                            QQueue<Frame>(), QPixmap(), 0, 0, 0, false, false });
+    }
+    // плитки, ушедшие из видового окна, освобождают кадры и файл
+    for (auto&& animation : m_animations) {
+        stop(animation);
+    }
+    m_animations.swap(animations);
+    for (auto it = m_animations.begin(); it != m_animations.end(); ++it) {
+        decodeAhead(it.key(), it.value());
+    }
+    TRACE_COUNTER("animation.tiles", m_animations.size());
+    advance();
+}
+
+void TileAnimator::invalidate(const QSet<quint32>& imageIds)
+{
+    for (quint32 imageId : imageIds) {
+        m_staticImages.remove(imageId);
+        auto animation = m_animations.find(imageId);
+        if (animation != m_animations.end()) {
+            stop(*animation);
+            m_animations.erase(animation);
+        }
+    }
+}
+
+QPixmap TileAnimator::frame(quint32 imageId) const
+{
+    auto animation = m_animations.constFind(imageId);
+    return animation == m_animations.constEnd() ? QPixmap() : animation->current;
+}
+
+void TileAnimator::advance()
+{
+    qint64 now = m_clock.elapsed();
+    qint64 nextDue = std::numeric_limits<qint64>::max();
+    QVector<int> rows;
+    for (auto it = m_animations.begin(); it != m_animations.end(); ++it) {
+        Animation& animation = it.value();
+        if (animation.current.isNull() || now >= animation.due) {
+            if (!animation.frames.isEmpty()) {
+                Frame frame = animation.frames.dequeue();
+                // срок считается от прежнего срока, а не от срабатывания таймера,
+                // чтобы задержки таймера не замедляли анимацию
+                bool late = animation.current.isNull() || now - animation.due > frame.delay;
+                animation.due = late ? now + frame.delay : animation.due + frame.delay;
+                animation.current = QPixmap::fromImage(std::move(frame.image));
+                animation.currentDelay = frame.delay;
+                rows.append(animation.row);
+                decodeAhead(it.key(), animation);
+            } else if (!animation.current.isNull() && animation.decoding && !animation.finished) {
+                // декодирование отстает: срок кадра пропускается, а кадр будет пропущен в потоке
+                animation.skippedFrames = qMin(animation.skippedFrames + 1, frameBufferSize);
+                animation.due += animation.currentDelay;
+            }
+        }
+        if (!animation.current.isNull() && (!animation.frames.isEmpty() || animation.decoding)) {
+            nextDue = qMin(nextDue, animation.due);
+        }
+    }
+    if (!rows.isEmpty()) {
+        TRACE_COUNTER("animation.frames", rows.size());
+        emit framesChanged(rows);
+    }
+    if (nextDue == std::numeric_limits<qint64>::max()) {
+        m_clockTimer->stop();
+    } else {
+        m_clockTimer->start(int(qBound(qint64(0), nextDue - now, qint64(std::numeric_limits<int>::max()))));
+    }
+}
+
+void TileAnimator::decodeAhead(quint32 imageId, Animation& animation)
+{
+    int count = frameBufferSize - animation.frames.size();
+    if (animation.decoding || animation.finished || count <= 0) {
+        return;
+    }
+    animation.decoding = true;
+    int skip = animation.skippedFrames;
+    animation.skippedFrames = 0;
+    std::shared_ptr<Stream> stream = animation.stream;
+    std::shared_ptr<std::atomic_bool> cancelled = animation.cancelled;
+    QtConcurrent::run(&m_threadPool, [this, imageId, stream, cancelled, count, skip] {
+        if (*cancelled) {
+            return;
+        }
+        DecodedFrames decoded = decodeFrames(*stream, count, skip, cancelled.get());
+        if (*cancelled) {
+            return;
+        }
+        QMetaObject::invokeMethod(this, [this, imageId, cancelled, decoded] {
+            auto animation = m_animations.find(imageId);
+            if (*cancelled || animation == m_animations.end()) {
+                return;
+            }
+            if (!decoded.animated) {
+                // неанимированную плитку рисует ImageListView из готовых эскизов
+                m_staticImages.insert(imageId);
+                m_animations.erase(animation);
+                return;
+            }
+            animation->decoding = false;
+            animation->finished = decoded.finished;
+            for (const Frame& frame : decoded.frames) {
+                animation->frames.enqueue(frame);
+            }
+            if (animation->current.isNull() || animation->due <= m_clock.elapsed()) {
+                advance();
+            } else {
+                decodeAhead(imageId, *animation);
+                if (!m_clockTimer->isActive()) {
+                    advance();
+                }
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void TileAnimator::stop(Animation& animation)
+{
+    *animation.cancelled = true;
+}
+
+TileAnimator::DecodedFrames TileAnimator::decodeFrames(Stream& stream, int count, int skip, const std::atomic_bool* cancelled)
+{
+    TRACE_SCOPE_HISTOGRAM("animation.decode", "animation.decode.us");
+    DecodedFrames decoded{ QVector<Frame>(), true, false };
+    auto open = [&] {
+        stream.file.reset(new CancellableFile{ stream.fileName, cancelled });
+        stream.reader.reset();
+        if (!stream.file->open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        stream.reader.reset(new QImageReader{ stream.file.get() });
+        return true;
+    };
+    if (!stream.opened) {
+        stream.opened = true;
+        if (!open() || !stream.reader->supportsAnimation() || stream.reader->imageCount() == 1) {
+            decoded.animated = false;
+            return decoded;
+        }
+        stream.repeatsLeft = stream.reader->loopCount();
+    }
+    if (!stream.reader) {
+        decoded.finished = true;
+        return decoded;
+    }
+    // пропущенные сроки: кадры читаются без приведения к размеру плитки
+    for (int skipped = 0; skipped < skip && !*cancelled; ++skipped) {
+        if (!stream.reader->jumpToNextImage() && stream.reader->read().isNull()) {
+            break;
+        }
+    }
+    bool restarted = false;
+    while (decoded.frames.size() < count && !*cancelled) {
+        QImage image = stream.reader->read();
+        if (image.isNull()) {
+            // конец потока: повторяем с первого кадра, если осталось число повторов
+            if (restarted || stream.repeatsLeft == 0 || !open()) {
+                stream.reader.reset();
+                stream.file.reset();
+                decoded.finished = true;
+                break;
+            }
+            if (stream.repeatsLeft > 0) {
+                --stream.repeatsLeft;
+            }
+            restarted = true;
+            continue;
+        }
+        restarted = false;
+        int delay = stream.reader->nextImageDelay();
+        if (delay <= minFrameDelay) {
+            delay = defaultFrameDelay;
+        }
+        decoded.frames.append(Frame{ ThumbnailDecoder::renderTile(image, stream.tileSize, stream.devicePixelRatio), delay });
+    }
+    return decoded;
+}
@@ -0,0 +1,190 @@
+#ifndef TILEANIMATOR_H
+#define TILEANIMATOR_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QImage>
+#include <QObject>
+#include <QPixmap>
+#include <QQueue>
+#include <QSet>
+#include <QSize>
+#include <QThreadPool>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+
+class QTimer;
+
+/**
+ * @brief The AnimatedTile struct
+ * Видимая плитка анимированного изображения
+ */
+struct AnimatedTile {
+    int row;
+    quint32 imageId;
+    QString imageFileName;
+};
+
+/**
+ * @brief The TileAnimator class
+ * TileAnimator - воспроизведение анимированных изображений (GIF) в плитках
+ * ImageListView. Анимируются только видимые плитки: состояние плитки, ушедшей
+ * из видового окна, вместе с открытым файлом удаляется, поэтому память и
+ * нагрузка на процессор не зависят от числа анимированных файлов в каталоге.
+ * Кадры декодируются последовательно (QImageReader читает поток GIF от кадра
+ * к кадру) в пуле потоков аниматора и сразу приводятся к размеру плитки.
+ * Каждая плитка держит не больше frameBufferSize готовых кадров; декодирование
+ * продолжается, когда кадр из очереди показан. Все плитки переключаются одними
+ * часами: таймер срабатывает к ближайшему сроку смены кадра среди всех плиток.
+ * Если декодирование отстает, пропущенные сроки кадров копятся, и следующее
+ * декодирование пропускает столько же кадров через QImageReader::jumpToNextImage(),
+ * сохраняя скорость воспроизведения.
+ */
+class TileAnimator : public QObject {
+    Q_OBJECT
+public:
+    /**
+     * @brief frameBufferSize наибольшее число готовых кадров плитки, не считая показанного
+     */
+    static const int frameBufferSize = 3;
+
+    explicit TileAnimator(QObject* parent = Q_NULLPTR);
+    ~TileAnimator();
+
+    // TileAnimator interface
+public:
+    /**
+     * @brief setTiles задает полный набор видимых анимированных плиток;
+     * воспроизведение остальных прекращается
+     * @param tiles
+     * @param tileSize логический размер плитки
+     * @param devicePixelRatio
+     */
+    void setTiles(const QVector<AnimatedTile>& tiles, const QSize& tileSize, qreal devicePixelRatio);
+    /**
+     * @brief invalidate прекращает воспроизведение изменившихся файлов imageIds
+     * @param imageIds
+     */
+    void invalidate(const QSet<quint32>& imageIds);
+    /**
+     * @brief frame возвращает текущий кадр плитки imageId
+     * @param imageId
+     * @return кадр размера плитки или пустой QPixmap, если кадр еще не готов
+     * или изображение не анимировано
+     */
+    QPixmap frame(quint32 imageId) const;
+
+signals:
+    /**
+     * @brief framesChanged сообщает о смене кадров плиток
+     * @param rows строки модели плиток, кадр которых сменился
+     */
+    void framesChanged(const QVector<int>& rows);
+
+private:
+    /**
+     * @brief The Frame struct
+     * Кадр размера плитки и время его показа
+     */
+    struct Frame {
+        QImage image;
+        int delay;
+    };
+    struct Stream;
+    /**
+     * @brief The DecodedFrames struct
+     * Результат одного декодирования кадров плитки
+     */
+    struct DecodedFrames {
+        QVector<Frame> frames;
+        /**
+         * @brief animated изображение содержит больше одного кадра
+         */
+        bool animated;
+        bool finished;
+    };
+    /**
+     * @brief The Animation struct
+     * Состояние воспроизведения одной плитки
+     */
+    struct Animation {
+        int row;
+        /**
+         * @brief stream поток кадров файла; пока идет декодирование, им владеет рабочий поток
+         */
+        std::shared_ptr<Stream> stream;
+        std::shared_ptr<std::atomic_bool> cancelled;
+        /**
+         * @brief frames готовые кадры по порядку показа
+         */
+        QQueue<Frame> frames;
+        QPixmap current;
+        /**
+         * @brief currentDelay время показа текущего кадра в миллисекундах
+         */
+        int currentDelay;
+        /**
+         * @brief due время смены текущего кадра по часам аниматора
+         */
+        qint64 due;
+        /**
+         * @brief skippedFrames число сроков кадров, пропущенных из-за отставания декодирования
+         */
+        int skippedFrames;
+        bool decoding;
+        /**
+         * @brief finished поток закончился и повторять его не нужно
+         */
+        bool finished;
+    };
+
+    /**
+     * @brief advance показывает кадры, срок которых наступил, и заводит таймер
+     * к следующему сроку
+     */
+    void advance();
+    /**
+     * @brief decodeAhead запускает декодирование недостающих кадров плитки imageId
+     * @param imageId
+     * @param animation
+     */
+    void decodeAhead(quint32 imageId, Animation& animation);
+    void stop(Animation& animation);
+    /**
+     * @brief decodeFrames декодирует следующие кадры потока; выполняется в рабочем потоке
+     * @param stream
+     * @param count число кадров
+     * @param skip число кадров, пропускаемых перед декодированием
+     * @param cancelled признак отмены
+     * @return кадры размера плитки
+     */
+    static DecodedFrames decodeFrames(Stream& stream, int count, int skip, const std::atomic_bool* cancelled);
+
+private:
+    /**
+     * @brief m_animations видимые анимированные плитки по идентификаторам изображений
+     */
+    QHash<quint32, Animation> m_animations;
+    /**
+     * @brief m_staticImages изображения, оказавшиеся неанимированными
+     */
+    QSet<quint32> m_staticImages;
+    QSize m_tileSize;
+    qreal m_devicePixelRatio = 1;
+    /**
+     * @brief m_clock общие часы воспроизведения
+     */
+    QElapsedTimer m_clock;
+    /**
+     * @brief m_clockTimer срабатывает к ближайшему сроку смены кадра
+     */
+    QTimer* m_clockTimer;
+    /**
+     * @brief m_threadPool потоки декодирования кадров
+     */
+    QThreadPool m_threadPool;
+};
+
+#endif // TILEANIMATOR_H
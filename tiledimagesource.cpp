@@ -0,0 +1,241 @@
+#include "tiledimagesource.h"
+#include "cancellablefile.h"
+#include "imagescaler.h"
+#include "trace.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QtDebug>
+
+const int TiledImageSource::tileSide;
+const qint64 TiledImageSource::maxBaseImagePixels;
+const qint64 TiledImageSource::maxCachedLevelPixels;
+
+namespace {
+QRect levelRect(const QRect& rect, int fromLevel, int toLevel, const QSize& toSize)
+{
+    // прямоугольник уровня fromLevel в координатах более подробного уровня toLevel
+    int shift = fromLevel - toLevel;
+    QRect mapped{ QPoint(rect.left() << shift, rect.top() << shift), QSize(rect.width() << shift, rect.height() << shift) };
+    return mapped & QRect(QPoint(0, 0), toSize);
+}
+}
+
+TiledImageSource::TiledImageSource(const QString& fileName)
+    : m_fileName{ fileName }
+{
+    QImageReader reader{ fileName };
+    m_size = reader.size();
+    m_transformation = reader.transformation();
+    m_regionDecoding = reader.supportsOption(QImageIOHandler::ClipRect);
+    m_scaledDecoding = reader.supportsOption(QImageIOHandler::ScaledSize);
+    if (!m_regionDecoding) {
+        // плагин Qt декодирует TIFF только целиком, поэтому TIFF читается самостоятельно
+        QFile file{ fileName };
+        if (file.open(QIODevice::ReadOnly)) {
+            m_tiffReader = TiffReader{ &file };
+        }
+        if (m_tiffReader.isValid()) {
+            m_size = m_tiffReader.size();
+            m_regionDecoding = true;
+        }
+    }
+    if (!m_size.isValid()) {
+        m_errorString = QCoreApplication::translate("TiledImageSource", "Cannot read image size: %1").arg(reader.errorString());
+        return;
+    }
+    m_levelCount = 1;
+    while (levelSize(m_levelCount - 1).width() > tileSide || levelSize(m_levelCount - 1).height() > tileSide) {
+        ++m_levelCount;
+    }
+    m_levelImages.resize(m_levelCount);
+    m_bands.setMaxCost(int(maxCachedLevelPixels / 1024));
+    qint64 maxLevelPixels = m_regionDecoding ? maxCachedLevelPixels : maxBaseImagePixels;
+    while (m_cachedLevel < m_levelCount - 1
+        && qint64(levelSize(m_cachedLevel).width()) * levelSize(m_cachedLevel).height() > maxLevelPixels) {
+        ++m_cachedLevel;
+    }
+    if (m_regionDecoding) {
+        return;
+    }
+    m_finestLevel = m_cachedLevel;
+    if (m_finestLevel > 0 && !m_scaledDecoding) {
+        // уменьшенный уровень пришлось бы получать из полного изображения
+        m_levelCount = 0;
+        m_errorString = QCoreApplication::translate("TiledImageSource", "The image is too large to be decoded in this format");
+    }
+}
+
+bool TiledImageSource::isValid() const
+{
+    return m_levelCount > 0;
+}
+
+QString TiledImageSource::errorString() const
+{
+    return m_errorString;
+}
+
+QString TiledImageSource::fileName() const
+{
+    return m_fileName;
+}
+
+QSize TiledImageSource::size() const
+{
+    return m_size;
+}
+
+QTransform TiledImageSource::transform() const
+{
+    // порядок как у QImageReader::setAutoTransform(): отражения, затем поворот на 90°
+    QTransform transform;
+    int width = m_size.width();
+    int height = m_size.height();
+    if (m_transformation & QImageIOHandler::TransformationMirror) {
+        transform *= QTransform(-1, 0, 0, 1, width, 0);
+    }
+    if (m_transformation & QImageIOHandler::TransformationFlip) {
+        transform *= QTransform(1, 0, 0, -1, 0, height);
+    }
+    if (m_transformation & QImageIOHandler::TransformationRotate90) {
+        transform *= QTransform(0, 1, -1, 0, height, 0);
+    }
+    return transform;
+}
+
+bool TiledImageSource::hasRegionDecoding() const
+{
+    return m_regionDecoding;
+}
+
+int TiledImageSource::levelCount() const
+{
+    return m_levelCount;
+}
+
+int TiledImageSource::finestLevel() const
+{
+    return m_finestLevel;
+}
+
+QSize TiledImageSource::levelSize(int level) const
+{
+    int scale = 1 << level;
+    return QSize((m_size.width() + scale - 1) / scale, (m_size.height() + scale - 1) / scale);
+}
+
+QRect TiledImageSource::tileRect(int level, int column, int row) const
+{
+    return QRect(column * tileSide, row * tileSide, tileSide, tileSide) & QRect(QPoint(0, 0), levelSize(level));
+}
+
+QImage TiledImageSource::readTile(int level, int column, int row, const std::atomic_bool* cancelled) const
+{
+    TRACE_SCOPE_HISTOGRAM("tile.read", "tile.read.us");
+    QRect rect = tileRect(level, column, row);
+    if (rect.isEmpty() || level < m_finestLevel || level >= m_levelCount) {
+        return QImage();
+    }
+    if (level >= m_cachedLevel) {
+        QImage image = levelImage(level, cancelled);
+        return image.isNull() ? image : image.copy(rect);
+    }
+    // полоса во всю ширину уровня декодируется один раз для всех ее плиток,
+    // если в кеше полос их помещается хотя бы четыре
+    if (qint64(levelSize(level).width()) * tileSide <= maxCachedLevelPixels / 4) {
+        QImage band = bandImage(level, row, cancelled);
+        return band.isNull() ? band : band.copy(rect.translated(0, -row * tileSide));
+    }
+    return decodeRegion(level, rect, cancelled);
+}
+
+QImage TiledImageSource::levelImage(int level, const std::atomic_bool* cancelled) const
+{
+    // уровень строится под блокировкой: плитки того же уровня ждут его,
+    // а не декодируют файл повторно
+    QMutexLocker locker{ &m_levelMutex };
+    int built = level;
+    while (built > m_cachedLevel && m_levelImages.at(built).isNull()) {
+        --built;
+    }
+    if (m_levelImages.at(built).isNull()) {
+        TRACE_SCOPE("tile.level");
+        QImage image = decodeRegion(m_cachedLevel, QRect(QPoint(0, 0), levelSize(m_cachedLevel)), cancelled);
+        if (image.isNull()) {
+            // отмененное декодирование повторит следующая плитка
+            return image;
+        }
+        m_levelImages[m_cachedLevel] = image;
+    }
+    // более грубые уровни получаются уменьшением вдвое предыдущего, без обращения к файлу
+    for (; built < level; ++built) {
+        m_levelImages[built + 1] = ImageScaler::scaled(m_levelImages.at(built), levelSize(built + 1));
+    }
+    return m_levelImages.at(level);
+}
+
+QImage TiledImageSource::bandImage(int level, int row, const std::atomic_bool* cancelled) const
+{
+    quint64 key = (quint64(level) << 32) | quint32(row);
+    QMutexLocker locker{ &m_bandMutex };
+    while (!m_bands.contains(key) && m_decodingBands.contains(key)) {
+        m_bandDecoded.wait(&m_bandMutex);
+    }
+    if (QImage* band = m_bands.object(key)) {
+        return *band;
+    }
+    m_decodingBands.insert(key);
+    locker.unlock();
+    QSize size = levelSize(level);
+    QImage band;
+    {
+        TRACE_SCOPE("tile.band");
+        band = decodeRegion(level, QRect(0, row * tileSide, size.width(), tileSide) & QRect(QPoint(0, 0), size), cancelled);
+    }
+    locker.relock();
+    m_decodingBands.remove(key);
+    if (!band.isNull()) {
+        m_bands.insert(key, new QImage(band), qMax(1, int(qint64(band.width()) * band.height() / 1024)));
+    }
+    // при ошибке или отмене полосу декодирует следующий ожидающий поток
+    m_bandDecoded.wakeAll();
+    return band;
+}
+
+QImage TiledImageSource::decodeRegion(int level, const QRect& rect, const std::atomic_bool* cancelled) const
+{
+    CancellableFile file{ m_fileName, cancelled };
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QImage();
+    }
+    QRect sourceRect = levelRect(rect, level, 0, m_size);
+    QImage image;
+    QString errorString;
+    if (m_tiffReader.isValid()) {
+        image = m_tiffReader.read(&file, sourceRect, level, cancelled);
+    } else {
+        QImageReader reader{ &file };
+        // область задается в координатах полного разрешения; для JPEG плагин Qt
+        // пропускает строки выше нее и уменьшает ее в DCT-области
+        if (sourceRect != QRect(QPoint(0, 0), m_size)) {
+            reader.setClipRect(sourceRect);
+        }
+        if (sourceRect.size() != rect.size()) {
+            reader.setScaledSize(rect.size());
+        }
+        image = reader.read();
+        errorString = reader.errorString();
+    }
+    if (cancelled && *cancelled) {
+        return QImage();
+    }
+    if (image.isNull()) {
+        qWarning() << "Decoding" << m_fileName << "failed:" << errorString;
+    } else if (image.size() != rect.size()) {
+        image = ImageScaler::scaled(image, rect.size());
+    }
+    return image;
+}
@@ -0,0 +1,180 @@
+#ifndef TILEDIMAGESOURCE_H
+#define TILEDIMAGESOURCE_H
+
+#include "tiffreader.h"
+
+#include <QCache>
+#include <QImage>
+#include <QImageIOHandler>
+#include <QMutex>
+#include <QRect>
+#include <QSet>
+#include <QSize>
+#include <QString>
+#include <QTransform>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <atomic>
+
+/**
+ * @brief The TiledImageSource class
+ * TiledImageSource - изображение как пирамида плиток для просмотра в крупном
+ * масштабе. Уровень 0 пирамиды - полное разрешение, каждый следующий вдвое
+ * меньше по обеим осям; последний уровень помещается в одну плитку.
+ * Грубые уровни, которые помещаются в maxCachedLevelPixels, декодируются один
+ * раз: самый подробный из них - из файла, остальные - уменьшением вдвое
+ * предыдущего; плитки вырезаются из кешированных уровней.
+ * Более подробные уровни доступны, если формат умеет декодировать область:
+ * - JPEG (QImageIOHandler::ClipRect) - через setClipRect() и setScaledSize();
+ *   последовательный JPEG при этом распаковывает все строки выше области,
+ *   поэтому декодируется сразу полоса плиток во всю ширину уровня, и полосы кешируются;
+ * - TIFF - TiffReader читает только полосы или плитки файла, пересекающие область,
+ *   и уменьшает их на лету.
+ * Для остальных форматов изображение декодируется целиком в наибольшем уровне,
+ * который помещается в maxBaseImagePixels; уменьшение при декодировании требует
+ * поддержки ScaledSize, поэтому без нее слишком крупные изображения не показываются,
+ * а более подробные уровни недоступны (finestLevel() > 0).
+ * Координаты плиток - в хранимой ориентации изображения; transform() переводит
+ * их в ориентацию EXIF. Методы класса безопасны для вызова из нескольких потоков.
+ */
+class TiledImageSource {
+public:
+    /**
+     * @brief tileSide сторона плитки в пикселях уровня
+     */
+    static const int tileSide = 256;
+    /**
+     * @brief maxBaseImagePixels наибольшее число пикселей изображения, декодируемого
+     * целиком для форматов без декодирования области (256 МБ в ARGB32)
+     */
+    static const qint64 maxBaseImagePixels = 64 * 1024 * 1024;
+    /**
+     * @brief maxCachedLevelPixels наибольшее число пикселей уровня, который декодируется
+     * целиком и кешируется, для форматов с декодированием области (64 МБ в ARGB32);
+     * тот же объем занимает кеш полос более подробных уровней
+     */
+    static const qint64 maxCachedLevelPixels = 16 * 1024 * 1024;
+
+    /**
+     * @brief TiledImageSource читает заголовок файла fileName
+     * @param fileName
+     */
+    explicit TiledImageSource(const QString& fileName);
+
+    // TiledImageSource interface
+public:
+    /**
+     * @brief isValid проверяет, можно ли показать изображение
+     * @return true, если размер известен и хотя бы один уровень декодируется в пределах памяти
+     */
+    bool isValid() const;
+    /**
+     * @brief errorString возвращает причину, по которой изображение нельзя показать
+     * @return описание ошибки
+     */
+    QString errorString() const;
+    QString fileName() const;
+    /**
+     * @brief size возвращает размер изображения в хранимой ориентации
+     * @return размер уровня 0
+     */
+    QSize size() const;
+    /**
+     * @brief transform возвращает преобразование из хранимой ориентации в ориентацию EXIF
+     * @return преобразование координат уровня 0
+     */
+    QTransform transform() const;
+    /**
+     * @brief hasRegionDecoding проверяет, декодируются ли плитки прямо из файла
+     * @return true, если формат поддерживает декодирование области
+     */
+    bool hasRegionDecoding() const;
+    int levelCount() const;
+    /**
+     * @brief finestLevel возвращает самый подробный доступный уровень
+     * @return 0, если доступно полное разрешение
+     */
+    int finestLevel() const;
+    /**
+     * @brief levelSize возвращает размер уровня level
+     * @param level
+     * @return размер уровня в пикселях
+     */
+    QSize levelSize(int level) const;
+    /**
+     * @brief tileRect возвращает прямоугольник плитки в координатах уровня level
+     * @param level
+     * @param column
+     * @param row
+     * @return прямоугольник плитки, обрезанный границами уровня
+     */
+    QRect tileRect(int level, int column, int row) const;
+    /**
+     * @brief readTile декодирует плитку; вызывается из рабочих потоков
+     * @param level уровень не подробнее finestLevel()
+     * @param column
+     * @param row
+     * @param cancelled признак отмены или nullptr
+     * @return плитка размера tileRect() или пустое изображение при ошибке и отмене
+     */
+    QImage readTile(int level, int column, int row, const std::atomic_bool* cancelled = nullptr) const;
+
+private:
+    /**
+     * @brief levelImage возвращает уровень level не подробнее m_cachedLevel, декодируя
+     * или уменьшая его при первом обращении
+     */
+    QImage levelImage(int level, const std::atomic_bool* cancelled) const;
+    /**
+     * @brief bandImage возвращает полосу плиток row уровня level во всю ширину уровня,
+     * декодируя ее при первом обращении; одну полосу декодирует один поток
+     */
+    QImage bandImage(int level, int row, const std::atomic_bool* cancelled) const;
+    /**
+     * @brief decodeRegion декодирует из файла область rect уровня level
+     */
+    QImage decodeRegion(int level, const QRect& rect, const std::atomic_bool* cancelled) const;
+
+private:
+    QString m_fileName;
+    QString m_errorString;
+    QSize m_size;
+    QImageIOHandler::Transformations m_transformation = QImageIOHandler::TransformationNone;
+    bool m_regionDecoding = false;
+    bool m_scaledDecoding = false;
+    /**
+     * @brief m_tiffReader разметка файла TIFF, если он читается по полосам или плиткам
+     */
+    TiffReader m_tiffReader;
+    int m_levelCount = 0;
+    int m_finestLevel = 0;
+    /**
+     * @brief m_cachedLevel самый подробный уровень, который декодируется целиком и кешируется
+     */
+    int m_cachedLevel = 0;
+    /**
+     * @brief m_levelMutex защищает m_levelImages
+     */
+    mutable QMutex m_levelMutex;
+    /**
+     * @brief m_levelImages уровни от m_cachedLevel и грубее, декодированные целиком
+     */
+    mutable QVector<QImage> m_levelImages;
+    /**
+     * @brief m_bandMutex защищает m_bands и m_decodingBands
+     */
+    mutable QMutex m_bandMutex;
+    mutable QWaitCondition m_bandDecoded;
+    /**
+     * @brief m_bands полосы плиток уровней подробнее m_cachedLevel по ключу
+     * (уровень, ряд); стоимость - число пикселей в тысячах
+     */
+    mutable QCache<quint64, QImage> m_bands;
+    /**
+     * @brief m_decodingBands ключи полос, которые сейчас декодируются
+     */
+    mutable QSet<quint64> m_decodingBands;
+};
+
+#endif // TILEDIMAGESOURCE_H
@@ -0,0 +1,197 @@
+#include "trace.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+#include <QtAlgorithms>
+#include <QtDebug>
+
+#include <atomic>
+#include <limits>
+
+namespace {
+// ограничение числа событий, чтобы долгая трассировка не исчерпала память
+const int maxEventCount = 4 * 1024 * 1024;
+// корзина 0 - значения не больше 0, корзина i - значения от 2^(i-1) до 2^i - 1
+const int histogramBucketCount = 64;
+
+struct TraceEvent {
+    const char* name;
+    char phase;
+    int threadId;
+    qint64 timestamp;
+    /**
+     * @brief value длительность интервала или значение счетчика
+     */
+    qint64 value;
+};
+
+struct Histogram {
+    quint64 count = 0;
+    qint64 sum = 0;
+    qint64 min = std::numeric_limits<qint64>::max();
+    qint64 max = std::numeric_limits<qint64>::min();
+    QVector<quint64> buckets = QVector<quint64>(histogramBucketCount);
+};
+
+struct TraceState {
+    TraceState()
+    {
+        clock.start();
+        events.reserve(64 * 1024);
+    }
+
+    QElapsedTimer clock;
+    QMutex mutex;
+    QVector<TraceEvent> events;
+    quint64 droppedEventCount = 0;
+    // имена - строковые литералы, поэтому ключом служит указатель;
+    // одинаковые имена из разных единиц трансляции объединяются при выгрузке
+    QHash<const char*, Histogram> histograms;
+};
+
+TraceState& traceState()
+{
+    static TraceState state;
+    return state;
+}
+
+int currentThreadId()
+{
+    static std::atomic_int nextThreadId{ 1 };
+    thread_local int threadId = nextThreadId++;
+    return threadId;
+}
+
+void appendEvent(const TraceEvent& event)
+{
+    TraceState& state = traceState();
+    QMutexLocker locker{ &state.mutex };
+    if (state.events.size() >= maxEventCount) {
+        ++state.droppedEventCount;
+        return;
+    }
+    state.events.append(event);
+}
+
+QByteArray microseconds(qint64 nanoseconds)
+{
+    return QByteArray::number(nanoseconds / 1000.0, 'f', 3);
+}
+}
+
+qint64 Tracer::timestamp()
+{
+    return traceState().clock.nsecsElapsed();
+}
+
+void Tracer::addSpan(const char* name, qint64 start, qint64 duration)
+{
+    appendEvent(TraceEvent{ name, 'X', currentThreadId(), start, duration });
+}
+
+void Tracer::addCounter(const char* name, qint64 value)
+{
+    appendEvent(TraceEvent{ name, 'C', currentThreadId(), timestamp(), value });
+}
+
+void Tracer::addHistogramSample(const char* name, qint64 value)
+{
+    int bucket = value <= 0 ? 0 : 64 - qCountLeadingZeroBits(quint64(value));
+    TraceState& state = traceState();
+    QMutexLocker locker{ &state.mutex };
+    Histogram& histogram = state.histograms[name];
+    ++histogram.count;
+    histogram.sum += value;
+    histogram.min = qMin(histogram.min, value);
+    histogram.max = qMax(histogram.max, value);
+    ++histogram.buckets[qMin(bucket, histogramBucketCount - 1)];
+}
+
+bool Tracer::writeChromeTrace(const QString& fileName)
+{
+    if (fileName.isEmpty()) {
+        return false;
+    }
+    TraceState& state = traceState();
+    QVector<TraceEvent> events;
+    QMap<QByteArray, Histogram> histograms;
+    quint64 droppedEventCount;
+    {
+        QMutexLocker locker{ &state.mutex };
+        events = state.events;
+        droppedEventCount = state.droppedEventCount;
+        for (auto it = state.histograms.cbegin(); it != state.histograms.cend(); ++it) {
+            Histogram& histogram = histograms[QByteArray(it.key())];
+            histogram.count += it->count;
+            histogram.sum += it->sum;
+            histogram.min = qMin(histogram.min, it->min);
+            histogram.max = qMax(histogram.max, it->max);
+            for (int i = 0; i < histogramBucketCount; ++i) {
+                histogram.buckets[i] += it->buckets.at(i);
+            }
+        }
+    }
+
+    // события пишутся потоком, без построения QJsonDocument на миллионы элементов
+    QFile file{ fileName };
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Writing trace" << fileName << "failed:" << file.errorString();
+        return false;
+    }
+    QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray chunk;
+    chunk.reserve(1024 * 1024);
+    chunk += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (int i = 0; i < events.size(); ++i) {
+        const TraceEvent& event = events.at(i);
+        chunk += i ? ",\n" : "\n";
+        chunk += "{\"name\":\"";
+        chunk += event.name;
+        chunk += "\",\"cat\":\"imageviewer\",\"ph\":\"";
+        chunk += event.phase;
+        chunk += "\",\"pid\":" + pid + ",\"tid\":" + QByteArray::number(event.threadId);
+        chunk += ",\"ts\":" + microseconds(event.timestamp);
+        if (event.phase == 'X') {
+            chunk += ",\"dur\":" + microseconds(event.value) + "}";
+        } else {
+            chunk += ",\"args\":{\"value\":" + QByteArray::number(event.value) + "}}";
+        }
+        if (chunk.size() > 1024 * 1024 - 1024) {
+            file.write(chunk);
+            chunk.clear();
+        }
+    }
+    chunk += "\n],\"otherData\":{\"droppedEvents\":" + QByteArray::number(droppedEventCount);
+    chunk += ",\"histograms\":{";
+    for (auto it = histograms.cbegin(); it != histograms.cend(); ++it) {
+        if (it != histograms.cbegin()) {
+            chunk += ",";
+        }
+        chunk += "\n\"" + it.key() + "\":{\"count\":" + QByteArray::number(it->count);
+        chunk += ",\"sum\":" + QByteArray::number(it->sum);
+        chunk += ",\"min\":" + QByteArray::number(it->min);
+        chunk += ",\"max\":" + QByteArray::number(it->max);
+        chunk += ",\"buckets\":{";
+        bool first = true;
+        for (int i = 0; i < histogramBucketCount; ++i) {
+            if (!it->buckets.at(i)) {
+                continue;
+            }
+            // корзина подписывается верхней границей значений
+            qint64 upperBound = i ? qint64((quint64(1) << i) - 1) : 0;
+            chunk += first ? "\"" : ",\"";
+            chunk += "<=" + QByteArray::number(upperBound) + "\":" + QByteArray::number(it->buckets.at(i));
+            first = false;
+        }
+        chunk += "}}";
+    }
+    chunk += "\n}}}\n";
+    file.write(chunk);
+    return file.error() == QFileDevice::NoError;
+}
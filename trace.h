@@ -0,0 +1,110 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * Трассировка горячих путей: интервалы (TRACE_SCOPE, TRACE_SCOPE_HISTOGRAM
+ * с гистограммой длительностей), счетчики (TRACE_COUNTER)
+ * и гистограммы (TRACE_HISTOGRAM) с выгрузкой в формате Chrome trace JSON,
+ * который открывают chrome://tracing и Perfetto (TRACE_WRITE).
+ * Трассировка компилируется только при CONFIG += tracing (IMAGEVIEWER_TRACING);
+ * иначе макросы раскрываются в пустые выражения, а их аргументы не вычисляются.
+ */
+
+#ifdef IMAGEVIEWER_TRACING
+
+#include <QString>
+#include <QtGlobal>
+
+/**
+ * @brief The Tracer class
+ * Tracer - потокобезопасный накопитель событий трассировки процесса
+ */
+class Tracer {
+public:
+    /**
+     * @brief timestamp возвращает время от начала трассировки
+     * @return время в наносекундах
+     */
+    static qint64 timestamp();
+    /**
+     * @brief addSpan добавляет завершенный интервал
+     * @param name имя интервала (строковый литерал)
+     * @param start время начала, см. timestamp()
+     * @param duration длительность в наносекундах
+     */
+    static void addSpan(const char* name, qint64 start, qint64 duration);
+    /**
+     * @brief addCounter добавляет значение счетчика
+     * @param name имя счетчика (строковый литерал)
+     * @param value
+     */
+    static void addCounter(const char* name, qint64 value);
+    /**
+     * @brief addHistogramSample добавляет значение в гистограмму со степенными
+     * корзинами (0, 1, 2-3, 4-7, ...)
+     * @param name имя гистограммы (строковый литерал)
+     * @param value
+     */
+    static void addHistogramSample(const char* name, qint64 value);
+    /**
+     * @brief writeChromeTrace записывает накопленные события в формате Chrome trace JSON;
+     * гистограммы записываются в раздел otherData
+     * @param fileName имя файла; пустое имя ничего не записывает
+     * @return true в случае успеха
+     */
+    static bool writeChromeTrace(const QString& fileName);
+};
+
+/**
+ * @brief The TraceSpan class
+ * TraceSpan - интервал трассировки, длящийся до конца области видимости
+ */
+class TraceSpan {
+public:
+    /**
+     * @brief TraceSpan
+     * @param name имя интервала
+     * @param histogram имя гистограммы длительностей в микросекундах или nullptr
+     */
+    explicit TraceSpan(const char* name, const char* histogram = nullptr)
+        : m_name{ name }
+        , m_histogram{ histogram }
+        , m_start{ Tracer::timestamp() }
+    {
+    }
+    ~TraceSpan()
+    {
+        qint64 duration = Tracer::timestamp() - m_start;
+        Tracer::addSpan(m_name, m_start, duration);
+        if (m_histogram) {
+            Tracer::addHistogramSample(m_histogram, duration / 1000);
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(TraceSpan)
+
+    const char* m_name;
+    const char* m_histogram;
+    qint64 m_start;
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__){ name }
+#define TRACE_SCOPE_HISTOGRAM(name, histogram) TraceSpan TRACE_CONCAT(traceSpan, __LINE__){ name, histogram }
+#define TRACE_COUNTER(name, value) Tracer::addCounter(name, value)
+#define TRACE_HISTOGRAM(name, value) Tracer::addHistogramSample(name, value)
+#define TRACE_WRITE(fileName) Tracer::writeChromeTrace(fileName)
+
+#else
+
+#define TRACE_SCOPE(name) static_cast<void>(0)
+#define TRACE_SCOPE_HISTOGRAM(name, histogram) static_cast<void>(0)
+#define TRACE_COUNTER(name, value) static_cast<void>(0)
+#define TRACE_HISTOGRAM(name, value) static_cast<void>(0)
+#define TRACE_WRITE(fileName) static_cast<void>(0)
+
+#endif // IMAGEVIEWER_TRACING
+
+#endif // TRACE_H